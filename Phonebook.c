@@ -1,281 +1,12369 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-// Define the size of the hash table
-#define TABLE_SIZE 100
-
-// Define max lengths for contact details
-#define MAX_NAME_LEN 50
-#define MAX_PHONE_LEN 15
-
-// Structure for a contact (a node in the linked list)
-typedef struct ContactNode {
-    char name[MAX_NAME_LEN];
-    char phone[MAX_PHONE_LEN];
-    struct ContactNode *next;
-} ContactNode;
-
-// Structure for the hash table
-typedef struct HashTable {
-    int size;
-    ContactNode **table; // Array of pointers to ContactNode
-} HashTable;
-
-/**
- * @brief Creates a new hash table.
- * @param size The number of buckets in the hash table.
- * @return A pointer to the newly created hash table.
- */
-HashTable* createHashTable(int size) {
-    HashTable *ht = (HashTable*)malloc(sizeof(HashTable));
-    if (!ht) {
-        perror("Failed to allocate HashTable");
-        exit(EXIT_FAILURE);
-    }
-
-    ht->size = size;
-    // Allocate memory for the array of pointers
-    ht->table = (ContactNode**)calloc(size, sizeof(ContactNode*));
-    if (!ht->table) {
-        perror("Failed to allocate table array");
-        free(ht);
-        exit(EXIT_FAILURE);
-    }
-    
-    // All pointers are automatically initialized to NULL by calloc()
-    return ht;
-}
-
-/**
- * @brief The hash function.
- * Uses a simple polynomial rolling hash (djb2 variant).
- * @param name The key (contact name) to hash.
- * @param tableSize The size of the hash table.
- * @return The calculated hash index.
- */
-unsigned int hashFunction(const char *name, int tableSize) {
-    unsigned long hash = 5381;
-    int c;
-
-    while ((c = *name++)) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
-    }
-
-    return hash % tableSize;
-}
-
-/**
- * @brief Inserts a new contact into the hash table.
- * @param ht A pointer to the hash table.
- * @param name The contact's name.
- * @param phone The contact's phone number.
- */
-void insertContact(HashTable *ht, const char *name, const char *phone) {
-    // 1. Get the hash index
-    unsigned int index = hashFunction(name, ht->size);
-
-    // 2. Create the new contact node
-    ContactNode *newNode = (ContactNode*)malloc(sizeof(ContactNode));
-    if (!newNode) {
-        perror("Failed to allocate ContactNode");
-        return;
-    }
-    strncpy(newNode->name, name, MAX_NAME_LEN - 1);
-    newNode->name[MAX_NAME_LEN - 1] = '\0'; // Ensure null-termination
-    strncpy(newNode->phone, phone, MAX_PHONE_LEN - 1);
-    newNode->phone[MAX_PHONE_LEN - 1] = '\0'; // Ensure null-termination
-
-    // 3. Insert at the head of the linked list (separate chaining)
-    newNode->next = ht->table[index];
-    ht->table[index] = newNode;
-
-    printf("SUCCESS: Added '%s' with phone '%s'.\n", name, phone);
-}
-
-/**
- * @brief Searches for a contact by name.
- * @param ht A pointer to the hash table.
- * @param name The name to search for.
- * @return A pointer to the found ContactNode, or NULL if not found.
- */
-ContactNode* searchContact(HashTable *ht, const char *name) {
-    // 1. Get the hash index
-    unsigned int index = hashFunction(name, ht->size);
-
-    // 2. Traverse the linked list at that index
-    ContactNode *temp = ht->table[index];
-    while (temp != NULL) {
-        if (strcmp(temp->name, name) == 0) {
-            // Found it!
-            return temp;
-        }
-        temp = temp->next;
-    }
-
-    // 3. Not found
-    return NULL;
-}
-
-/**
- * @brief Deletes a contact by name.
- * @param ht A pointer to the hash table.
- * @param name The name of the contact to delete.
- */
-void deleteContact(HashTable *ht, const char *name) {
-    // 1. Get the hash index
-    unsigned int index = hashFunction(name, ht->size);
-
-    // 2. Traverse the list to find the node
-    ContactNode *current = ht->table[index];
-    ContactNode *prev = NULL;
-
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            // Found the node to delete
-            
-            // Case 1: It's the head of the list
-            if (prev == NULL) {
-                ht->table[index] = current->next;
-            } 
-            // Case 2: It's in the middle or end
-            else {
-                prev->next = current->next;
-            }
-
-            free(current); // Free the memory
-            printf("SUCCESS: Deleted '%s'.\n", name);
-            return;
-        }
-        // Move to the next node
-        prev = current;
-        current = current->next;
-    }
-
-    // 3. If loop finishes, the contact was not found
-    printf("ERROR: Contact '%s' not found.\n", name);
-}
-
-/**
- * @brief Displays all contacts in the phonebook.
- * @param ht A pointer to the hash table.
- */
-void displayContacts(HashTable *ht) {
-    printf("\n--- 📖 Phonebook Contacts 📖 ---\n");
-    int empty = 1;
-    for (int i = 0; i < ht->size; i++) {
-        ContactNode *temp = ht->table[i];
-        if (temp != NULL) {
-            empty = 0;
-            printf("Bucket[%d]:\n", i);
-            while (temp != NULL) {
-                printf("  -> Name: %-20s | Phone: %s\n", temp->name, temp->phone);
-                temp = temp->next;
-            }
-        }
-    }
-    if (empty) {
-        printf("Phonebook is empty.\n");
-    }
-    printf("----------------------------------\n");
-}
-
-/**
- * @brief Frees all allocated memory for the hash table.
- * @param ht A pointer to the hash table.
- */
-void freeHashTable(HashTable *ht) {
-    if (!ht) return;
-
-    for (int i = 0; i < ht->size; i++) {
-        ContactNode *current = ht->table[i];
-        while (current != NULL) {
-            ContactNode *temp = current;
-            current = current->next;
-            free(temp); // Free each node
-        }
-    }
-    free(ht->table); // Free the array of pointers
-    free(ht);        // Free the hash table structure
-    printf("Phonebook memory freed.\n");
-}
-
-// Helper function to clear the input buffer
-void clearInputBuffer() {
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF);
-}
-
-// Main driver function
-int main() {
-    HashTable *phonebook = createHashTable(TABLE_SIZE);
-    int choice;
-    char name[MAX_NAME_LEN];
-    char phone[MAX_PHONE_LEN];
-    ContactNode *found;
-
-    while (1) {
-        printf("\n--- Contact/Phonebook Menu ---\n");
-        printf("1. Add Contact\n");
-        printf("2. Search Contact\n");
-        printf("3. Delete Contact\n");
-        printf("4. Display All Contacts\n");
-        printf("5. Exit\n");
-        printf("Enter your choice: ");
-
-        if (scanf("%d", &choice) != 1) {
-            printf("Invalid input. Please enter a number.\n");
-            clearInputBuffer();
-            continue;
-        }
-        clearInputBuffer(); // Consume the newline character
-
-        switch (choice) {
-            case 1: // Add
-                printf("Enter Name: ");
-                fgets(name, MAX_NAME_LEN, stdin);
-                name[strcspn(name, "\n")] = 0; // Remove newline
-
-                printf("Enter Phone: ");
-                fgets(phone, MAX_PHONE_LEN, stdin);
-                phone[strcspn(phone, "\n")] = 0; // Remove newline
-
-                insertContact(phonebook, name, phone);
-                break;
-
-            case 2: // Search
-                printf("Enter Name to Search: ");
-                fgets(name, MAX_NAME_LEN, stdin);
-                name[strcspn(name, "\n")] = 0; // Remove newline
-
-                found = searchContact(phonebook, name);
-                if (found) {
-                    printf("FOUND: Name: %s, Phone: %s\n", found->name, found->phone);
-                } else {
-                    printf("ERROR: Contact '%s' not found.\n", name);
-                }
-                break;
-
-            case 3: // Delete
-                printf("Enter Name to Delete: ");
-                fgets(name, MAX_NAME_LEN, stdin);
-                name[strcspn(name, "\n")] = 0; // Remove newline
-                deleteContact(phonebook, name);
-                break;
-
-            case 4: // Display
-                displayContacts(phonebook);
-                break;
-
-            case 5: // Exit
-                printf("Exiting...\n");
-                freeHashTable(phonebook); // Clean up memory
-                return 0;
-
-            default:
-                printf("Invalid choice. Please try again.\n");
-        }
-    }
-
-    return 0;
+// Build: gcc -std=gnu11 -O2 -pthread Phonebook.c -o phonebook -lm
+// (-pthread for the parallel tools, -lm for the HyperLogLog estimates)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <search.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <ctype.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// Static tracepoints (USDT, provider "phonebook"). With <sys/sdt.h> each
+// probe is a single nop plus an ELF note that bpftrace, perf or SystemTap
+// can attach to at run time; without it, or with -DPHONEBOOK_NO_PROBES,
+// they compile away and their arguments are never evaluated. Arguments are
+// evaluated whenever probes are compiled in, traced or not, so they are
+// limited to values the caller already has (tracers can take strlen(arg0)).
+//   contact__insert  (name, bucket or -1 on disk)
+//   contact__search  (name, chain nodes walked or -1, found)
+//   contact__delete  (name, chain nodes walked or -1, removed)
+//   bucket__split    (page, sibling page, new local depth, records moved)
+//   directory__grow  (new global depth, directory entries)
+//   page__write      (page, bytes)
+//   directory__save  (global depth, bytes)
+//   snapshot__save   (path, contacts, bytes)
+//   log__append      (op, segment, bytes)
+// e.g. bpftrace -e 'usdt:./phonebook:phonebook:contact__search { @[arg1] = count(); }'
+#if !defined(PHONEBOOK_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PHONEBOOK_HAVE_PROBES 1
+#endif
+#endif
+#ifdef PHONEBOOK_HAVE_PROBES
+#define PHONEBOOK_PROBE1(name, a) DTRACE_PROBE1(phonebook, name, a)
+#define PHONEBOOK_PROBE2(name, a, b) DTRACE_PROBE2(phonebook, name, a, b)
+#define PHONEBOOK_PROBE3(name, a, b, c) DTRACE_PROBE3(phonebook, name, a, b, c)
+#define PHONEBOOK_PROBE4(name, a, b, c, d) DTRACE_PROBE4(phonebook, name, a, b, c, d)
+#else
+#define PHONEBOOK_PROBE1(name, a) ((void)sizeof(a))
+#define PHONEBOOK_PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define PHONEBOOK_PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#define PHONEBOOK_PROBE4(name, a, b, c, d) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d))
+#endif
+
+// Define the size of the hash table
+#define TABLE_SIZE 100
+
+// Define max lengths for contact details
+#define MAX_NAME_LEN 50
+#define MAX_PHONE_LEN 15
+
+// Define the on-disk engine parameters (fixed-size pages + buffer pool)
+#define DISK_PAGE_SIZE 4096
+#define DISK_POOL_PAGES 256
+#define DISK_MIN_POOL_PAGES 4
+#define DISK_MAX_DEPTH 24
+#define DISK_DIR_MAGIC 0x50424448u // "PBDH"
+
+// Define the change log parameters
+#define CHANGELOG_SEGMENT_BYTES (4 * 1024 * 1024)
+#define CHANGELOG_CHECKPOINT_SEGMENTS 16
+#define RESTORE_THREADS 4
+#define SNAPSHOT_MAGIC "PBSNAP01"
+#define CHANGELOG_HEADER_BYTES 11 // int64 timestamp + op + nameLen + phoneLen
+
+// Define the largest event ring a watcher may ask for
+#define WATCH_MAX_CAPACITY (1u << 20)
+#define WATCH_MENU_CAPACITY 64 // Ring size for watches started from the menu
+
+// Define the Merkle sync protocol message types
+#define MERKLE_MSG_HELLO 1
+#define MERKLE_MSG_NODES 2
+#define MERKLE_MSG_BUCKETS 3
+#define MERKLE_MSG_DONE 4
+
+// Define the partitioned hash join parameters
+#define PARTITION_TARGET_ENTRIES 4096
+#define PARTITION_MIN_BITS 4
+#define PARTITION_MAX_BITS 14
+
+// Define the MinHash / LSH parameters (16 bands x 4 rows ~ Jaccard 0.5)
+#define MINHASH_SIZE 64
+#define MINHASH_BANDS 16
+#define MINHASH_ROWS (MINHASH_SIZE / MINHASH_BANDS)
+#define MINHASH_MIN_SIMILARITY 0.4
+#define MINHASH_MAX_PAIRS_PER_ITEM 32
+
+// Define the string sort parameters
+#define SORT_INSERTION_THRESHOLD 16
+#define SORT_OUTPUT_BUFFER (1 << 20)
+
+// Define the heavy-hitter tracker parameters
+#define HH_SKETCH_DEPTH 4
+#define HH_SKETCH_WIDTH 4096      // Power of two
+#define HH_LOCAL_SLOTS 256        // Per-thread candidate slots (power of two)
+#define HH_MERGE_INTERVAL 4096    // Lookups between per-thread merges
+#define HH_DECAY_SECONDS 60       // Counts halve every period
+#define HH_DEFAULT_K 10
+
+// Define the directory statistics sketches
+#define HLL_BITS 12               // 4096 registers, ~1.6% standard error
+#define HLL_REGISTERS (1 << HLL_BITS)
+#define STATS_REBUILD_CHUNK 64    // Buckets claimed at a time by a rebuild worker
+
+// Define the ranked suggestion parameters
+#define SUGGEST_HALF_LIFE_SECONDS (7 * 24 * 3600) // Usage counts halve weekly
+#define SUGGEST_DEFAULT_K 5
+
+// Define the attribute index parameters
+#define ROARING_ARRAY_MAX 4096    // Larger containers switch to bitmaps
+#define ROARING_BITMAP_WORDS 1024 // 65536 bits per bitmap container
+#define ATTRIBUTE_AREA_CODES 1000
+#define ATTRIBUTE_MAX_TAG 32
+
+// Define the trigram index parameters
+#define TRIGRAM_PENDING_MAX 32    // Out-of-order ids buffered per posting list
+#define TRIGRAM_MIN_REBUILD 4096  // Stale entries tolerated before any rebuild
+#define TRIGRAM_VERIFY_BYTES (2 * MAX_NAME_LEN + 32) // Name plus SIMD slack
+
+// Define the filter scan parameters
+#define FILTER_SCAN_CHUNK 64      // Buckets claimed at a time by a scan worker
+#define FILTER_MAX_STRING 64
+
+// Define the ingest (import) parameters
+#define INGEST_BATCH_ROWS 4096
+#define INGEST_READ_BUFFER (1 << 20)
+#define INGEST_MAX_REPORTED 20    // Rejected rows echoed before going quiet
+#define INGEST_MAX_RAW_PHONE 32   // Longest phone accepted before stripping
+#define INGEST_MIN_DIGITS 3
+
+// Define the columnar export parameters
+#define COLUMNAR_GROUP_ROWS 65536 // Rows per row group
+#define COLUMNAR_COLUMNS 3
+#define COLUMNAR_CELL 64          // Widest decoded value, plus NUL
+#define COLUMNAR_MAGIC "PBCOLS01"
+
+// Define the benchmark parameters
+#define BENCH_DEFAULT_CONTACTS 1000000
+#define BENCH_DEFAULT_OPS 1000000
+#define BENCH_COUNTERS 6
+#define BENCH_SCALE_CONTACTS 200000
+#define BENCH_SCALE_MILLIS 500    // Measured time per (workload, threads) point
+#define BENCH_MAX_THREADS 256
+#define BENCH_LATENCY_SAMPLE 16   // Every Nth operation is timed individually
+#define BENCH_HOT_KEYS 16
+#define BENCH_GENERATE_CHUNK 4096 // Contacts generated at a time by the footprint tool
+#define BENCH_BUDGET_PERCENT 25   // Budget layout: share of contact bytes kept resident
+#define OPEN_MAP_MIN_CAPACITY 16
+#define COMPARE_HSEARCH_MAX 100000  // Above this hsearch_r's probe runs make a scenario take minutes
+
+// Define how far below the memory budget eviction drains the table
+#define BUDGET_LOW_WATER_PERCENT 90
+#define BUDGET_EVICT_BATCH 64
+// What one resident node costs: malloc's chunk header, rounded to 16 bytes
+#define CONTACT_NODE_FOOTPRINT ((sizeof(ContactNode) + sizeof(size_t) + 15) & ~(size_t)15)
+
+// Structure for a contact (a node in the linked list)
+typedef struct ContactNode {
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+    uint32_t historyHead; // Newest version-history entry (offset + 1), 0 if none
+    struct ContactNode *next;
+    struct ContactNode *lruPrev; // Recency list, maintained under a memory budget
+    struct ContactNode *lruNext;
+} ContactNode;
+
+// Structure for a contact record as stored in a disk page
+typedef struct DiskRecord {
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+    uint32_t historyHead; // Carried along when a contact is spilled
+} DiskRecord;
+
+// Header at the start of every bucket page
+typedef struct DiskBucketHeader {
+    uint32_t localDepth;
+    uint32_t count;
+} DiskBucketHeader;
+
+#define DISK_RECORDS_PER_PAGE \
+    ((DISK_PAGE_SIZE - sizeof(DiskBucketHeader)) / sizeof(DiskRecord))
+
+// Structure for one frame of the buffer pool
+typedef struct BufferFrame {
+    uint32_t pageId;
+    int valid;
+    int dirty;
+    int referenced; // CLOCK reference bit
+    int pinCount;
+    unsigned char *data;
+} BufferFrame;
+
+// Structure for the disk-resident extendible hash
+typedef struct DiskHash {
+    int fd;
+    char *dirPath;        // Sidecar file holding the directory
+    uint32_t globalDepth;
+    uint32_t *directory;  // 2^globalDepth bucket page ids (kept in memory)
+    uint32_t numPages;
+    BufferFrame *frames;
+    int numFrames;
+    int clockHand;
+    int32_t *frameOfPage; // Page id -> frame index, or -1
+    uint32_t frameOfPageCap;
+    unsigned long numRecords;
+    unsigned long diskReads;
+    unsigned long diskWrites;
+} DiskHash;
+
+// Types of change recorded in the change log
+typedef enum ChangeOp {
+    CHANGE_INSERT = 1,
+    CHANGE_DELETE = 2,
+    CHANGE_UPDATE = 3
+} ChangeOp;
+
+// Header of a change log record (followed by the name and phone bytes);
+// changeRecordEncode() defines its on-disk layout
+typedef struct ChangeRecordHeader {
+    int64_t timestamp; // Microseconds since the Unix epoch
+    uint8_t op;
+    uint8_t nameLen;
+    uint8_t phoneLen;
+} ChangeRecordHeader;
+
+// Structure for a timestamped, segmented change log
+typedef struct ChangeLog {
+    char *dir;
+    FILE *segment;          // Active segment, opened for append
+    uint32_t segmentNo;
+    size_t segmentBytes;
+    uint32_t segmentsSinceCheckpoint;
+    int64_t lastTimestamp;  // Timestamps are strictly increasing
+} ChangeLog;
+
+// Append-only arena of version-history entries. Each entry is packed as
+//   uint32 prev (offset + 1 of the next older entry, 0 if none)
+//   varint changedAt (microseconds since the arena's epoch)
+//   uint8 flags/len (HISTORY_ABSENT or the old phone's length)
+//   old phone bytes
+// An entry means "before changedAt, the phone was <old phone>".
+// Deleting a contact leaves a tombstone holding its chain, so the contact
+// can still be read as of an earlier time and a re-add continues the chain.
+typedef struct HistoryTombstone {
+    char name[MAX_NAME_LEN];
+    uint32_t head; // Newest entry of the deleted contact's chain
+    struct HistoryTombstone *next;
+} HistoryTombstone;
+
+typedef struct HistoryArena {
+    unsigned char *bytes;
+    size_t used;
+    size_t capacity;
+    int64_t epoch;
+    unsigned long entries;
+    HistoryTombstone **tombstones; // HISTORY_TOMBSTONE_BUCKETS chains, allocated on first delete
+    unsigned long tombstoneCount;
+} HistoryArena;
+
+#define HISTORY_ABSENT 0x80 // The contact did not exist before changedAt
+#define HISTORY_TOMBSTONE_BUCKETS 1024
+
+// Structure for one change notification delivered to a watcher
+typedef struct WatchEvent {
+    uint64_t seq;      // Global change sequence number
+    ChangeOp op;
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN]; // New phone, or the removed phone for deletes
+} WatchEvent;
+
+// Structure for one watcher and its bounded event ring
+typedef struct WatchSubscriber {
+    int active;
+    int isPrefix;
+    char pattern[MAX_NAME_LEN];
+    WatchEvent *ring;
+    uint32_t capacity;  // Power of two
+    uint64_t written;   // Events ever written
+    uint64_t read;      // Events ever consumed
+    unsigned long dropped; // Oldest events overwritten before being read
+} WatchSubscriber;
+
+// Node of the subscription trie (first-child / next-sibling layout)
+typedef struct WatchTrieNode {
+    unsigned char ch;
+    struct WatchTrieNode *child;
+    struct WatchTrieNode *sibling;
+    int *prefixSubs;   // Subscribers to every name starting here
+    int numPrefix;
+    int *exactSubs;    // Subscribers to exactly this name
+    int numExact;
+} WatchTrieNode;
+
+// Structure for the watch registry of a table
+typedef struct WatchRegistry {
+    WatchTrieNode root;
+    WatchSubscriber *subs;
+    int numSubs;
+    int capSubs;
+    uint64_t nextSeq;
+} WatchRegistry;
+
+// Incremental Merkle tree over the buckets, stored as an implicit heap:
+// node 1 is the root, node i has children 2i and 2i+1, and the leaves
+// numLeaves..2*numLeaves-1 hold one bucket each. A leaf hash is the sum
+// of its contacts' digests, so it can be updated without rescanning.
+typedef struct MerkleTree {
+    uint32_t numLeaves; // Power of two >= table size
+    uint64_t *nodes;    // 2 * numLeaves entries; index 0 unused
+} MerkleTree;
+
+// Traffic and work done by one anti-entropy run
+typedef struct MerkleSyncStats {
+    unsigned long roundTrips;
+    unsigned long nodesCompared;
+    unsigned long bucketsTransferred;
+    unsigned long contactsChanged;
+    unsigned long bytesSent;
+    unsigned long bytesReceived;
+} MerkleSyncStats;
+
+// A candidate hot name remembered by a thread between merges
+typedef struct HeavyHitterSlot {
+    uint64_t hash;
+    uint32_t count;
+    char name[MAX_NAME_LEN];
+} HeavyHitterSlot;
+
+// Per-thread sketch, merged into the shared tracker periodically
+typedef struct HeavyHitterLocal {
+    uint32_t sketch[HH_SKETCH_DEPTH][HH_SKETCH_WIDTH];
+    HeavyHitterSlot slots[HH_LOCAL_SLOTS];
+    uint32_t pending;
+    struct HeavyHitterLocal *nextLocal; // Registration list of the tracker
+} HeavyHitterLocal;
+
+// One entry of the shared top list
+typedef struct HeavyHitter {
+    uint64_t hash;
+    double count;    // Decayed count-min estimate
+    char name[MAX_NAME_LEN];
+} HeavyHitter;
+
+// Shared heavy-hitter state: merged count-min sketch plus a space-saving
+// style list of the k * 4 best candidates seen so far
+typedef struct HeavyHitterTracker {
+    pthread_mutex_t lock;
+    pthread_key_t localKey; // Each thread's HeavyHitterLocal for this tracker
+    double sketch[HH_SKETCH_DEPTH][HH_SKETCH_WIDTH];
+    HeavyHitter *top;
+    int topCount;
+    int topCapacity;
+    int k;
+    int64_t startedAt;    // Microseconds
+    int64_t lastDecayAt;
+    int decays;
+    HeavyHitterLocal *locals;
+} HeavyHitterTracker;
+
+// HyperLogLog sketch; the running sum keeps estimates O(1)
+typedef struct HyperLogLog {
+    uint8_t registers[HLL_REGISTERS];
+    double inverseSum;    // Sum of 2^-register over all registers
+    int zeros;            // Registers still at zero
+} HyperLogLog;
+
+// Distinct counts and exact small distributions over the directory
+typedef struct DirectoryStats {
+    HyperLogLog phones;
+    HyperLogLog surnames;
+    HyperLogLog areaCodes;
+    uint64_t nameLength[MAX_NAME_LEN];   // Contacts by name length
+    uint64_t phoneDigits[MAX_PHONE_LEN]; // Contacts by digits in the phone
+    uint64_t contacts;
+    uint64_t deletesSinceRebuild;        // Sketches cannot forget deletes
+} DirectoryStats;
+
+// Node of the suggestion trie. Scores are log2 of a decayed usage count
+// expressed at a fixed time origin (see suggestRecordUse()), so they only
+// grow with use and can be compared without knowing the current time.
+typedef struct SuggestNode {
+    unsigned char ch;
+    unsigned char isContact;     // A contact's name ends here
+    struct SuggestNode *parent;
+    struct SuggestNode *child;
+    struct SuggestNode *sibling;
+    double score;                // This contact's score (-INFINITY if unused)
+    double maxScore;             // Best score anywhere in this subtree
+} SuggestNode;
+
+// Prefix index of contact names ranked by decayed usage
+typedef struct SuggestIndex {
+    SuggestNode root;
+    int64_t origin;              // Microseconds; scores are relative to it
+    pthread_mutex_t lock;        // Lookups update scores concurrently
+} SuggestIndex;
+
+// One 65536-id chunk of a Roaring bitmap: a sorted array of the low 16
+// bits while sparse, a plain bitmap once it holds more than 4096 ids
+typedef struct RoaringContainer {
+    uint16_t key;         // High 16 bits of the ids
+    uint16_t isBitmap;
+    uint32_t cardinality;
+    uint32_t capacity;    // Array containers: allocated entries
+    void *data;           // uint16_t[capacity] or uint64_t[ROARING_BITMAP_WORDS]
+} RoaringContainer;
+
+// Compressed set of contact ids
+typedef struct RoaringBitmap {
+    RoaringContainer *containers; // Sorted by key
+    int count;
+    int capacity;
+} RoaringBitmap;
+
+// Dense contact ids for secondary indexes. Deleted ids are reused so
+// bitmaps and posting lists stay compact.
+typedef struct ContactIdMap {
+    char (*names)[MAX_NAME_LEN]; // Name of each id
+    uint8_t *live;
+    uint32_t numIds;
+    uint32_t capacity;
+    uint32_t *freeIds;
+    uint32_t numFree;
+    uint32_t *slots;      // Open-addressing name -> id map (UINT32_MAX = empty)
+    uint32_t slotMask;
+} ContactIdMap;
+
+// Attributes remembered per contact id, so a delete can find its bitmaps
+typedef struct AttributeRecord {
+    int16_t areaCode;     // -1 if none
+    int32_t addedMonth;   // YYYYMM
+} AttributeRecord;
+
+// A named bitmap (tags and added months)
+typedef struct AttributeValue {
+    char label[ATTRIBUTE_MAX_TAG];
+    int32_t month;
+    RoaringBitmap bits;
+} AttributeValue;
+
+// Bitmap indexes over low-cardinality contact attributes
+typedef struct AttributeIndex {
+    ContactIdMap ids;
+    AttributeRecord *records;
+    uint32_t numRecords;
+    RoaringBitmap live;
+    RoaringBitmap *byAreaCode[ATTRIBUTE_AREA_CODES];
+    AttributeValue *months;
+    int numMonths;
+    AttributeValue *tags;
+    int numTags;
+} AttributeIndex;
+
+// Posting list of one trigram: increasing ids as varint deltas, plus a
+// few reused (smaller) ids waiting to be merged in
+typedef struct TrigramPosting {
+    uint32_t trigram;     // Three lowercased bytes; UINT32_MAX = empty slot
+    uint32_t count;       // Ids in the compressed list
+    uint32_t lastId;
+    uint32_t numPending;
+    uint8_t *bytes;
+    uint32_t length;
+    uint32_t capacity;
+    uint32_t pending[TRIGRAM_PENDING_MAX];
+} TrigramPosting;
+
+// Trigram inverted index over contact names
+typedef struct TrigramIndex {
+    ContactIdMap ids;
+    TrigramPosting *postings;  // Open addressing by trigram
+    uint32_t postingMask;
+    uint32_t numPostings;
+    uint64_t totalEntries;
+    uint64_t staleEntries;     // Entries left behind by deleted contacts
+} TrigramIndex;
+
+// A combined filter; every field that is set must match
+typedef struct AttributeFilter {
+    int areaCode;         // -1 for any
+    const char *tag;      // NULL for any
+    int addedMonth;       // YYYYMM, 0 for any
+} AttributeFilter;
+
+// Structure for the hash table
+typedef struct HashTable {
+    int size;
+    ContactNode **table; // Array of pointers to ContactNode
+    DiskHash *disk;      // Non-NULL when the table lives on disk
+    ContactNode diskResult; // Lookup result slot for the disk engine
+
+    // Memory budget (0 = unlimited) and the overflow store it spills to
+    size_t memoryBudget;
+    size_t memoryUsed;   // Bytes held by resident ContactNodes
+    ContactNode *lruHead; // Most recently used
+    ContactNode *lruTail; // Least recently used
+    DiskHash *overflow;
+    char *overflowPath;
+    unsigned long spills;
+    unsigned long reloads;
+
+    ChangeLog *log;      // Non-NULL when mutations are being logged
+    HistoryArena *history; // Non-NULL when version history is recorded
+    WatchRegistry *watch;  // Non-NULL once anyone has subscribed
+    MerkleTree *merkle;    // Non-NULL when anti-entropy hashing is enabled
+    HeavyHitterTracker *hitters; // Non-NULL when lookups are being ranked
+    DirectoryStats *stats; // Non-NULL when directory statistics are kept
+    SuggestIndex *suggest; // Non-NULL when ranked suggestions are kept
+    AttributeIndex *attributes; // Non-NULL when bitmap indexes are kept
+    TrigramIndex *trigrams; // Non-NULL when substring search is indexed
+    pthread_rwlock_t *stripes; // Non-NULL when threads share the table
+    unsigned stripeMask;
+} HashTable;
+
+/**
+ * @brief Creates a new hash table.
+ * @param size The number of buckets in the hash table.
+ * @return A pointer to the newly created hash table.
+ */
+HashTable* createHashTable(int size) {
+    HashTable *ht = (HashTable*)calloc(1, sizeof(HashTable));
+    if (!ht) {
+        perror("Failed to allocate HashTable");
+        exit(EXIT_FAILURE);
+    }
+
+    ht->size = size;
+    // Allocate memory for the array of pointers
+    ht->table = (ContactNode**)calloc(size, sizeof(ContactNode*));
+    if (!ht->table) {
+        perror("Failed to allocate table array");
+        free(ht);
+        exit(EXIT_FAILURE);
+    }
+    
+    // All pointers are automatically initialized to NULL by calloc()
+    return ht;
+}
+
+/**
+ * @brief Hashes a contact name.
+ * Uses a simple polynomial rolling hash (djb2 variant).
+ * @param name The key (contact name) to hash.
+ * @return The full-width hash value.
+ */
+unsigned long hashString(const char *name) {
+    unsigned long hash = 5381;
+    int c;
+
+    while ((c = (unsigned char)*name++)) {
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    }
+
+    return hash;
+}
+
+/**
+ * @brief The hash function.
+ * @param name The key (contact name) to hash.
+ * @param tableSize The size of the hash table.
+ * @return The calculated hash index.
+ */
+unsigned int hashFunction(const char *name, int tableSize) {
+    return hashString(name) % tableSize;
+}
+
+/**
+ * @brief Scrambles a hash so that its low bits are usable on their own.
+ * djb2 keeps most of its entropy in the high bits; the disk directory
+ * indexes by the low bits, so they are mixed first (splitmix64 finalizer).
+ * @param h The hash to mix.
+ * @return The mixed hash.
+ */
+uint64_t mixHash(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/**
+ * @brief Copies a string into a fixed-size field, always null-terminating.
+ * @param dst The destination buffer.
+ * @param src The source string.
+ * @param size The size of the destination buffer.
+ */
+void copyField(char *dst, const char *src, size_t size) {
+    size_t len = strnlen(src, size - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0'; // Ensure null-termination
+}
+
+/* ------------------------------------------------------------------ */
+/*  Disk-resident extendible hashing                                   */
+/*                                                                     */
+/*  Contacts are stored in fixed-size bucket pages. The directory      */
+/*  (2^globalDepth page ids) always stays in memory, so a lookup is     */
+/*  one directory probe plus at most one page read through the buffer   */
+/*  pool. A full bucket is split and, when needed, the directory is     */
+/*  doubled. The pool is bounded and evicts with the CLOCK algorithm.   */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Makes sure the page -> frame map covers a page id.
+ * @param dh A pointer to the disk hash.
+ * @param pageId The page id that must be addressable.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int diskEnsurePageMap(DiskHash *dh, uint32_t pageId) {
+    if (pageId < dh->frameOfPageCap) return 0;
+
+    uint32_t newCap = dh->frameOfPageCap ? dh->frameOfPageCap : 64;
+    while (newCap <= pageId) newCap *= 2;
+
+    int32_t *map = (int32_t*)realloc(dh->frameOfPage, newCap * sizeof(int32_t));
+    if (!map) {
+        perror("Failed to grow page map");
+        return -1;
+    }
+    for (uint32_t i = dh->frameOfPageCap; i < newCap; i++) map[i] = -1;
+    dh->frameOfPage = map;
+    dh->frameOfPageCap = newCap;
+    return 0;
+}
+
+/**
+ * @brief Writes a frame back to disk if it is dirty.
+ * @param dh A pointer to the disk hash.
+ * @param frame The frame to write.
+ * @return 0 on success, -1 on I/O error.
+ */
+static int diskWriteFrame(DiskHash *dh, BufferFrame *frame) {
+    if (!frame->valid || !frame->dirty) return 0;
+
+    off_t offset = (off_t)frame->pageId * DISK_PAGE_SIZE;
+    if (pwrite(dh->fd, frame->data, DISK_PAGE_SIZE, offset) != DISK_PAGE_SIZE) {
+        perror("Failed to write page");
+        return -1;
+    }
+    frame->dirty = 0;
+    dh->diskWrites++;
+    PHONEBOOK_PROBE2(page__write, frame->pageId, DISK_PAGE_SIZE);
+    return 0;
+}
+
+/**
+ * @brief Pins a page in the buffer pool, reading it from disk if needed.
+ * Victims are chosen with CLOCK: the hand skips pinned frames and clears
+ * reference bits until it finds an unreferenced frame.
+ * @param dh A pointer to the disk hash.
+ * @param pageId The page to fetch.
+ * @return A pointer to the page bytes, or NULL on failure.
+ */
+static unsigned char* bufferPoolFetch(DiskHash *dh, uint32_t pageId) {
+    if (diskEnsurePageMap(dh, pageId) != 0) return NULL;
+
+    // 1. Hit: the page is already resident
+    int32_t slot = dh->frameOfPage[pageId];
+    if (slot >= 0) {
+        BufferFrame *frame = &dh->frames[slot];
+        frame->referenced = 1;
+        frame->pinCount++;
+        return frame->data;
+    }
+
+    // 2. Miss: run the CLOCK hand to find a victim
+    BufferFrame *victim = NULL;
+    for (int steps = 0; steps < 2 * dh->numFrames; steps++) {
+        BufferFrame *frame = &dh->frames[dh->clockHand];
+        int index = dh->clockHand;
+        dh->clockHand = (dh->clockHand + 1) % dh->numFrames;
+
+        if (frame->pinCount > 0) continue;
+        if (frame->valid && frame->referenced) {
+            frame->referenced = 0; // Second chance
+            continue;
+        }
+        victim = frame;
+        slot = index;
+        break;
+    }
+    if (!victim) {
+        fprintf(stderr, "ERROR: Buffer pool exhausted (all frames pinned).\n");
+        return NULL;
+    }
+
+    // 3. Evict the victim, writing it back if dirty
+    if (victim->valid) {
+        if (diskWriteFrame(dh, victim) != 0) return NULL;
+        dh->frameOfPage[victim->pageId] = -1;
+        victim->valid = 0;
+    }
+
+    // 4. Read the requested page (pages past the end of the file are zero)
+    memset(victim->data, 0, DISK_PAGE_SIZE);
+    if (pageId < dh->numPages) {
+        ssize_t got = pread(dh->fd, victim->data, DISK_PAGE_SIZE,
+                            (off_t)pageId * DISK_PAGE_SIZE);
+        if (got < 0) {
+            perror("Failed to read page");
+            return NULL;
+        }
+        dh->diskReads++;
+    }
+
+    victim->pageId = pageId;
+    victim->valid = 1;
+    victim->dirty = 0;
+    victim->referenced = 1;
+    victim->pinCount = 1;
+    dh->frameOfPage[pageId] = slot;
+    return victim->data;
+}
+
+/**
+ * @brief Releases a pin taken by bufferPoolFetch().
+ * @param dh A pointer to the disk hash.
+ * @param pageId The pinned page.
+ * @param dirty Non-zero if the page was modified.
+ */
+static void bufferPoolUnpin(DiskHash *dh, uint32_t pageId, int dirty) {
+    BufferFrame *frame = &dh->frames[dh->frameOfPage[pageId]];
+    if (dirty) frame->dirty = 1;
+    frame->pinCount--;
+}
+
+/**
+ * @brief Allocates and pins a fresh, empty bucket page.
+ * @param dh A pointer to the disk hash.
+ * @param localDepth The local depth of the new bucket.
+ * @param pageId Receives the new page id.
+ * @return A pointer to the page bytes, or NULL on failure.
+ */
+static unsigned char* diskNewBucket(DiskHash *dh, uint32_t localDepth, uint32_t *pageId) {
+    *pageId = dh->numPages;
+    unsigned char *page = bufferPoolFetch(dh, *pageId);
+    if (!page) return NULL;
+    dh->numPages++;
+
+    DiskBucketHeader *hdr = (DiskBucketHeader*)page;
+    hdr->localDepth = localDepth;
+    hdr->count = 0;
+    return page;
+}
+
+/**
+ * @brief Returns the directory-level hash used by the disk engine.
+ * @param name The contact name.
+ * @return The mixed 64-bit hash.
+ */
+static uint64_t diskHashKey(const char *name) {
+    return mixHash(hashString(name));
+}
+
+/**
+ * @brief Writes the in-memory directory to its sidecar file.
+ * The file is written beside the old one and renamed over it, so a crash
+ * leaves either the old or the new directory, never a torn one.
+ * @param dh A pointer to the disk hash.
+ * @return 0 on success, -1 on I/O error.
+ */
+static int diskSaveDirectory(DiskHash *dh) {
+    char tmpPath[4096];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", dh->dirPath);
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        perror("Failed to open directory file");
+        return -1;
+    }
+    uint32_t header[4] = { DISK_DIR_MAGIC, dh->globalDepth, dh->numPages,
+                           (uint32_t)dh->numRecords };
+    size_t entries = (size_t)1 << dh->globalDepth;
+    int ok = fwrite(header, sizeof(header), 1, fp) == 1 &&
+             fwrite(dh->directory, sizeof(uint32_t), entries, fp) == entries;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || rename(tmpPath, dh->dirPath) != 0) {
+        perror("Failed to write directory file");
+        unlink(tmpPath);
+        return -1;
+    }
+    PHONEBOOK_PROBE2(directory__save, dh->globalDepth, sizeof(header) + entries * sizeof(uint32_t));
+    return 0;
+}
+
+/**
+ * @brief Records a split that did not double the directory, rewriting
+ * only the header and the entries that now point at the new bucket.
+ * @param dh A pointer to the disk hash.
+ * @param newId The bucket created by the split.
+ * @return 0 on success, -1 on I/O error.
+ */
+static int diskSaveDirectoryEntries(DiskHash *dh, uint32_t newId) {
+    int fd = open(dh->dirPath, O_WRONLY);
+    if (fd < 0) return diskSaveDirectory(dh);
+
+    uint32_t header[4] = { DISK_DIR_MAGIC, dh->globalDepth, dh->numPages,
+                           (uint32_t)dh->numRecords };
+    size_t entries = (size_t)1 << dh->globalDepth;
+    size_t bytes = sizeof(header);
+    int ok = pwrite(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    for (size_t i = 0; ok && i < entries; i++) {
+        if (dh->directory[i] != newId) continue;
+        off_t offset = (off_t)(sizeof(header) + i * sizeof(uint32_t));
+        ok = pwrite(fd, &dh->directory[i], sizeof(uint32_t), offset) == (ssize_t)sizeof(uint32_t);
+        bytes += sizeof(uint32_t);
+    }
+    if (close(fd) != 0) ok = 0;
+    if (!ok) {
+        perror("Failed to update directory file");
+        return -1;
+    }
+    PHONEBOOK_PROBE2(directory__save, dh->globalDepth, bytes);
+    return 0;
+}
+
+/**
+ * @brief Loads the directory from its sidecar file, if present.
+ * @param dh A pointer to the disk hash.
+ * @return 1 if loaded, 0 if there is no directory yet, -1 on error.
+ */
+static int diskLoadDirectory(DiskHash *dh) {
+    FILE *fp = fopen(dh->dirPath, "rb");
+    if (!fp) {
+        if (errno == ENOENT) return 0;
+        perror("Failed to open directory file");
+        return -1;
+    }
+
+    // Nothing here writes back: a corrupt file is reported and left as is
+    uint32_t header[4];
+    if (fread(header, sizeof(header), 1, fp) != 1 || header[0] != DISK_DIR_MAGIC ||
+        header[1] > DISK_MAX_DEPTH) {
+        fprintf(stderr, "ERROR: Corrupt directory file '%s'.\n", dh->dirPath);
+        fclose(fp);
+        return -1;
+    }
+    size_t entries = (size_t)1 << header[1];
+    dh->directory = (uint32_t*)malloc(entries * sizeof(uint32_t));
+    if (!dh->directory || fread(dh->directory, sizeof(uint32_t), entries, fp) != entries) {
+        fprintf(stderr, "ERROR: Corrupt directory file '%s'.\n", dh->dirPath);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    for (size_t i = 0; i < entries; i++) {
+        if (dh->directory[i] >= header[2]) {
+            fprintf(stderr, "ERROR: Corrupt directory file '%s'.\n", dh->dirPath);
+            return -1;
+        }
+    }
+    dh->globalDepth = header[1];
+    dh->numPages = header[2];
+    dh->numRecords = header[3];
+    return 1;
+}
+
+/**
+ * @brief Writes every dirty page and the directory to disk.
+ * @param dh A pointer to the disk hash.
+ * @return 0 on success, -1 on I/O error.
+ */
+int diskHashFlush(DiskHash *dh) {
+    int rc = 0;
+    for (int i = 0; i < dh->numFrames; i++) {
+        if (diskWriteFrame(dh, &dh->frames[i]) != 0) rc = -1;
+    }
+    if (diskSaveDirectory(dh) != 0) rc = -1;
+    return rc;
+}
+
+/**
+ * @brief Frees a disk hash without writing anything back.
+ * Used on open failures, where the files must stay as they were found.
+ * @param dh A pointer to the disk hash.
+ */
+static void diskHashRelease(DiskHash *dh) {
+    if (dh->fd >= 0) close(dh->fd);
+    for (int i = 0; i < dh->numFrames; i++) free(dh->frames[i].data);
+    free(dh->frames);
+    free(dh->frameOfPage);
+    free(dh->directory);
+    free(dh->dirPath);
+    free(dh);
+}
+
+/**
+ * @brief Closes a disk hash, flushing it and freeing all memory.
+ * @param dh A pointer to the disk hash.
+ */
+void diskHashClose(DiskHash *dh) {
+    if (!dh) return;
+    diskHashFlush(dh);
+    diskHashRelease(dh);
+}
+
+/**
+ * @brief Opens (or creates) a disk-resident extendible hash.
+ * A data file that is not empty is only opened together with its
+ * directory; it is refused, untouched, when the directory is missing.
+ * @param path The data file; the directory is kept in "<path>.dir".
+ * @param poolPages The number of buffer pool frames.
+ * @return A pointer to the disk hash, or NULL on failure.
+ */
+DiskHash* diskHashOpen(const char *path, int poolPages) {
+    DiskHash *dh = (DiskHash*)calloc(1, sizeof(DiskHash));
+    if (!dh) {
+        perror("Failed to allocate DiskHash");
+        return NULL;
+    }
+    if (poolPages < DISK_MIN_POOL_PAGES) poolPages = DISK_MIN_POOL_PAGES;
+
+    // 1. Open the data file and allocate the buffer pool
+    dh->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (dh->fd < 0) {
+        perror("Failed to open disk table");
+        free(dh);
+        return NULL;
+    }
+    dh->dirPath = (char*)malloc(strlen(path) + 5);
+    dh->frames = (BufferFrame*)calloc(poolPages, sizeof(BufferFrame));
+    if (!dh->dirPath || !dh->frames) {
+        perror("Failed to allocate buffer pool");
+        diskHashRelease(dh);
+        return NULL;
+    }
+    sprintf(dh->dirPath, "%s.dir", path);
+    dh->numFrames = poolPages;
+    for (int i = 0; i < poolPages; i++) {
+        dh->frames[i].data = (unsigned char*)malloc(DISK_PAGE_SIZE);
+        if (!dh->frames[i].data) {
+            perror("Failed to allocate buffer frame");
+            dh->numFrames = i;
+            diskHashRelease(dh);
+            return NULL;
+        }
+    }
+
+    // 2. Load the directory, or start with a single empty bucket
+    int loaded = diskLoadDirectory(dh);
+    if (loaded < 0) {
+        diskHashRelease(dh);
+        return NULL;
+    }
+    if (loaded == 0) {
+        // Without its directory the pages cannot be found; never reuse them
+        struct stat st;
+        if (fstat(dh->fd, &st) != 0 || st.st_size > 0) {
+            fprintf(stderr, "ERROR: '%s' holds data but its directory '%s' is missing.\n",
+                    path, dh->dirPath);
+            diskHashRelease(dh);
+            return NULL;
+        }
+        dh->directory = (uint32_t*)malloc(sizeof(uint32_t));
+        uint32_t pageId;
+        if (!dh->directory || !diskNewBucket(dh, 0, &pageId)) {
+            diskHashRelease(dh);
+            return NULL;
+        }
+        dh->globalDepth = 0;
+        dh->directory[0] = pageId;
+        bufferPoolUnpin(dh, pageId, 1);
+
+        // Write the page, then the directory, so the pair exists from now on
+        if (diskHashFlush(dh) != 0) {
+            diskHashRelease(dh);
+            return NULL;
+        }
+    }
+    return dh;
+}
+
+/**
+ * @brief Looks up a contact in the disk hash.
+ * Costs one in-memory directory probe and at most one page read.
+ * @param dh A pointer to the disk hash.
+ * @param name The name to search for.
+ * @param out Receives the record when found.
+ * @return 1 if found, 0 if not found, -1 on I/O error.
+ */
+int diskHashGet(DiskHash *dh, const char *name, DiskRecord *out) {
+    uint64_t h = diskHashKey(name);
+    uint32_t pageId = dh->directory[h & (((uint64_t)1 << dh->globalDepth) - 1)];
+
+    unsigned char *page = bufferPoolFetch(dh, pageId);
+    if (!page) return -1;
+
+    DiskBucketHeader *hdr = (DiskBucketHeader*)page;
+    DiskRecord *records = (DiskRecord*)(page + sizeof(DiskBucketHeader));
+    int found = 0;
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        if (strcmp(records[i].name, name) == 0) {
+            *out = records[i];
+            found = 1;
+            break;
+        }
+    }
+    bufferPoolUnpin(dh, pageId, 0);
+    return found;
+}
+
+/**
+ * @brief Splits a full bucket, doubling the directory if needed.
+ * Both pages and the directory reach disk before it returns, so a crash
+ * cannot lose the split itself.
+ * @param dh A pointer to the disk hash.
+ * @param pageId The full bucket page (pinned by the caller).
+ * @param page The bytes of the full bucket page.
+ * @return 0 on success, -1 if the bucket cannot be split or on I/O error.
+ */
+static int diskSplitBucket(DiskHash *dh, uint32_t pageId, unsigned char *page) {
+    DiskBucketHeader *hdr = (DiskBucketHeader*)page;
+
+    // 1. Double the directory when the bucket is at global depth
+    int doubled = hdr->localDepth == dh->globalDepth;
+    if (doubled) {
+        if (dh->globalDepth >= DISK_MAX_DEPTH) {
+            fprintf(stderr, "ERROR: Disk directory reached its maximum depth.\n");
+            return -1;
+        }
+        size_t entries = (size_t)1 << dh->globalDepth;
+        uint32_t *dir = (uint32_t*)realloc(dh->directory, 2 * entries * sizeof(uint32_t));
+        if (!dir) {
+            perror("Failed to grow disk directory");
+            return -1;
+        }
+        memcpy(dir + entries, dir, entries * sizeof(uint32_t));
+        dh->directory = dir;
+        dh->globalDepth++;
+        PHONEBOOK_PROBE2(directory__grow, dh->globalDepth, 2 * entries);
+    }
+
+    // 2. Create the sibling bucket
+    uint32_t bit = (uint32_t)1 << hdr->localDepth;
+    uint32_t newId;
+    unsigned char *newPage = diskNewBucket(dh, hdr->localDepth + 1, &newId);
+    if (!newPage) return -1;
+    hdr->localDepth++;
+
+    // 3. Move records whose next hash bit is set into the sibling
+    DiskBucketHeader *newHdr = (DiskBucketHeader*)newPage;
+    DiskRecord *records = (DiskRecord*)(page + sizeof(DiskBucketHeader));
+    DiskRecord *newRecords = (DiskRecord*)(newPage + sizeof(DiskBucketHeader));
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        if (diskHashKey(records[i].name) & bit) {
+            newRecords[newHdr->count++] = records[i];
+        } else {
+            records[kept++] = records[i];
+        }
+    }
+    hdr->count = kept;
+    PHONEBOOK_PROBE4(bucket__split, pageId, newId, hdr->localDepth, newHdr->count);
+
+    // 4. Repoint the directory entries that now belong to the sibling
+    size_t entries = (size_t)1 << dh->globalDepth;
+    for (size_t i = 0; i < entries; i++) {
+        if (dh->directory[i] == pageId && (i & bit)) {
+            dh->directory[i] = newId;
+        }
+    }
+
+    // 5. Persist the split: the new page first, then the directory entries
+    //    pointing at it, then the shrunken page, so the directory on disk
+    //    never refers to a page that was not written
+    BufferFrame *newFrame = &dh->frames[dh->frameOfPage[newId]];
+    BufferFrame *oldFrame = &dh->frames[dh->frameOfPage[pageId]];
+    newFrame->dirty = oldFrame->dirty = 1;
+    int rc = diskWriteFrame(dh, newFrame);
+    if (rc == 0) rc = doubled ? diskSaveDirectory(dh) : diskSaveDirectoryEntries(dh, newId);
+    if (rc == 0) rc = diskWriteFrame(dh, oldFrame);
+    bufferPoolUnpin(dh, newId, 0);
+    return rc;
+}
+
+/**
+ * @brief Inserts or replaces a whole record in the disk hash.
+ * @param dh A pointer to the disk hash.
+ * @param rec The record to store (its name is the key).
+ * @return 0 on success, -1 on failure.
+ */
+int diskHashPutRecord(DiskHash *dh, const DiskRecord *rec) {
+    const char *name = rec->name;
+    uint64_t h = diskHashKey(name);
+
+    while (1) {
+        uint32_t pageId = dh->directory[h & (((uint64_t)1 << dh->globalDepth) - 1)];
+        unsigned char *page = bufferPoolFetch(dh, pageId);
+        if (!page) return -1;
+
+        DiskBucketHeader *hdr = (DiskBucketHeader*)page;
+        DiskRecord *records = (DiskRecord*)(page + sizeof(DiskBucketHeader));
+
+        // 1. Replace an existing record in place
+        for (uint32_t i = 0; i < hdr->count; i++) {
+            if (strcmp(records[i].name, name) == 0) {
+                records[i] = *rec;
+                bufferPoolUnpin(dh, pageId, 1);
+                return 0;
+            }
+        }
+
+        // 2. Append if there is room
+        if (hdr->count < DISK_RECORDS_PER_PAGE) {
+            records[hdr->count++] = *rec;
+            dh->numRecords++;
+            bufferPoolUnpin(dh, pageId, 1);
+            return 0;
+        }
+
+        // 3. Otherwise split and retry
+        int rc = diskSplitBucket(dh, pageId, page);
+        bufferPoolUnpin(dh, pageId, 1);
+        if (rc != 0) return -1;
+    }
+}
+
+/**
+ * @brief Inserts or replaces a contact in the disk hash.
+ * @param dh A pointer to the disk hash.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return 0 on success, -1 on failure.
+ */
+int diskHashPut(DiskHash *dh, const char *name, const char *phone) {
+    DiskRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    copyField(rec.name, name, MAX_NAME_LEN);
+    copyField(rec.phone, phone, MAX_PHONE_LEN);
+    return diskHashPutRecord(dh, &rec);
+}
+
+/**
+ * @brief Deletes a contact from the disk hash.
+ * @param dh A pointer to the disk hash.
+ * @param name The name of the contact to delete.
+ * @return 1 if deleted, 0 if not found, -1 on I/O error.
+ */
+int diskHashDelete(DiskHash *dh, const char *name) {
+    uint64_t h = diskHashKey(name);
+    uint32_t pageId = dh->directory[h & (((uint64_t)1 << dh->globalDepth) - 1)];
+
+    unsigned char *page = bufferPoolFetch(dh, pageId);
+    if (!page) return -1;
+
+    DiskBucketHeader *hdr = (DiskBucketHeader*)page;
+    DiskRecord *records = (DiskRecord*)(page + sizeof(DiskBucketHeader));
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        if (strcmp(records[i].name, name) == 0) {
+            records[i] = records[--hdr->count]; // Keep the page dense
+            dh->numRecords--;
+            bufferPoolUnpin(dh, pageId, 1);
+            return 1;
+        }
+    }
+    bufferPoolUnpin(dh, pageId, 0);
+    return 0;
+}
+
+/**
+ * @brief Calls a function for every record in the disk hash.
+ * @param dh A pointer to the disk hash.
+ * @param fn The callback, given the page id and the record.
+ * @param ctx Opaque pointer passed through to the callback.
+ * @return 0 on success, -1 on I/O error.
+ */
+int diskHashForEach(DiskHash *dh, void (*fn)(uint32_t, const DiskRecord*, void*), void *ctx) {
+    for (uint32_t pageId = 0; pageId < dh->numPages; pageId++) {
+        unsigned char *page = bufferPoolFetch(dh, pageId);
+        if (!page) return -1;
+
+        DiskBucketHeader *hdr = (DiskBucketHeader*)page;
+        DiskRecord *records = (DiskRecord*)(page + sizeof(DiskBucketHeader));
+        for (uint32_t i = 0; i < hdr->count; i++) {
+            fn(pageId, &records[i], ctx);
+        }
+        bufferPoolUnpin(dh, pageId, 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens a phonebook whose contacts live in a disk-resident hash.
+ * The returned table works with the regular insertContact(),
+ * searchContact(), deleteContact() and displayContacts() functions.
+ * @param path The data file to open or create.
+ * @param poolPages The number of buffer pool frames.
+ * @return A pointer to the hash table, or NULL on failure.
+ */
+HashTable* openDiskHashTable(const char *path, int poolPages) {
+    DiskHash *dh = diskHashOpen(path, poolPages);
+    if (!dh) return NULL;
+
+    HashTable *ht = (HashTable*)calloc(1, sizeof(HashTable));
+    if (!ht) {
+        perror("Failed to allocate HashTable");
+        diskHashClose(dh);
+        return NULL;
+    }
+    ht->size = 0;
+    ht->table = NULL;
+    ht->disk = dh;
+    return ht;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Memory budget                                                      */
+/*                                                                     */
+/*  With a budget set, resident contacts are kept on an LRU list. When  */
+/*  a new node would push the table over budget (or malloc fails), the  */
+/*  least recently used contacts are spilled to an on-disk overflow     */
+/*  store and searchContact() reloads them transparently on a miss.     */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Removes a node from the recency list.
+ * @param ht A pointer to the hash table.
+ * @param node The node to unlink.
+ */
+static void lruUnlink(HashTable *ht, ContactNode *node) {
+    if (node->lruPrev) node->lruPrev->lruNext = node->lruNext;
+    else if (ht->lruHead == node) ht->lruHead = node->lruNext;
+    if (node->lruNext) node->lruNext->lruPrev = node->lruPrev;
+    else if (ht->lruTail == node) ht->lruTail = node->lruPrev;
+    node->lruPrev = node->lruNext = NULL;
+}
+
+/**
+ * @brief Marks a node as the most recently used.
+ * @param ht A pointer to the hash table.
+ * @param node The node to move to the front.
+ */
+static void lruPushFront(HashTable *ht, ContactNode *node) {
+    node->lruPrev = NULL;
+    node->lruNext = ht->lruHead;
+    if (ht->lruHead) ht->lruHead->lruPrev = node;
+    ht->lruHead = node;
+    if (!ht->lruTail) ht->lruTail = node;
+}
+
+/**
+ * @brief Unlinks a node from its bucket chain without freeing it.
+ * @param ht A pointer to the hash table.
+ * @param node The node to unlink.
+ */
+static void unlinkFromBucket(HashTable *ht, ContactNode *node) {
+    ContactNode **link = &ht->table[hashFunction(node->name, ht->size)];
+    while (*link && *link != node) link = &(*link)->next;
+    if (*link) *link = node->next;
+}
+
+/**
+ * @brief Releases a resident node and its memory accounting.
+ * @param ht A pointer to the hash table.
+ * @param node The node, already unlinked from its bucket.
+ */
+static void releaseContactNode(HashTable *ht, ContactNode *node) {
+    if (ht->memoryBudget) lruUnlink(ht, node);
+    __atomic_sub_fetch(&ht->memoryUsed, sizeof(ContactNode), __ATOMIC_RELAXED); // Shared in concurrent mode
+    free(node);
+}
+
+/**
+ * @brief Returns the memory a budgeted table holds besides its nodes: the
+ * bucket array, the overflow store's buffer pool and directory, and the
+ * version history. The optional indexes are not counted.
+ * @param ht A pointer to the hash table.
+ * @return The bytes charged to the budget regardless of residents.
+ */
+static size_t budgetFixedBytes(HashTable *ht) {
+    size_t bytes = (size_t)ht->size * sizeof(ContactNode*);
+    DiskHash *dh = ht->overflow;
+    if (dh) {
+        bytes += sizeof(DiskHash) + (size_t)dh->numFrames * (sizeof(BufferFrame) + DISK_PAGE_SIZE) +
+                 (size_t)dh->frameOfPageCap * sizeof(int32_t) +
+                 ((size_t)1 << dh->globalDepth) * sizeof(uint32_t);
+    }
+    if (ht->history) {
+        bytes += sizeof(HistoryArena) + ht->history->capacity +
+                 ht->history->tombstoneCount * sizeof(HistoryTombstone);
+        if (ht->history->tombstones) bytes += HISTORY_TOMBSTONE_BUCKETS * sizeof(HistoryTombstone*);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Returns the memory charged to a table's budget.
+ * @param ht A pointer to the hash table.
+ * @return The resident nodes at their allocator footprint plus the fixed bytes.
+ */
+static size_t budgetUsage(HashTable *ht) {
+    return ht->memoryUsed / sizeof(ContactNode) * CONTACT_NODE_FOOTPRINT + budgetFixedBytes(ht);
+}
+
+/**
+ * @brief Spills least recently used contacts until usage drops to a target.
+ * @param ht A pointer to the hash table.
+ * @param target The budget usage to drain down to, in bytes.
+ * @return The number of contacts spilled.
+ */
+static size_t spillContacts(HashTable *ht, size_t target) {
+    size_t spilled = 0;
+    while (ht->overflow && ht->lruTail && budgetUsage(ht) > target) {
+        ContactNode *victim = ht->lruTail;
+        DiskRecord rec;
+        memcpy(rec.name, victim->name, MAX_NAME_LEN);
+        memcpy(rec.phone, victim->phone, MAX_PHONE_LEN);
+        rec.historyHead = victim->historyHead;
+        if (diskHashPutRecord(ht->overflow, &rec) != 0) break;
+        unlinkFromBucket(ht, victim);
+        releaseContactNode(ht, victim);
+        ht->spills++;
+        spilled++;
+    }
+    return spilled;
+}
+
+/**
+ * @brief Allocates a node, spilling to the overflow store to stay in budget.
+ * @param ht A pointer to the hash table.
+ * @return A new node, or NULL if memory could not be obtained.
+ */
+static ContactNode* allocContactNode(HashTable *ht) {
+    // 1. Make room ahead of time when the budget would be exceeded
+    if (ht->memoryBudget && budgetUsage(ht) + CONTACT_NODE_FOOTPRINT > ht->memoryBudget) {
+        spillContacts(ht, ht->memoryBudget / 100 * BUDGET_LOW_WATER_PERCENT);
+    }
+
+    // 2. If malloc still fails, spill a batch and retry instead of giving up
+    const size_t batch = BUDGET_EVICT_BATCH * CONTACT_NODE_FOOTPRINT;
+    ContactNode *node = (ContactNode*)calloc(1, sizeof(ContactNode));
+    while (!node && ht->memoryUsed > 0) {
+        size_t usage = budgetUsage(ht);
+        if (spillContacts(ht, usage > batch ? usage - batch : 0) == 0) break;
+        node = (ContactNode*)calloc(1, sizeof(ContactNode));
+    }
+    if (!node) return NULL;
+
+    __atomic_add_fetch(&ht->memoryUsed, sizeof(ContactNode), __ATOMIC_RELAXED);
+    return node;
+}
+
+/**
+ * @brief Moves a spilled contact from the overflow store back into memory.
+ * @param ht A pointer to the hash table.
+ * @param name The name to reload.
+ * @return The resident node, or NULL if the name was not spilled.
+ */
+static ContactNode* reloadSpilledContact(HashTable *ht, const char *name) {
+    if (!ht->overflow || ht->overflow->numRecords == 0) return NULL;
+
+    DiskRecord rec;
+    if (diskHashGet(ht->overflow, name, &rec) != 1) return NULL;
+
+    ContactNode *node = allocContactNode(ht);
+    if (!node) return NULL;
+    memcpy(node->name, rec.name, MAX_NAME_LEN);
+    memcpy(node->phone, rec.phone, MAX_PHONE_LEN);
+    node->historyHead = rec.historyHead;
+    diskHashDelete(ht->overflow, name);
+
+    unsigned int index = hashFunction(node->name, ht->size);
+    node->next = ht->table[index];
+    ht->table[index] = node;
+    if (ht->memoryBudget) lruPushFront(ht, node);
+    ht->reloads++;
+    return node;
+}
+
+/**
+ * @brief Limits the memory held by a table.
+ * The budget covers the resident nodes (at their allocator footprint), the
+ * bucket array, the overflow store's buffer pool and directory and the
+ * version history; the optional secondary indexes are outside it. Contacts
+ * beyond the budget are spilled, least recently used first, to an
+ * overflow store created at overflowPath; the store is removed again by
+ * freeHashTable(). The path and "<path>.dir" must not exist yet.
+ * @param ht A pointer to the (in-memory) hash table.
+ * @param bytes The budget in bytes, or 0 to stop evicting.
+ * @param overflowPath The file to use as the overflow store.
+ * @return 0 on success, -1 on failure.
+ */
+int setMemoryBudget(HashTable *ht, size_t bytes, const char *overflowPath) {
+    if (ht->disk) {
+        fprintf(stderr, "ERROR: Disk-backed tables do not use a memory budget.\n");
+        return -1;
+    }
+
+    // 1. Open the overflow store on first use
+    if (!ht->overflow) {
+        ht->overflowPath = strdup(overflowPath);
+        if (!ht->overflowPath) {
+            perror("Failed to allocate overflow path");
+            return -1;
+        }
+        // Both files must be new: the store is deleted again on close, so
+        // an existing file given by mistake must never be taken over
+        char dirPath[4096];
+        snprintf(dirPath, sizeof(dirPath), "%s.dir", overflowPath);
+        struct stat st;
+        int fd = -1;
+        if (lstat(dirPath, &st) == 0) {
+            errno = EEXIST;
+        } else {
+            fd = open(overflowPath, O_RDWR | O_CREAT | O_EXCL, 0600);
+        }
+        if (fd < 0) {
+            fprintf(stderr, "ERROR: Cannot create overflow store '%s': %s.\n",
+                    overflowPath, strerror(errno));
+            free(ht->overflowPath);
+            ht->overflowPath = NULL;
+            return -1;
+        }
+        close(fd);
+        // The store's buffer pool is charged to the budget: give it a quarter
+        size_t poolPages = bytes / 4 / DISK_PAGE_SIZE;
+        if (poolPages > DISK_POOL_PAGES) poolPages = DISK_POOL_PAGES;
+        ht->overflow = diskHashOpen(overflowPath, (int)poolPages);
+        if (!ht->overflow) {
+            unlink(overflowPath);
+            unlink(dirPath);
+            free(ht->overflowPath);
+            ht->overflowPath = NULL;
+            return -1;
+        }
+    }
+
+    // 2. Put the current residents on the recency list
+    if (!ht->memoryBudget) {
+        ht->lruHead = ht->lruTail = NULL;
+        for (int i = 0; i < ht->size; i++) {
+            for (ContactNode *node = ht->table[i]; node; node = node->next) {
+                lruPushFront(ht, node);
+            }
+        }
+    }
+    // 3. Without a budget nothing keeps the recency list current: drop it
+    if (!bytes) {
+        ContactNode *node = ht->lruHead;
+        while (node) {
+            ContactNode *next = node->lruNext;
+            node->lruPrev = node->lruNext = NULL;
+            node = next;
+        }
+        ht->lruHead = ht->lruTail = NULL;
+    }
+    ht->memoryBudget = bytes;
+
+    // 4. Drain down to the new budget right away
+    if (bytes && budgetFixedBytes(ht) >= bytes) {
+        fprintf(stderr, "WARNING: A budget of %zu bytes is below the table's fixed %zu bytes; "
+                "every contact will be spilled.\n", bytes, budgetFixedBytes(ht));
+    }
+    if (bytes && budgetUsage(ht) > bytes) {
+        spillContacts(ht, bytes / 100 * BUDGET_LOW_WATER_PERCENT);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Snapshots and the change log                                       */
+/*                                                                     */
+/*  A snapshot is a full dump of the table:                             */
+/*    "PBSNAP01", uint32 tableSize, uint32 0, uint64 count,             */
+/*    then count x { uint8 nameLen, uint8 phoneLen, name, phone }.      */
+/*  The change log appends one record per mutation to numbered          */
+/*  segment files in a directory:                                       */
+/*    int64 timestamp (little-endian), uint8 op, uint8 nameLen,         */
+/*    uint8 phoneLen, name, phone.                                      */
+/*  segments.idx lists "segNo firstTs" for every segment and            */
+/*  checkpoints.idx lists "ts" for every checkpoint-<ts>.snap, so a     */
+/*  restore can find the nearest checkpoint and the segments that       */
+/*  follow it without scanning the directory.                           */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Returns the current wall-clock time in microseconds.
+ * @return Microseconds since the Unix epoch.
+ */
+int64_t currentTimeMicros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Helper state for writing disk records into a snapshot
+typedef struct SnapshotWriter {
+    FILE *fp;
+    uint64_t count;
+    int failed;
+} SnapshotWriter;
+
+/**
+ * @brief Appends one contact to an open snapshot file.
+ * @param writer The snapshot writer state.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ */
+static void snapshotWriteContact(SnapshotWriter *writer, const char *name, const char *phone) {
+    uint8_t lens[2] = { (uint8_t)strlen(name), (uint8_t)strlen(phone) };
+    if (fwrite(lens, 1, 2, writer->fp) != 2 ||
+        fwrite(name, 1, lens[0], writer->fp) != lens[0] ||
+        fwrite(phone, 1, lens[1], writer->fp) != lens[1]) {
+        writer->failed = 1;
+    }
+    writer->count++;
+}
+
+static void snapshotWriteDiskRecord(uint32_t pageId, const DiskRecord *rec, void *ctx) {
+    (void)pageId;
+    snapshotWriteContact((SnapshotWriter*)ctx, rec->name, rec->phone);
+}
+
+/**
+ * @brief Writes every contact in the table to a snapshot file.
+ * Spilled contacts and disk-backed tables are included.
+ * @param ht A pointer to the hash table.
+ * @param path The snapshot file to create.
+ * @return 0 on success, -1 on I/O error (the partial file is removed).
+ */
+int saveSnapshot(HashTable *ht, const char *path) {
+    SnapshotWriter writer = { fopen(path, "wb"), 0, 0 };
+    if (!writer.fp) {
+        perror("Failed to create snapshot");
+        return -1;
+    }
+
+    // 1. Header; the count is patched once it is known
+    uint32_t sizes[2] = { (uint32_t)(ht->size ? ht->size : TABLE_SIZE), 0 };
+    uint64_t count = 0;
+    if (fwrite(SNAPSHOT_MAGIC, 1, 8, writer.fp) != 8 ||
+        fwrite(sizes, sizeof(sizes), 1, writer.fp) != 1 ||
+        fwrite(&count, sizeof(count), 1, writer.fp) != 1) {
+        writer.failed = 1;
+    }
+
+    // 2. Contacts from every place they can live
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node; node = node->next) {
+            snapshotWriteContact(&writer, node->name, node->phone);
+        }
+    }
+    if ((ht->disk && diskHashForEach(ht->disk, snapshotWriteDiskRecord, &writer) != 0) ||
+        (ht->overflow && diskHashForEach(ht->overflow, snapshotWriteDiskRecord, &writer) != 0)) {
+        writer.failed = 1;
+    }
+
+    // 3. Patch the count
+    count = writer.count;
+    long bytes = ftell(writer.fp);
+    if (fseek(writer.fp, 16, SEEK_SET) != 0 || fwrite(&count, sizeof(count), 1, writer.fp) != 1) {
+        writer.failed = 1;
+    }
+    if (fclose(writer.fp) != 0 || writer.failed) {
+        perror("Failed to write snapshot");
+        unlink(path);
+        return -1;
+    }
+    PHONEBOOK_PROBE3(snapshot__save, path, count, bytes);
+    return 0;
+}
+
+/**
+ * @brief Appends a line to one of the change log's index files.
+ * @param log A pointer to the change log.
+ * @param file The index file name inside the log directory.
+ * @param line The text to append.
+ * @return 0 on success, -1 on I/O error.
+ */
+static int changeLogAppendIndex(ChangeLog *log, const char *file, const char *line) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", log->dir, file);
+    FILE *fp = fopen(path, "a");
+    if (!fp) {
+        perror("Failed to open change log index");
+        return -1;
+    }
+    fputs(line, fp);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Returns a strictly increasing timestamp for the next log entry.
+ * @param log A pointer to the change log.
+ * @return The timestamp in microseconds.
+ */
+static int64_t changeLogNextTimestamp(ChangeLog *log) {
+    int64_t now = currentTimeMicros();
+    if (now <= log->lastTimestamp) now = log->lastTimestamp + 1;
+    log->lastTimestamp = now;
+    return now;
+}
+
+/**
+ * @brief Seals the active segment and starts the next one.
+ * @param log A pointer to the change log.
+ * @return 0 on success, -1 on I/O error.
+ */
+static int changeLogRotate(ChangeLog *log) {
+    if (log->segment) {
+        fclose(log->segment);
+        log->segment = NULL;
+        log->segmentNo++;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/segment-%08u.log", log->dir, log->segmentNo);
+    log->segment = fopen(path, "ab");
+    if (!log->segment) {
+        perror("Failed to open change log segment");
+        return -1;
+    }
+    log->segmentBytes = 0;
+
+    // The segment covers every record from its first timestamp onwards
+    char line[64];
+    snprintf(line, sizeof(line), "%u %lld\n", log->segmentNo,
+             (long long)(log->lastTimestamp + 1));
+    return changeLogAppendIndex(log, "segments.idx", line);
+}
+
+/**
+ * @brief Writes a checkpoint snapshot and starts a fresh segment.
+ * Everything logged up to the checkpoint's timestamp is in the snapshot.
+ * @param ht A pointer to a hash table with a change log.
+ * @return 0 on success, -1 on failure.
+ */
+int checkpointChangeLog(HashTable *ht) {
+    ChangeLog *log = ht->log;
+    if (!log) return -1;
+
+    if (log->segment) fflush(log->segment);
+    int64_t ts = changeLogNextTimestamp(log);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/checkpoint-%lld.snap", log->dir, (long long)ts);
+    if (saveSnapshot(ht, path) != 0) return -1;
+
+    char line[32];
+    snprintf(line, sizeof(line), "%lld\n", (long long)ts);
+    if (changeLogAppendIndex(log, "checkpoints.idx", line) != 0) return -1;
+
+    log->segmentsSinceCheckpoint = 0;
+    return changeLogRotate(log);
+}
+
+/**
+ * @brief Starts logging every change to the table into a directory.
+ * An initial checkpoint of the current contents is written, so the
+ * table can be restored to any time from now on.
+ * @param ht A pointer to the hash table.
+ * @param dir An existing directory for segments and checkpoints.
+ * @return 0 on success, -1 on failure.
+ */
+int openChangeLog(HashTable *ht, const char *dir) {
+    ChangeLog *log = (ChangeLog*)calloc(1, sizeof(ChangeLog));
+    if (!log || !(log->dir = strdup(dir))) {
+        perror("Failed to allocate ChangeLog");
+        free(log);
+        return -1;
+    }
+
+    // 1. Continue numbering after any existing segments
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/segments.idx", dir);
+    FILE *idx = fopen(path, "r");
+    if (idx) {
+        unsigned int segNo;
+        long long firstTs;
+        while (fscanf(idx, "%u %lld", &segNo, &firstTs) == 2) {
+            log->segmentNo = segNo + 1;
+            if (firstTs > log->lastTimestamp) log->lastTimestamp = firstTs;
+        }
+        fclose(idx);
+    }
+
+    // 2. Checkpoint the current contents (this also opens a segment)
+    ht->log = log;
+    if (checkpointChangeLog(ht) != 0) {
+        ht->log = NULL;
+        free(log->dir);
+        free(log);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Serializes a change record header in its on-disk layout.
+ * @param hdr The header.
+ * @param out Receives CHANGELOG_HEADER_BYTES bytes.
+ */
+static void changeRecordEncode(const ChangeRecordHeader *hdr, unsigned char *out) {
+    for (int i = 0; i < 8; i++) out[i] = (unsigned char)((uint64_t)hdr->timestamp >> (8 * i));
+    out[8] = hdr->op;
+    out[9] = hdr->nameLen;
+    out[10] = hdr->phoneLen;
+}
+
+/**
+ * @brief Parses a change record header from its on-disk layout.
+ * @param in CHANGELOG_HEADER_BYTES bytes.
+ * @param hdr Receives the header.
+ */
+static void changeRecordDecode(const unsigned char *in, ChangeRecordHeader *hdr) {
+    uint64_t ts = 0;
+    for (int i = 0; i < 8; i++) ts |= (uint64_t)in[i] << (8 * i);
+    hdr->timestamp = (int64_t)ts;
+    hdr->op = in[8];
+    hdr->nameLen = in[9];
+    hdr->phoneLen = in[10];
+}
+
+/**
+ * @brief Appends one change to the active log segment.
+ * @param ht A pointer to a hash table with a change log.
+ * @param op The kind of change.
+ * @param name The contact's name.
+ * @param phone The contact's phone number ("" for deletes).
+ * @return 0 once the record is written, -1 if it could not be (the segment
+ * is cut back so no partial record remains).
+ */
+static int changeLogAppend(HashTable *ht, ChangeOp op, const char *name, const char *phone) {
+    ChangeLog *log = ht->log;
+    if (!log->segment && changeLogRotate(log) != 0) return -1; // An earlier roll failed
+    ChangeRecordHeader hdr;
+    hdr.timestamp = changeLogNextTimestamp(log);
+    hdr.op = (uint8_t)op;
+    hdr.nameLen = (uint8_t)strnlen(name, MAX_NAME_LEN - 1);
+    hdr.phoneLen = (uint8_t)strnlen(phone, MAX_PHONE_LEN - 1);
+
+    // 1. Header and payload go out in one write
+    unsigned char record[CHANGELOG_HEADER_BYTES + MAX_NAME_LEN + MAX_PHONE_LEN];
+    changeRecordEncode(&hdr, record);
+    memcpy(record + CHANGELOG_HEADER_BYTES, name, hdr.nameLen);
+    memcpy(record + CHANGELOG_HEADER_BYTES + hdr.nameLen, phone, hdr.phoneLen);
+    size_t bytes = CHANGELOG_HEADER_BYTES + hdr.nameLen + hdr.phoneLen;
+    if (fwrite(record, 1, bytes, log->segment) != bytes || fflush(log->segment) != 0) {
+        perror("Failed to append to change log");
+
+        // Drop whatever part of the record reached the segment
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/segment-%08u.log", log->dir, log->segmentNo);
+        fclose(log->segment);
+        log->segment = NULL;
+        if (truncate(path, (off_t)log->segmentBytes) == 0) log->segment = fopen(path, "ab");
+        if (!log->segment) log->segmentNo++; // The next append starts a fresh segment
+        return -1;
+    }
+    log->segmentBytes += bytes;
+    PHONEBOOK_PROBE3(log__append, op, log->segmentNo, bytes);
+
+    // Roll to a new segment, checkpointing every few segments. The record
+    // is already durable, so a failed roll is retried by the next append.
+    if (log->segmentBytes >= CHANGELOG_SEGMENT_BYTES) {
+        if (++log->segmentsSinceCheckpoint >= CHANGELOG_CHECKPOINT_SEGMENTS) {
+            checkpointChangeLog(ht);
+        } else {
+            changeLogRotate(log);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops logging, writing a final checkpoint.
+ * @param ht A pointer to the hash table.
+ */
+void closeChangeLog(HashTable *ht) {
+    ChangeLog *log = ht->log;
+    if (!log) return;
+
+    checkpointChangeLog(ht);
+    if (log->segment) fclose(log->segment);
+    free(log->dir);
+    free(log);
+    ht->log = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Per-contact version history                                        */
+/*                                                                     */
+/*  Each change to a contact appends one packed entry to a shared,      */
+/*  append-only arena and links it from the node. The current phone is  */
+/*  still stored inline, so searchContact() never touches the arena.    */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Starts recording version history for the table's contacts.
+ * Contacts that already exist start their history from now.
+ * @param ht A pointer to the (in-memory) hash table.
+ * @return 0 on success, -1 on failure.
+ */
+int enableVersionHistory(HashTable *ht) {
+    if (ht->disk) {
+        fprintf(stderr, "ERROR: Disk-backed tables do not keep version history.\n");
+        return -1;
+    }
+    if (ht->history) return 0;
+
+    ht->history = (HistoryArena*)calloc(1, sizeof(HistoryArena));
+    if (!ht->history) {
+        perror("Failed to allocate HistoryArena");
+        return -1;
+    }
+    ht->history->epoch = currentTimeMicros();
+    return 0;
+}
+
+/**
+ * @brief Appends one history entry to the arena.
+ * @param arena A pointer to the history arena.
+ * @param prev The node's current history head.
+ * @param changedAt When the change happened, in microseconds.
+ * @param oldPhone The phone before the change, or NULL if absent.
+ * @return The new history head (offset + 1), or prev on failure.
+ */
+static uint32_t historyAppend(HistoryArena *arena, uint32_t prev, int64_t changedAt,
+                              const char *oldPhone) {
+    size_t len = oldPhone ? strlen(oldPhone) : 0;
+    size_t need = sizeof(uint32_t) + 10 + 1 + len;
+
+    // 1. Grow the arena geometrically
+    if (arena->used + need > arena->capacity) {
+        size_t capacity = arena->capacity ? arena->capacity * 2 : 4096;
+        while (capacity < arena->used + need) capacity *= 2;
+        if (capacity > UINT32_MAX) return prev; // Offsets are 32-bit
+        unsigned char *bytes = (unsigned char*)realloc(arena->bytes, capacity);
+        if (!bytes) {
+            perror("Failed to grow history arena");
+            return prev;
+        }
+        arena->bytes = bytes;
+        arena->capacity = capacity;
+    }
+
+    // 2. Pack the entry
+    size_t offset = arena->used;
+    unsigned char *out = arena->bytes + offset;
+    memcpy(out, &prev, sizeof(prev));
+    out += sizeof(prev);
+    uint64_t delta = changedAt > arena->epoch ? (uint64_t)(changedAt - arena->epoch) : 0;
+    do {
+        unsigned char byte = delta & 0x7F;
+        delta >>= 7;
+        *out++ = byte | (delta ? 0x80 : 0);
+    } while (delta);
+    *out++ = oldPhone ? (unsigned char)len : HISTORY_ABSENT;
+    memcpy(out, oldPhone ? oldPhone : "", len);
+    out += len;
+
+    arena->used = out - arena->bytes;
+    arena->entries++;
+    return (uint32_t)(offset + 1);
+}
+
+/**
+ * @brief Unpacks the history entry at a given head.
+ * @param arena A pointer to the history arena.
+ * @param head The entry's offset + 1.
+ * @param changedAt Receives the change time in microseconds.
+ * @param oldPhone Receives the old phone (MAX_PHONE_LEN bytes).
+ * @param absent Receives 1 if the contact did not exist before the change.
+ * @return The next older entry's head, or 0.
+ */
+static uint32_t historyRead(const HistoryArena *arena, uint32_t head, int64_t *changedAt,
+                            char *oldPhone, int *absent) {
+    const unsigned char *in = arena->bytes + head - 1;
+    uint32_t prev;
+    memcpy(&prev, in, sizeof(prev));
+    in += sizeof(prev);
+
+    uint64_t delta = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = *in++;
+        delta |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    *changedAt = arena->epoch + (int64_t)delta;
+
+    unsigned char len = *in++;
+    *absent = (len == HISTORY_ABSENT);
+    if (*absent) len = 0;
+    memcpy(oldPhone, in, len);
+    oldPhone[len] = '\0';
+    return prev;
+}
+
+/**
+ * @brief Records the history chain of a contact that was just deleted.
+ * @param arena A pointer to the history arena.
+ * @param name The deleted contact's name.
+ * @param head The newest entry of its chain (the deletion itself).
+ */
+static void historyBury(HistoryArena *arena, const char *name, uint32_t head) {
+    if (!arena->tombstones) {
+        arena->tombstones = (HistoryTombstone**)calloc(HISTORY_TOMBSTONE_BUCKETS,
+                                                       sizeof(HistoryTombstone*));
+        if (!arena->tombstones) {
+            perror("Failed to allocate history tombstones");
+            return;
+        }
+    }
+    HistoryTombstone *tomb = (HistoryTombstone*)malloc(sizeof(HistoryTombstone));
+    if (!tomb) {
+        perror("Failed to allocate history tombstone");
+        return;
+    }
+    unsigned int bucket = hashFunction(name, HISTORY_TOMBSTONE_BUCKETS);
+    copyField(tomb->name, name, MAX_NAME_LEN);
+    tomb->head = head;
+    tomb->next = arena->tombstones[bucket];
+    arena->tombstones[bucket] = tomb;
+    arena->tombstoneCount++;
+}
+
+/**
+ * @brief Finds the history chain of a deleted contact.
+ * @param arena A pointer to the history arena.
+ * @param name The contact's name.
+ * @param take Non-zero to remove the tombstone (the name is being re-added).
+ * @return The newest entry of the chain, or 0 if the name has no tombstone.
+ */
+static uint32_t historyTombstone(HistoryArena *arena, const char *name, int take) {
+    if (!arena->tombstones) return 0;
+    HistoryTombstone **link = &arena->tombstones[hashFunction(name, HISTORY_TOMBSTONE_BUCKETS)];
+    while (*link && strcmp((*link)->name, name) != 0) link = &(*link)->next;
+    HistoryTombstone *tomb = *link;
+    if (!tomb) return 0;
+
+    uint32_t head = tomb->head;
+    if (take) {
+        *link = tomb->next;
+        free(tomb);
+        arena->tombstoneCount--;
+    }
+    return head;
+}
+
+/**
+ * @brief Finds a resident contact without any lookup side effects.
+ * @param ht A pointer to the hash table.
+ * @param name The name to search for.
+ * @return The node, or NULL if it is not resident.
+ */
+static ContactNode* findResidentContact(HashTable *ht, const char *name) {
+    if (ht->disk) return NULL;
+    ContactNode *node = ht->table[hashFunction(name, ht->size)];
+    while (node && strcmp(node->name, name) != 0) node = node->next;
+    return node;
+}
+
+/**
+ * @brief Looks up a contact as it was at a given time.
+ * Deleted contacts are found through their history tombstone.
+ * @param ht A pointer to the hash table.
+ * @param name The name to search for.
+ * @param asOf The point in time, in microseconds since the epoch.
+ * @param phoneOut Receives the phone valid at that time (MAX_PHONE_LEN bytes).
+ * @return 1 if the contact existed at that time, 0 otherwise.
+ */
+int searchContactAsOf(HashTable *ht, const char *name, int64_t asOf, char *phoneOut) {
+    ContactNode *node = findResidentContact(ht, name);
+    if (!node) node = reloadSpilledContact(ht, name);
+
+    // A deleted contact starts absent and rewinds through its tombstone
+    int present = node != NULL;
+    uint32_t head = node ? node->historyHead : 0;
+    if (node) {
+        copyField(phoneOut, node->phone, MAX_PHONE_LEN);
+    } else if (ht->history) {
+        phoneOut[0] = '\0';
+        head = historyTombstone(ht->history, name, 0);
+    }
+
+    // Walk from newest to oldest; every change after asOf rewinds the value
+    char oldPhone[MAX_PHONE_LEN];
+    while (head && ht->history) {
+        int64_t changedAt;
+        int absent;
+        uint32_t prev = historyRead(ht->history, head, &changedAt, oldPhone, &absent);
+        if (changedAt <= asOf) break;
+        present = !absent;
+        memcpy(phoneOut, oldPhone, MAX_PHONE_LEN);
+        head = prev;
+    }
+    return present;
+}
+
+/**
+ * @brief Prints every recorded version of a contact, newest first.
+ * @param ht A pointer to the hash table.
+ * @param name The contact's name.
+ */
+void printContactHistory(HashTable *ht, const char *name) {
+    ContactNode *node = findResidentContact(ht, name);
+    if (!node) node = reloadSpilledContact(ht, name);
+    uint32_t head = node ? node->historyHead : 0;
+    if (!node && ht->history) head = historyTombstone(ht->history, name, 0);
+    if (!node && !head) {
+        printf("ERROR: Contact '%s' not found.\n", name);
+        return;
+    }
+
+    printf("History of '%s':\n", name);
+    printf("  now                     -> %s\n", node ? node->phone : "(not in phonebook)");
+    char oldPhone[MAX_PHONE_LEN];
+    while (head && ht->history) {
+        int64_t changedAt;
+        int absent;
+        head = historyRead(ht->history, head, &changedAt, oldPhone, &absent);
+
+        char when[32];
+        time_t secs = (time_t)(changedAt / 1000000);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+        printf("  before %s -> %s\n", when, absent ? "(not in phonebook)" : oldPhone);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/*  Change subscriptions                                               */
+/*                                                                     */
+/*  Watchers subscribe to an exact name or a name prefix. Patterns are  */
+/*  stored in a trie, so dispatching a change walks at most one path of */
+/*  length strlen(name) and touches only the watchers that match; the   */
+/*  total number of watchers does not matter. Each watcher owns a       */
+/*  bounded ring that overwrites its oldest event when full.            */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Finds (or creates) the child of a trie node for a character.
+ * @param node The parent node.
+ * @param ch The character.
+ * @param create Non-zero to create the child if missing.
+ * @return The child, or NULL if missing (or allocation failed).
+ */
+static WatchTrieNode* watchTrieChild(WatchTrieNode *node, unsigned char ch, int create) {
+    WatchTrieNode *child = node->child;
+    while (child && child->ch != ch) child = child->sibling;
+    if (child || !create) return child;
+
+    child = (WatchTrieNode*)calloc(1, sizeof(WatchTrieNode));
+    if (!child) {
+        perror("Failed to allocate WatchTrieNode");
+        return NULL;
+    }
+    child->ch = ch;
+    child->sibling = node->child;
+    node->child = child;
+    return child;
+}
+
+/**
+ * @brief Appends a subscriber id to one of a trie node's lists.
+ * @param list The list to grow.
+ * @param count The list length.
+ * @param id The subscriber id.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int watchListAdd(int **list, int *count, int id) {
+    int *grown = (int*)realloc(*list, (*count + 1) * sizeof(int));
+    if (!grown) {
+        perror("Failed to grow watch list");
+        return -1;
+    }
+    grown[(*count)++] = id;
+    *list = grown;
+    return 0;
+}
+
+/**
+ * @brief Removes a subscriber id from one of a trie node's lists.
+ * @param list The list.
+ * @param count The list length.
+ * @param id The subscriber id.
+ */
+static void watchListRemove(int *list, int *count, int id) {
+    for (int i = 0; i < *count; i++) {
+        if (list[i] == id) {
+            list[i] = list[--(*count)];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Subscribes to changes of one name or of every name with a prefix.
+ * @param ht A pointer to the hash table.
+ * @param pattern The exact name, or the prefix ("" watches everything).
+ * @param isPrefix Non-zero to treat the pattern as a prefix.
+ * @param capacity The number of events buffered (rounded up to a power of
+ * two, at most WATCH_MAX_CAPACITY).
+ * @return The subscriber id, or -1 on failure. Ids of cancelled
+ * subscriptions are handed out again.
+ */
+int watchSubscribe(HashTable *ht, const char *pattern, int isPrefix, unsigned int capacity) {
+    if (capacity > WATCH_MAX_CAPACITY) {
+        fprintf(stderr, "ERROR: A watch ring holds at most %u events.\n", WATCH_MAX_CAPACITY);
+        return -1;
+    }
+    if (!ht->watch) {
+        ht->watch = (WatchRegistry*)calloc(1, sizeof(WatchRegistry));
+        if (!ht->watch) {
+            perror("Failed to allocate WatchRegistry");
+            return -1;
+        }
+    }
+    WatchRegistry *reg = ht->watch;
+
+    // 1. Reuse a cancelled slot, or append one, and allocate its ring
+    int id = 0;
+    while (id < reg->numSubs && reg->subs[id].active) id++;
+    if (id == reg->numSubs && reg->numSubs == reg->capSubs) {
+        int cap = reg->capSubs ? reg->capSubs * 2 : 8;
+        WatchSubscriber *subs = (WatchSubscriber*)realloc(reg->subs, cap * sizeof(WatchSubscriber));
+        if (!subs) {
+            perror("Failed to grow subscriber table");
+            return -1;
+        }
+        reg->subs = subs;
+        reg->capSubs = cap;
+    }
+    WatchSubscriber *sub = &reg->subs[id];
+    memset(sub, 0, sizeof(*sub));
+
+    uint32_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    sub->ring = (WatchEvent*)malloc(cap * sizeof(WatchEvent));
+    if (!sub->ring) {
+        perror("Failed to allocate watch ring");
+        return -1;
+    }
+    sub->capacity = cap;
+    sub->isPrefix = isPrefix;
+    copyField(sub->pattern, pattern, MAX_NAME_LEN);
+
+    // 2. Register the pattern in the trie
+    WatchTrieNode *node = &reg->root;
+    for (const unsigned char *p = (const unsigned char*)sub->pattern; *p && node; p++) {
+        node = watchTrieChild(node, *p, 1);
+    }
+    if (!node || (isPrefix ? watchListAdd(&node->prefixSubs, &node->numPrefix, id)
+                           : watchListAdd(&node->exactSubs, &node->numExact, id)) != 0) {
+        free(sub->ring);
+        return -1;
+    }
+
+    sub->active = 1;
+    if (id == reg->numSubs) reg->numSubs++;
+    return id;
+}
+
+/**
+ * @brief Cancels a subscription and frees its ring.
+ * @param ht A pointer to the hash table.
+ * @param id The subscriber id.
+ * @return 0 on success, -1 if there is no such subscriber.
+ */
+int watchUnsubscribe(HashTable *ht, int id) {
+    WatchRegistry *reg = ht->watch;
+    if (!reg || id < 0 || id >= reg->numSubs || !reg->subs[id].active) return -1;
+    WatchSubscriber *sub = &reg->subs[id];
+
+    WatchTrieNode *node = &reg->root;
+    for (const unsigned char *p = (const unsigned char*)sub->pattern; *p && node; p++) {
+        node = watchTrieChild(node, *p, 0);
+    }
+    if (node) {
+        if (sub->isPrefix) watchListRemove(node->prefixSubs, &node->numPrefix, id);
+        else watchListRemove(node->exactSubs, &node->numExact, id);
+    }
+    free(sub->ring);
+    sub->ring = NULL;
+    sub->active = 0;
+    return 0;
+}
+
+/**
+ * @brief Takes the oldest unread event from a subscriber's ring.
+ * @param ht A pointer to the hash table.
+ * @param id The subscriber id.
+ * @param out Receives the event.
+ * @return 1 if an event was returned, 0 if the ring is empty.
+ */
+int watchPoll(HashTable *ht, int id, WatchEvent *out) {
+    WatchRegistry *reg = ht->watch;
+    if (!reg || id < 0 || id >= reg->numSubs || !reg->subs[id].active) return 0;
+    WatchSubscriber *sub = &reg->subs[id];
+
+    if (sub->read == sub->written) return 0;
+    *out = sub->ring[sub->read & (sub->capacity - 1)];
+    sub->read++;
+    return 1;
+}
+
+/**
+ * @brief Prints and consumes every unread event of a subscriber.
+ * @param ht A pointer to the hash table.
+ * @param id The subscriber id.
+ */
+void displayWatchEvents(HashTable *ht, int id) {
+    static const char *opNames[] = { "?", "added", "deleted", "updated" };
+    WatchRegistry *reg = ht->watch;
+    if (!reg || id < 0 || id >= reg->numSubs || !reg->subs[id].active) {
+        printf("ERROR: No watcher %d.\n", id);
+        return;
+    }
+
+    WatchEvent event;
+    int shown = 0;
+    unsigned long dropped = reg->subs[id].dropped;
+    printf("Changes for watcher %d:\n", id);
+    while (watchPoll(ht, id, &event)) {
+        printf("  #%llu %s Name: %s, Phone: %s\n", (unsigned long long)event.seq,
+               opNames[event.op <= CHANGE_UPDATE ? event.op : 0], event.name, event.phone);
+        shown++;
+    }
+    if (dropped) printf("  (%lu older changes were overwritten)\n", dropped);
+    reg->subs[id].dropped = 0;
+    if (!shown) printf("  (no new changes)\n");
+}
+
+/**
+ * @brief Pushes an event into the rings of a list of subscribers.
+ * @param reg A pointer to the watch registry.
+ * @param ids The subscriber ids.
+ * @param count The number of ids.
+ * @param event The event to deliver.
+ */
+static void watchDeliver(WatchRegistry *reg, const int *ids, int count, const WatchEvent *event) {
+    for (int i = 0; i < count; i++) {
+        WatchSubscriber *sub = &reg->subs[ids[i]];
+        if (sub->written - sub->read == sub->capacity) {
+            sub->read++; // Full: overwrite the oldest event
+            sub->dropped++;
+        }
+        sub->ring[sub->written & (sub->capacity - 1)] = *event;
+        sub->written++;
+    }
+}
+
+/**
+ * @brief Dispatches a change to every matching subscriber.
+ * @param reg A pointer to the watch registry.
+ * @param op The kind of change.
+ * @param name The contact's name.
+ * @param phone The phone carried by the event.
+ */
+static void watchNotify(WatchRegistry *reg, ChangeOp op, const char *name, const char *phone) {
+    WatchEvent event;
+    event.seq = ++reg->nextSeq;
+    event.op = op;
+    copyField(event.name, name, MAX_NAME_LEN);
+    copyField(event.phone, phone ? phone : "", MAX_PHONE_LEN);
+
+    // Walk the name's path: every node on it holds matching prefix watchers
+    WatchTrieNode *node = &reg->root;
+    watchDeliver(reg, node->prefixSubs, node->numPrefix, &event);
+    for (const unsigned char *p = (const unsigned char*)event.name; *p; p++) {
+        node = watchTrieChild(node, *p, 0);
+        if (!node) return;
+        watchDeliver(reg, node->prefixSubs, node->numPrefix, &event);
+    }
+    watchDeliver(reg, node->exactSubs, node->numExact, &event);
+}
+
+/**
+ * @brief Frees a subscription trie below (and excluding) a node.
+ * @param node The node whose descendants are freed.
+ */
+static void watchTrieFree(WatchTrieNode *node) {
+    WatchTrieNode *child = node->child;
+    while (child) {
+        WatchTrieNode *next = child->sibling;
+        watchTrieFree(child);
+        free(child);
+        child = next;
+    }
+    free(node->prefixSubs);
+    free(node->exactSubs);
+}
+
+/**
+ * @brief Frees the watch registry of a table.
+ * @param ht A pointer to the hash table.
+ */
+static void watchFree(HashTable *ht) {
+    WatchRegistry *reg = ht->watch;
+    if (!reg) return;
+    watchTrieFree(&reg->root);
+    for (int i = 0; i < reg->numSubs; i++) free(reg->subs[i].ring);
+    free(reg->subs);
+    free(reg);
+    ht->watch = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Merkle tree for replica anti-entropy                               */
+/*                                                                     */
+/*  Every bucket has a leaf hash equal to the (wrapping) sum of its     */
+/*  contacts' digests, and each mutation adjusts one leaf and rehashes  */
+/*  its path to the root in O(log buckets). Two replicas compare roots  */
+/*  and descend only into differing subtrees, so the data exchanged is  */
+/*  proportional to the number of differing buckets.                    */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Digests one contact for the Merkle leaves.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return A 64-bit digest of the (name, phone) pair.
+ */
+uint64_t contactDigest(const char *name, const char *phone) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a offset basis
+    for (const unsigned char *p = (const unsigned char*)name; *p; p++) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    h = (h ^ 0xFF) * 0x100000001b3ULL; // Separator that cannot occur in text
+    for (const unsigned char *p = (const unsigned char*)phone; *p; p++) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    return mixHash(h);
+}
+
+/**
+ * @brief Combines two child hashes into their parent's hash.
+ * @param left The left child's hash.
+ * @param right The right child's hash.
+ * @return The parent hash.
+ */
+static uint64_t merkleCombine(uint64_t left, uint64_t right) {
+    return mixHash(left ^ ((right << 29) | (right >> 35)) ^ 0x9e3779b97f4a7c15ULL);
+}
+
+/**
+ * @brief Adds (or, with a negative sign, removes) a contact from its leaf.
+ * @param tree A pointer to the Merkle tree.
+ * @param bucket The contact's bucket.
+ * @param digest The contact's digest.
+ * @param sign +1 to add, -1 to remove.
+ */
+static void merkleApply(MerkleTree *tree, unsigned int bucket, uint64_t digest, int sign) {
+    uint32_t i = tree->numLeaves + bucket;
+    tree->nodes[i] += sign > 0 ? digest : (uint64_t)0 - digest;
+    for (i /= 2; i >= 1; i /= 2) {
+        tree->nodes[i] = merkleCombine(tree->nodes[2 * i], tree->nodes[2 * i + 1]);
+    }
+}
+
+static void merkleAddDiskRecord(uint32_t pageId, const DiskRecord *rec, void *ctx) {
+    (void)pageId;
+    HashTable *ht = (HashTable*)ctx;
+    MerkleTree *tree = ht->merkle;
+    tree->nodes[tree->numLeaves + hashFunction(rec->name, ht->size)] +=
+        contactDigest(rec->name, rec->phone);
+}
+
+/**
+ * @brief Starts maintaining a Merkle tree over the table's buckets.
+ * @param ht A pointer to the (in-memory) hash table.
+ * @return 0 on success, -1 on failure.
+ */
+int enableMerkleTree(HashTable *ht) {
+    if (ht->disk) {
+        fprintf(stderr, "ERROR: Disk-backed tables do not support Merkle sync.\n");
+        return -1;
+    }
+    if (ht->merkle) return 0;
+
+    MerkleTree *tree = (MerkleTree*)calloc(1, sizeof(MerkleTree));
+    if (!tree) {
+        perror("Failed to allocate MerkleTree");
+        return -1;
+    }
+    tree->numLeaves = 1;
+    while (tree->numLeaves < (uint32_t)ht->size) tree->numLeaves <<= 1;
+    tree->nodes = (uint64_t*)calloc(2 * (size_t)tree->numLeaves, sizeof(uint64_t));
+    if (!tree->nodes) {
+        perror("Failed to allocate Merkle nodes");
+        free(tree);
+        return -1;
+    }
+    ht->merkle = tree;
+
+    // 1. Fill the leaves from every contact, resident or spilled
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node; node = node->next) {
+            tree->nodes[tree->numLeaves + i] += contactDigest(node->name, node->phone);
+        }
+    }
+    if (ht->overflow) diskHashForEach(ht->overflow, merkleAddDiskRecord, ht);
+
+    // 2. Build the inner nodes bottom-up
+    for (uint32_t i = tree->numLeaves - 1; i >= 1; i--) {
+        tree->nodes[i] = merkleCombine(tree->nodes[2 * i], tree->nodes[2 * i + 1]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the Merkle root hash of a table.
+ * @param ht A pointer to the hash table.
+ * @return The root hash, or 0 if the tree is not enabled.
+ */
+uint64_t merkleRoot(HashTable *ht) {
+    return ht->merkle ? ht->merkle->nodes[1] : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Directory statistics                                               */
+/*                                                                     */
+/*  Distinct phones, surnames and area codes are counted with          */
+/*  HyperLogLog sketches updated on every insert. Each sketch also      */
+/*  keeps the harmonic sum of its registers, so an estimate is a        */
+/*  single division instead of a pass over 4096 registers. Name         */
+/*  lengths and phone digit counts have so few possible values that     */
+/*  exact histograms serve as their quantile sketches.                  */
+/* ------------------------------------------------------------------ */
+
+int defaultThreadCount(void);
+static void runParallel(void *(*fn)(void*), void *job, int threads);
+
+/**
+ * @brief Resets a HyperLogLog sketch to empty.
+ * @param hll The sketch.
+ */
+static void hllReset(HyperLogLog *hll) {
+    memset(hll->registers, 0, sizeof(hll->registers));
+    hll->inverseSum = HLL_REGISTERS;
+    hll->zeros = HLL_REGISTERS;
+}
+
+/**
+ * @brief Adds a hashed item to a HyperLogLog sketch.
+ * @param hll The sketch.
+ * @param h A well-mixed 64-bit hash of the item.
+ */
+static void hllAdd(HyperLogLog *hll, uint64_t h) {
+    uint32_t index = (uint32_t)(h >> (64 - HLL_BITS));
+    uint64_t rest = (h << HLL_BITS) | ((uint64_t)1 << (HLL_BITS - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    uint8_t old = hll->registers[index];
+    if (rank <= old) return;
+
+    hll->registers[index] = rank;
+    hll->inverseSum += 1.0 / (double)((uint64_t)1 << rank) - 1.0 / (double)((uint64_t)1 << old);
+    if (old == 0) hll->zeros--;
+}
+
+/**
+ * @brief Recomputes the running sum after registers were merged.
+ * @param hll The sketch.
+ */
+static void hllRecount(HyperLogLog *hll) {
+    hll->inverseSum = 0;
+    hll->zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        hll->inverseSum += 1.0 / (double)((uint64_t)1 << hll->registers[i]);
+        if (hll->registers[i] == 0) hll->zeros++;
+    }
+}
+
+/**
+ * @brief Estimates the number of distinct items added to a sketch.
+ * @param hll The sketch.
+ * @return The estimate.
+ */
+static double hllEstimate(const HyperLogLog *hll) {
+    const double m = HLL_REGISTERS;
+    double estimate = (0.7213 / (1 + 1.079 / m)) * m * m / hll->inverseSum;
+    // Small cardinalities are far more accurate with linear counting
+    if (estimate <= 2.5 * m && hll->zeros > 0) {
+        estimate = m * log(m / hll->zeros);
+    }
+    return estimate;
+}
+
+/**
+ * @brief Hashes the surname of a name, case-insensitively.
+ * "Smith, John" and "John Smith" both give "smith".
+ * @param name The contact's name.
+ * @param h Receives the hash.
+ * @return 1 if the name has a surname, 0 otherwise.
+ */
+static int surnameHash(const char *name, uint64_t *h) {
+    const char *start, *end;
+    const char *comma = strchr(name, ',');
+    if (comma) {
+        start = name;
+        end = comma;
+    } else {
+        end = name + strlen(name);
+        while (end > name && isspace((unsigned char)end[-1])) end--;
+        start = end;
+        while (start > name && !isspace((unsigned char)start[-1])) start--;
+    }
+    while (start < end && isspace((unsigned char)*start)) start++;
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    if (start == end) return 0;
+
+    unsigned long hash = 5381; // djb2, as in hashString()
+    for (const char *c = start; c < end; c++) {
+        hash = ((hash << 5) + hash) + (unsigned char)tolower((unsigned char)*c);
+    }
+    *h = mixHash(hash);
+    return 1;
+}
+
+/**
+ * @brief Counts the digits of a phone number and extracts its area code.
+ * The area code is the first three digits of a ten-digit number, after
+ * dropping a leading country code 1 from an eleven-digit one.
+ * @param phone The phone number.
+ * @param digits Receives the number of digits (may be NULL).
+ * @return The area code (0-999), or -1 if the number has none.
+ */
+static int phoneAreaCode(const char *phone, int *digits) {
+    char lead[4];
+    int n = 0;
+    for (const char *c = phone; *c; c++) {
+        if (!isdigit((unsigned char)*c)) continue;
+        if (n < 4) lead[n] = *c;
+        n++;
+    }
+    if (digits) *digits = n;
+
+    const char *code;
+    if (n == 10) {
+        code = lead;
+    } else if (n == 11 && lead[0] == '1') {
+        code = lead + 1;
+    } else {
+        return -1;
+    }
+    return (code[0] - '0') * 100 + (code[1] - '0') * 10 + (code[2] - '0');
+}
+
+/**
+ * @brief Adds one contact to, or removes one from, a stats block.
+ * The distinct-count sketches only grow; a deleted contact is just counted.
+ * @param stats The stats block.
+ * @param op The change being applied (an update removes the old phone and
+ * adds the new one, but deletes nothing).
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @param delta +1 to add, -1 to remove.
+ */
+static void statsApply(DirectoryStats *stats, ChangeOp op, const char *name, const char *phone,
+                       int delta) {
+    int digits;
+    uint64_t h;
+    int areaCode = phoneAreaCode(phone, &digits);
+    size_t nameLen = strnlen(name, MAX_NAME_LEN - 1);
+    if (digits >= MAX_PHONE_LEN) digits = MAX_PHONE_LEN - 1;
+
+    stats->nameLength[nameLen] += delta;
+    stats->phoneDigits[digits] += delta;
+    stats->contacts += delta;
+    if (delta < 0) {
+        if (op == CHANGE_DELETE) stats->deletesSinceRebuild++;
+        return;
+    }
+    if (areaCode >= 0) hllAdd(&stats->areaCodes, mixHash((uint64_t)areaCode + 1));
+    hllAdd(&stats->phones, mixHash(hashString(phone)));
+    if (surnameHash(name, &h)) hllAdd(&stats->surnames, h);
+}
+
+/**
+ * @brief Resets a stats block to empty.
+ * @param stats The stats block.
+ */
+static void statsReset(DirectoryStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    hllReset(&stats->phones);
+    hllReset(&stats->surnames);
+    hllReset(&stats->areaCodes);
+}
+
+// Shared state of a parallel stats rebuild
+typedef struct StatsRebuildJob {
+    HashTable *ht;
+    int nextBucket;
+    pthread_mutex_t lock;
+} StatsRebuildJob;
+
+/**
+ * @brief Merges one stats block into another.
+ * @param dst The destination (its running sums are stale afterwards).
+ * @param src The source.
+ */
+static void statsMerge(DirectoryStats *dst, const DirectoryStats *src) {
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        if (src->phones.registers[i] > dst->phones.registers[i])
+            dst->phones.registers[i] = src->phones.registers[i];
+        if (src->surnames.registers[i] > dst->surnames.registers[i])
+            dst->surnames.registers[i] = src->surnames.registers[i];
+        if (src->areaCodes.registers[i] > dst->areaCodes.registers[i])
+            dst->areaCodes.registers[i] = src->areaCodes.registers[i];
+    }
+    for (int i = 0; i < MAX_NAME_LEN; i++) dst->nameLength[i] += src->nameLength[i];
+    for (int i = 0; i < MAX_PHONE_LEN; i++) dst->phoneDigits[i] += src->phoneDigits[i];
+    dst->contacts += src->contacts;
+}
+
+static void *statsRebuildRun(void *arg) {
+    StatsRebuildJob *job = (StatsRebuildJob*)arg;
+    HashTable *ht = job->ht;
+    DirectoryStats *local = (DirectoryStats*)malloc(sizeof(DirectoryStats));
+    if (!local) return NULL;
+    statsReset(local);
+
+    // 1. Claim chunks of buckets until none are left
+    for (;;) {
+        int first = __atomic_fetch_add(&job->nextBucket, STATS_REBUILD_CHUNK, __ATOMIC_RELAXED);
+        if (first >= ht->size) break;
+        int last = first + STATS_REBUILD_CHUNK < ht->size ? first + STATS_REBUILD_CHUNK : ht->size;
+        for (int i = first; i < last; i++) {
+            for (ContactNode *node = ht->table[i]; node; node = node->next) {
+                statsApply(local, CHANGE_INSERT, node->name, node->phone, +1);
+            }
+        }
+    }
+
+    // 2. Fold the thread's sketches into the table's
+    pthread_mutex_lock(&job->lock);
+    statsMerge(ht->stats, local);
+    pthread_mutex_unlock(&job->lock);
+    free(local);
+    return NULL;
+}
+
+static void statsAddDiskRecord(uint32_t page, const DiskRecord *rec, void *ctx) {
+    (void)page;
+    statsApply((DirectoryStats*)ctx, CHANGE_INSERT, rec->name, rec->phone, +1);
+}
+
+/**
+ * @brief Rebuilds the directory statistics from every contact.
+ * Run after many deletes, which the distinct counts cannot forget.
+ * @param ht A pointer to the hash table (stats must be enabled).
+ * @param threads The number of threads scanning resident buckets.
+ */
+void rebuildDirectoryStats(HashTable *ht, int threads) {
+    if (!ht->stats) return;
+    statsReset(ht->stats);
+
+    if (ht->disk) {
+        diskHashForEach(ht->disk, statsAddDiskRecord, ht->stats);
+    } else {
+        StatsRebuildJob job;
+        job.ht = ht;
+        job.nextBucket = 0;
+        pthread_mutex_init(&job.lock, NULL);
+        runParallel(statsRebuildRun, &job, threads);
+        pthread_mutex_destroy(&job.lock);
+        if (ht->overflow) diskHashForEach(ht->overflow, statsAddDiskRecord, ht->stats);
+    }
+    hllRecount(&ht->stats->phones);
+    hllRecount(&ht->stats->surnames);
+    hllRecount(&ht->stats->areaCodes);
+}
+
+/**
+ * @brief Starts maintaining directory statistics.
+ * @param ht A pointer to the hash table.
+ * @param threads The number of threads for the initial build.
+ * @return 0 on success, -1 on failure.
+ */
+int enableDirectoryStats(HashTable *ht, int threads) {
+    if (ht->stats) return 0;
+    ht->stats = (DirectoryStats*)malloc(sizeof(DirectoryStats));
+    if (!ht->stats) {
+        perror("Failed to allocate DirectoryStats");
+        return -1;
+    }
+    rebuildDirectoryStats(ht, threads);
+    return 0;
+}
+
+/**
+ * @brief Returns the smallest value at or below which a fraction of a
+ * histogram lies.
+ * @param histogram The histogram.
+ * @param buckets The number of values.
+ * @param total The sum of the histogram.
+ * @param q The fraction (0..1).
+ * @return The quantile value, or 0 for an empty histogram.
+ */
+static int histogramQuantile(const uint64_t *histogram, int buckets, uint64_t total, double q) {
+    if (total == 0) return 0;
+    uint64_t target = (uint64_t)ceil(q * (double)total);
+    if (target < 1) target = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < buckets; i++) {
+        seen += histogram[i];
+        if (seen >= target) return i;
+    }
+    return buckets - 1;
+}
+
+/**
+ * @brief Returns a quantile of contact name lengths.
+ * @param ht A pointer to the hash table (stats must be enabled).
+ * @param q The fraction (0..1), e.g. 0.5 for the median.
+ * @return The name length in bytes.
+ */
+int nameLengthQuantile(HashTable *ht, double q) {
+    DirectoryStats *stats = ht->stats;
+    return stats ? histogramQuantile(stats->nameLength, MAX_NAME_LEN, stats->contacts, q) : 0;
+}
+
+/**
+ * @brief Returns a quantile of digits per phone number.
+ * @param ht A pointer to the hash table (stats must be enabled).
+ * @param q The fraction (0..1).
+ * @return The number of digits.
+ */
+int phoneDigitsQuantile(HashTable *ht, double q) {
+    DirectoryStats *stats = ht->stats;
+    return stats ? histogramQuantile(stats->phoneDigits, MAX_PHONE_LEN, stats->contacts, q) : 0;
+}
+
+/**
+ * @brief Estimates the number of distinct phone numbers.
+ * @param ht A pointer to the hash table (stats must be enabled).
+ * @return The estimate.
+ */
+double distinctPhones(HashTable *ht) {
+    return ht->stats ? hllEstimate(&ht->stats->phones) : 0;
+}
+
+/**
+ * @brief Estimates the number of distinct surnames.
+ * @param ht A pointer to the hash table (stats must be enabled).
+ * @return The estimate.
+ */
+double distinctSurnames(HashTable *ht) {
+    return ht->stats ? hllEstimate(&ht->stats->surnames) : 0;
+}
+
+/**
+ * @brief Estimates the number of distinct area codes.
+ * @param ht A pointer to the hash table (stats must be enabled).
+ * @return The estimate.
+ */
+double distinctAreaCodes(HashTable *ht) {
+    return ht->stats ? hllEstimate(&ht->stats->areaCodes) : 0;
+}
+
+/**
+ * @brief Prints the directory statistics.
+ * @param ht A pointer to the hash table.
+ */
+void displayDirectoryStats(HashTable *ht) {
+    if (!ht->stats) {
+        printf("Directory statistics are off (start with --stats).\n");
+        return;
+    }
+    DirectoryStats *stats = ht->stats;
+    printf("\n--- Directory Statistics ---\n");
+    printf("Contacts:            %llu\n", (unsigned long long)stats->contacts);
+    printf("Distinct phones:     ~%.0f\n", distinctPhones(ht));
+    printf("Distinct surnames:   ~%.0f\n", distinctSurnames(ht));
+    printf("Distinct area codes: ~%.0f\n", distinctAreaCodes(ht));
+    printf("Name length p50/p90/p99: %d/%d/%d\n", nameLengthQuantile(ht, 0.5),
+           nameLengthQuantile(ht, 0.9), nameLengthQuantile(ht, 0.99));
+    printf("Phone digits p50/p90/p99: %d/%d/%d\n", phoneDigitsQuantile(ht, 0.5),
+           phoneDigitsQuantile(ht, 0.9), phoneDigitsQuantile(ht, 0.99));
+    if (stats->deletesSinceRebuild) {
+        printf("(Distinct counts include %llu deleted contacts until the next rebuild.)\n",
+               (unsigned long long)stats->deletesSinceRebuild);
+    }
+    printf("----------------------------\n");
+}
+
+/* ------------------------------------------------------------------ */
+/*  Frequency-ranked suggestions                                       */
+/*                                                                     */
+/*  Every contact name lives in a trie whose terminal nodes carry a     */
+/*  usage score, and every node caches the best score in its subtree.   */
+/*  A use at time t adds 2^(t/H) to a contact's count at a fixed time   */
+/*  origin, which is the same ranking as an exponentially decayed       */
+/*  count with half-life H but never needs rescaling. Scores are kept   */
+/*  as log2 of that count; they only grow, so a use just raises the     */
+/*  cached maxima on the path to the root. A top-k prefix query walks   */
+/*  the subtree best-first by those maxima and stops after k contacts.  */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Finds (or creates) the child of a suggestion node.
+ * @param node The parent node.
+ * @param ch The character.
+ * @param create Non-zero to create the child if missing.
+ * @return The child, or NULL if missing (or allocation failed).
+ */
+static SuggestNode* suggestChild(SuggestNode *node, unsigned char ch, int create) {
+    SuggestNode *child = node->child;
+    while (child && child->ch != ch) child = child->sibling;
+    if (child || !create) return child;
+
+    child = (SuggestNode*)calloc(1, sizeof(SuggestNode));
+    if (!child) {
+        perror("Failed to allocate SuggestNode");
+        return NULL;
+    }
+    child->ch = ch;
+    child->parent = node;
+    child->score = -INFINITY;
+    child->maxScore = -INFINITY;
+    child->sibling = node->child;
+    node->child = child;
+    return child;
+}
+
+/**
+ * @brief Finds the node of an exact name.
+ * @param index The suggestion index.
+ * @param name The name.
+ * @param create Non-zero to create missing nodes.
+ * @return The node, or NULL.
+ */
+static SuggestNode* suggestFind(SuggestIndex *index, const char *name, int create) {
+    SuggestNode *node = &index->root;
+    for (const unsigned char *c = (const unsigned char*)name; *c && node; c++) {
+        node = suggestChild(node, *c, create);
+    }
+    return node;
+}
+
+/**
+ * @brief Recomputes the cached maxima from a node up to the root,
+ * pruning nodes that no longer lead to any contact.
+ * @param node The lowest node whose subtree changed.
+ */
+static void suggestRefresh(SuggestNode *node) {
+    while (node) {
+        double best = node->isContact ? node->score : -INFINITY;
+        for (SuggestNode *c = node->child; c; c = c->sibling) {
+            if (c->maxScore > best) best = c->maxScore;
+        }
+        node->maxScore = best;
+
+        SuggestNode *parent = node->parent;
+        if (parent && !node->isContact && !node->child) {
+            SuggestNode **link = &parent->child;
+            while (*link != node) link = &(*link)->sibling;
+            *link = node->sibling;
+            free(node);
+        }
+        node = parent;
+    }
+}
+
+/**
+ * @brief Adds a contact name to the index with no usage yet.
+ * @param index The suggestion index.
+ * @param name The name.
+ */
+static void suggestInsert(SuggestIndex *index, const char *name) {
+    pthread_mutex_lock(&index->lock);
+    SuggestNode *node = suggestFind(index, name, 1);
+    if (node && !node->isContact) {
+        node->isContact = 1;
+        node->score = -INFINITY;
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+/**
+ * @brief Removes a contact name from the index.
+ * @param index The suggestion index.
+ * @param name The name.
+ */
+static void suggestRemove(SuggestIndex *index, const char *name) {
+    pthread_mutex_lock(&index->lock);
+    SuggestNode *node = suggestFind(index, name, 0);
+    if (node && node->isContact) {
+        node->isContact = 0;
+        node->score = -INFINITY;
+        suggestRefresh(node);
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+/**
+ * @brief Records one use of a contact (called on successful lookups).
+ * @param index The suggestion index.
+ * @param name The contact's name.
+ */
+static void suggestRecordUse(SuggestIndex *index, const char *name) {
+    double t = (double)(currentTimeMicros() - index->origin) / 1e6 / SUGGEST_HALF_LIFE_SECONDS;
+
+    pthread_mutex_lock(&index->lock);
+    SuggestNode *node = suggestFind(index, name, 0);
+    if (node && node->isContact) {
+        // 1. score = log2(2^score + 2^t), computed without overflow
+        double hi = node->score > t ? node->score : t;
+        double lo = node->score > t ? t : node->score;
+        node->score = hi + log2(1 + exp2(lo - hi));
+
+        // 2. Scores only grow, so the maxima can only rise
+        for (SuggestNode *n = node; n && n->maxScore < node->score; n = n->parent) {
+            n->maxScore = node->score;
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+static void suggestAddDiskRecord(uint32_t page, const DiskRecord *rec, void *ctx) {
+    (void)page;
+    suggestInsert((SuggestIndex*)ctx, rec->name);
+}
+
+/**
+ * @brief Starts keeping ranked suggestions over the table's names.
+ * Usage counts start at zero.
+ * @param ht A pointer to the hash table.
+ * @return 0 on success, -1 on failure.
+ */
+int enableSuggestions(HashTable *ht) {
+    if (ht->suggest) return 0;
+    SuggestIndex *index = (SuggestIndex*)calloc(1, sizeof(SuggestIndex));
+    if (!index) {
+        perror("Failed to allocate SuggestIndex");
+        return -1;
+    }
+    index->root.score = -INFINITY;
+    index->root.maxScore = -INFINITY;
+    index->origin = currentTimeMicros();
+    pthread_mutex_init(&index->lock, NULL);
+    ht->suggest = index;
+
+    if (ht->disk) {
+        diskHashForEach(ht->disk, suggestAddDiskRecord, index);
+        return 0;
+    }
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node; node = node->next) {
+            suggestInsert(index, node->name);
+        }
+    }
+    if (ht->overflow) diskHashForEach(ht->overflow, suggestAddDiskRecord, index);
+    return 0;
+}
+
+/**
+ * @brief Frees a suggestion subtree.
+ * @param node The subtree root (itself freed unless it is the index root).
+ * @param isRoot Non-zero for the index root.
+ */
+static void suggestFreeNode(SuggestNode *node, int isRoot) {
+    SuggestNode *child = node->child;
+    while (child) {
+        SuggestNode *next = child->sibling;
+        suggestFreeNode(child, 0);
+        child = next;
+    }
+    if (!isRoot) free(node);
+}
+
+/**
+ * @brief Frees the suggestion index of a table.
+ * @param ht A pointer to the hash table.
+ */
+static void suggestFree(HashTable *ht) {
+    if (!ht->suggest) return;
+    suggestFreeNode(&ht->suggest->root, 1);
+    pthread_mutex_destroy(&ht->suggest->lock);
+    free(ht->suggest);
+    ht->suggest = NULL;
+}
+
+// A suggestion search frontier entry: a subtree, or a contact itself
+typedef struct SuggestCandidate {
+    SuggestNode *node;
+    double key;
+    int isContact;
+} SuggestCandidate;
+
+/**
+ * @brief Pushes a candidate onto a max-heap.
+ * @param heap The heap array.
+ * @param count The heap size (updated).
+ * @param c The candidate.
+ */
+static void suggestHeapPush(SuggestCandidate *heap, int *count, SuggestCandidate c) {
+    int i = (*count)++;
+    while (i > 0 && heap[(i - 1) / 2].key < c.key) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = c;
+}
+
+/**
+ * @brief Pops the best candidate from a max-heap.
+ * @param heap The heap array.
+ * @param count The heap size (updated).
+ * @return The best candidate.
+ */
+static SuggestCandidate suggestHeapPop(SuggestCandidate *heap, int *count) {
+    SuggestCandidate top = heap[0];
+    SuggestCandidate last = heap[--(*count)];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= *count) break;
+        if (c + 1 < *count && heap[c + 1].key > heap[c].key) c++;
+        if (heap[c].key <= last.key) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    if (*count > 0) heap[i] = last;
+    return top;
+}
+
+/**
+ * @brief Returns the k most used contacts whose names start with a prefix.
+ * Contacts never looked up rank after used ones, in no particular order.
+ * @param ht A pointer to the hash table (suggestions must be enabled).
+ * @param prefix The typed prefix.
+ * @param k The maximum number of suggestions.
+ * @param names Receives up to k names (each MAX_NAME_LEN bytes).
+ * @param uses Receives each suggestion's decayed usage count (may be NULL).
+ * @return The number of suggestions, or -1 on failure.
+ */
+int suggestContacts(HashTable *ht, const char *prefix, int k,
+                    char (*names)[MAX_NAME_LEN], double *uses) {
+    SuggestIndex *index = ht->suggest;
+    if (!index || k < 1) return 0;
+    double now = (double)(currentTimeMicros() - index->origin) / 1e6 / SUGGEST_HALF_LIFE_SECONDS;
+
+    pthread_mutex_lock(&index->lock);
+    SuggestNode *start = suggestFind(index, prefix, 0);
+    if (!start) {
+        pthread_mutex_unlock(&index->lock);
+        return 0;
+    }
+
+    // 1. Best-first search: a subtree is expanded only while its cached
+    //    maximum beats every contact already waiting in the heap
+    int capacity = 64, count = 0, found = 0;
+    SuggestCandidate *heap = (SuggestCandidate*)malloc(capacity * sizeof(SuggestCandidate));
+    if (!heap) {
+        pthread_mutex_unlock(&index->lock);
+        perror("Failed to allocate suggestion heap");
+        return -1;
+    }
+    SuggestCandidate first = { start, start->maxScore, 0 };
+    suggestHeapPush(heap, &count, first);
+
+    while (count > 0 && found < k) {
+        SuggestCandidate best = suggestHeapPop(heap, &count);
+        if (best.isContact) {
+            // 2. Rebuild the name by walking up to the root
+            char reversed[MAX_NAME_LEN];
+            int len = 0;
+            for (SuggestNode *n = best.node; n->parent && len < MAX_NAME_LEN - 1; n = n->parent) {
+                reversed[len++] = (char)n->ch;
+            }
+            for (int i = 0; i < len; i++) names[found][i] = reversed[len - 1 - i];
+            names[found][len] = '\0';
+            if (uses) uses[found] = isinf(best.key) ? 0 : exp2(best.key - now);
+            found++;
+            continue;
+        }
+
+        int needed = count + 1;
+        for (SuggestNode *c = best.node->child; c; c = c->sibling) needed++;
+        if (needed > capacity) {
+            while (capacity < needed) capacity *= 2;
+            SuggestCandidate *grown = (SuggestCandidate*)realloc(heap, capacity * sizeof(SuggestCandidate));
+            if (!grown) {
+                perror("Failed to grow suggestion heap");
+                break;
+            }
+            heap = grown;
+        }
+        if (best.node->isContact) {
+            SuggestCandidate self = { best.node, best.node->score, 1 };
+            suggestHeapPush(heap, &count, self);
+        }
+        for (SuggestNode *c = best.node->child; c; c = c->sibling) {
+            SuggestCandidate sub = { c, c->maxScore, 0 };
+            suggestHeapPush(heap, &count, sub);
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+    free(heap);
+    return found;
+}
+
+/**
+ * @brief Prints the most used contacts starting with a prefix.
+ * @param ht A pointer to the hash table.
+ * @param prefix The typed prefix.
+ */
+void displaySuggestions(HashTable *ht, const char *prefix) {
+    if (!ht->suggest) {
+        printf("Suggestions are off (start with --suggest).\n");
+        return;
+    }
+    char names[SUGGEST_DEFAULT_K][MAX_NAME_LEN];
+    double uses[SUGGEST_DEFAULT_K];
+    int n = suggestContacts(ht, prefix, SUGGEST_DEFAULT_K, names, uses);
+
+    printf("\n--- Suggestions for '%s' ---\n", prefix);
+    for (int i = 0; i < n; i++) {
+        printf("%d. %-20s (used ~%.1f times recently)\n", i + 1, names[i], uses[i]);
+    }
+    if (n <= 0) {
+        printf("No contacts start with '%s'.\n", prefix);
+    }
+    printf("----------------------------\n");
+}
+
+/* ------------------------------------------------------------------ */
+/*  Roaring bitmaps                                                     */
+/*                                                                     */
+/*  Ids are split into 65536-id chunks by their high 16 bits. A chunk   */
+/*  with at most 4096 ids stores a sorted uint16_t array (8 KiB max);   */
+/*  a fuller one stores a 8 KiB bitmap. Intersections and unions pick    */
+/*  a kernel per container pair; bitmap pairs run 256 bits at a time    */
+/*  with AVX2 where the CPU has it.                                     */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Frees the containers of a bitmap (the struct itself is kept).
+ * @param bm The bitmap.
+ */
+static void roaringClear(RoaringBitmap *bm) {
+    for (int i = 0; i < bm->count; i++) free(bm->containers[i].data);
+    free(bm->containers);
+    memset(bm, 0, sizeof(*bm));
+}
+
+/**
+ * @brief Frees a bitmap returned by roaringAnd(), roaringOr() or
+ * filterContacts().
+ * @param bm The bitmap.
+ */
+void roaringFree(RoaringBitmap *bm) {
+    if (!bm) return;
+    roaringClear(bm);
+    free(bm);
+}
+
+/**
+ * @brief Finds a container by key.
+ * @param bm The bitmap.
+ * @param key The high 16 bits.
+ * @return The index, or -(insertion point + 1) if missing.
+ */
+static int roaringFind(const RoaringBitmap *bm, uint16_t key) {
+    int lo = 0, hi = bm->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        uint16_t k = bm->containers[mid].key;
+        if (k == key) return mid;
+        if (k < key) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -(lo + 1);
+}
+
+/**
+ * @brief Appends a container; keys must arrive in increasing order.
+ * @param bm The bitmap.
+ * @param c The container (ownership of its data moves to the bitmap).
+ * @return 0 on success, -1 on failure.
+ */
+static int roaringAppend(RoaringBitmap *bm, const RoaringContainer *c) {
+    if (bm->count == bm->capacity) {
+        int capacity = bm->capacity ? bm->capacity * 2 : 4;
+        RoaringContainer *grown = (RoaringContainer*)realloc(bm->containers, capacity * sizeof(RoaringContainer));
+        if (!grown) return -1;
+        bm->containers = grown;
+        bm->capacity = capacity;
+    }
+    bm->containers[bm->count++] = *c;
+    return 0;
+}
+
+/**
+ * @brief Converts an array container into a bitmap container.
+ * @param c The container.
+ * @return 0 on success, -1 on failure.
+ */
+static int containerToBitmap(RoaringContainer *c) {
+    uint64_t *bits = (uint64_t*)calloc(ROARING_BITMAP_WORDS, sizeof(uint64_t));
+    if (!bits) return -1;
+    const uint16_t *array = (const uint16_t*)c->data;
+    for (uint32_t i = 0; i < c->cardinality; i++) {
+        bits[array[i] >> 6] |= (uint64_t)1 << (array[i] & 63);
+    }
+    free(c->data);
+    c->data = bits;
+    c->isBitmap = 1;
+    c->capacity = 0;
+    return 0;
+}
+
+/**
+ * @brief Converts a bitmap container into an array container.
+ * @param c The container (cardinality must be at most ROARING_ARRAY_MAX).
+ * @return 0 on success, -1 on failure.
+ */
+static int containerToArray(RoaringContainer *c) {
+    uint16_t *array = (uint16_t*)malloc((c->cardinality ? c->cardinality : 1) * sizeof(uint16_t));
+    if (!array) return -1;
+    const uint64_t *bits = (const uint64_t*)c->data;
+    uint32_t n = 0;
+    for (int w = 0; w < ROARING_BITMAP_WORDS; w++) {
+        for (uint64_t word = bits[w]; word; word &= word - 1) {
+            array[n++] = (uint16_t)(w * 64 + __builtin_ctzll(word));
+        }
+    }
+    free(c->data);
+    c->data = array;
+    c->isBitmap = 0;
+    c->capacity = c->cardinality ? c->cardinality : 1;
+    return 0;
+}
+
+/**
+ * @brief Adds an id to a bitmap.
+ * @param bm The bitmap.
+ * @param id The id.
+ * @return 0 on success, -1 on failure.
+ */
+int roaringAdd(RoaringBitmap *bm, uint32_t id) {
+    uint16_t key = (uint16_t)(id >> 16), low = (uint16_t)id;
+
+    // 1. Find or create the container
+    int at = roaringFind(bm, key);
+    if (at < 0) {
+        at = -at - 1;
+        RoaringContainer fresh = { key, 0, 0, 4, malloc(4 * sizeof(uint16_t)) };
+        if (!fresh.data || roaringAppend(bm, &fresh) != 0) {
+            free(fresh.data);
+            return -1;
+        }
+        memmove(&bm->containers[at + 1], &bm->containers[at],
+                (bm->count - 1 - at) * sizeof(RoaringContainer));
+        bm->containers[at] = fresh;
+    }
+    RoaringContainer *c = &bm->containers[at];
+
+    // 2. Set the bit, converting a full array to a bitmap
+    if (!c->isBitmap) {
+        uint16_t *array = (uint16_t*)c->data;
+        int lo = 0, hi = (int)c->cardinality - 1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            if (array[mid] == low) return 0;
+            if (array[mid] < low) lo = mid + 1;
+            else hi = mid - 1;
+        }
+        if (c->cardinality < ROARING_ARRAY_MAX) {
+            if (c->cardinality == c->capacity) {
+                uint32_t capacity = c->capacity * 2 < ROARING_ARRAY_MAX ? c->capacity * 2 : ROARING_ARRAY_MAX;
+                uint16_t *grown = (uint16_t*)realloc(array, capacity * sizeof(uint16_t));
+                if (!grown) return -1;
+                c->data = array = grown;
+                c->capacity = capacity;
+            }
+            memmove(&array[lo + 1], &array[lo], (c->cardinality - lo) * sizeof(uint16_t));
+            array[lo] = low;
+            c->cardinality++;
+            return 0;
+        }
+        if (containerToBitmap(c) != 0) return -1;
+    }
+    uint64_t *bits = (uint64_t*)c->data;
+    uint64_t mask = (uint64_t)1 << (low & 63);
+    if (!(bits[low >> 6] & mask)) {
+        bits[low >> 6] |= mask;
+        c->cardinality++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes an id from a bitmap.
+ * @param bm The bitmap.
+ * @param id The id.
+ */
+void roaringRemove(RoaringBitmap *bm, uint32_t id) {
+    uint16_t low = (uint16_t)id;
+    int at = roaringFind(bm, (uint16_t)(id >> 16));
+    if (at < 0) return;
+    RoaringContainer *c = &bm->containers[at];
+
+    if (c->isBitmap) {
+        uint64_t *bits = (uint64_t*)c->data;
+        uint64_t mask = (uint64_t)1 << (low & 63);
+        if (!(bits[low >> 6] & mask)) return;
+        bits[low >> 6] &= ~mask;
+        if (--c->cardinality <= ROARING_ARRAY_MAX) containerToArray(c);
+    } else {
+        uint16_t *array = (uint16_t*)c->data;
+        int lo = 0, hi = (int)c->cardinality - 1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            if (array[mid] == low) {
+                memmove(&array[mid], &array[mid + 1], (c->cardinality - mid - 1) * sizeof(uint16_t));
+                c->cardinality--;
+                break;
+            }
+            if (array[mid] < low) lo = mid + 1;
+            else hi = mid - 1;
+        }
+    }
+
+    // Drop empty containers
+    if (c->cardinality == 0) {
+        free(c->data);
+        memmove(c, c + 1, (bm->count - at - 1) * sizeof(RoaringContainer));
+        bm->count--;
+    }
+}
+
+/**
+ * @brief Returns the number of ids in a bitmap.
+ * @param bm The bitmap.
+ * @return The cardinality.
+ */
+uint64_t roaringCardinality(const RoaringBitmap *bm) {
+    uint64_t total = 0;
+    for (int i = 0; i < bm->count; i++) total += bm->containers[i].cardinality;
+    return total;
+}
+
+/**
+ * @brief Calls a function for every id in a bitmap, in increasing order.
+ * @param bm The bitmap.
+ * @param fn The callback.
+ * @param ctx Passed through to the callback.
+ */
+void roaringForEach(const RoaringBitmap *bm, void (*fn)(uint32_t, void*), void *ctx) {
+    for (int i = 0; i < bm->count; i++) {
+        const RoaringContainer *c = &bm->containers[i];
+        uint32_t base = (uint32_t)c->key << 16;
+        if (c->isBitmap) {
+            const uint64_t *bits = (const uint64_t*)c->data;
+            for (int w = 0; w < ROARING_BITMAP_WORDS; w++) {
+                for (uint64_t word = bits[w]; word; word &= word - 1) {
+                    fn(base + w * 64 + __builtin_ctzll(word), ctx);
+                }
+            }
+        } else {
+            const uint16_t *array = (const uint16_t*)c->data;
+            for (uint32_t j = 0; j < c->cardinality; j++) fn(base + array[j], ctx);
+        }
+    }
+}
+
+/**
+ * @brief ANDs or ORs two bitmap containers word by word (portable version).
+ * @param a The first container's words.
+ * @param b The second container's words.
+ * @param out Receives the result words.
+ * @param isOr Non-zero for OR, zero for AND.
+ * @return The result's cardinality.
+ */
+static uint32_t bitmapCombineScalar(const uint64_t *a, const uint64_t *b, uint64_t *out, int isOr) {
+    uint32_t card = 0;
+    for (int w = 0; w < ROARING_BITMAP_WORDS; w++) {
+        out[w] = isOr ? a[w] | b[w] : a[w] & b[w];
+        card += __builtin_popcountll(out[w]);
+    }
+    return card;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief ANDs or ORs two bitmap containers, 256 bits at a time.
+ * @param a The first container's words.
+ * @param b The second container's words.
+ * @param out Receives the result words.
+ * @param isOr Non-zero for OR, zero for AND.
+ * @return The result's cardinality.
+ */
+__attribute__((target("avx2,popcnt")))
+static uint32_t bitmapCombineAvx2(const uint64_t *a, const uint64_t *b, uint64_t *out, int isOr) {
+    uint32_t card = 0;
+    for (int w = 0; w < ROARING_BITMAP_WORDS; w += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + w));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + w));
+        __m256i vr = isOr ? _mm256_or_si256(va, vb) : _mm256_and_si256(va, vb);
+        _mm256_storeu_si256((__m256i*)(out + w), vr);
+        card += (uint32_t)(_mm_popcnt_u64(out[w]) + _mm_popcnt_u64(out[w + 1]) +
+                           _mm_popcnt_u64(out[w + 2]) + _mm_popcnt_u64(out[w + 3]));
+    }
+    return card;
+}
+#endif
+
+/**
+ * @brief Intersects two sorted arrays, galloping through the longer one
+ * when the sizes are lopsided.
+ * @param a The shorter array.
+ * @param na Its length.
+ * @param b The longer array.
+ * @param nb Its length.
+ * @param out Receives the intersection (room for na entries).
+ * @return The intersection's length.
+ */
+static uint32_t arrayIntersect(const uint16_t *a, uint32_t na, const uint16_t *b, uint32_t nb, uint16_t *out) {
+    uint32_t n = 0, i = 0, j = 0;
+    if (nb > 32 * na) {
+        for (; i < na && j < nb; i++) {
+            // Gallop to the first b[j] >= a[i], then binary search
+            uint32_t step = 1;
+            while (j + step < nb && b[j + step] < a[i]) step *= 2;
+            uint32_t lo = j, hi = j + step < nb ? j + step : nb - 1;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if (b[mid] < a[i]) lo = mid + 1;
+                else hi = mid;
+            }
+            j = lo;
+            if (b[j] == a[i]) out[n++] = a[i];
+        }
+        return n;
+    }
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Combines two containers with the same key.
+ * @param x The first container.
+ * @param y The second container.
+ * @param isOr Non-zero for OR, zero for AND.
+ * @param useAvx2 Non-zero to use the AVX2 bitmap kernel.
+ * @param out Receives the result (cardinality 0 means empty).
+ * @return 0 on success, -1 on failure.
+ */
+static int containerCombine(const RoaringContainer *x, const RoaringContainer *y, int isOr,
+                            int useAvx2, RoaringContainer *out) {
+    memset(out, 0, sizeof(*out));
+    out->key = x->key;
+
+    // 1. Bitmap with bitmap: word-parallel kernel
+    if (x->isBitmap && y->isBitmap) {
+        uint64_t *bits = (uint64_t*)malloc(ROARING_BITMAP_WORDS * sizeof(uint64_t));
+        if (!bits) return -1;
+#if defined(__x86_64__) || defined(__i386__)
+        if (useAvx2) {
+            out->cardinality = bitmapCombineAvx2((const uint64_t*)x->data, (const uint64_t*)y->data, bits, isOr);
+        } else
+#endif
+        out->cardinality = bitmapCombineScalar((const uint64_t*)x->data, (const uint64_t*)y->data, bits, isOr);
+        (void)useAvx2;
+        out->data = bits;
+        out->isBitmap = 1;
+        if (out->cardinality <= ROARING_ARRAY_MAX) return containerToArray(out);
+        return 0;
+    }
+
+    // 2. Array with bitmap: probe (AND) or set bits in a copy (OR)
+    if (x->isBitmap || y->isBitmap) {
+        const RoaringContainer *arr = x->isBitmap ? y : x;
+        const RoaringContainer *bmp = x->isBitmap ? x : y;
+        const uint16_t *array = (const uint16_t*)arr->data;
+        const uint64_t *src = (const uint64_t*)bmp->data;
+        if (isOr) {
+            uint64_t *bits = (uint64_t*)malloc(ROARING_BITMAP_WORDS * sizeof(uint64_t));
+            if (!bits) return -1;
+            memcpy(bits, src, ROARING_BITMAP_WORDS * sizeof(uint64_t));
+            out->cardinality = bmp->cardinality;
+            for (uint32_t i = 0; i < arr->cardinality; i++) {
+                uint64_t mask = (uint64_t)1 << (array[i] & 63);
+                if (!(bits[array[i] >> 6] & mask)) {
+                    bits[array[i] >> 6] |= mask;
+                    out->cardinality++;
+                }
+            }
+            out->data = bits;
+            out->isBitmap = 1;
+            return 0;
+        }
+        uint16_t *result = (uint16_t*)malloc((arr->cardinality ? arr->cardinality : 1) * sizeof(uint16_t));
+        if (!result) return -1;
+        for (uint32_t i = 0; i < arr->cardinality; i++) {
+            if (src[array[i] >> 6] & ((uint64_t)1 << (array[i] & 63))) result[out->cardinality++] = array[i];
+        }
+        out->data = result;
+        out->capacity = arr->cardinality ? arr->cardinality : 1;
+        return 0;
+    }
+
+    // 3. Array with array: merge (or gallop), spilling a big union to a bitmap
+    const uint16_t *a = (const uint16_t*)x->data, *b = (const uint16_t*)y->data;
+    uint32_t na = x->cardinality, nb = y->cardinality;
+    uint32_t room = isOr ? na + nb : (na < nb ? na : nb);
+    uint16_t *result = (uint16_t*)malloc((room ? room : 1) * sizeof(uint16_t));
+    if (!result) return -1;
+    if (!isOr) {
+        out->cardinality = na <= nb ? arrayIntersect(a, na, b, nb, result)
+                                    : arrayIntersect(b, nb, a, na, result);
+    } else {
+        uint32_t i = 0, j = 0, n = 0;
+        while (i < na || j < nb) {
+            if (j >= nb || (i < na && a[i] < b[j])) result[n++] = a[i++];
+            else if (i >= na || b[j] < a[i]) result[n++] = b[j++];
+            else {
+                result[n++] = a[i++];
+                j++;
+            }
+        }
+        out->cardinality = n;
+    }
+    out->data = result;
+    out->capacity = room ? room : 1;
+    if (out->cardinality > ROARING_ARRAY_MAX) return containerToBitmap(out);
+    return 0;
+}
+
+/**
+ * @brief Intersects or unites two bitmaps.
+ * @param a The first bitmap.
+ * @param b The second bitmap.
+ * @param isOr Non-zero for OR, zero for AND.
+ * @return A new bitmap, or NULL on failure.
+ */
+static RoaringBitmap* roaringCombine(const RoaringBitmap *a, const RoaringBitmap *b, int isOr) {
+    RoaringBitmap *result = (RoaringBitmap*)calloc(1, sizeof(RoaringBitmap));
+    if (!result) return NULL;
+    int useAvx2 = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    useAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+
+    // Walk both container lists in key order
+    int i = 0, j = 0;
+    while (i < a->count || j < b->count) {
+        const RoaringContainer *x = i < a->count ? &a->containers[i] : NULL;
+        const RoaringContainer *y = j < b->count ? &b->containers[j] : NULL;
+        RoaringContainer c;
+        if (x && y && x->key == y->key) {
+            if (containerCombine(x, y, isOr, useAvx2, &c) != 0) goto fail;
+            i++;
+            j++;
+        } else {
+            const RoaringContainer *only = (!y || (x && x->key < y->key)) ? x : y;
+            if (only == x) i++;
+            else j++;
+            if (!isOr) continue;
+
+            // A container on one side only is copied into a union
+            size_t bytes = only->isBitmap ? ROARING_BITMAP_WORDS * sizeof(uint64_t)
+                                          : only->cardinality * sizeof(uint16_t);
+            c = *only;
+            c.capacity = only->isBitmap ? 0 : only->cardinality;
+            c.data = malloc(bytes ? bytes : 1);
+            if (!c.data) goto fail;
+            memcpy(c.data, only->data, bytes);
+        }
+        if (c.cardinality == 0) {
+            free(c.data);
+        } else if (roaringAppend(result, &c) != 0) {
+            free(c.data);
+            goto fail;
+        }
+    }
+    return result;
+
+fail:
+    perror("Failed to combine bitmaps");
+    roaringFree(result);
+    return NULL;
+}
+
+/**
+ * @brief Intersects two bitmaps.
+ * @param a The first bitmap.
+ * @param b The second bitmap.
+ * @return A new bitmap (free with roaringFree()), or NULL on failure.
+ */
+RoaringBitmap* roaringAnd(const RoaringBitmap *a, const RoaringBitmap *b) {
+    return roaringCombine(a, b, 0);
+}
+
+/**
+ * @brief Unites two bitmaps.
+ * @param a The first bitmap.
+ * @param b The second bitmap.
+ * @return A new bitmap (free with roaringFree()), or NULL on failure.
+ */
+RoaringBitmap* roaringOr(const RoaringBitmap *a, const RoaringBitmap *b) {
+    return roaringCombine(a, b, 1);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Dense contact ids                                                   */
+/*                                                                     */
+/*  Bitmap and posting-list indexes identify contacts by small integers */
+/*  rather than names. Freed ids go on a stack and are handed out       */
+/*  again first, so the id space stays as dense as the directory.       */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Sets up an empty id map.
+ * @param map The map.
+ * @return 0 on success, -1 on failure.
+ */
+static int contactIdInit(ContactIdMap *map) {
+    memset(map, 0, sizeof(*map));
+    map->slots = (uint32_t*)malloc(1024 * sizeof(uint32_t));
+    if (!map->slots) return -1;
+    memset(map->slots, 0xff, 1024 * sizeof(uint32_t));
+    map->slotMask = 1023;
+    return 0;
+}
+
+/**
+ * @brief Frees an id map's arrays.
+ * @param map The map.
+ */
+static void contactIdFree(ContactIdMap *map) {
+    free(map->names);
+    free(map->live);
+    free(map->freeIds);
+    free(map->slots);
+    memset(map, 0, sizeof(*map));
+}
+
+/**
+ * @brief Finds the map slot of a name.
+ * @param map The map.
+ * @param name The contact's name.
+ * @return The slot holding its id, or the empty slot where it would go.
+ */
+static uint32_t contactIdSlot(const ContactIdMap *map, const char *name) {
+    uint32_t s = (uint32_t)mixHash(hashString(name)) & map->slotMask;
+    while (map->slots[s] != UINT32_MAX && strcmp(map->names[map->slots[s]], name) != 0) {
+        s = (s + 1) & map->slotMask;
+    }
+    return s;
+}
+
+/**
+ * @brief Finds the id of a contact.
+ * @param map The map.
+ * @param name The contact's name.
+ * @return The id, or UINT32_MAX if the contact has none.
+ */
+static uint32_t contactIdFind(const ContactIdMap *map, const char *name) {
+    return map->slots[contactIdSlot(map, name)];
+}
+
+/**
+ * @brief Returns whether an id is in use.
+ * @param map The map.
+ * @param id The id.
+ * @return Non-zero if live.
+ */
+static inline int contactIdLive(const ContactIdMap *map, uint32_t id) {
+    return id < map->numIds && map->live[id];
+}
+
+/**
+ * @brief Doubles the name -> id slots.
+ * @param map The map.
+ * @return 0 on success, -1 on failure.
+ */
+static int contactIdGrowSlots(ContactIdMap *map) {
+    uint32_t size = (map->slotMask + 1) * 2;
+    uint32_t *slots = (uint32_t*)malloc(size * sizeof(uint32_t));
+    if (!slots) return -1;
+    memset(slots, 0xff, size * sizeof(uint32_t));
+    for (uint32_t s = 0; s <= map->slotMask; s++) {
+        uint32_t id = map->slots[s];
+        if (id == UINT32_MAX) continue;
+        uint32_t t = (uint32_t)mixHash(hashString(map->names[id])) & (size - 1);
+        while (slots[t] != UINT32_MAX) t = (t + 1) & (size - 1);
+        slots[t] = id;
+    }
+    free(map->slots);
+    map->slots = slots;
+    map->slotMask = size - 1;
+    return 0;
+}
+
+/**
+ * @brief Gives a new contact an id, reusing a freed one when possible.
+ * Callers keeping per-id arrays must grow them to map->capacity.
+ * @param map The map.
+ * @param name The contact's name (must not have an id yet).
+ * @return The id, or UINT32_MAX on failure.
+ */
+static uint32_t contactIdAssign(ContactIdMap *map, const char *name) {
+    uint32_t slot = contactIdSlot(map, name);
+    uint32_t id;
+    if (map->numFree > 0) {
+        id = map->freeIds[--map->numFree];
+    } else {
+        if (map->numIds == map->capacity) {
+            uint32_t capacity = map->capacity ? map->capacity * 2 : 1024;
+            char (*names)[MAX_NAME_LEN] = (char (*)[MAX_NAME_LEN])realloc(map->names, capacity * sizeof(*names));
+            if (names) map->names = names;
+            uint8_t *live = (uint8_t*)realloc(map->live, capacity);
+            if (live) map->live = live;
+            uint32_t *ids = (uint32_t*)realloc(map->freeIds, capacity * sizeof(uint32_t));
+            if (ids) map->freeIds = ids;
+            if (!names || !live || !ids) {
+                perror("Failed to grow contact ids");
+                return UINT32_MAX;
+            }
+            map->capacity = capacity;
+        }
+        id = map->numIds++;
+    }
+    copyField(map->names[id], name, MAX_NAME_LEN);
+    map->live[id] = 1;
+    map->slots[slot] = id;
+    if (map->numIds - map->numFree > (map->slotMask + 1) / 2) contactIdGrowSlots(map);
+    return id;
+}
+
+/**
+ * @brief Releases a contact's id for reuse.
+ * @param map The map.
+ * @param name The contact's name.
+ * @return The released id, or UINT32_MAX if the contact had none.
+ */
+static uint32_t contactIdRelease(ContactIdMap *map, const char *name) {
+    uint32_t slot = contactIdSlot(map, name);
+    uint32_t id = map->slots[slot];
+    if (id == UINT32_MAX) return id;
+    map->live[id] = 0;
+    map->freeIds[map->numFree++] = id;
+
+    // Delete from the linear-probing slots by shifting later entries back
+    uint32_t hole = slot, s = slot;
+    for (;;) {
+        s = (s + 1) & map->slotMask;
+        uint32_t other = map->slots[s];
+        if (other == UINT32_MAX) break;
+        uint32_t home = (uint32_t)mixHash(hashString(map->names[other])) & map->slotMask;
+        if (((s - home) & map->slotMask) >= ((s - hole) & map->slotMask)) {
+            map->slots[hole] = other;
+            hole = s;
+        }
+    }
+    map->slots[hole] = UINT32_MAX;
+    return id;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Attribute indexes                                                   */
+/*                                                                     */
+/*  Every contact gets a dense id, and each attribute value (area code, */
+/*  added month, tag) owns a Roaring bitmap of the ids that have it. A  */
+/*  combined filter is the intersection of a few bitmaps, smallest      */
+/*  first, so it never touches the contacts themselves.                 */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Returns the current month as YYYYMM.
+ * @return The month.
+ */
+static int32_t currentMonth(void) {
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+/**
+ * @brief Finds (or creates) a named bitmap in a list.
+ * @param list The list (tags or months).
+ * @param count The list length.
+ * @param label The tag (NULL for months).
+ * @param month The month (ignored for tags).
+ * @param create Non-zero to create a missing entry.
+ * @return The bitmap, or NULL.
+ */
+static RoaringBitmap* attributeValue(AttributeValue **list, int *count, const char *label,
+                                     int32_t month, int create) {
+    for (int i = 0; i < *count; i++) {
+        AttributeValue *v = &(*list)[i];
+        if (label ? strcmp(v->label, label) == 0 : v->month == month) return &v->bits;
+    }
+    if (!create) return NULL;
+    AttributeValue *grown = (AttributeValue*)realloc(*list, (*count + 1) * sizeof(AttributeValue));
+    if (!grown) return NULL;
+    *list = grown;
+    AttributeValue *v = &grown[(*count)++];
+    memset(v, 0, sizeof(*v));
+    if (label) copyField(v->label, label, ATTRIBUTE_MAX_TAG);
+    v->month = month;
+    return &v->bits;
+}
+
+/**
+ * @brief Indexes a new contact.
+ * @param index The attribute index.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @param month The month it was added (YYYYMM).
+ */
+static void attributeInsert(AttributeIndex *index, const char *name, const char *phone, int32_t month) {
+    if (contactIdFind(&index->ids, name) != UINT32_MAX) return;
+
+    // 1. Take an id, growing the per-id attributes along with the map
+    uint32_t id = contactIdAssign(&index->ids, name);
+    if (id == UINT32_MAX) return;
+    if (id >= index->numRecords) {
+        AttributeRecord *grown = (AttributeRecord*)realloc(index->records, index->ids.capacity * sizeof(AttributeRecord));
+        if (!grown) {
+            perror("Failed to grow attribute index");
+            contactIdRelease(&index->ids, name);
+            return;
+        }
+        index->records = grown;
+        index->numRecords = index->ids.capacity;
+    }
+
+    // 2. Remember the attributes
+    AttributeRecord *rec = &index->records[id];
+    rec->areaCode = (int16_t)phoneAreaCode(phone, NULL);
+    rec->addedMonth = month;
+
+    // 3. Set the id in every bitmap it belongs to
+    roaringAdd(&index->live, id);
+    if (rec->areaCode >= 0) {
+        RoaringBitmap **bm = &index->byAreaCode[rec->areaCode];
+        if (!*bm) *bm = (RoaringBitmap*)calloc(1, sizeof(RoaringBitmap));
+        if (*bm) roaringAdd(*bm, id);
+    }
+    RoaringBitmap *byMonth = attributeValue(&index->months, &index->numMonths, NULL, month, 1);
+    if (byMonth) roaringAdd(byMonth, id);
+}
+
+/**
+ * @brief Removes a contact from the index, freeing its id for reuse.
+ * @param index The attribute index.
+ * @param name The contact's name.
+ */
+static void attributeRemove(AttributeIndex *index, const char *name) {
+    uint32_t id = contactIdRelease(&index->ids, name);
+    if (id == UINT32_MAX) return;
+    AttributeRecord *rec = &index->records[id];
+
+    // Clear the id from its bitmaps
+    roaringRemove(&index->live, id);
+    if (rec->areaCode >= 0 && index->byAreaCode[rec->areaCode]) {
+        roaringRemove(index->byAreaCode[rec->areaCode], id);
+    }
+    RoaringBitmap *byMonth = attributeValue(&index->months, &index->numMonths, NULL, rec->addedMonth, 0);
+    if (byMonth) roaringRemove(byMonth, id);
+    for (int i = 0; i < index->numTags; i++) roaringRemove(&index->tags[i].bits, id);
+}
+
+/**
+ * @brief Re-indexes a contact's area code after a phone change.
+ * @param index The attribute index.
+ * @param name The contact's name.
+ * @param phone The new phone number.
+ */
+static void attributeUpdate(AttributeIndex *index, const char *name, const char *phone) {
+    uint32_t id = contactIdFind(&index->ids, name);
+    if (id == UINT32_MAX) return;
+    AttributeRecord *rec = &index->records[id];
+    int16_t areaCode = (int16_t)phoneAreaCode(phone, NULL);
+    if (areaCode == rec->areaCode) return;
+
+    if (rec->areaCode >= 0 && index->byAreaCode[rec->areaCode]) {
+        roaringRemove(index->byAreaCode[rec->areaCode], id);
+    }
+    rec->areaCode = areaCode;
+    if (areaCode >= 0) {
+        RoaringBitmap **bm = &index->byAreaCode[areaCode];
+        if (!*bm) *bm = (RoaringBitmap*)calloc(1, sizeof(RoaringBitmap));
+        if (*bm) roaringAdd(*bm, id);
+    }
+}
+
+static void attributeAddDiskRecord(uint32_t page, const DiskRecord *rec, void *ctx) {
+    (void)page;
+    AttributeIndex *index = (AttributeIndex*)ctx;
+    attributeInsert(index, rec->name, rec->phone, currentMonth());
+}
+
+/**
+ * @brief Starts maintaining bitmap indexes over contact attributes.
+ * Contacts already present count as added this month.
+ * @param ht A pointer to the hash table.
+ * @return 0 on success, -1 on failure.
+ */
+int enableAttributeIndex(HashTable *ht) {
+    if (ht->attributes) return 0;
+    AttributeIndex *index = (AttributeIndex*)calloc(1, sizeof(AttributeIndex));
+    if (!index || contactIdInit(&index->ids) != 0) {
+        perror("Failed to allocate AttributeIndex");
+        free(index);
+        return -1;
+    }
+    ht->attributes = index;
+
+    int32_t month = currentMonth();
+    if (ht->disk) {
+        diskHashForEach(ht->disk, attributeAddDiskRecord, index);
+        return 0;
+    }
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node; node = node->next) {
+            attributeInsert(index, node->name, node->phone, month);
+        }
+    }
+    if (ht->overflow) diskHashForEach(ht->overflow, attributeAddDiskRecord, index);
+    return 0;
+}
+
+/**
+ * @brief Frees the attribute index of a table.
+ * @param ht A pointer to the hash table.
+ */
+static void attributeFree(HashTable *ht) {
+    AttributeIndex *index = ht->attributes;
+    if (!index) return;
+    roaringClear(&index->live);
+    for (int i = 0; i < ATTRIBUTE_AREA_CODES; i++) roaringFree(index->byAreaCode[i]);
+    for (int i = 0; i < index->numMonths; i++) roaringClear(&index->months[i].bits);
+    for (int i = 0; i < index->numTags; i++) roaringClear(&index->tags[i].bits);
+    free(index->months);
+    free(index->tags);
+    free(index->records);
+    contactIdFree(&index->ids);
+    free(index);
+    ht->attributes = NULL;
+}
+
+/**
+ * @brief Tags a contact (or removes a tag from it).
+ * Tags live only in the attribute index.
+ * @param ht A pointer to the hash table (attribute index enabled).
+ * @param name The contact's name.
+ * @param tag The tag.
+ * @param set Non-zero to add the tag, zero to remove it.
+ * @return 0 on success, -1 if the contact is unknown or on failure.
+ */
+int tagContact(HashTable *ht, const char *name, const char *tag, int set) {
+    AttributeIndex *index = ht->attributes;
+    uint32_t id = index ? contactIdFind(&index->ids, name) : UINT32_MAX;
+    if (id == UINT32_MAX) return -1;
+    RoaringBitmap *bm = attributeValue(&index->tags, &index->numTags, tag, 0, set);
+    if (!bm) return set ? -1 : 0;
+    if (set) return roaringAdd(bm, id);
+    roaringRemove(bm, id);
+    return 0;
+}
+
+static int compareBitmapSize(const void *a, const void *b) {
+    uint64_t x = roaringCardinality(*(const RoaringBitmap* const*)a);
+    uint64_t y = roaringCardinality(*(const RoaringBitmap* const*)b);
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Finds the ids of all contacts matching a combined filter.
+ * @param ht A pointer to the hash table (attribute index enabled).
+ * @param filter The filter; unset fields match everything.
+ * @return A new bitmap of contact ids (free with roaringFree()), or NULL.
+ */
+RoaringBitmap* filterContacts(HashTable *ht, const AttributeFilter *filter) {
+    AttributeIndex *index = ht->attributes;
+    if (!index) return NULL;
+    static const RoaringBitmap empty;
+
+    // 1. Collect one bitmap per predicate
+    const RoaringBitmap *terms[3];
+    int numTerms = 0;
+    if (filter->areaCode >= 0) {
+        const RoaringBitmap *bm = filter->areaCode < ATTRIBUTE_AREA_CODES ? index->byAreaCode[filter->areaCode] : NULL;
+        terms[numTerms++] = bm ? bm : &empty;
+    }
+    if (filter->tag) {
+        const RoaringBitmap *bm = attributeValue(&index->tags, &index->numTags, filter->tag, 0, 0);
+        terms[numTerms++] = bm ? bm : &empty;
+    }
+    if (filter->addedMonth) {
+        const RoaringBitmap *bm = attributeValue(&index->months, &index->numMonths, NULL, filter->addedMonth, 0);
+        terms[numTerms++] = bm ? bm : &empty;
+    }
+    if (numTerms == 0) terms[numTerms++] = &index->live;
+
+    // 2. Intersect smallest first so intermediate results stay small
+    qsort(terms, numTerms, sizeof(terms[0]), compareBitmapSize);
+    RoaringBitmap *result = roaringOr(terms[0], &empty);
+    for (int i = 1; i < numTerms && result; i++) {
+        RoaringBitmap *next = roaringAnd(result, terms[i]);
+        roaringFree(result);
+        result = next;
+    }
+    return result;
+}
+
+/**
+ * @brief Returns the name of an indexed contact.
+ * @param ht A pointer to the hash table (attribute index enabled).
+ * @param id The contact id.
+ * @return The name, or NULL if the id is not in use.
+ */
+const char* attributeContactName(HashTable *ht, uint32_t id) {
+    AttributeIndex *index = ht->attributes;
+    if (!index || !contactIdLive(&index->ids, id)) return NULL;
+    return index->ids.names[id];
+}
+
+// Helper state for printing filter results
+typedef struct FilterDisplayState {
+    HashTable *ht;
+    int shown;
+} FilterDisplayState;
+
+static void displayFilteredContact(uint32_t id, void *ctx) {
+    FilterDisplayState *state = (FilterDisplayState*)ctx;
+    if (state->shown++ < 50) printf("  -> %s\n", attributeContactName(state->ht, id));
+}
+
+/**
+ * @brief Prints the contacts matching a combined filter.
+ * @param ht A pointer to the hash table.
+ * @param filter The filter.
+ */
+void displayFilteredContacts(HashTable *ht, const AttributeFilter *filter) {
+    if (!ht->attributes) {
+        printf("Attribute indexes are off (start with --attributes).\n");
+        return;
+    }
+    RoaringBitmap *matches = filterContacts(ht, filter);
+    if (!matches) return;
+
+    FilterDisplayState state = { ht, 0 };
+    printf("\n--- Matching Contacts ---\n");
+    roaringForEach(matches, displayFilteredContact, &state);
+    if (state.shown > 50) printf("  ... and %d more\n", state.shown - 50);
+    printf("%llu contact(s) matched.\n", (unsigned long long)roaringCardinality(matches));
+    printf("-------------------------\n");
+    roaringFree(matches);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Trigram substring index                                             */
+/*                                                                     */
+/*  Every three-byte window of a lowercased name maps to a posting list */
+/*  of contact ids. A substring query looks up the needle's trigrams,   */
+/*  intersects their lists starting with the shortest, and verifies     */
+/*  the few survivors with a SIMD substring search. Ids mostly arrive   */
+/*  in increasing order and are appended as varint deltas; a reused id  */
+/*  waits in a small pending buffer until the list is re-encoded.       */
+/*  Deleted contacts are filtered out at verification time and swept    */
+/*  by a rebuild once they make up half the entries.                    */
+/* ------------------------------------------------------------------ */
+
+static ContactNode* lookupContact(HashTable *ht, const char *name);
+
+/**
+ * @brief Lowercases a string into a zero-padded buffer.
+ * @param dst The buffer (TRIGRAM_VERIFY_BYTES bytes).
+ * @param src The string.
+ * @return The folded length.
+ */
+static size_t trigramFold(char *dst, const char *src) {
+    size_t n = 0;
+    while (src[n] && n < TRIGRAM_VERIFY_BYTES - 33) {
+        dst[n] = (char)tolower((unsigned char)src[n]);
+        n++;
+    }
+    memset(dst + n, 0, TRIGRAM_VERIFY_BYTES - n);
+    return n;
+}
+
+/**
+ * @brief Collects the distinct trigrams of a folded string.
+ * @param folded The folded string.
+ * @param len Its length.
+ * @param out Receives the trigrams (room for len entries).
+ * @return The number of distinct trigrams.
+ */
+static int trigramsOf(const char *folded, size_t len, uint32_t *out) {
+    int n = 0;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        uint32_t t = (uint32_t)(unsigned char)folded[i] << 16 |
+                     (uint32_t)(unsigned char)folded[i + 1] << 8 | (unsigned char)folded[i + 2];
+        int seen = 0;
+        for (int j = 0; j < n && !seen; j++) seen = out[j] == t;
+        if (!seen) out[n++] = t;
+    }
+    return n;
+}
+
+/**
+ * @brief Finds (or creates) the posting list of a trigram.
+ * @param index The trigram index.
+ * @param trigram The trigram.
+ * @param create Non-zero to create a missing list.
+ * @return The posting list, or NULL.
+ */
+static TrigramPosting* trigramPosting(TrigramIndex *index, uint32_t trigram, int create) {
+    uint32_t s = (uint32_t)mixHash(trigram) & index->postingMask;
+    while (index->postings[s].trigram != UINT32_MAX) {
+        if (index->postings[s].trigram == trigram) return &index->postings[s];
+        s = (s + 1) & index->postingMask;
+    }
+    if (!create) return NULL;
+
+    // Keep the table at most half full
+    if (2 * (index->numPostings + 1) > index->postingMask + 1) {
+        uint32_t size = (index->postingMask + 1) * 2;
+        TrigramPosting *grown = (TrigramPosting*)malloc(size * sizeof(TrigramPosting));
+        if (!grown) return NULL;
+        for (uint32_t i = 0; i < size; i++) grown[i].trigram = UINT32_MAX;
+        for (uint32_t i = 0; i <= index->postingMask; i++) {
+            if (index->postings[i].trigram == UINT32_MAX) continue;
+            uint32_t t = (uint32_t)mixHash(index->postings[i].trigram) & (size - 1);
+            while (grown[t].trigram != UINT32_MAX) t = (t + 1) & (size - 1);
+            grown[t] = index->postings[i];
+        }
+        free(index->postings);
+        index->postings = grown;
+        index->postingMask = size - 1;
+        return trigramPosting(index, trigram, 1);
+    }
+    TrigramPosting *posting = &index->postings[s];
+    memset(posting, 0, sizeof(*posting));
+    posting->trigram = trigram;
+    index->numPostings++;
+    return posting;
+}
+
+/**
+ * @brief Appends a varint to a posting list.
+ * @param posting The posting list.
+ * @param value The value.
+ * @return 0 on success, -1 on failure.
+ */
+static int postingPutVarint(TrigramPosting *posting, uint32_t value) {
+    if (posting->length + 5 > posting->capacity) {
+        uint32_t capacity = posting->capacity ? posting->capacity * 2 : 16;
+        uint8_t *grown = (uint8_t*)realloc(posting->bytes, capacity);
+        if (!grown) return -1;
+        posting->bytes = grown;
+        posting->capacity = capacity;
+    }
+    while (value >= 0x80) {
+        posting->bytes[posting->length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    posting->bytes[posting->length++] = (uint8_t)value;
+    return 0;
+}
+
+/**
+ * @brief Reads the next id of a posting list.
+ * @param bytes The encoded list.
+ * @param pos The read position (advanced).
+ * @param prev The previous id (updated).
+ * @return The id.
+ */
+static inline uint32_t postingNext(const uint8_t *bytes, uint32_t *pos, uint32_t *prev) {
+    uint32_t value = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = bytes[(*pos)++];
+        value |= (uint32_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    *prev += value;
+    return *prev;
+}
+
+static int compareIds(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Re-encodes a posting list with its pending ids merged in.
+ * @param posting The posting list.
+ * @return 0 on success, -1 on failure.
+ */
+static int postingMerge(TrigramPosting *posting) {
+    uint32_t total = posting->count + posting->numPending;
+    uint32_t *ids = (uint32_t*)malloc(total * sizeof(uint32_t));
+    if (!ids) return -1;
+    uint32_t pos = 0, prev = 0, n = 0;
+    for (uint32_t i = 0; i < posting->count; i++) ids[n++] = postingNext(posting->bytes, &pos, &prev);
+    memcpy(ids + n, posting->pending, posting->numPending * sizeof(uint32_t));
+    n += posting->numPending;
+    qsort(ids, n, sizeof(uint32_t), compareIds);
+
+    posting->length = 0;
+    posting->count = 0;
+    posting->lastId = 0;
+    posting->numPending = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i > 0 && ids[i] == ids[i - 1]) continue;
+        if (postingPutVarint(posting, ids[i] - posting->lastId) != 0) {
+            free(ids);
+            return -1;
+        }
+        posting->lastId = ids[i];
+        posting->count++;
+    }
+    free(ids);
+    return 0;
+}
+
+/**
+ * @brief Adds an id to a posting list.
+ * @param posting The posting list.
+ * @param id The id.
+ * @return 0 on success, -1 on failure.
+ */
+static int postingAdd(TrigramPosting *posting, uint32_t id) {
+    // 1. In-order ids are appended as deltas
+    if (posting->count == 0 || id > posting->lastId) {
+        if (postingPutVarint(posting, id - posting->lastId) != 0) return -1;
+        posting->lastId = id;
+        posting->count++;
+        return 0;
+    }
+    if (id == posting->lastId) return 0;
+
+    // 2. A reused id waits until enough pile up to re-encode the list
+    posting->pending[posting->numPending++] = id;
+    return posting->numPending == TRIGRAM_PENDING_MAX ? postingMerge(posting) : 0;
+}
+
+/**
+ * @brief Indexes the trigrams of one contact id.
+ * @param index The trigram index.
+ * @param id The contact id.
+ */
+static void trigramAddId(TrigramIndex *index, uint32_t id) {
+    char folded[TRIGRAM_VERIFY_BYTES];
+    uint32_t trigrams[TRIGRAM_VERIFY_BYTES];
+    int n = trigramsOf(folded, trigramFold(folded, index->ids.names[id]), trigrams);
+    for (int i = 0; i < n; i++) {
+        TrigramPosting *posting = trigramPosting(index, trigrams[i], 1);
+        if (!posting || postingAdd(posting, id) != 0) {
+            perror("Failed to grow trigram index");
+            return;
+        }
+        index->totalEntries++;
+    }
+}
+
+/**
+ * @brief Rebuilds every posting list from the live contacts.
+ * @param index The trigram index.
+ */
+static void trigramRebuild(TrigramIndex *index) {
+    for (uint32_t i = 0; i <= index->postingMask; i++) {
+        free(index->postings[i].bytes);
+        index->postings[i].bytes = NULL;
+        index->postings[i].trigram = UINT32_MAX;
+    }
+    index->numPostings = 0;
+    index->totalEntries = 0;
+    index->staleEntries = 0;
+    for (uint32_t id = 0; id < index->ids.numIds; id++) {
+        if (index->ids.live[id]) trigramAddId(index, id);
+    }
+}
+
+/**
+ * @brief Indexes a new contact.
+ * @param index The trigram index.
+ * @param name The contact's name.
+ */
+static void trigramInsert(TrigramIndex *index, const char *name) {
+    if (contactIdFind(&index->ids, name) != UINT32_MAX) return;
+    uint32_t id = contactIdAssign(&index->ids, name);
+    if (id != UINT32_MAX) trigramAddId(index, id);
+}
+
+/**
+ * @brief Unindexes a contact; its entries go stale until a rebuild.
+ * @param index The trigram index.
+ * @param name The contact's name.
+ */
+static void trigramRemove(TrigramIndex *index, const char *name) {
+    if (contactIdRelease(&index->ids, name) == UINT32_MAX) return;
+    char folded[TRIGRAM_VERIFY_BYTES];
+    uint32_t trigrams[TRIGRAM_VERIFY_BYTES];
+    index->staleEntries += trigramsOf(folded, trigramFold(folded, name), trigrams);
+    if (index->staleEntries > TRIGRAM_MIN_REBUILD && 2 * index->staleEntries > index->totalEntries) {
+        trigramRebuild(index);
+    }
+}
+
+static void trigramAddDiskRecord(uint32_t page, const DiskRecord *rec, void *ctx) {
+    (void)page;
+    trigramInsert((TrigramIndex*)ctx, rec->name);
+}
+
+/**
+ * @brief Starts maintaining a trigram index for substring search.
+ * @param ht A pointer to the hash table.
+ * @return 0 on success, -1 on failure.
+ */
+int enableTrigramIndex(HashTable *ht) {
+    if (ht->trigrams) return 0;
+    TrigramIndex *index = (TrigramIndex*)calloc(1, sizeof(TrigramIndex));
+    if (index) index->postings = (TrigramPosting*)malloc(1024 * sizeof(TrigramPosting));
+    if (!index || !index->postings || contactIdInit(&index->ids) != 0) {
+        perror("Failed to allocate TrigramIndex");
+        if (index) free(index->postings);
+        free(index);
+        return -1;
+    }
+    for (int i = 0; i < 1024; i++) index->postings[i].trigram = UINT32_MAX;
+    index->postingMask = 1023;
+    ht->trigrams = index;
+
+    if (ht->disk) {
+        diskHashForEach(ht->disk, trigramAddDiskRecord, index);
+        return 0;
+    }
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node; node = node->next) {
+            trigramInsert(index, node->name);
+        }
+    }
+    if (ht->overflow) diskHashForEach(ht->overflow, trigramAddDiskRecord, index);
+    return 0;
+}
+
+/**
+ * @brief Frees the trigram index of a table.
+ * @param ht A pointer to the hash table.
+ */
+static void trigramFree(HashTable *ht) {
+    TrigramIndex *index = ht->trigrams;
+    if (!index) return;
+    for (uint32_t i = 0; i <= index->postingMask; i++) {
+        if (index->postings[i].trigram != UINT32_MAX) free(index->postings[i].bytes);
+    }
+    free(index->postings);
+    contactIdFree(&index->ids);
+    free(index);
+    ht->trigrams = NULL;
+}
+
+/**
+ * @brief Intersects a sorted candidate list with a posting list.
+ * @param posting The posting list.
+ * @param cand The candidates (filtered in place).
+ * @param n The number of candidates.
+ * @return The number of candidates left.
+ */
+static uint32_t postingIntersect(const TrigramPosting *posting, uint32_t *cand, uint32_t n) {
+    uint32_t pending[TRIGRAM_PENDING_MAX];
+    memcpy(pending, posting->pending, posting->numPending * sizeof(uint32_t));
+    qsort(pending, posting->numPending, sizeof(uint32_t), compareIds);
+
+    // Merge the candidates with the decoded stream and the pending ids
+    uint32_t pos = 0, prev = 0, read = 0, kept = 0, p = 0;
+    uint32_t next = posting->count ? postingNext(posting->bytes, &pos, &prev) : UINT32_MAX;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t id = cand[i];
+        while (next < id) {
+            next = ++read < posting->count ? postingNext(posting->bytes, &pos, &prev) : UINT32_MAX;
+        }
+        while (p < posting->numPending && pending[p] < id) p++;
+        if (next == id || (p < posting->numPending && pending[p] == id)) cand[kept++] = id;
+    }
+    return kept;
+}
+
+/**
+ * @brief Decodes a whole posting list, pending ids included.
+ * @param posting The posting list.
+ * @param n Receives the number of ids.
+ * @return The sorted distinct ids, or NULL on failure.
+ */
+static uint32_t* postingDecode(const TrigramPosting *posting, uint32_t *n) {
+    uint32_t *ids = (uint32_t*)malloc((posting->count + posting->numPending + 1) * sizeof(uint32_t));
+    if (!ids) return NULL;
+    uint32_t pos = 0, prev = 0, count = 0;
+    for (uint32_t i = 0; i < posting->count; i++) ids[count++] = postingNext(posting->bytes, &pos, &prev);
+    if (posting->numPending) {
+        memcpy(ids + count, posting->pending, posting->numPending * sizeof(uint32_t));
+        count += posting->numPending;
+        qsort(ids, count, sizeof(uint32_t), compareIds);
+    }
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (unique == 0 || ids[i] != ids[unique - 1]) ids[unique++] = ids[i];
+    }
+    *n = unique;
+    return ids;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Substring test comparing the needle's first and last bytes at
+ * 32 positions at once; only positions matching both are compared fully.
+ * @param hay The haystack, followed by at least 32 readable bytes.
+ * @param n The haystack length.
+ * @param needle The needle.
+ * @param k The needle length (at least 1).
+ * @return Non-zero if the needle occurs in the haystack.
+ */
+__attribute__((target("avx2")))
+static int containsAvx2(const char *hay, size_t n, const char *needle, size_t k) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[k - 1]);
+    for (size_t i = 0; i + k <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(hay + i + k - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t at = i + __builtin_ctz(mask);
+            if (at + k <= n && (k <= 2 || memcmp(hay + at + 1, needle + 1, k - 2) == 0)) return 1;
+            mask &= mask - 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief Finds the contacts whose names contain a string, ignoring case.
+ * @param ht A pointer to the hash table (trigram index enabled).
+ * @param needle The string to look for.
+ * @param ids Receives a malloc'd array of matching contact ids.
+ * @return The number of matches, or -1 on failure.
+ */
+long findNamesContaining(HashTable *ht, const char *needle, uint32_t **ids) {
+    TrigramIndex *index = ht->trigrams;
+    *ids = NULL;
+    if (!index) return -1;
+    char folded[TRIGRAM_VERIFY_BYTES];
+    size_t k = trigramFold(folded, needle);
+    if (k >= MAX_NAME_LEN) return 0; // Longer than any name
+
+    // 1. Candidates: the intersection of the needle's posting lists,
+    //    shortest first (every live id for needles under three bytes)
+    uint32_t n = 0, *cand = NULL;
+    uint32_t trigrams[TRIGRAM_VERIFY_BYTES];
+    int numTrigrams = trigramsOf(folded, k, trigrams);
+    if (numTrigrams == 0) {
+        cand = (uint32_t*)malloc((index->ids.numIds + 1) * sizeof(uint32_t));
+        if (!cand) return -1;
+        for (uint32_t id = 0; id < index->ids.numIds; id++) cand[n++] = id;
+    } else {
+        TrigramPosting *lists[TRIGRAM_VERIFY_BYTES];
+        for (int i = 0; i < numTrigrams; i++) {
+            lists[i] = trigramPosting(index, trigrams[i], 0);
+            if (!lists[i]) return 0;
+            // Insertion sort by length
+            for (int j = i; j > 0 && lists[j]->count + lists[j]->numPending <
+                                      lists[j - 1]->count + lists[j - 1]->numPending; j--) {
+                TrigramPosting *t = lists[j];
+                lists[j] = lists[j - 1];
+                lists[j - 1] = t;
+            }
+        }
+        cand = postingDecode(lists[0], &n);
+        if (!cand) return -1;
+        for (int i = 1; i < numTrigrams && n > 0; i++) n = postingIntersect(lists[i], cand, n);
+    }
+
+    // 2. Verify: drop deleted ids and trigram-only coincidences
+    int useAvx2 = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+    uint32_t matched = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!contactIdLive(&index->ids, cand[i])) continue;
+        char hay[TRIGRAM_VERIFY_BYTES];
+        size_t len = trigramFold(hay, index->ids.names[cand[i]]);
+        int found;
+#if defined(__x86_64__) || defined(__i386__)
+        if (useAvx2) {
+            found = k == 0 || containsAvx2(hay, len, folded, k);
+        } else
+#endif
+        found = strstr(hay, folded) != NULL;
+        (void)len;
+        if (found) cand[matched++] = cand[i];
+    }
+    *ids = cand;
+    return matched;
+}
+
+/**
+ * @brief Prints the contacts whose names contain a string.
+ * @param ht A pointer to the hash table.
+ * @param needle The string to look for.
+ */
+void displayNamesContaining(HashTable *ht, const char *needle) {
+    if (!ht->trigrams) {
+        printf("Substring indexing is off (start with --trigram).\n");
+        return;
+    }
+    uint32_t *ids;
+    long n = findNamesContaining(ht, needle, &ids);
+    if (n < 0) return;
+
+    printf("\n--- Names Containing '%s' ---\n", needle);
+    for (long i = 0; i < n; i++) {
+        const char *name = ht->trigrams->ids.names[ids[i]];
+        ContactNode *contact = lookupContact(ht, name);
+        printf("  -> Name: %-20s | Phone: %s\n", name, contact ? contact->phone : "?");
+    }
+    printf("%ld contact(s) matched.\n", n);
+    printf("-----------------------------\n");
+    free(ids);
+}
+
+/**
+ * @brief Runs every per-change hook after a successful mutation.
+ * The change is logged first; if that fails no other hook runs and the
+ * caller must undo the mutation.
+ * @param ht A pointer to the hash table.
+ * @param op The kind of change.
+ * @param name The contact's name.
+ * @param oldPhone The phone before the change (NULL for inserts).
+ * @param newPhone The phone after the change (NULL for deletes).
+ * @return 0 on success, -1 if the change could not be logged.
+ */
+static int notifyChange(HashTable *ht, ChangeOp op, const char *name,
+                        const char *oldPhone, const char *newPhone) {
+    if (ht->log && changeLogAppend(ht, op, name, newPhone ? newPhone : "") != 0) return -1;
+    if (ht->watch) watchNotify(ht->watch, op, name, newPhone ? newPhone : oldPhone);
+    if (ht->merkle) {
+        unsigned int bucket = hashFunction(name, ht->size);
+        if (oldPhone) merkleApply(ht->merkle, bucket, contactDigest(name, oldPhone), -1);
+        if (newPhone) merkleApply(ht->merkle, bucket, contactDigest(name, newPhone), +1);
+    }
+    if (ht->stats) {
+        if (oldPhone) statsApply(ht->stats, op, name, oldPhone, -1);
+        if (newPhone) statsApply(ht->stats, op, name, newPhone, +1);
+    }
+    if (ht->suggest) {
+        if (op == CHANGE_INSERT) suggestInsert(ht->suggest, name);
+        if (op == CHANGE_DELETE) suggestRemove(ht->suggest, name);
+    }
+    if (ht->attributes) {
+        if (op == CHANGE_INSERT) attributeInsert(ht->attributes, name, newPhone, currentMonth());
+        if (op == CHANGE_DELETE) attributeRemove(ht->attributes, name);
+        if (op == CHANGE_UPDATE) attributeUpdate(ht->attributes, name, newPhone);
+    }
+    if (ht->trigrams) {
+        if (op == CHANGE_INSERT) trigramInsert(ht->trigrams, name);
+        if (op == CHANGE_DELETE) trigramRemove(ht->trigrams, name);
+    }
+    return 0;
+}
+
+static int changeContactPhone(HashTable *ht, const char *name, const char *phone);
+
+/**
+ * @brief Adds a contact without printing anything.
+ * Names are unique in every backend: adding a name that already exists
+ * replaces its phone, exactly as updateContact() would, and is logged and
+ * indexed as an update. The existence check walks the chain and, when the
+ * table has spilled contacts, probes the overflow store.
+ * @param ht A pointer to the hash table.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return 0 if added, 1 if an existing contact was updated, -1 on failure.
+ */
+static int addContact(HashTable *ht, const char *name, const char *phone) {
+    // Match on the stored (truncated) name so overlong names cannot slip past
+    char key[MAX_NAME_LEN];
+    copyField(key, name, MAX_NAME_LEN);
+    name = key;
+    int updated = changeContactPhone(ht, name, phone);
+    if (updated != 0) return updated;
+
+    // Disk-backed tables store the contact in a bucket page
+    if (ht->disk) {
+        if (diskHashPut(ht->disk, name, phone) != 0) return -1;
+        PHONEBOOK_PROBE2(contact__insert, name, -1);
+        if (notifyChange(ht, CHANGE_INSERT, name, NULL, phone) != 0) {
+            diskHashDelete(ht->disk, name); // Not logged, so undo it
+            return -1;
+        }
+        return 0;
+    }
+
+    // 1. Get the hash index
+    unsigned int index = hashFunction(name, ht->size);
+    PHONEBOOK_PROBE2(contact__insert, name, (int)index);
+
+    // 2. Create the new contact node
+    ContactNode *newNode = allocContactNode(ht);
+    if (!newNode) {
+        perror("Failed to allocate ContactNode");
+        return -1;
+    }
+    copyField(newNode->name, name, MAX_NAME_LEN);
+    copyField(newNode->phone, phone, MAX_PHONE_LEN);
+
+    // 3. Insert at the head of the linked list (separate chaining)
+    newNode->next = ht->table[index];
+    ht->table[index] = newNode;
+    if (ht->memoryBudget) lruPushFront(ht, newNode);
+
+    // 4. Log and index it; a change that cannot be logged is undone
+    if (notifyChange(ht, CHANGE_INSERT, newNode->name, NULL, newNode->phone) != 0) {
+        ht->table[index] = newNode->next;
+        releaseContactNode(ht, newNode);
+        return -1;
+    }
+    if (ht->history) {
+        uint32_t buried = historyTombstone(ht->history, name, 1);
+        newNode->historyHead = historyAppend(ht->history, buried, currentTimeMicros(), NULL);
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes a contact without printing anything.
+ * @param ht A pointer to the hash table.
+ * @param name The name of the contact to remove.
+ * @return 1 if removed, 0 if not found, -1 if the delete could not be logged.
+ */
+static int removeContact(HashTable *ht, const char *name) {
+    int removed = 0, walked = -1;
+    char oldPhone[MAX_PHONE_LEN] = "";
+    uint32_t historyHead = 0;
+    DiskRecord rec;
+    DiskHash *store = NULL; // Where a removed record lived, for the undo
+    ContactNode *victim = NULL, *victimPrev = NULL;
+    unsigned int index = 0;
+
+    if (ht->disk) {
+        if (diskHashGet(ht->disk, name, &rec) == 1) {
+            memcpy(oldPhone, rec.phone, MAX_PHONE_LEN);
+            removed = diskHashDelete(ht->disk, name) == 1;
+            store = ht->disk;
+        }
+    } else {
+        // 1. Get the hash index
+        index = hashFunction(name, ht->size);
+
+        // 2. Traverse the list to find the node
+        ContactNode *current = ht->table[index];
+        ContactNode *prev = NULL;
+
+        walked = 0;
+        while (current != NULL) {
+            walked++;
+            if (strcmp(current->name, name) == 0) {
+                // Case 1: It's the head of the list
+                if (prev == NULL) {
+                    ht->table[index] = current->next;
+                }
+                // Case 2: It's in the middle or end
+                else {
+                    prev->next = current->next;
+                }
+
+                memcpy(oldPhone, current->phone, MAX_PHONE_LEN);
+                historyHead = current->historyHead;
+                victim = current; // Freed once the delete is logged
+                victimPrev = prev;
+                removed = 1;
+                break;
+            }
+            // Move to the next node
+            prev = current;
+            current = current->next;
+        }
+
+        // 3. If not resident, the contact may still be spilled to disk
+        if (!removed && ht->overflow && diskHashGet(ht->overflow, name, &rec) == 1) {
+            memcpy(oldPhone, rec.phone, MAX_PHONE_LEN);
+            historyHead = rec.historyHead;
+            removed = diskHashDelete(ht->overflow, name) == 1;
+            store = ht->overflow;
+        }
+    }
+
+    PHONEBOOK_PROBE3(contact__delete, name, walked, removed);
+    if (!removed) return 0;
+
+    // 4. A delete that cannot be logged is undone
+    if (notifyChange(ht, CHANGE_DELETE, name, oldPhone, NULL) != 0) {
+        if (victim && victimPrev) victimPrev->next = victim;
+        else if (victim) ht->table[index] = victim;
+        else diskHashPutRecord(store, &rec);
+        return -1;
+    }
+    if (victim) releaseContactNode(ht, victim); // Free the memory
+
+    // 5. Keep the version history readable after the delete
+    if (ht->history) {
+        historyBury(ht->history, name,
+                    historyAppend(ht->history, historyHead, currentTimeMicros(), oldPhone));
+    }
+    return 1;
+}
+
+/**
+ * @brief Changes a contact's phone without printing anything.
+ * With version history enabled, the previous phone is recorded first.
+ * @param ht A pointer to the hash table.
+ * @param name The contact's name.
+ * @param phone The new phone number.
+ * @return 1 if updated, 0 if not found, -1 on failure.
+ */
+static int changeContactPhone(HashTable *ht, const char *name, const char *phone) {
+    char oldPhone[MAX_PHONE_LEN];
+    char newPhone[MAX_PHONE_LEN];
+    copyField(newPhone, phone, MAX_PHONE_LEN);
+
+    DiskRecord rec;
+    ContactNode *node = NULL;
+
+    if (ht->disk) {
+        if (diskHashGet(ht->disk, name, &rec) != 1) return 0;
+        if (diskHashPut(ht->disk, name, newPhone) != 0) return -1;
+        memcpy(oldPhone, rec.phone, MAX_PHONE_LEN);
+    } else {
+        node = findResidentContact(ht, name);
+        if (!node) node = reloadSpilledContact(ht, name);
+        if (!node) return 0;
+
+        memcpy(oldPhone, node->phone, MAX_PHONE_LEN);
+        memcpy(node->phone, newPhone, MAX_PHONE_LEN);
+    }
+
+    // A change that cannot be logged is undone
+    if (notifyChange(ht, CHANGE_UPDATE, name, oldPhone, newPhone) != 0) {
+        if (node) memcpy(node->phone, oldPhone, MAX_PHONE_LEN);
+        else diskHashPutRecord(ht->disk, &rec);
+        return -1;
+    }
+    if (node && ht->history) {
+        node->historyHead = historyAppend(ht->history, node->historyHead,
+                                          currentTimeMicros(), oldPhone);
+    }
+    return 1;
+}
+
+/**
+ * @brief Updates the phone number of an existing contact.
+ * @param ht A pointer to the hash table.
+ * @param name The contact's name.
+ * @param phone The new phone number.
+ */
+void updateContact(HashTable *ht, const char *name, const char *phone) {
+    int rc = changeContactPhone(ht, name, phone);
+    if (rc == 1) {
+        printf("SUCCESS: Updated '%s' to phone '%s'.\n", name, phone);
+    } else if (rc == 0) {
+        printf("ERROR: Contact '%s' not found.\n", name);
+    } else {
+        printf("ERROR: Could not update '%s'.\n", name);
+    }
+}
+
+/**
+ * @brief Inserts a new contact into the hash table.
+ * @param ht A pointer to the hash table.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ */
+void insertContact(HashTable *ht, const char *name, const char *phone) {
+    int rc = addContact(ht, name, phone);
+    if (rc < 0) {
+        printf("ERROR: Could not add '%s'.\n", name);
+        return;
+    }
+    if (rc == 1) {
+        printf("SUCCESS: '%s' already existed; updated to phone '%s'.\n", name, phone);
+        return;
+    }
+    printf("SUCCESS: Added '%s' with phone '%s'.\n", name, phone);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Heavy hitters among looked-up names                                */
+/*                                                                     */
+/*  Each thread counts its lookups in a private count-min sketch and    */
+/*  remembers a few candidate names in a direct-mapped slot table, so   */
+/*  a lookup costs one hash and a handful of cache-local increments.    */
+/*  Every HH_MERGE_INTERVAL lookups the thread folds its sketch into    */
+/*  the shared one under a lock and offers its candidates to the top    */
+/*  list. Counts halve every HH_DECAY_SECONDS so the list follows what  */
+/*  is hot now rather than since startup.                               */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Starts tracking the most looked-up names.
+ * @param ht A pointer to the hash table.
+ * @param k The number of names reported by getHeavyHitters().
+ * @return 0 on success, -1 on failure.
+ */
+int enableHeavyHitters(HashTable *ht, int k) {
+    if (ht->hitters) return 0;
+    HeavyHitterTracker *tracker = (HeavyHitterTracker*)calloc(1, sizeof(HeavyHitterTracker));
+    if (k < 1) k = HH_DEFAULT_K;
+    if (tracker) tracker->top = (HeavyHitter*)calloc((size_t)k * 4, sizeof(HeavyHitter));
+    if (!tracker || !tracker->top) {
+        perror("Failed to allocate HeavyHitterTracker");
+        free(tracker);
+        return -1;
+    }
+    // The tracker owns the locals (see heavyHitterFree), so no destructor
+    int rc = pthread_key_create(&tracker->localKey, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "ERROR: Cannot create heavy-hitter thread key: %s\n", strerror(rc));
+        free(tracker->top);
+        free(tracker);
+        return -1;
+    }
+    pthread_mutex_init(&tracker->lock, NULL);
+    tracker->k = k;
+    tracker->topCapacity = k * 4;
+    tracker->startedAt = tracker->lastDecayAt = currentTimeMicros();
+    ht->hitters = tracker;
+    return 0;
+}
+
+/**
+ * @brief Returns the count-min column of a hash in a given row.
+ * @param h The mixed name hash.
+ * @param row The sketch row.
+ * @return The column index.
+ */
+static inline uint32_t heavyHitterColumn(uint64_t h, int row) {
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    return (h1 + (uint32_t)row * h2) & (HH_SKETCH_WIDTH - 1);
+}
+
+/**
+ * @brief Estimates a name's decayed count from the shared sketch.
+ * @param tracker The tracker (locked by the caller).
+ * @param h The mixed name hash.
+ * @return The estimate (never an underestimate of the decayed count).
+ */
+static double heavyHitterEstimate(HeavyHitterTracker *tracker, uint64_t h) {
+    double best = tracker->sketch[0][heavyHitterColumn(h, 0)];
+    for (int r = 1; r < HH_SKETCH_DEPTH; r++) {
+        double v = tracker->sketch[r][heavyHitterColumn(h, r)];
+        if (v < best) best = v;
+    }
+    return best;
+}
+
+/**
+ * @brief Offers a candidate to the top list, replacing the weakest entry.
+ * @param tracker The tracker (locked by the caller).
+ * @param slot The candidate.
+ */
+static void heavyHitterOffer(HeavyHitterTracker *tracker, const HeavyHitterSlot *slot) {
+    double estimate = heavyHitterEstimate(tracker, slot->hash);
+    int weakest = -1;
+    for (int i = 0; i < tracker->topCount; i++) {
+        HeavyHitter *hh = &tracker->top[i];
+        if (hh->hash == slot->hash && strcmp(hh->name, slot->name) == 0) {
+            hh->count = estimate;
+            return;
+        }
+        if (weakest < 0 || hh->count < tracker->top[weakest].count) weakest = i;
+    }
+    HeavyHitter *dst;
+    if (tracker->topCount < tracker->topCapacity) {
+        dst = &tracker->top[tracker->topCount++];
+    } else if (estimate > tracker->top[weakest].count) {
+        dst = &tracker->top[weakest];
+    } else {
+        return;
+    }
+    dst->hash = slot->hash;
+    dst->count = estimate;
+    memcpy(dst->name, slot->name, MAX_NAME_LEN);
+}
+
+/**
+ * @brief Folds a thread's local sketch into the shared tracker.
+ * @param tracker The tracker (locked by the caller).
+ * @param local The thread's local state (cleared afterwards).
+ */
+static void heavyHitterMerge(HeavyHitterTracker *tracker, HeavyHitterLocal *local) {
+    // 1. Halve everything once per decay period
+    int64_t now = currentTimeMicros();
+    while (now - tracker->lastDecayAt >= (int64_t)HH_DECAY_SECONDS * 1000000) {
+        for (int r = 0; r < HH_SKETCH_DEPTH; r++) {
+            for (int c = 0; c < HH_SKETCH_WIDTH; c++) tracker->sketch[r][c] *= 0.5;
+        }
+        for (int i = 0; i < tracker->topCount; i++) tracker->top[i].count *= 0.5;
+        tracker->lastDecayAt += (int64_t)HH_DECAY_SECONDS * 1000000;
+        tracker->decays++;
+    }
+
+    // 2. Add the local counts, then offer the local candidates
+    for (int r = 0; r < HH_SKETCH_DEPTH; r++) {
+        for (int c = 0; c < HH_SKETCH_WIDTH; c++) {
+            tracker->sketch[r][c] += local->sketch[r][c];
+        }
+    }
+    for (int i = 0; i < HH_LOCAL_SLOTS; i++) {
+        if (local->slots[i].count) heavyHitterOffer(tracker, &local->slots[i]);
+    }
+    memset(local->sketch, 0, sizeof(local->sketch));
+    memset(local->slots, 0, sizeof(local->slots));
+    local->pending = 0;
+}
+
+/**
+ * @brief Records one lookup of a name (called from searchContact()).
+ * @param tracker The tracker.
+ * @param name The looked-up name.
+ */
+static void heavyHitterRecord(HeavyHitterTracker *tracker, const char *name) {
+    // 1. Find (or register) this thread's local sketch for this tracker
+    HeavyHitterLocal *local = (HeavyHitterLocal*)pthread_getspecific(tracker->localKey);
+    if (!local) {
+        local = (HeavyHitterLocal*)calloc(1, sizeof(HeavyHitterLocal));
+        if (!local || pthread_setspecific(tracker->localKey, local) != 0) {
+            free(local);
+            return;
+        }
+        pthread_mutex_lock(&tracker->lock);
+        local->nextLocal = tracker->locals;
+        tracker->locals = local;
+        pthread_mutex_unlock(&tracker->lock);
+    }
+
+    // 2. Count it and keep it as a candidate if it beats the slot's owner
+    uint64_t h = mixHash(hashString(name));
+    uint32_t estimate = UINT32_MAX;
+    for (int r = 0; r < HH_SKETCH_DEPTH; r++) {
+        uint32_t v = ++local->sketch[r][heavyHitterColumn(h, r)];
+        if (v < estimate) estimate = v;
+    }
+    HeavyHitterSlot *slot = &local->slots[(h >> 40) & (HH_LOCAL_SLOTS - 1)];
+    if (slot->hash == h) {
+        slot->count = estimate;
+    } else if (estimate > slot->count) {
+        slot->hash = h;
+        slot->count = estimate;
+        copyField(slot->name, name, MAX_NAME_LEN);
+    }
+
+    // 3. Merge periodically
+    if (++local->pending >= HH_MERGE_INTERVAL) {
+        pthread_mutex_lock(&tracker->lock);
+        heavyHitterMerge(tracker, local);
+        pthread_mutex_unlock(&tracker->lock);
+    }
+}
+
+static int compareHeavyHitters(const void *a, const void *b) {
+    double x = ((const HeavyHitter*)a)->count, y = ((const HeavyHitter*)b)->count;
+    return (x < y) - (x > y);
+}
+
+/**
+ * @brief Returns the current top-k looked-up names.
+ * The calling thread's pending lookups are merged first; other threads'
+ * lookups appear after their next periodic merge.
+ * @param ht A pointer to the hash table.
+ * @param out Receives up to k entries, hottest first.
+ * @param ratePerSecond Receives each entry's approximate lookups/second.
+ * @return The number of entries written.
+ */
+int getHeavyHitters(HashTable *ht, HeavyHitter *out, double *ratePerSecond) {
+    HeavyHitterTracker *tracker = ht->hitters;
+    if (!tracker) return 0;
+
+    HeavyHitterLocal *local = (HeavyHitterLocal*)pthread_getspecific(tracker->localKey);
+    pthread_mutex_lock(&tracker->lock);
+    if (local && local->pending > 0) heavyHitterMerge(tracker, local);
+    for (int i = 0; i < tracker->topCount; i++) {
+        tracker->top[i].count = heavyHitterEstimate(tracker, tracker->top[i].hash);
+    }
+    qsort(tracker->top, tracker->topCount, sizeof(HeavyHitter), compareHeavyHitters);
+    int n = tracker->topCount < tracker->k ? tracker->topCount : tracker->k;
+    memcpy(out, tracker->top, n * sizeof(HeavyHitter));
+
+    // A steady rate r leaves about r * window in the decayed counters
+    double window = (currentTimeMicros() - tracker->lastDecayAt) / 1e6 +
+                    (tracker->decays ? HH_DECAY_SECONDS : 0);
+    if (window < 1e-3) window = 1e-3;
+    pthread_mutex_unlock(&tracker->lock);
+
+    for (int i = 0; i < n; i++) ratePerSecond[i] = out[i].count / window;
+    return n;
+}
+
+/**
+ * @brief Frees the heavy-hitter tracker of a table.
+ * @param ht A pointer to the hash table.
+ */
+static void heavyHittersFree(HashTable *ht) {
+    HeavyHitterTracker *tracker = ht->hitters;
+    if (!tracker) return;
+    while (tracker->locals) {
+        HeavyHitterLocal *next = tracker->locals->nextLocal;
+        free(tracker->locals);
+        tracker->locals = next;
+    }
+    pthread_key_delete(tracker->localKey);
+    pthread_mutex_destroy(&tracker->lock);
+    free(tracker->top);
+    free(tracker);
+    ht->hitters = NULL;
+}
+
+/**
+ * @brief Prints the hottest looked-up names.
+ * @param ht A pointer to the hash table.
+ */
+void displayHeavyHitters(HashTable *ht) {
+    if (!ht->hitters) {
+        printf("Lookup tracking is off (start with --track-hot).\n");
+        return;
+    }
+    HeavyHitter *top = (HeavyHitter*)calloc(ht->hitters->k, sizeof(HeavyHitter));
+    double *rates = (double*)calloc(ht->hitters->k, sizeof(double));
+    if (!top || !rates) {
+        free(top);
+        free(rates);
+        return;
+    }
+    int n = getHeavyHitters(ht, top, rates);
+
+    printf("\n--- Hottest Names ---\n");
+    for (int i = 0; i < n; i++) {
+        printf("%2d. %-20s ~%.0f lookups (%.2f/s)\n", i + 1, top[i].name, top[i].count, rates[i]);
+    }
+    if (n == 0) {
+        printf("No lookups recorded yet.\n");
+    }
+    printf("---------------------\n");
+    free(top);
+    free(rates);
+}
+
+/**
+ * @brief Finds a contact by name without recording the lookup.
+ * @param ht A pointer to the hash table.
+ * @param name The name to search for.
+ * @return A pointer to the found ContactNode, or NULL if not found.
+ */
+static ContactNode* lookupContact(HashTable *ht, const char *name) {
+    // Disk-backed tables return a copy held in the table's result slot
+    if (ht->disk) {
+        DiskRecord rec;
+        int found = diskHashGet(ht->disk, name, &rec) == 1;
+        PHONEBOOK_PROBE3(contact__search, name, -1, found);
+        if (!found) return NULL;
+        memcpy(ht->diskResult.name, rec.name, MAX_NAME_LEN);
+        memcpy(ht->diskResult.phone, rec.phone, MAX_PHONE_LEN);
+        ht->diskResult.next = NULL;
+        return &ht->diskResult;
+    }
+
+    // 1. Get the hash index
+    unsigned int index = hashFunction(name, ht->size);
+
+    // 2. Traverse the linked list at that index
+    ContactNode *temp = ht->table[index];
+    int walked = 0;
+    while (temp != NULL) {
+        walked++;
+        if (strcmp(temp->name, name) == 0) {
+            // Found it!
+            PHONEBOOK_PROBE3(contact__search, name, walked, 1);
+            if (ht->memoryBudget && ht->lruHead != temp) {
+                lruUnlink(ht, temp);
+                lruPushFront(ht, temp);
+            }
+            return temp;
+        }
+        temp = temp->next;
+    }
+    PHONEBOOK_PROBE3(contact__search, name, walked, 0);
+
+    // 3. Not resident: it may have been spilled to the overflow store
+    return reloadSpilledContact(ht, name);
+}
+
+/**
+ * @brief Searches for a contact by name, recording the lookup for the
+ * heavy-hitter tracker and the usage-ranked suggestions.
+ * @param ht A pointer to the hash table.
+ * @param name The name of the contact to find.
+ * @return A pointer to the ContactNode if found, otherwise NULL.
+ */
+ContactNode* searchContact(HashTable *ht, const char *name) {
+    if (ht->hitters) heavyHitterRecord(ht->hitters, name);
+
+    ContactNode *found = lookupContact(ht, name);
+    if (found && ht->suggest) suggestRecordUse(ht->suggest, name);
+    return found;
+}
+
+/**
+ * @brief Deletes a contact by name.
+ * @param ht A pointer to the hash table.
+ * @param name The name of the contact to delete.
+ */
+void deleteContact(HashTable *ht, const char *name) {
+    int rc = removeContact(ht, name);
+    if (rc == 1) {
+        printf("SUCCESS: Deleted '%s'.\n", name);
+    } else if (rc < 0) {
+        printf("ERROR: Could not delete '%s'.\n", name);
+    } else {
+        printf("ERROR: Contact '%s' not found.\n", name);
+    }
+}
+
+// Helper state for printing disk pages in displayContacts()
+typedef struct DiskDisplayState {
+    int empty;
+    uint32_t lastPage;
+} DiskDisplayState;
+
+static void displayDiskRecord(uint32_t pageId, const DiskRecord *rec, void *ctx) {
+    DiskDisplayState *state = (DiskDisplayState*)ctx;
+    if (state->empty || state->lastPage != pageId) {
+        printf("Page[%u]:\n", pageId);
+    }
+    state->empty = 0;
+    state->lastPage = pageId;
+    printf("  -> Name: %-20s | Phone: %s\n", rec->name, rec->phone);
+}
+
+/**
+ * @brief Displays all contacts in the phonebook.
+ * @param ht A pointer to the hash table.
+ */
+void displayContacts(HashTable *ht) {
+    printf("\n--- 📖 Phonebook Contacts 📖 ---\n");
+    if (ht->disk) {
+        DiskDisplayState state = { 1, 0 };
+        diskHashForEach(ht->disk, displayDiskRecord, &state);
+        if (state.empty) {
+            printf("Phonebook is empty.\n");
+        }
+        printf("Disk I/O: %lu page reads, %lu page writes\n",
+               ht->disk->diskReads, ht->disk->diskWrites);
+        printf("----------------------------------\n");
+        return;
+    }
+    int empty = 1;
+    for (int i = 0; i < ht->size; i++) {
+        ContactNode *temp = ht->table[i];
+        if (temp != NULL) {
+            empty = 0;
+            printf("Bucket[%d]:\n", i);
+            while (temp != NULL) {
+                printf("  -> Name: %-20s | Phone: %s\n", temp->name, temp->phone);
+                temp = temp->next;
+            }
+        }
+    }
+    if (ht->overflow && ht->overflow->numRecords > 0) {
+        DiskDisplayState state = { 1, 0 };
+        empty = 0;
+        printf("Spilled to disk (%lu):\n", ht->overflow->numRecords);
+        diskHashForEach(ht->overflow, displayDiskRecord, &state);
+    }
+    if (empty) {
+        printf("Phonebook is empty.\n");
+    }
+    printf("----------------------------------\n");
+}
+
+/**
+ * @brief Frees all allocated memory for the hash table without printing.
+ * @param ht A pointer to the hash table.
+ */
+static void releaseHashTable(HashTable *ht) {
+    if (!ht) return;
+
+    closeChangeLog(ht); // Writes a final checkpoint while contacts still exist
+    if (ht->disk) {
+        diskHashClose(ht->disk); // Flushes dirty pages and the directory
+    }
+    watchFree(ht);
+    heavyHittersFree(ht);
+    free(ht->stats);
+    suggestFree(ht);
+    attributeFree(ht);
+    trigramFree(ht);
+    if (ht->merkle) {
+        free(ht->merkle->nodes);
+        free(ht->merkle);
+    }
+    if (ht->history) {
+        if (ht->history->tombstones) {
+            for (int i = 0; i < HISTORY_TOMBSTONE_BUCKETS; i++) {
+                HistoryTombstone *tomb = ht->history->tombstones[i];
+                while (tomb) {
+                    HistoryTombstone *next = tomb->next;
+                    free(tomb);
+                    tomb = next;
+                }
+            }
+            free(ht->history->tombstones);
+        }
+        free(ht->history->bytes);
+        free(ht->history);
+    }
+    if (ht->overflow) {
+        diskHashClose(ht->overflow);
+        unlink(ht->overflowPath); // The overflow store is scratch space
+        char dirPath[4096];
+        snprintf(dirPath, sizeof(dirPath), "%s.dir", ht->overflowPath);
+        unlink(dirPath);
+        free(ht->overflowPath);
+    }
+
+    for (int i = 0; i < ht->size; i++) {
+        ContactNode *current = ht->table[i];
+        while (current != NULL) {
+            ContactNode *temp = current;
+            current = current->next;
+            free(temp); // Free each node
+        }
+    }
+    if (ht->stripes) {
+        for (unsigned i = 0; i <= ht->stripeMask; i++) pthread_rwlock_destroy(&ht->stripes[i]);
+        free(ht->stripes);
+    }
+    free(ht->table); // Free the array of pointers
+    free(ht);        // Free the hash table structure
+}
+
+/**
+ * @brief Frees all allocated memory for the hash table.
+ * @param ht A pointer to the hash table.
+ */
+void freeHashTable(HashTable *ht) {
+    if (!ht) return;
+    releaseHashTable(ht);
+    printf("Phonebook memory freed.\n");
+}
+
+/* ------------------------------------------------------------------ */
+/*  Concurrent access with striped locks                                */
+/*                                                                     */
+/*  A plain in-memory table can be shared by threads: buckets are       */
+/*  covered by a power-of-two array of reader-writer locks (bucket i    */
+/*  by stripe i & mask), lookups take their stripe shared and changes   */
+/*  take it exclusive. Results are copied out under the lock, since a   */
+/*  node may be freed as soon as it is released. Subsystems that keep   */
+/*  their own unsynchronized state (disk pages, the memory budget's LRU */
+/*  list, logs, history, watchers and secondary indexes) are refused;   */
+/*  the heavy-hitter tracker is thread-aware and may stay. They must    */
+/*  not be enabled after this either.                                   */
+/* ------------------------------------------------------------------ */
+
+/**
+ * @brief Lets several threads use the table through the concurrent*()
+ * functions.
+ * @param ht A pointer to the hash table.
+ * @param stripes The number of locks (rounded up to a power of two).
+ * @return 0 on success, -1 if the table cannot be shared or on failure.
+ */
+int enableConcurrentAccess(HashTable *ht, int stripes) {
+    if (ht->stripes) return 0;
+    if (ht->disk || ht->overflow || ht->log || ht->history || ht->watch || ht->merkle ||
+        ht->stats || ht->suggest || ht->attributes || ht->trigrams) {
+        fprintf(stderr, "ERROR: Concurrent access needs a plain in-memory table "
+                        "(no disk, memory budget, log, history, watchers or indexes).\n");
+        return -1;
+    }
+    unsigned count = 1;
+    while (count < (unsigned)stripes && count < (1u << 16)) count <<= 1;
+    pthread_rwlock_t *locks = (pthread_rwlock_t*)malloc(count * sizeof(pthread_rwlock_t));
+    if (!locks) {
+        perror("Failed to allocate stripe locks");
+        return -1;
+    }
+    for (unsigned i = 0; i < count; i++) pthread_rwlock_init(&locks[i], NULL);
+    ht->stripes = locks;
+    ht->stripeMask = count - 1;
+    return 0;
+}
+
+static inline pthread_rwlock_t* stripeFor(HashTable *ht, const char *name) {
+    return &ht->stripes[hashFunction(name, ht->size) & ht->stripeMask];
+}
+
+/**
+ * @brief Looks up a contact from any thread.
+ * @param ht A pointer to the (concurrent) hash table.
+ * @param name The name to search for.
+ * @param phone Receives the phone (MAX_PHONE_LEN bytes) when found.
+ * @return 1 if found, 0 if not.
+ */
+int concurrentSearch(HashTable *ht, const char *name, char *phone) {
+    if (ht->hitters) heavyHitterRecord(ht->hitters, name);
+    pthread_rwlock_t *lock = stripeFor(ht, name);
+    pthread_rwlock_rdlock(lock);
+    ContactNode *node = lookupContact(ht, name);
+    if (node) memcpy(phone, node->phone, MAX_PHONE_LEN);
+    pthread_rwlock_unlock(lock);
+    return node != NULL;
+}
+
+/**
+ * @brief Adds a contact from any thread.
+ * @param ht A pointer to the (concurrent) hash table.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return 0 if added, 1 if the name existed and was updated, -1 on failure.
+ */
+int concurrentInsert(HashTable *ht, const char *name, const char *phone) {
+    pthread_rwlock_t *lock = stripeFor(ht, name);
+    pthread_rwlock_wrlock(lock);
+    int rc = addContact(ht, name, phone);
+    pthread_rwlock_unlock(lock);
+    return rc;
+}
+
+/**
+ * @brief Changes a contact's phone from any thread.
+ * @param ht A pointer to the (concurrent) hash table.
+ * @param name The contact's name.
+ * @param phone The new phone number.
+ * @return 1 if updated, 0 if not found, -1 on failure.
+ */
+int concurrentUpdate(HashTable *ht, const char *name, const char *phone) {
+    pthread_rwlock_t *lock = stripeFor(ht, name);
+    pthread_rwlock_wrlock(lock);
+    int rc = changeContactPhone(ht, name, phone);
+    pthread_rwlock_unlock(lock);
+    return rc;
+}
+
+/**
+ * @brief Removes a contact from any thread.
+ * @param ht A pointer to the (concurrent) hash table.
+ * @param name The name of the contact to remove.
+ * @return 1 if removed, 0 if not found, -1 on failure.
+ */
+int concurrentDelete(HashTable *ht, const char *name) {
+    pthread_rwlock_t *lock = stripeFor(ht, name);
+    pthread_rwlock_wrlock(lock);
+    int rc = removeContact(ht, name);
+    pthread_rwlock_unlock(lock);
+    return rc;
+}
+
+// Helper function to clear the input buffer
+void clearInputBuffer() {
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+}
+
+/**
+ * @brief Opens a snapshot file and validates its header.
+ * @param path The snapshot file.
+ * @param buckets Receives the table size it was saved from.
+ * @param count Receives the number of contacts.
+ * @return The file positioned at the first contact, or NULL on failure.
+ */
+static FILE* openSnapshot(const char *path, uint32_t *buckets, uint64_t *count) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror("Failed to open snapshot");
+        return NULL;
+    }
+
+    char magic[8];
+    uint32_t sizes[2];
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 ||
+        fread(sizes, sizeof(sizes), 1, fp) != 1 || fread(count, sizeof(*count), 1, fp) != 1 ||
+        sizes[0] == 0) {
+        fprintf(stderr, "ERROR: '%s' is not a phonebook snapshot.\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    *buckets = sizes[0];
+    return fp;
+}
+
+/**
+ * @brief Inserts the contacts of an opened snapshot and closes it.
+ * @param ht The table receiving them.
+ * @param fp The snapshot, positioned at the first contact.
+ * @param count The number of contacts.
+ * @param path The file name, for messages.
+ * @return 0 on success, -1 if the snapshot is truncated.
+ */
+static int readSnapshotContacts(HashTable *ht, FILE *fp, uint64_t count, const char *path) {
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+    int rc = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint8_t lens[2];
+        if (fread(lens, 1, 2, fp) != 2 || lens[0] >= MAX_NAME_LEN || lens[1] >= MAX_PHONE_LEN ||
+            fread(name, 1, lens[0], fp) != lens[0] || fread(phone, 1, lens[1], fp) != lens[1]) {
+            fprintf(stderr, "ERROR: Snapshot '%s' is truncated.\n", path);
+            rc = -1;
+            break;
+        }
+        name[lens[0]] = '\0';
+        phone[lens[1]] = '\0';
+        addContact(ht, name, phone);
+    }
+    fclose(fp);
+    return rc;
+}
+
+/**
+ * @brief Loads a snapshot file into a new in-memory table.
+ * @param path The snapshot file.
+ * @return A pointer to the new hash table, or NULL on failure.
+ */
+HashTable* loadSnapshot(const char *path) {
+    uint32_t buckets;
+    uint64_t count;
+    FILE *fp = openSnapshot(path, &buckets, &count);
+    if (!fp) return NULL;
+    HashTable *ht = createHashTable((int)buckets);
+    readSnapshotContacts(ht, fp, count, path);
+    return ht;
+}
+
+/**
+ * @brief Loads a snapshot file into an existing table, for example one
+ * prepared with a memory budget so the load never exceeds it.
+ * @param ht The table receiving the contacts.
+ * @param path The snapshot file.
+ * @return 0 on success, -1 on failure.
+ */
+int loadSnapshotInto(HashTable *ht, const char *path) {
+    uint32_t buckets;
+    uint64_t count;
+    FILE *fp = openSnapshot(path, &buckets, &count);
+    if (!fp) return -1;
+    return readSnapshotContacts(ht, fp, count, path);
+}
+
+// One log segment held in memory, its records split by owning partition
+typedef struct RestoreSegment {
+    unsigned char *data;
+    size_t length;
+    uint32_t **offsets;  // Per partition: record offsets, in log order
+    uint32_t *counts;
+    uint32_t *caps;
+} RestoreSegment;
+
+// Shared state of a parallel restore
+typedef struct RestoreJob {
+    HashTable *ht;
+    const char *dir;
+    const uint32_t *segmentNos;
+    RestoreSegment *segments;
+    int numSegments;
+    int partitions;       // Bucket index modulo partitions picks the owner
+    int64_t afterTs;      // Records at or before this are in the checkpoint
+    int64_t untilTs;      // Records after this are not replayed
+    int nextSegment;      // Work claimed with atomic increments
+    int nextPartition;
+    unsigned long applied;
+    int failed;
+} RestoreJob;
+
+/**
+ * @brief Reads one record header and payload from a segment buffer.
+ * @param seg The segment.
+ * @param offset The record offset.
+ * @param hdr Receives the header.
+ * @param name Receives the name (MAX_NAME_LEN bytes).
+ * @param phone Receives the phone (MAX_PHONE_LEN bytes).
+ * @return The record length, or 0 if it is torn or malformed.
+ */
+static size_t restoreReadRecord(const RestoreSegment *seg, size_t offset, ChangeRecordHeader *hdr,
+                                char *name, char *phone) {
+    if (seg->length - offset < CHANGELOG_HEADER_BYTES) return 0;
+    changeRecordDecode(seg->data + offset, hdr);
+    size_t length = CHANGELOG_HEADER_BYTES + hdr->nameLen + hdr->phoneLen;
+    if (hdr->nameLen >= MAX_NAME_LEN || hdr->phoneLen >= MAX_PHONE_LEN ||
+        seg->length - offset < length) {
+        return 0;
+    }
+    const unsigned char *payload = seg->data + offset + CHANGELOG_HEADER_BYTES;
+    memcpy(name, payload, hdr->nameLen);
+    name[hdr->nameLen] = '\0';
+    memcpy(phone, payload + hdr->nameLen, hdr->phoneLen);
+    phone[hdr->phoneLen] = '\0';
+    return length;
+}
+
+/**
+ * @brief Phase 1 of a restore: each thread claims whole segments, reads
+ * them once and files every record in the window under its partition.
+ * @param arg A pointer to the RestoreJob.
+ * @return NULL.
+ */
+static void* restoreScanRun(void *arg) {
+    RestoreJob *job = (RestoreJob*)arg;
+    char path[4096];
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+
+    int s;
+    while ((s = __atomic_fetch_add(&job->nextSegment, 1, __ATOMIC_RELAXED)) < job->numSegments) {
+        RestoreSegment *seg = &job->segments[s];
+
+        // 1. Read the segment (an index entry may precede a crash before creation)
+        snprintf(path, sizeof(path), "%s/segment-%08u.log", job->dir, job->segmentNos[s]);
+        FILE *fp = fopen(path, "rb");
+        if (!fp) continue;
+        long size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+        if (size > 0 && (uint64_t)size < UINT32_MAX) {
+            seg->data = (unsigned char*)malloc((size_t)size);
+            if (seg->data && fseek(fp, 0, SEEK_SET) == 0) seg->length = fread(seg->data, 1, (size_t)size, fp);
+        }
+        fclose(fp);
+        if (size > 0 && !seg->data) {
+            perror("Failed to read change log segment");
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // 2. File each record in (afterTs, untilTs] under its partition
+        size_t offset = 0, length;
+        ChangeRecordHeader hdr;
+        while ((length = restoreReadRecord(seg, offset, &hdr, name, phone)) > 0) {
+            if (hdr.timestamp > job->untilTs) break;
+            if (hdr.timestamp > job->afterTs) {
+                int p = (int)(hashFunction(name, job->ht->size) % (unsigned)job->partitions);
+                if (seg->counts[p] == seg->caps[p]) {
+                    uint32_t cap = seg->caps[p] ? seg->caps[p] * 2 : 256;
+                    uint32_t *grown = (uint32_t*)realloc(seg->offsets[p], cap * sizeof(uint32_t));
+                    if (!grown) {
+                        perror("Failed to allocate restore offsets");
+                        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+                        break;
+                    }
+                    seg->offsets[p] = grown;
+                    seg->caps[p] = cap;
+                }
+                seg->offsets[p][seg->counts[p]++] = (uint32_t)offset;
+            }
+            offset += length; // A torn tail of the last segment ends the loop
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Phase 2 of a restore: each thread claims a partition and applies
+ * its records segment by segment, so per-contact order is preserved and
+ * no two threads touch the same chain.
+ * @param arg A pointer to the RestoreJob.
+ * @return NULL.
+ */
+static void* restoreApplyRun(void *arg) {
+    RestoreJob *job = (RestoreJob*)arg;
+    HashTable *ht = job->ht;
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+    unsigned long applied = 0;
+
+    int p;
+    while ((p = __atomic_fetch_add(&job->nextPartition, 1, __ATOMIC_RELAXED)) < job->partitions) {
+        for (int s = 0; s < job->numSegments; s++) {
+            const RestoreSegment *seg = &job->segments[s];
+            for (uint32_t r = 0; r < seg->counts[p]; r++) {
+                ChangeRecordHeader hdr;
+                restoreReadRecord(seg, seg->offsets[p][r], &hdr, name, phone);
+                unsigned int index = hashFunction(name, ht->size);
+
+                if (hdr.op == CHANGE_INSERT) {
+                    // Names stay unique: a repeated insert replaces the phone
+                    ContactNode *node = ht->table[index];
+                    while (node && strcmp(node->name, name) != 0) node = node->next;
+                    if (node) {
+                        memcpy(node->phone, phone, MAX_PHONE_LEN);
+                        applied++;
+                        continue;
+                    }
+                    node = (ContactNode*)calloc(1, sizeof(ContactNode));
+                    if (!node) {
+                        perror("Failed to allocate ContactNode");
+                        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+                        break;
+                    }
+                    memcpy(node->name, name, MAX_NAME_LEN);
+                    memcpy(node->phone, phone, MAX_PHONE_LEN);
+                    node->next = ht->table[index];
+                    ht->table[index] = node;
+                } else if (hdr.op == CHANGE_DELETE) {
+                    ContactNode **link = &ht->table[index];
+                    while (*link && strcmp((*link)->name, name) != 0) link = &(*link)->next;
+                    if (*link) {
+                        ContactNode *dead = *link;
+                        *link = dead->next;
+                        free(dead);
+                    }
+                } else if (hdr.op == CHANGE_UPDATE) {
+                    ContactNode *node = ht->table[index];
+                    while (node && strcmp(node->name, name) != 0) node = node->next;
+                    if (node) memcpy(node->phone, phone, MAX_PHONE_LEN);
+                }
+                applied++;
+            }
+        }
+    }
+    __atomic_add_fetch(&job->applied, applied, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * @brief Adds a segment number to a growing list.
+ * @param segments The list (reallocated as it grows).
+ * @param count The number of entries in use.
+ * @param cap The allocated capacity.
+ * @param segNo The segment number to add.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int restoreAddSegment(uint32_t **segments, int *count, int *cap, uint32_t segNo) {
+    if (*count == *cap) {
+        int grown = *cap ? *cap * 2 : 16;
+        uint32_t *list = (uint32_t*)realloc(*segments, grown * sizeof(uint32_t));
+        if (!list) {
+            perror("Failed to allocate segment list");
+            return -1;
+        }
+        *segments = list;
+        *cap = grown;
+    }
+    (*segments)[(*count)++] = segNo;
+    return 0;
+}
+
+/**
+ * @brief Rebuilds the table as it was at a point in time.
+ * Loads the newest checkpoint at or before the timestamp, then replays
+ * the following log segments in two parallel passes: threads first read
+ * disjoint segments and split their records by bucket partition, then
+ * apply disjoint partitions.
+ * @param dir The change log directory.
+ * @param timestamp The target time in microseconds since the epoch.
+ * @param threads The number of replay threads.
+ * @return A pointer to the restored table, or NULL on failure.
+ */
+HashTable* restoreToTimestamp(const char *dir, int64_t timestamp, int threads) {
+    char path[4096];
+    long long ts;
+
+    // 1. Find the nearest checkpoint at or before the target time
+    snprintf(path, sizeof(path), "%s/checkpoints.idx", dir);
+    FILE *idx = fopen(path, "r");
+    if (!idx) {
+        perror("Failed to open checkpoint index");
+        return NULL;
+    }
+    int64_t checkpoint = -1;
+    while (fscanf(idx, "%lld", &ts) == 1) {
+        if (ts <= timestamp && ts > checkpoint) checkpoint = ts;
+    }
+    fclose(idx);
+    if (checkpoint < 0) {
+        fprintf(stderr, "ERROR: No checkpoint at or before the requested time.\n");
+        return NULL;
+    }
+
+    // 2. Pick the segments that can hold records in (checkpoint, timestamp]
+    snprintf(path, sizeof(path), "%s/segments.idx", dir);
+    idx = fopen(path, "r");
+    if (!idx) {
+        perror("Failed to open segment index");
+        return NULL;
+    }
+    uint32_t *segments = NULL;
+    int numSegments = 0, capSegments = 0, rc = 0;
+    unsigned int segNo, prevNo = 0;
+    int havePrev = 0;
+    while (rc == 0 && fscanf(idx, "%u %lld", &segNo, &ts) == 2) {
+        // The previous segment ends where this one starts
+        if (havePrev && ts > checkpoint + 1) {
+            rc = restoreAddSegment(&segments, &numSegments, &capSegments, prevNo);
+        }
+        havePrev = ts <= timestamp;
+        prevNo = segNo;
+    }
+    fclose(idx);
+    if (rc == 0 && havePrev) rc = restoreAddSegment(&segments, &numSegments, &capSegments, prevNo);
+    if (rc != 0) {
+        free(segments);
+        return NULL;
+    }
+
+    // 3. Load the checkpoint
+    snprintf(path, sizeof(path), "%s/checkpoint-%lld.snap", dir, (long long)checkpoint);
+    HashTable *ht = loadSnapshot(path);
+    if (!ht) {
+        free(segments);
+        return NULL;
+    }
+
+    // 4. Read and partition the segments, then replay the partitions
+    if (threads < 1) threads = 1;
+    if (threads > ht->size) threads = ht->size;
+    RestoreJob job;
+    memset(&job, 0, sizeof(job));
+    job.ht = ht;
+    job.dir = dir;
+    job.segmentNos = segments;
+    job.numSegments = numSegments;
+    job.partitions = threads;
+    job.afterTs = checkpoint;
+    job.untilTs = timestamp;
+    job.segments = (RestoreSegment*)calloc(numSegments ? numSegments : 1, sizeof(RestoreSegment));
+    int ok = job.segments != NULL;
+    for (int s = 0; ok && s < numSegments; s++) {
+        RestoreSegment *seg = &job.segments[s];
+        seg->offsets = (uint32_t**)calloc(threads, sizeof(uint32_t*));
+        seg->counts = (uint32_t*)calloc(threads, sizeof(uint32_t));
+        seg->caps = (uint32_t*)calloc(threads, sizeof(uint32_t));
+        ok = seg->offsets && seg->counts && seg->caps;
+    }
+    if (!ok) {
+        perror("Failed to allocate restore state");
+        job.failed = 1;
+    } else {
+        runParallel(restoreScanRun, &job, threads);
+        if (!job.failed) runParallel(restoreApplyRun, &job, threads);
+    }
+
+    // 5. Recompute the memory accounting the workers skipped
+    ht->memoryUsed = 0;
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node; node = node->next) {
+            ht->memoryUsed += sizeof(ContactNode);
+        }
+    }
+
+    for (int s = 0; job.segments && s < numSegments; s++) {
+        RestoreSegment *seg = &job.segments[s];
+        for (int p = 0; seg->offsets && p < threads; p++) free(seg->offsets[p]);
+        free(seg->offsets);
+        free(seg->counts);
+        free(seg->caps);
+        free(seg->data);
+    }
+    free(job.segments);
+    free(segments);
+    if (job.failed) {
+        fprintf(stderr, "ERROR: Could not replay the change log.\n");
+        releaseHashTable(ht);
+        return NULL;
+    }
+    printf("Restored from checkpoint %lld, replayed %lu changes from %d segment(s).\n",
+           (long long)checkpoint, job.applied, numSegments);
+    return ht;
+}
+
+/**
+ * @brief Parses a restore target time.
+ * Accepts Unix seconds ("1700000000[.5]") or local "YYYY-MM-DDTHH:MM:SS".
+ * @param text The time to parse.
+ * @param out Receives microseconds since the epoch.
+ * @return 0 on success, -1 if the text is not a time.
+ */
+int parseTimestamp(const char *text, int64_t *out) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (end && *end == '\0') {
+        tm.tm_isdst = -1;
+        *out = (int64_t)mktime(&tm) * 1000000;
+        return 0;
+    }
+
+    char *stop;
+    double seconds = strtod(text, &stop);
+    if (stop == text || *stop != '\0') return -1;
+    *out = (int64_t)(seconds * 1000000.0);
+    return 0;
+}
+
+/**
+ * @brief The "restore" tool: rebuilds a table as of a time.
+ * Usage: phonebook restore <log-dir> <time> [snapshot-out]
+ * @return The process exit status.
+ */
+int runRestoreTool(int argc, char *argv[]) {
+    int64_t timestamp;
+    if (argc < 4 || argc > 5 || parseTimestamp(argv[3], &timestamp) != 0) {
+        fprintf(stderr, "Usage: %s restore <log-dir> <unix-seconds|YYYY-MM-DDTHH:MM:SS> "
+                "[snapshot-out]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    HashTable *ht = restoreToTimestamp(argv[2], timestamp, RESTORE_THREADS);
+    if (!ht) return EXIT_FAILURE;
+
+    int rc = EXIT_SUCCESS;
+    if (argc == 5) {
+        rc = saveSnapshot(ht, argv[4]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        displayContacts(ht);
+    }
+    releaseHashTable(ht);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Merkle sync protocol                                               */
+/*                                                                     */
+/*  The puller sends requests of the form                              */
+/*    uint8 type, uint32 count, count x uint32 ids                     */
+/*  and the server answers:                                            */
+/*    HELLO   -> uint32 tableSize, uint32 numLeaves                    */
+/*    NODES   -> count x uint64 node hashes                            */
+/*    BUCKETS -> per bucket: uint32 n, n x {uint8 nameLen,             */
+/*               uint8 phoneLen, name, phone}                          */
+/*    DONE    -> (connection closes)                                   */
+/*  The puller walks the tree one level per round trip, asking only    */
+/*  for the children of nodes whose hashes differ.                     */
+/* ------------------------------------------------------------------ */
+
+// The contacts of one bucket, gathered for transfer or comparison
+typedef struct BucketContents {
+    DiskRecord *items;
+    uint32_t count;
+    uint32_t capacity;
+} BucketContents;
+
+/**
+ * @brief Writes a whole buffer to a descriptor.
+ * @param fd The descriptor.
+ * @param buf The bytes to write.
+ * @param len The number of bytes.
+ * @param counter Incremented by the bytes written (may be NULL).
+ * @return 0 on success, -1 on error.
+ */
+static int writeAll(int fd, const void *buf, size_t len, unsigned long *counter) {
+    const char *p = (const char*)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        if (counter) *counter += (unsigned long)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads exactly len bytes from a descriptor.
+ * @param fd The descriptor.
+ * @param buf Receives the bytes.
+ * @param len The number of bytes.
+ * @param counter Incremented by the bytes read (may be NULL).
+ * @return 0 on success, -1 on error or EOF.
+ */
+static int readAll(int fd, void *buf, size_t len, unsigned long *counter) {
+    char *p = (char*)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        if (counter) *counter += (unsigned long)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends a record to a bucket's contents.
+ * @param bc The bucket contents.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int bucketContentsAdd(BucketContents *bc, const char *name, const char *phone) {
+    if (bc->count == bc->capacity) {
+        uint32_t cap = bc->capacity ? bc->capacity * 2 : 8;
+        DiskRecord *items = (DiskRecord*)realloc(bc->items, cap * sizeof(DiskRecord));
+        if (!items) {
+            perror("Failed to grow bucket contents");
+            return -1;
+        }
+        bc->items = items;
+        bc->capacity = cap;
+    }
+    DiskRecord *rec = &bc->items[bc->count++];
+    memset(rec, 0, sizeof(*rec));
+    copyField(rec->name, name, MAX_NAME_LEN);
+    copyField(rec->phone, phone, MAX_PHONE_LEN);
+    return 0;
+}
+
+// Helper state for collecting spilled contacts of selected buckets
+typedef struct BucketGather {
+    HashTable *ht;
+    const uint32_t *buckets; // Sorted
+    uint32_t count;
+    BucketContents *out;
+} BucketGather;
+
+static void gatherDiskRecord(uint32_t pageId, const DiskRecord *rec, void *ctx) {
+    (void)pageId;
+    BucketGather *g = (BucketGather*)ctx;
+    uint32_t bucket = hashFunction(rec->name, g->ht->size);
+    uint32_t lo = 0, hi = g->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (g->buckets[mid] < bucket) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < g->count && g->buckets[lo] == bucket) {
+        bucketContentsAdd(&g->out[lo], rec->name, rec->phone);
+    }
+}
+
+/**
+ * @brief Collects every contact (resident or spilled) of sorted buckets.
+ * @param ht A pointer to the hash table.
+ * @param buckets The bucket ids, in ascending order.
+ * @param count The number of buckets.
+ * @param out Receives one BucketContents per bucket (zero-initialised).
+ */
+static void gatherBuckets(HashTable *ht, const uint32_t *buckets, uint32_t count,
+                          BucketContents *out) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (buckets[i] >= (uint32_t)ht->size) continue;
+        for (ContactNode *node = ht->table[buckets[i]]; node; node = node->next) {
+            bucketContentsAdd(&out[i], node->name, node->phone);
+        }
+    }
+    if (ht->overflow && ht->overflow->numRecords > 0) {
+        BucketGather g = { ht, buckets, count, out };
+        diskHashForEach(ht->overflow, gatherDiskRecord, &g);
+    }
+}
+
+static int compareU32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Serves Merkle sync requests for a table until DONE or EOF.
+ * @param ht A pointer to a table with a Merkle tree.
+ * @param fd A connected descriptor.
+ * @return 0 on a clean finish, -1 on protocol or I/O error.
+ */
+int merkleServe(HashTable *ht, int fd) {
+    if (!ht->merkle) return -1;
+    MerkleTree *tree = ht->merkle;
+    uint32_t *ids = NULL;
+
+    while (1) {
+        // 1. Read the request
+        uint8_t type;
+        uint32_t count;
+        if (readAll(fd, &type, 1, NULL) != 0) break;
+        if (type == MERKLE_MSG_DONE) {
+            free(ids);
+            return 0;
+        }
+        if (readAll(fd, &count, sizeof(count), NULL) != 0 || count > 2 * tree->numLeaves) break;
+        uint32_t *grown = (uint32_t*)realloc(ids, (count + 1) * sizeof(uint32_t));
+        if (!grown) break;
+        ids = grown;
+        if (readAll(fd, ids, count * sizeof(uint32_t), NULL) != 0) break;
+
+        // 2. Answer it
+        int rc = 0;
+        if (type == MERKLE_MSG_HELLO) {
+            uint32_t reply[2] = { (uint32_t)ht->size, tree->numLeaves };
+            rc = writeAll(fd, reply, sizeof(reply), NULL);
+        } else if (type == MERKLE_MSG_NODES) {
+            for (uint32_t i = 0; i < count && rc == 0; i++) {
+                uint64_t h = ids[i] < 2 * tree->numLeaves ? tree->nodes[ids[i]] : 0;
+                rc = writeAll(fd, &h, sizeof(h), NULL);
+            }
+        } else if (type == MERKLE_MSG_BUCKETS) {
+            int valid = 1;
+            for (uint32_t i = 0; i < count; i++) {
+                if (ids[i] >= (uint32_t)ht->size) valid = 0;
+            }
+            if (!valid) break; // A peer asking for buckets we do not have
+            qsort(ids, count, sizeof(uint32_t), compareU32);
+            BucketContents *contents = (BucketContents*)calloc(count + 1, sizeof(BucketContents));
+            if (!contents) break;
+            gatherBuckets(ht, ids, count, contents);
+            for (uint32_t i = 0; i < count; i++) {
+                if (rc == 0) rc = writeAll(fd, &ids[i], sizeof(uint32_t), NULL);
+                if (rc == 0) rc = writeAll(fd, &contents[i].count, sizeof(uint32_t), NULL);
+                for (uint32_t j = 0; j < contents[i].count && rc == 0; j++) {
+                    const DiskRecord *rec = &contents[i].items[j];
+                    uint8_t lens[2] = { (uint8_t)strlen(rec->name), (uint8_t)strlen(rec->phone) };
+                    rc = writeAll(fd, lens, 2, NULL);
+                    if (rc == 0) rc = writeAll(fd, rec->name, lens[0], NULL);
+                    if (rc == 0) rc = writeAll(fd, rec->phone, lens[1], NULL);
+                }
+                free(contents[i].items);
+            }
+            free(contents);
+        } else {
+            break;
+        }
+        if (rc != 0) break;
+    }
+    free(ids);
+    return -1;
+}
+
+/**
+ * @brief Sends one request to the server.
+ * @param fd The connected descriptor.
+ * @param type The message type.
+ * @param ids The ids carried by the request.
+ * @param count The number of ids.
+ * @param stats The sync statistics to update.
+ * @return 0 on success, -1 on I/O error.
+ */
+static int merkleRequest(int fd, uint8_t type, const uint32_t *ids, uint32_t count,
+                         MerkleSyncStats *stats) {
+    stats->roundTrips++;
+    if (writeAll(fd, &type, 1, &stats->bytesSent) != 0) return -1;
+    if (type == MERKLE_MSG_DONE) return 0;
+    if (writeAll(fd, &count, sizeof(count), &stats->bytesSent) != 0) return -1;
+    return writeAll(fd, ids, count * sizeof(uint32_t), &stats->bytesSent);
+}
+
+/**
+ * @brief Makes one local bucket match the remote copy.
+ * Contacts present on both sides are left alone; a changed phone
+ * becomes an update; the rest are added or removed.
+ * @param ht A pointer to the local table.
+ * @param local The local contents of the bucket.
+ * @param remote The remote contents of the bucket.
+ * @return The number of contacts changed.
+ */
+static unsigned long merkleReconcileBucket(HashTable *ht, BucketContents *local,
+                                           BucketContents *remote) {
+    unsigned long changed = 0;
+    char *localUsed = (char*)calloc(local->count + 1, 1);
+    char *remoteUsed = (char*)calloc(remote->count + 1, 1);
+    if (!localUsed || !remoteUsed) {
+        free(localUsed);
+        free(remoteUsed);
+        return 0;
+    }
+
+    // 1. Pair up identical contacts
+    for (uint32_t r = 0; r < remote->count; r++) {
+        for (uint32_t l = 0; l < local->count; l++) {
+            if (!localUsed[l] && strcmp(local->items[l].name, remote->items[r].name) == 0 &&
+                strcmp(local->items[l].phone, remote->items[r].phone) == 0) {
+                localUsed[l] = remoteUsed[r] = 1;
+                break;
+            }
+        }
+    }
+
+    // 2. Remote-only contacts: update a same-named local one, or add
+    for (uint32_t r = 0; r < remote->count; r++) {
+        if (remoteUsed[r]) continue;
+        int updated = 0;
+        for (uint32_t l = 0; l < local->count; l++) {
+            if (!localUsed[l] && strcmp(local->items[l].name, remote->items[r].name) == 0) {
+                localUsed[l] = 1;
+                updated = changeContactPhone(ht, remote->items[r].name, remote->items[r].phone) == 1;
+                break;
+            }
+        }
+        if (!updated) addContact(ht, remote->items[r].name, remote->items[r].phone);
+        changed++;
+    }
+
+    // 3. Local-only contacts are removed
+    for (uint32_t l = 0; l < local->count; l++) {
+        if (!localUsed[l]) {
+            removeContact(ht, local->items[l].name);
+            changed++;
+        }
+    }
+    free(localUsed);
+    free(remoteUsed);
+    return changed;
+}
+
+/**
+ * @brief Pulls differences from a remote replica until both trees match.
+ * @param ht A pointer to the local table (with a Merkle tree).
+ * @param fd A descriptor connected to merkleServe() on the remote.
+ * @param stats Receives traffic and work counters.
+ * @return 0 on success, -1 on failure.
+ */
+int merkleSyncFrom(HashTable *ht, int fd, MerkleSyncStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!ht->merkle) return -1;
+    MerkleTree *tree = ht->merkle;
+
+    // 1. Make sure both replicas bucket the same way
+    uint32_t hello[2];
+    if (merkleRequest(fd, MERKLE_MSG_HELLO, NULL, 0, stats) != 0 ||
+        readAll(fd, hello, sizeof(hello), &stats->bytesReceived) != 0) {
+        return -1;
+    }
+    if (hello[0] != (uint32_t)ht->size || hello[1] != tree->numLeaves) {
+        fprintf(stderr, "ERROR: Replicas have different table sizes (%u vs %d).\n",
+                hello[0], ht->size);
+        merkleRequest(fd, MERKLE_MSG_DONE, NULL, 0, stats);
+        return -1;
+    }
+
+    // 2. Descend level by level through the differing nodes
+    uint32_t *frontier = (uint32_t*)malloc(2 * tree->numLeaves * sizeof(uint32_t));
+    uint32_t *next = (uint32_t*)malloc(2 * tree->numLeaves * sizeof(uint32_t));
+    uint32_t *diffBuckets = (uint32_t*)malloc(tree->numLeaves * sizeof(uint32_t));
+    uint64_t *hashes = (uint64_t*)malloc(2 * tree->numLeaves * sizeof(uint64_t));
+    if (!frontier || !next || !diffBuckets || !hashes) {
+        free(frontier); free(next); free(diffBuckets); free(hashes);
+        return -1;
+    }
+    uint32_t frontierCount = 1, numDiff = 0;
+    frontier[0] = 1;
+    int rc = 0;
+    while (frontierCount > 0 && rc == 0) {
+        rc = merkleRequest(fd, MERKLE_MSG_NODES, frontier, frontierCount, stats);
+        if (rc == 0) {
+            rc = readAll(fd, hashes, frontierCount * sizeof(uint64_t), &stats->bytesReceived);
+        }
+        uint32_t nextCount = 0;
+        for (uint32_t i = 0; i < frontierCount && rc == 0; i++) {
+            uint32_t id = frontier[i];
+            stats->nodesCompared++;
+            if (hashes[i] == tree->nodes[id]) continue;
+            if (id >= tree->numLeaves) {
+                if (id - tree->numLeaves < (uint32_t)ht->size) {
+                    diffBuckets[numDiff++] = id - tree->numLeaves;
+                }
+            } else {
+                next[nextCount++] = 2 * id;
+                next[nextCount++] = 2 * id + 1;
+            }
+        }
+        uint32_t *swap = frontier;
+        frontier = next;
+        next = swap;
+        frontierCount = nextCount;
+    }
+
+    // 3. Fetch the differing buckets and reconcile them
+    if (rc == 0 && numDiff > 0) {
+        BucketContents *remote = (BucketContents*)calloc(numDiff, sizeof(BucketContents));
+        BucketContents *local = (BucketContents*)calloc(numDiff, sizeof(BucketContents));
+        rc = (remote && local) ? merkleRequest(fd, MERKLE_MSG_BUCKETS, diffBuckets, numDiff, stats) : -1;
+        for (uint32_t i = 0; i < numDiff && rc == 0; i++) {
+            uint32_t header[2];
+            rc = readAll(fd, header, sizeof(header), &stats->bytesReceived);
+            // The server answers in sorted order; anything else is a bad peer
+            if (rc == 0 && (header[0] >= (uint32_t)ht->size || (i > 0 && header[0] <= diffBuckets[i - 1]))) {
+                fprintf(stderr, "ERROR: Replica sent an invalid bucket id %u.\n", header[0]);
+                rc = -1;
+                break;
+            }
+            diffBuckets[i] = header[0];
+            for (uint32_t j = 0; j < header[1] && rc == 0; j++) {
+                uint8_t lens[2];
+                char name[MAX_NAME_LEN] = "", phone[MAX_PHONE_LEN] = "";
+                rc = readAll(fd, lens, 2, &stats->bytesReceived);
+                if (rc == 0 && (lens[0] >= MAX_NAME_LEN || lens[1] >= MAX_PHONE_LEN)) rc = -1;
+                if (rc == 0) rc = readAll(fd, name, lens[0], &stats->bytesReceived);
+                if (rc == 0) rc = readAll(fd, phone, lens[1], &stats->bytesReceived);
+                if (rc == 0) bucketContentsAdd(&remote[i], name, phone);
+            }
+        }
+        if (rc == 0) {
+            gatherBuckets(ht, diffBuckets, numDiff, local);
+            for (uint32_t i = 0; i < numDiff; i++) {
+                stats->contactsChanged += merkleReconcileBucket(ht, &local[i], &remote[i]);
+            }
+            stats->bucketsTransferred = numDiff;
+        }
+        for (uint32_t i = 0; remote && local && i < numDiff; i++) {
+            free(remote[i].items);
+            free(local[i].items);
+        }
+        free(remote);
+        free(local);
+    }
+
+    merkleRequest(fd, MERKLE_MSG_DONE, NULL, 0, stats);
+    free(frontier);
+    free(next);
+    free(diffBuckets);
+    free(hashes);
+    return rc;
+}
+
+// Arguments for serving a replica on a background thread
+typedef struct MerkleServeJob {
+    HashTable *ht;
+    int fd;
+} MerkleServeJob;
+
+static void* merkleServeThread(void *arg) {
+    MerkleServeJob *job = (MerkleServeJob*)arg;
+    merkleServe(job->ht, job->fd);
+    return NULL;
+}
+
+/**
+ * @brief The "sync" tool: brings a replica snapshot up to date with a source.
+ * Both snapshots are loaded, and the sync protocol runs over a socket pair
+ * exactly as it would between two hosts.
+ * Usage: phonebook sync <replica.snap> <source.snap>
+ * @return The process exit status.
+ */
+int runSyncTool(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s sync <replica.snap> <source.snap>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    HashTable *replica = loadSnapshot(argv[2]);
+    HashTable *source = replica ? loadSnapshot(argv[3]) : NULL;
+    int fds[2];
+    if (!source || enableMerkleTree(replica) != 0 || enableMerkleTree(source) != 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        releaseHashTable(replica);
+        releaseHashTable(source);
+        return EXIT_FAILURE;
+    }
+
+    MerkleServeJob job = { source, fds[1] };
+    pthread_t server;
+    int err = pthread_create(&server, NULL, merkleServeThread, &job);
+    if (err != 0) {
+        fprintf(stderr, "ERROR: Could not start the sync server: %s\n", strerror(err));
+        close(fds[0]);
+        close(fds[1]);
+        releaseHashTable(replica);
+        releaseHashTable(source);
+        return EXIT_FAILURE;
+    }
+    MerkleSyncStats stats;
+    int rc = merkleSyncFrom(replica, fds[0], &stats);
+    pthread_join(server, NULL);
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("Sync %s: %lu round trips, %lu nodes compared, %lu buckets transferred, "
+           "%lu contacts changed, %lu bytes sent, %lu bytes received.\n",
+           rc == 0 && merkleRoot(replica) == merkleRoot(source) ? "complete" : "FAILED",
+           stats.roundTrips, stats.nodesCompared, stats.bucketsTransferred,
+           stats.contactsChanged, stats.bytesSent, stats.bytesReceived);
+    if (rc == 0) rc = saveSnapshot(replica, argv[2]);
+
+    releaseHashTable(replica);
+    releaseHashTable(source);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Parallel partitioning and set operations                           */
+/*                                                                     */
+/*  Contacts are radix-partitioned by the top bits of a 64-bit key      */
+/*  hash (two passes: per-thread histograms, then a scatter into        */
+/*  exclusive slices, so no locks are needed). Inputs partitioned with  */
+/*  the same bits line up partition by partition, so set operations     */
+/*  and diffs become independent small hash joins that threads pick up  */
+/*  one partition at a time.                                            */
+/* ------------------------------------------------------------------ */
+
+// One contact reference inside a partition
+typedef struct PartitionEntry {
+    uint64_t hash;
+    const char *name;
+    const char *phone;
+} PartitionEntry;
+
+// Contacts of one table split into 2^bits partitions
+typedef struct PartitionSet {
+    int bits;
+    int numPartitions;
+    PartitionEntry **parts;
+    size_t *counts;
+    DiskRecord *spilled; // Copies of spilled contacts the entries point into
+    size_t numSpilled;
+} PartitionSet;
+
+// Keys contacts can be partitioned by
+typedef enum PartitionKey {
+    PARTITION_BY_NAME,
+    PARTITION_BY_PHONE
+} PartitionKey;
+
+// Work description for one partitioning thread
+typedef struct PartitionWorker {
+    HashTable *ht;
+    PartitionSet *set;
+    PartitionKey key;
+    int firstBucket;
+    int lastBucket;
+    const DiskRecord *records; // Spilled contacts handled by this worker
+    size_t numRecords;
+    size_t *cursor; // Per-partition histogram, then write offsets
+} PartitionWorker;
+
+/**
+ * @brief Returns the number of contacts held in memory.
+ * @param ht A pointer to the hash table.
+ * @return The number of resident ContactNodes.
+ */
+size_t residentContacts(HashTable *ht) {
+    return ht->memoryUsed / sizeof(ContactNode);
+}
+
+// Contacts copied out of a table's disk store
+typedef struct SpillCopy {
+    DiskRecord *records;
+    size_t count;
+    size_t capacity;
+} SpillCopy;
+
+static void spillCopyRecord(uint32_t pageId, const DiskRecord *rec, void *ctx) {
+    (void)pageId;
+    SpillCopy *copy = (SpillCopy*)ctx;
+    if (copy->count < copy->capacity) copy->records[copy->count++] = *rec;
+}
+
+/**
+ * @brief Copies out the contacts that do not live in ContactNodes, i.e.
+ * the whole disk store of a disk-backed table or the overflow store of a
+ * budgeted one.
+ * @param ht A pointer to the hash table.
+ * @param copy Receives the copies (records is NULL when there are none).
+ * @return 0 on success, -1 on failure.
+ */
+static int copySpilledContacts(HashTable *ht, SpillCopy *copy) {
+    memset(copy, 0, sizeof(*copy));
+    DiskHash *store = ht->disk ? ht->disk : ht->overflow;
+    if (!store || store->numRecords == 0) return 0;
+    copy->capacity = store->numRecords;
+    copy->records = (DiskRecord*)malloc(copy->capacity * sizeof(DiskRecord));
+    if (!copy->records) {
+        perror("Failed to copy spilled contacts");
+        return -1;
+    }
+    diskHashForEach(store, spillCopyRecord, copy);
+    return 0;
+}
+
+/**
+ * @brief Returns the number of online CPUs, used as the default thread count.
+ * @return The CPU count (at least 1).
+ */
+int defaultThreadCount(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+/**
+ * @brief Returns the partitioning hash of a contact.
+ * @param key Which field to partition by.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return The mixed 64-bit hash.
+ */
+static uint64_t partitionHash(PartitionKey key, const char *name, const char *phone) {
+    return mixHash(hashString(key == PARTITION_BY_NAME ? name : phone));
+}
+
+// Places one contact at the worker's next write offset of its partition
+static void partitionScatterOne(PartitionWorker *w, int shift, const char *name,
+                                const char *phone) {
+    uint64_t h = partitionHash(w->key, name, phone);
+    PartitionEntry *e = &w->set->parts[h >> shift][w->cursor[h >> shift]++];
+    e->hash = h;
+    e->name = name;
+    e->phone = phone;
+}
+
+static void* partitionCountRun(void *arg) {
+    PartitionWorker *w = (PartitionWorker*)arg;
+    int shift = 64 - w->set->bits;
+    for (int i = w->firstBucket; i < w->lastBucket; i++) {
+        for (ContactNode *node = w->ht->table[i]; node; node = node->next) {
+            w->cursor[partitionHash(w->key, node->name, node->phone) >> shift]++;
+        }
+    }
+    for (size_t i = 0; i < w->numRecords; i++) {
+        w->cursor[partitionHash(w->key, w->records[i].name, w->records[i].phone) >> shift]++;
+    }
+    return NULL;
+}
+
+static void* partitionScatterRun(void *arg) {
+    PartitionWorker *w = (PartitionWorker*)arg;
+    int shift = 64 - w->set->bits;
+    for (int i = w->firstBucket; i < w->lastBucket; i++) {
+        for (ContactNode *node = w->ht->table[i]; node; node = node->next) {
+            partitionScatterOne(w, shift, node->name, node->phone);
+        }
+    }
+    for (size_t i = 0; i < w->numRecords; i++) {
+        partitionScatterOne(w, shift, w->records[i].name, w->records[i].phone);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs one function over every worker, each on its own thread.
+ * @param fn The thread function.
+ * @param workers The worker array.
+ * @param size The size of one worker.
+ * @param count The number of workers.
+ */
+static void runWorkers(void *(*fn)(void*), void *workers, size_t size, int count) {
+    pthread_t *tids = (pthread_t*)calloc(count, sizeof(pthread_t));
+    char *created = (char*)calloc(count, 1);
+    for (int t = 0; t < count; t++) {
+        void *w = (char*)workers + t * size;
+        if (tids && created && pthread_create(&tids[t], NULL, fn, w) == 0) {
+            created[t] = 1;
+        } else {
+            fn(w); // Fall back to running inline
+        }
+    }
+    for (int t = 0; t < count; t++) {
+        if (created && created[t]) pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    free(created);
+}
+
+/**
+ * @brief Runs the same job function on several threads plus the caller.
+ * The function is expected to claim work items itself (e.g. partitions
+ * through an atomic counter) until none are left.
+ * @param fn The thread function.
+ * @param job The shared job state.
+ * @param threads The total number of threads, including the caller.
+ */
+static void runParallel(void *(*fn)(void*), void *job, int threads) {
+    if (threads < 1) threads = 1;
+    pthread_t *tids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    int started = 0;
+    for (int t = 0; t < threads - 1 && tids; t++) {
+        if (pthread_create(&tids[started], NULL, fn, job) == 0) started++;
+    }
+    fn(job); // The caller works too
+    for (int t = 0; t < started; t++) pthread_join(tids[t], NULL);
+    free(tids);
+}
+
+/**
+ * @brief Picks partition bits so partitions hold a few thousand entries.
+ * @param total The number of contacts to partition.
+ * @return The number of partition bits.
+ */
+int choosePartitionBits(size_t total) {
+    int bits = PARTITION_MIN_BITS;
+    while (bits < PARTITION_MAX_BITS &&
+           ((size_t)1 << bits) * PARTITION_TARGET_ENTRIES < total) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * @brief Frees a partition set.
+ * @param set The partition set.
+ */
+void freePartitionSet(PartitionSet *set) {
+    if (!set) return;
+    for (int p = 0; p < set->numPartitions; p++) free(set->parts[p]);
+    free(set->parts);
+    free(set->counts);
+    free(set->spilled);
+    free(set);
+}
+
+/**
+ * @brief Radix-partitions the contacts of a table in parallel.
+ * Resident entries point into the table's nodes, so the table must outlive
+ * the set; spilled contacts are copied into the set and handled by one
+ * extra worker.
+ * @param ht A pointer to the (in-memory) hash table.
+ * @param key Which field to partition by.
+ * @param bits The number of partition bits.
+ * @param threads The number of threads.
+ * @return The partition set, or NULL on failure.
+ */
+PartitionSet* partitionContacts(HashTable *ht, PartitionKey key, int bits, int threads) {
+    PartitionSet *set = (PartitionSet*)calloc(1, sizeof(PartitionSet));
+    if (!set) return NULL;
+    set->bits = bits;
+    set->numPartitions = 1 << bits;
+    set->parts = (PartitionEntry**)calloc(set->numPartitions, sizeof(PartitionEntry*));
+    set->counts = (size_t*)calloc(set->numPartitions, sizeof(size_t));
+    SpillCopy spilled;
+    if (copySpilledContacts(ht, &spilled) != 0) {
+        freePartitionSet(set);
+        return NULL;
+    }
+    set->spilled = spilled.records;
+    set->numSpilled = spilled.count;
+
+    if (threads < 1) threads = 1;
+    if (threads > ht->size) threads = ht->size > 0 ? ht->size : 1;
+    int numWorkers = threads + (set->numSpilled > 0);
+    PartitionWorker *workers = (PartitionWorker*)calloc(numWorkers, sizeof(PartitionWorker));
+    size_t *cursors = (size_t*)calloc((size_t)numWorkers * set->numPartitions, sizeof(size_t));
+    if (!set->parts || !set->counts || !workers || !cursors) {
+        perror("Failed to allocate partitions");
+        free(workers);
+        free(cursors);
+        freePartitionSet(set);
+        return NULL;
+    }
+    for (int t = 0; t < numWorkers; t++) {
+        workers[t].ht = ht;
+        workers[t].set = set;
+        workers[t].key = key;
+        workers[t].firstBucket = (int)((long long)ht->size * (t < threads ? t : threads) / threads);
+        workers[t].lastBucket = (int)((long long)ht->size * (t < threads ? t + 1 : threads) / threads);
+        workers[t].cursor = cursors + (size_t)t * set->numPartitions;
+    }
+    if (numWorkers > threads) {
+        workers[threads].records = set->spilled;
+        workers[threads].numRecords = set->numSpilled;
+    }
+
+    // 1. Histogram pass
+    runWorkers(partitionCountRun, workers, sizeof(PartitionWorker), numWorkers);
+
+    // 2. Turn histograms into exclusive write offsets per (thread, partition)
+    int failed = 0;
+    for (int p = 0; p < set->numPartitions; p++) {
+        size_t total = 0;
+        for (int t = 0; t < numWorkers; t++) {
+            size_t n = workers[t].cursor[p];
+            workers[t].cursor[p] = total;
+            total += n;
+        }
+        set->counts[p] = total;
+        set->parts[p] = (PartitionEntry*)malloc((total ? total : 1) * sizeof(PartitionEntry));
+        if (!set->parts[p]) failed = 1;
+    }
+
+    // 3. Scatter pass
+    if (!failed) runWorkers(partitionScatterRun, workers, sizeof(PartitionWorker), numWorkers);
+    free(workers);
+    free(cursors);
+    if (failed) {
+        perror("Failed to allocate partitions");
+        freePartitionSet(set);
+        return NULL;
+    }
+    return set;
+}
+
+// One key of a partition-local join, with its value in each input
+typedef struct JoinSlot {
+    uint64_t hash;
+    const char *name;
+    const char *phone[3]; // NULL where the input does not have the key
+} JoinSlot;
+
+/**
+ * @brief Joins the same partition of up to three inputs on the name.
+ * @param inputs The partition sets (all with the same bits; NULL to skip).
+ * @param numInputs The number of inputs.
+ * @param p The partition index.
+ * @param capacity Receives the slot array's capacity.
+ * @return A sparse slot array (empty slots have name == NULL), or NULL.
+ */
+static JoinSlot* joinPartition(PartitionSet **inputs, int numInputs, int p, size_t *capacity) {
+    size_t total = 0;
+    for (int k = 0; k < numInputs; k++) {
+        if (inputs[k]) total += inputs[k]->counts[p];
+    }
+    size_t cap = 16;
+    while (cap < 2 * total) cap <<= 1;
+    JoinSlot *slots = (JoinSlot*)calloc(cap, sizeof(JoinSlot));
+    if (!slots) return NULL;
+
+    for (int k = 0; k < numInputs; k++) {
+        if (!inputs[k]) continue;
+        for (size_t i = 0; i < inputs[k]->counts[p]; i++) {
+            const PartitionEntry *e = &inputs[k]->parts[p][i];
+            size_t pos = e->hash & (cap - 1);
+            while (slots[pos].name &&
+                   (slots[pos].hash != e->hash || strcmp(slots[pos].name, e->name) != 0)) {
+                pos = (pos + 1) & (cap - 1);
+            }
+            if (!slots[pos].name) {
+                slots[pos].hash = e->hash;
+                slots[pos].name = e->name;
+            }
+            if (!slots[pos].phone[k]) slots[pos].phone[k] = e->phone; // First duplicate wins
+        }
+    }
+    *capacity = cap;
+    return slots;
+}
+
+// Set operations over two phonebooks keyed by name
+typedef enum SetOperation {
+    SET_UNION,        // Every name; the left phone wins on conflicts
+    SET_INTERSECTION, // Names in both; the left phone is kept
+    SET_DIFFERENCE    // Names only in the left input
+} SetOperation;
+
+// Output of one partition of a set operation
+typedef struct SetOpOutput {
+    const char **names;
+    const char **phones;
+    size_t count;
+} SetOpOutput;
+
+// Shared state of the set-operation / diff workers
+typedef struct JoinJob {
+    PartitionSet *inputs[3];
+    int numInputs;
+    SetOperation op;
+    int threeWay;
+    int nextPartition;    // Claimed atomically by workers
+    SetOpOutput *outputs; // One per partition (set operations)
+    char **reports;       // One text buffer per partition (diffs)
+    size_t *reportLens;
+    unsigned long *categoryCounts; // Per partition x DIFF_CATEGORIES
+    int failed;           // Set by a worker that could not finish a partition
+} JoinJob;
+
+static void* setOperationRun(void *arg) {
+    JoinJob *job = (JoinJob*)arg;
+    int numPartitions = job->inputs[0]->numPartitions;
+    int p;
+    while ((p = __atomic_fetch_add(&job->nextPartition, 1, __ATOMIC_RELAXED)) < numPartitions) {
+        size_t cap;
+        JoinSlot *slots = joinPartition(job->inputs, 2, p, &cap);
+        if (!slots) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        SetOpOutput *out = &job->outputs[p];
+        out->names = (const char**)malloc(cap * sizeof(char*));
+        out->phones = (const char**)malloc(cap * sizeof(char*));
+        if (!out->names || !out->phones) __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < cap && out->names && out->phones; i++) {
+            const JoinSlot *slot = &slots[i];
+            if (!slot->name) continue;
+            const char *phone = NULL;
+            switch (job->op) {
+                case SET_UNION:
+                    phone = slot->phone[0] ? slot->phone[0] : slot->phone[1];
+                    break;
+                case SET_INTERSECTION:
+                    phone = slot->phone[1] ? slot->phone[0] : NULL;
+                    break;
+                case SET_DIFFERENCE:
+                    phone = slot->phone[1] ? NULL : slot->phone[0];
+                    break;
+            }
+            if (phone) {
+                out->names[out->count] = slot->name;
+                out->phones[out->count] = phone;
+                out->count++;
+            }
+        }
+        free(slots);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Computes a set operation between two phonebooks, keyed by name.
+ * Both inputs are partitioned in parallel and joined partition by
+ * partition; the result is a new table.
+ * @param a The left phonebook.
+ * @param b The right phonebook.
+ * @param op The operation.
+ * @param threads The number of threads.
+ * @return The result table, or NULL on failure (no partial result is
+ * returned).
+ */
+HashTable* phonebookSetOperation(HashTable *a, HashTable *b, SetOperation op, int threads) {
+    if (a->disk || b->disk) {
+        fprintf(stderr, "ERROR: Set operations need in-memory tables.\n");
+        return NULL;
+    }
+    size_t total = residentContacts(a) + residentContacts(b);
+    int bits = choosePartitionBits(total);
+
+    JoinJob job;
+    memset(&job, 0, sizeof(job));
+    job.inputs[0] = partitionContacts(a, PARTITION_BY_NAME, bits, threads);
+    job.inputs[1] = partitionContacts(b, PARTITION_BY_NAME, bits, threads);
+    job.numInputs = 2;
+    job.op = op;
+    job.outputs = (SetOpOutput*)calloc((size_t)1 << bits, sizeof(SetOpOutput));
+    HashTable *result = NULL;
+
+    if (job.inputs[0] && job.inputs[1] && job.outputs) {
+        // 1. Join partitions in parallel
+        runParallel(setOperationRun, &job, threads);
+
+        // 2. Materialise the result table
+        if (!job.failed) result = createHashTable(a->size > b->size ? a->size : b->size);
+        for (int p = 0; result && p < (1 << bits); p++) {
+            for (size_t i = 0; i < job.outputs[p].count; i++) {
+                if (addContact(result, job.outputs[p].names[i], job.outputs[p].phones[i]) < 0) {
+                    job.failed = 1;
+                }
+            }
+        }
+    }
+    if (job.failed || !result) {
+        fprintf(stderr, "ERROR: The set operation ran out of memory.\n");
+        releaseHashTable(result);
+        result = NULL;
+    }
+
+    for (int p = 0; job.outputs && p < (1 << bits); p++) {
+        free(job.outputs[p].names);
+        free(job.outputs[p].phones);
+    }
+    free(job.outputs);
+    freePartitionSet(job.inputs[0]);
+    freePartitionSet(job.inputs[1]);
+    return result;
+}
+
+// Categories of a diff report
+enum {
+    DIFF_ADDED_LEFT, DIFF_ADDED_RIGHT, DIFF_REMOVED_LEFT, DIFF_REMOVED_RIGHT,
+    DIFF_CHANGED_LEFT, DIFF_CHANGED_RIGHT, DIFF_SAME_CHANGE, DIFF_CONFLICT,
+    DIFF_CATEGORIES
+};
+
+static const char *diffCategoryNames[DIFF_CATEGORIES] = {
+    "added-left", "added-right", "removed-left", "removed-right",
+    "changed-left", "changed-right", "same-change", "conflict"
+};
+
+/**
+ * @brief Appends a formatted line to a growable report buffer.
+ * @param buf The buffer.
+ * @param len The current length.
+ * @param fmt The printf-style format.
+ * @return 0 on success, -1 if the line could not be added.
+ */
+static int reportAppend(char **buf, size_t *len, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static int reportAppend(char **buf, size_t *len, const char *fmt, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n < 0) return -1;
+    if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+
+    char *grown = (char*)realloc(*buf, *len + n + 1);
+    if (!grown) return -1;
+    memcpy(grown + *len, line, n + 1);
+    *buf = grown;
+    *len += n;
+    return 0;
+}
+
+/**
+ * @brief Classifies one key of a three-way diff.
+ * @param base The base phone (NULL if absent).
+ * @param left The left phone (NULL if absent).
+ * @param right The right phone (NULL if absent).
+ * @return The category, or -1 if nothing changed.
+ */
+static int classifyDiff(const char *base, const char *left, const char *right) {
+#define SAME(x, y) ((x) == (y) || ((x) && (y) && strcmp((x), (y)) == 0))
+    if (SAME(left, right)) return SAME(base, left) ? -1 : DIFF_SAME_CHANGE;
+    if (SAME(base, left)) {
+        return !base ? DIFF_ADDED_RIGHT : !right ? DIFF_REMOVED_RIGHT : DIFF_CHANGED_RIGHT;
+    }
+    if (SAME(base, right)) {
+        return !base ? DIFF_ADDED_LEFT : !left ? DIFF_REMOVED_LEFT : DIFF_CHANGED_LEFT;
+    }
+    return DIFF_CONFLICT;
+#undef SAME
+}
+
+static void* diffRun(void *arg) {
+    JoinJob *job = (JoinJob*)arg;
+    int numPartitions = job->inputs[1]->numPartitions;
+    int p;
+    while ((p = __atomic_fetch_add(&job->nextPartition, 1, __ATOMIC_RELAXED)) < numPartitions) {
+        size_t cap;
+        JoinSlot *slots = joinPartition(job->inputs, 3, p, &cap);
+        if (!slots) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        unsigned long *counts = job->categoryCounts + (size_t)p * DIFF_CATEGORIES;
+        for (size_t i = 0; i < cap; i++) {
+            const JoinSlot *slot = &slots[i];
+            if (!slot->name) continue;
+            // Two-way diffs compare left (old) against right (new)
+            const char *base = job->threeWay ? slot->phone[0] : slot->phone[1];
+            int category = classifyDiff(base, slot->phone[1], slot->phone[2]);
+            if (category < 0) continue;
+            counts[category]++;
+            if (reportAppend(&job->reports[p], &job->reportLens[p], "%s\t%s\t%s\t%s\t%s\n",
+                             diffCategoryNames[category], slot->name,
+                             slot->phone[0] ? slot->phone[0] : "-",
+                             slot->phone[1] ? slot->phone[1] : "-",
+                             slot->phone[2] ? slot->phone[2] : "-") != 0) {
+                __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            }
+        }
+        free(slots);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Writes a diff report between phonebooks as tab-separated lines.
+ * With a base, it is a three-way diff (base, left, right) and every key is
+ * classified as added/removed/changed on one side, the same change on
+ * both, or a conflict. Without a base, left is the old version and right
+ * the new one, reported as *-right changes.
+ * Columns: category, name, base phone, left phone, right phone.
+ * @param base The common ancestor, or NULL for a two-way diff.
+ * @param left The left (or old) phonebook.
+ * @param right The right (or new) phonebook.
+ * @param out The stream to write the report to.
+ * @param threads The number of threads.
+ * @return 0 on success, -1 on failure.
+ */
+int phonebookDiff(HashTable *base, HashTable *left, HashTable *right, FILE *out, int threads) {
+    if ((base && base->disk) || left->disk || right->disk) {
+        fprintf(stderr, "ERROR: Diffs need in-memory tables.\n");
+        return -1;
+    }
+    size_t total = (base ? residentContacts(base) : 0) + residentContacts(left) +
+                   residentContacts(right);
+    int bits = choosePartitionBits(total);
+    int numPartitions = 1 << bits;
+
+    JoinJob job;
+    memset(&job, 0, sizeof(job));
+    job.inputs[0] = base ? partitionContacts(base, PARTITION_BY_NAME, bits, threads) : NULL;
+    job.inputs[1] = partitionContacts(left, PARTITION_BY_NAME, bits, threads);
+    job.inputs[2] = partitionContacts(right, PARTITION_BY_NAME, bits, threads);
+    job.numInputs = 3;
+    job.threeWay = base != NULL;
+    job.reports = (char**)calloc(numPartitions, sizeof(char*));
+    job.reportLens = (size_t*)calloc(numPartitions, sizeof(size_t));
+    job.categoryCounts = (unsigned long*)calloc((size_t)numPartitions * DIFF_CATEGORIES,
+                                                sizeof(unsigned long));
+    int ready = (!base || job.inputs[0]) && job.inputs[1] && job.inputs[2] &&
+                job.reports && job.reportLens && job.categoryCounts;
+    int rc = -1;
+
+    // 1. Classify partitions in parallel; an incomplete report is not emitted
+    if (ready) runParallel(diffRun, &job, threads);
+    if (ready && job.failed) {
+        fprintf(stderr, "ERROR: The diff ran out of memory.\n");
+    } else if (ready) {
+        // 2. Emit the report in partition order, then the summary
+        unsigned long totals[DIFF_CATEGORIES] = { 0 };
+        fprintf(out, "category\tname\tbase\tleft\tright\n");
+        for (int p = 0; p < numPartitions; p++) {
+            if (job.reports[p]) fwrite(job.reports[p], 1, job.reportLens[p], out);
+            for (int c = 0; c < DIFF_CATEGORIES; c++) {
+                totals[c] += job.categoryCounts[(size_t)p * DIFF_CATEGORIES + c];
+            }
+        }
+        fprintf(out, "# summary:");
+        for (int c = 0; c < DIFF_CATEGORIES; c++) {
+            if (totals[c]) fprintf(out, " %s=%lu", diffCategoryNames[c], totals[c]);
+        }
+        fprintf(out, "\n");
+        rc = ferror(out) ? -1 : 0;
+    }
+
+    for (int p = 0; job.reports && p < numPartitions; p++) free(job.reports[p]);
+    free(job.reports);
+    free(job.reportLens);
+    free(job.categoryCounts);
+    for (int k = 0; k < 3; k++) freePartitionSet(job.inputs[k]);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Duplicate phone detection                                          */
+/*                                                                     */
+/*  A single parallel group-by: contacts are radix-partitioned by phone */
+/*  hash, so every copy of a phone number lands in the same partition,  */
+/*  then each partition is sorted and scanned for runs of one phone     */
+/*  with more than one distinct name.                                   */
+/* ------------------------------------------------------------------ */
+
+// A phone number shared by several names
+typedef struct DuplicateCluster {
+    const char *phone;
+    const char **names;
+    size_t count;
+} DuplicateCluster;
+
+// All duplicate clusters of a table, grouped by partition
+typedef struct DuplicateReport {
+    DuplicateCluster *clusters;
+    size_t count;
+    size_t capacity;
+    DiskRecord *spilled; // Spilled contacts the clusters may point into
+} DuplicateReport;
+
+// Shared state of the duplicate-detection workers
+typedef struct DuplicateJob {
+    PartitionSet *set;
+    int nextPartition;
+    DuplicateReport *perPartition;
+} DuplicateJob;
+
+static int compareByPhone(const void *a, const void *b) {
+    const PartitionEntry *x = (const PartitionEntry*)a, *y = (const PartitionEntry*)b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    int c = strcmp(x->phone, y->phone);
+    return c ? c : strcmp(x->name, y->name);
+}
+
+static void* duplicateRun(void *arg) {
+    DuplicateJob *job = (DuplicateJob*)arg;
+    int p;
+    while ((p = __atomic_fetch_add(&job->nextPartition, 1, __ATOMIC_RELAXED)) <
+           job->set->numPartitions) {
+        PartitionEntry *entries = job->set->parts[p];
+        size_t n = job->set->counts[p];
+        DuplicateReport *out = &job->perPartition[p];
+        qsort(entries, n, sizeof(PartitionEntry), compareByPhone);
+
+        // Scan runs of equal phones, counting distinct (sorted) names
+        for (size_t start = 0; start < n; ) {
+            size_t end = start + 1, distinct = 1;
+            while (end < n && entries[end].hash == entries[start].hash &&
+                   strcmp(entries[end].phone, entries[start].phone) == 0) {
+                if (strcmp(entries[end].name, entries[end - 1].name) != 0) distinct++;
+                end++;
+            }
+            if (distinct > 1) {
+                if (out->count == out->capacity) {
+                    size_t cap = out->capacity ? out->capacity * 2 : 8;
+                    DuplicateCluster *grown =
+                        (DuplicateCluster*)realloc(out->clusters, cap * sizeof(DuplicateCluster));
+                    if (!grown) break;
+                    out->clusters = grown;
+                    out->capacity = cap;
+                }
+                DuplicateCluster *cluster = &out->clusters[out->count];
+                cluster->names = (const char**)malloc(distinct * sizeof(char*));
+                if (!cluster->names) break;
+                cluster->phone = entries[start].phone;
+                cluster->count = 0;
+                for (size_t i = start; i < end; i++) {
+                    if (i == start || strcmp(entries[i].name, entries[i - 1].name) != 0) {
+                        cluster->names[cluster->count++] = entries[i].name;
+                    }
+                }
+                out->count++;
+            }
+            start = end;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Frees a duplicate report.
+ * @param report The report.
+ */
+void freeDuplicateReport(DuplicateReport *report) {
+    if (!report) return;
+    for (size_t i = 0; i < report->count; i++) free(report->clusters[i].names);
+    free(report->clusters);
+    free(report->spilled);
+    free(report);
+}
+
+/**
+ * @brief Finds every phone number shared by more than one name, including
+ * contacts spilled to the overflow store.
+ * Strings in the report point into the table, which must outlive it.
+ * @param ht A pointer to the (in-memory) hash table.
+ * @param threads The number of threads.
+ * @return The report, or NULL on failure.
+ */
+DuplicateReport* findDuplicatePhones(HashTable *ht, int threads) {
+    if (ht->disk) {
+        fprintf(stderr, "ERROR: Duplicate detection needs an in-memory table.\n");
+        return NULL;
+    }
+    DuplicateJob job;
+    memset(&job, 0, sizeof(job));
+    size_t total = residentContacts(ht) + (ht->overflow ? ht->overflow->numRecords : 0);
+    job.set = partitionContacts(ht, PARTITION_BY_PHONE, choosePartitionBits(total), threads);
+    if (!job.set) return NULL;
+    job.perPartition = (DuplicateReport*)calloc(job.set->numPartitions, sizeof(DuplicateReport));
+    DuplicateReport *report = (DuplicateReport*)calloc(1, sizeof(DuplicateReport));
+    if (!job.perPartition || !report) {
+        free(job.perPartition);
+        free(report);
+        freePartitionSet(job.set);
+        return NULL;
+    }
+
+    // 1. Group by phone, one partition at a time, in parallel
+    runParallel(duplicateRun, &job, threads);
+
+    // 2. Concatenate the per-partition clusters
+    for (int p = 0; p < job.set->numPartitions; p++) report->capacity += job.perPartition[p].count;
+    report->clusters = (DuplicateCluster*)malloc((report->capacity + 1) * sizeof(DuplicateCluster));
+    for (int p = 0; p < job.set->numPartitions; p++) {
+        DuplicateReport *part = &job.perPartition[p];
+        if (report->clusters) {
+            if (part->count) {
+                memcpy(report->clusters + report->count, part->clusters,
+                       part->count * sizeof(DuplicateCluster));
+            }
+            report->count += part->count;
+        } else {
+            for (size_t i = 0; i < part->count; i++) free(part->clusters[i].names);
+        }
+        free(part->clusters);
+    }
+    free(job.perPartition);
+    report->spilled = job.set->spilled; // Cluster names may point into it
+    job.set->spilled = NULL;
+    freePartitionSet(job.set);
+    return report;
+}
+
+/**
+ * @brief Prints every phone number shared by more than one name.
+ * @param ht A pointer to the hash table.
+ */
+void displayDuplicatePhones(HashTable *ht) {
+    DuplicateReport *report = findDuplicatePhones(ht, defaultThreadCount());
+    if (!report) return;
+
+    printf("\n--- Shared Phone Numbers ---\n");
+    for (size_t i = 0; i < report->count; i++) {
+        DuplicateCluster *cluster = &report->clusters[i];
+        printf("Phone: %s (%zu names)\n", cluster->phone, cluster->count);
+        for (size_t j = 0; j < cluster->count; j++) {
+            printf("  -> Name: %s\n", cluster->names[j]);
+        }
+    }
+    if (report->count == 0) {
+        printf("No phone number is shared by several names.\n");
+    }
+    printf("----------------------------\n");
+    freeDuplicateReport(report);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Near-duplicate names (MinHash + LSH)                               */
+/*                                                                     */
+/*  Names are normalised (case folded, punctuation dropped, words      */
+/*  sorted so "Smith, John" == "john smith"), cut into character        */
+/*  3-gram shingles and summarised by a 64-value MinHash signature.     */
+/*  Signatures are split into 16 bands of 4; names agreeing on a whole  */
+/*  band become candidates, which are verified by signature agreement   */
+/*  and merged with union-find. Work is near-linear in the table size.  */
+/* ------------------------------------------------------------------ */
+
+// A group of names that look like variants of each other
+typedef struct NameCluster {
+    const char **names;
+    size_t count;
+} NameCluster;
+
+// All near-duplicate clusters of a table
+typedef struct NameClusterReport {
+    NameCluster *clusters;
+    size_t count;
+    DiskRecord *spilled; // Spilled contacts the clusters may point into
+} NameClusterReport;
+
+// A verified candidate pair of item indexes
+typedef struct IndexPair {
+    uint32_t a;
+    uint32_t b;
+} IndexPair;
+
+// A band key of one item, used to bucket items by band
+typedef struct BandKey {
+    uint64_t key;
+    uint32_t item;
+} BandKey;
+
+// Shared state of the MinHash workers
+typedef struct MinHashJob {
+    const char **names;
+    uint32_t numNames;
+    uint32_t *signatures; // numNames x MINHASH_SIZE
+    int nextChunk;        // Signature work, claimed in chunks
+    int nextBand;         // Banding work, claimed one band at a time
+    IndexPair **pairs;    // Per band verified pairs
+    size_t *pairCounts;
+} MinHashJob;
+
+#define MINHASH_CHUNK 1024
+
+// Per-lane multipliers (odd) and offsets of the MinHash permutations
+static uint32_t minHashMul[MINHASH_SIZE];
+static uint32_t minHashAdd[MINHASH_SIZE];
+static pthread_once_t minHashOnce = PTHREAD_ONCE_INIT;
+
+static void minHashInitParams(void) {
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    for (int i = 0; i < MINHASH_SIZE; i++) {
+        state = mixHash(state + 0x9e3779b97f4a7c15ULL);
+        minHashMul[i] = (uint32_t)state | 1;
+        minHashAdd[i] = (uint32_t)(state >> 32);
+    }
+}
+
+/**
+ * @brief Normalises a name for similarity: lower case, words sorted.
+ * @param name The name.
+ * @param out Receives the normalised name, padded with a leading and
+ *            trailing space (at least MAX_NAME_LEN + 2 bytes).
+ * @return The length of the normalised text.
+ */
+static size_t normalizeNameForSimilarity(const char *name, char *out) {
+    char words[MAX_NAME_LEN][MAX_NAME_LEN];
+    int numWords = 0, len = 0;
+
+    // 1. Split on anything that is not a letter or digit
+    for (const unsigned char *p = (const unsigned char*)name; ; p++) {
+        if (*p && (isalnum(*p) || *p >= 0x80)) {
+            if (len < MAX_NAME_LEN - 1) words[numWords][len++] = (char)tolower(*p);
+        } else {
+            if (len > 0) {
+                words[numWords][len] = '\0';
+                numWords++;
+                len = 0;
+            }
+            if (!*p || numWords == MAX_NAME_LEN) break;
+        }
+    }
+
+    // 2. Sort the words (insertion sort; there are only a few)
+    for (int i = 1; i < numWords; i++) {
+        char tmp[MAX_NAME_LEN];
+        memcpy(tmp, words[i], MAX_NAME_LEN);
+        int j = i - 1;
+        while (j >= 0 && strcmp(words[j], tmp) > 0) {
+            memcpy(words[j + 1], words[j], MAX_NAME_LEN);
+            j--;
+        }
+        memcpy(words[j + 1], tmp, MAX_NAME_LEN);
+    }
+
+    // 3. Join with single spaces, padded so edge shingles are kept
+    size_t outLen = 0;
+    out[outLen++] = ' ';
+    for (int i = 0; i < numWords; i++) {
+        size_t wl = strlen(words[i]);
+        if (outLen + wl + 1 > MAX_NAME_LEN) break;
+        memcpy(out + outLen, words[i], wl);
+        outLen += wl;
+        out[outLen++] = ' ';
+    }
+    out[outLen] = '\0';
+    return outLen;
+}
+
+/**
+ * @brief Folds a shingle value into a signature (portable version).
+ * @param sig The signature (MINHASH_SIZE values).
+ * @param x The shingle hash.
+ */
+static void minHashUpdateScalar(uint32_t *sig, uint32_t x) {
+    for (int i = 0; i < MINHASH_SIZE; i++) {
+        uint32_t h = minHashMul[i] * x + minHashAdd[i];
+        if (h < sig[i]) sig[i] = h;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Folds a shingle value into a signature, eight lanes at a time.
+ * @param sig The signature (MINHASH_SIZE values).
+ * @param x The shingle hash.
+ */
+__attribute__((target("avx2")))
+static void minHashUpdateAvx2(uint32_t *sig, uint32_t x) {
+    __m256i vx = _mm256_set1_epi32((int)x);
+    for (int i = 0; i < MINHASH_SIZE; i += 8) {
+        __m256i mul = _mm256_loadu_si256((const __m256i*)(minHashMul + i));
+        __m256i add = _mm256_loadu_si256((const __m256i*)(minHashAdd + i));
+        __m256i h = _mm256_add_epi32(_mm256_mullo_epi32(mul, vx), add);
+        __m256i cur = _mm256_loadu_si256((const __m256i*)(sig + i));
+        _mm256_storeu_si256((__m256i*)(sig + i), _mm256_min_epu32(cur, h));
+    }
+}
+#endif
+
+/**
+ * @brief Computes the MinHash signature of a name.
+ * @param name The name.
+ * @param sig Receives MINHASH_SIZE values.
+ * @param useAvx2 Non-zero to use the AVX2 kernel.
+ */
+static void minHashSignature(const char *name, uint32_t *sig, int useAvx2) {
+    char norm[MAX_NAME_LEN + 2];
+    size_t len = normalizeNameForSimilarity(name, norm);
+
+    for (int i = 0; i < MINHASH_SIZE; i++) sig[i] = UINT32_MAX;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        uint32_t shingle = (uint32_t)(unsigned char)norm[i] |
+                           (uint32_t)(unsigned char)norm[i + 1] << 8 |
+                           (uint32_t)(unsigned char)norm[i + 2] << 16;
+        uint32_t x = (uint32_t)mixHash(shingle);
+#if defined(__x86_64__) || defined(__i386__)
+        if (useAvx2) {
+            minHashUpdateAvx2(sig, x);
+            continue;
+        }
+#endif
+        (void)useAvx2;
+        minHashUpdateScalar(sig, x);
+    }
+}
+
+static void* minHashSignatureRun(void *arg) {
+    MinHashJob *job = (MinHashJob*)arg;
+    int useAvx2 = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+    uint32_t numChunks = (job->numNames + MINHASH_CHUNK - 1) / MINHASH_CHUNK;
+    int c;
+    while ((c = __atomic_fetch_add(&job->nextChunk, 1, __ATOMIC_RELAXED)) < (int)numChunks) {
+        uint32_t end = ((uint32_t)c + 1) * MINHASH_CHUNK;
+        if (end > job->numNames) end = job->numNames;
+        for (uint32_t i = (uint32_t)c * MINHASH_CHUNK; i < end; i++) {
+            minHashSignature(job->names[i], job->signatures + (size_t)i * MINHASH_SIZE, useAvx2);
+        }
+    }
+    return NULL;
+}
+
+static int compareBandKeys(const void *a, const void *b) {
+    const BandKey *x = (const BandKey*)a, *y = (const BandKey*)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->item > y->item) - (x->item < y->item);
+}
+
+/**
+ * @brief Estimates the Jaccard similarity of two items from signatures.
+ * @param job The MinHash job.
+ * @param a The first item.
+ * @param b The second item.
+ * @return The fraction of agreeing signature values.
+ */
+static double minHashSimilarity(const MinHashJob *job, uint32_t a, uint32_t b) {
+    const uint32_t *x = job->signatures + (size_t)a * MINHASH_SIZE;
+    const uint32_t *y = job->signatures + (size_t)b * MINHASH_SIZE;
+    int same = 0;
+    for (int i = 0; i < MINHASH_SIZE; i++) same += x[i] == y[i];
+    return (double)same / MINHASH_SIZE;
+}
+
+static void* minHashBandRun(void *arg) {
+    MinHashJob *job = (MinHashJob*)arg;
+    BandKey *keys = (BandKey*)malloc(((size_t)job->numNames + 1) * sizeof(BandKey));
+    if (!keys) return NULL;
+
+    int band;
+    while ((band = __atomic_fetch_add(&job->nextBand, 1, __ATOMIC_RELAXED)) < MINHASH_BANDS) {
+        // 1. Hash this band of every signature
+        for (uint32_t i = 0; i < job->numNames; i++) {
+            const uint32_t *row = job->signatures + (size_t)i * MINHASH_SIZE + band * MINHASH_ROWS;
+            uint64_t key = (uint64_t)band;
+            for (int r = 0; r < MINHASH_ROWS; r++) key = mixHash(key ^ row[r]);
+            keys[i].key = key;
+            keys[i].item = i;
+        }
+        qsort(keys, job->numNames, sizeof(BandKey), compareBandKeys);
+
+        // 2. Items sharing a band key are candidates; keep verified pairs
+        size_t cap = 0;
+        for (uint32_t start = 0; start < job->numNames; ) {
+            uint32_t end = start + 1;
+            while (end < job->numNames && keys[end].key == keys[start].key) end++;
+            for (uint32_t j = start + 1; j < end; j++) {
+                uint32_t first = j > start + MINHASH_MAX_PAIRS_PER_ITEM
+                                     ? j - MINHASH_MAX_PAIRS_PER_ITEM : start;
+                for (uint32_t i = first; i < j; i++) {
+                    if (minHashSimilarity(job, keys[i].item, keys[j].item) < MINHASH_MIN_SIMILARITY) {
+                        continue;
+                    }
+                    if (job->pairCounts[band] == cap) {
+                        cap = cap ? cap * 2 : 64;
+                        IndexPair *grown = (IndexPair*)realloc(job->pairs[band], cap * sizeof(IndexPair));
+                        if (!grown) break;
+                        job->pairs[band] = grown;
+                    }
+                    job->pairs[band][job->pairCounts[band]].a = keys[i].item;
+                    job->pairs[band][job->pairCounts[band]].b = keys[j].item;
+                    job->pairCounts[band]++;
+                    break; // One verified link per item is enough for union-find
+                }
+            }
+            start = end;
+        }
+    }
+    free(keys);
+    return NULL;
+}
+
+static uint32_t unionFindRoot(uint32_t *parent, uint32_t x) {
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]]; // Path halving
+        x = parent[x];
+    }
+    return x;
+}
+
+/**
+ * @brief Frees a near-duplicate report.
+ * @param report The report.
+ */
+void freeNameClusterReport(NameClusterReport *report) {
+    if (!report) return;
+    for (size_t i = 0; i < report->count; i++) free(report->clusters[i].names);
+    free(report->clusters);
+    free(report->spilled);
+    free(report);
+}
+
+/**
+ * @brief Finds clusters of names that look like variants of each other,
+ * including contacts spilled to the overflow store.
+ * Strings in the report point into the table, which must outlive it.
+ * @param ht A pointer to the (in-memory) hash table.
+ * @param threads The number of threads.
+ * @return The report, or NULL on failure.
+ */
+NameClusterReport* findSimilarNames(HashTable *ht, int threads) {
+    if (ht->disk) {
+        fprintf(stderr, "ERROR: Similar-name detection needs an in-memory table.\n");
+        return NULL;
+    }
+    pthread_once(&minHashOnce, minHashInitParams);
+
+    // 1. Gather the names, resident and spilled
+    SpillCopy spilled;
+    if (copySpilledContacts(ht, &spilled) != 0) return NULL;
+    MinHashJob job;
+    memset(&job, 0, sizeof(job));
+    size_t total = residentContacts(ht) + spilled.count;
+    job.names = (const char**)malloc((total + 1) * sizeof(char*));
+    job.signatures = (uint32_t*)malloc((total + 1) * MINHASH_SIZE * sizeof(uint32_t));
+    job.pairs = (IndexPair**)calloc(MINHASH_BANDS, sizeof(IndexPair*));
+    job.pairCounts = (size_t*)calloc(MINHASH_BANDS, sizeof(size_t));
+    uint32_t *parent = (uint32_t*)malloc((total + 1) * sizeof(uint32_t));
+    uint32_t *order = (uint32_t*)malloc((total + 1) * sizeof(uint32_t));
+    NameClusterReport *report = (NameClusterReport*)calloc(1, sizeof(NameClusterReport));
+    if (!job.names || !job.signatures || !job.pairs || !job.pairCounts || !parent || !order ||
+        !report) {
+        perror("Failed to allocate MinHash state");
+        free(report);
+        free(spilled.records);
+        report = NULL;
+        goto done;
+    }
+    report->spilled = spilled.records; // Cluster names may point into it
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node && job.numNames < total; node = node->next) {
+            job.names[job.numNames++] = node->name;
+        }
+    }
+    for (size_t i = 0; i < spilled.count && job.numNames < total; i++) {
+        job.names[job.numNames++] = spilled.records[i].name;
+    }
+
+    // 2. Signatures, then banding, both in parallel
+    runParallel(minHashSignatureRun, &job, threads);
+    runParallel(minHashBandRun, &job, threads);
+
+    // 3. Merge verified pairs into clusters
+    for (uint32_t i = 0; i < job.numNames; i++) parent[i] = i;
+    for (int b = 0; b < MINHASH_BANDS; b++) {
+        for (size_t k = 0; k < job.pairCounts[b]; k++) {
+            uint32_t ra = unionFindRoot(parent, job.pairs[b][k].a);
+            uint32_t rb = unionFindRoot(parent, job.pairs[b][k].b);
+            if (ra != rb) parent[ra < rb ? rb : ra] = ra < rb ? ra : rb;
+        }
+    }
+
+    // 4. Emit groups with more than one member, ordered by root
+    for (uint32_t i = 0; i < job.numNames; i++) order[i] = i;
+    for (uint32_t i = 0; i < job.numNames; i++) parent[i] = unionFindRoot(parent, i);
+    uint32_t *counts = (uint32_t*)calloc(job.numNames + 1, sizeof(uint32_t));
+    if (!counts) goto done;
+    for (uint32_t i = 0; i < job.numNames; i++) counts[parent[i]]++;
+    size_t numClusters = 0;
+    for (uint32_t i = 0; i < job.numNames; i++) numClusters += parent[i] == i && counts[i] > 1;
+    report->clusters = (NameCluster*)calloc(numClusters + 1, sizeof(NameCluster));
+    uint32_t *slotOf = order; // Reused: root -> cluster slot
+    for (uint32_t i = 0; i < job.numNames && report->clusters; i++) {
+        if (parent[i] == i && counts[i] > 1) {
+            slotOf[i] = (uint32_t)report->count;
+            report->clusters[report->count].names = (const char**)malloc(counts[i] * sizeof(char*));
+            report->count++;
+        }
+    }
+    for (uint32_t i = 0; i < job.numNames && report->clusters; i++) {
+        uint32_t root = parent[i];
+        if (counts[root] < 2) continue;
+        NameCluster *cluster = &report->clusters[slotOf[root]];
+        if (cluster->names) cluster->names[cluster->count++] = job.names[i];
+    }
+    free(counts);
+
+done:
+    for (int b = 0; job.pairs && b < MINHASH_BANDS; b++) free(job.pairs[b]);
+    free(job.pairs);
+    free(job.pairCounts);
+    free(job.names);
+    free(job.signatures);
+    free(parent);
+    free(order);
+    return report;
+}
+
+/**
+ * @brief Prints groups of names that look like variants of each other.
+ * @param ht A pointer to the hash table.
+ */
+void displaySimilarNames(HashTable *ht) {
+    NameClusterReport *report = findSimilarNames(ht, defaultThreadCount());
+    if (!report) return;
+
+    printf("\n--- Similar Names ---\n");
+    for (size_t i = 0; i < report->count; i++) {
+        printf("Cluster %zu:\n", i + 1);
+        for (size_t j = 0; j < report->clusters[i].count; j++) {
+            printf("  -> Name: %s\n", report->clusters[i].names[j]);
+        }
+    }
+    if (report->count == 0) {
+        printf("No near-duplicate names found.\n");
+    }
+    printf("---------------------\n");
+    freeNameClusterReport(report);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Sorted listing                                                     */
+/*                                                                     */
+/*  Names are sorted by reference: each entry caches the next 8 bytes  */
+/*  of its name as a big-endian integer, so most comparisons are one   */
+/*  integer compare. A first MSD radix pass splits entries by leading  */
+/*  byte into 256 buckets that threads sort independently with a        */
+/*  multikey (3-way radix) quicksort, 8 bytes per level.                */
+/* ------------------------------------------------------------------ */
+
+// A name reference with its cached key prefix
+typedef struct SortRef {
+    uint64_t key;     // Bytes [depth, depth + 8) of the name, big-endian
+    const char *name;
+    const char *phone;
+} SortRef;
+
+// Shared state of the sort workers
+typedef struct SortJob {
+    SortRef *refs;
+    size_t bucketStart[257];
+    int nextBucket;
+} SortJob;
+
+/**
+ * @brief Loads 8 bytes of a string as a big-endian key (zero past the end).
+ * @param s The string.
+ * @param depth The byte offset to start at.
+ * @return The key.
+ */
+static uint64_t sortKeyAt(const char *s, size_t depth) {
+    uint64_t key = 0;
+    size_t i = 0;
+    while (i < depth && s[i]) i++;
+    s += i;
+    if (i < depth) return 0; // The string ended before depth
+    for (int b = 0; b < 8; b++) {
+        unsigned char c = (unsigned char)*s;
+        key = (key << 8) | c;
+        if (c) s++;
+    }
+    return key;
+}
+
+/**
+ * @brief Sorts name references with multikey quicksort.
+ * All refs agree on the first depth bytes and carry the key at depth.
+ * @param a The refs.
+ * @param n The number of refs.
+ * @param depth The byte depth the cached keys start at.
+ */
+static void multikeyQuicksort(SortRef *a, size_t n, size_t depth) {
+    while (n > SORT_INSERTION_THRESHOLD) {
+        // 1. Median-of-three pivot on the cached keys
+        uint64_t x = a[0].key, y = a[n / 2].key, z = a[n - 1].key;
+        uint64_t pivot = x < y ? (y < z ? y : (x < z ? z : x)) : (x < z ? x : (y < z ? z : y));
+
+        // 2. Three-way partition: [< pivot | == pivot | > pivot]
+        size_t lt = 0, i = 0, gt = n;
+        while (i < gt) {
+            if (a[i].key < pivot) {
+                SortRef t = a[lt]; a[lt++] = a[i]; a[i++] = t;
+            } else if (a[i].key > pivot) {
+                SortRef t = a[--gt]; a[gt] = a[i]; a[i] = t;
+            } else {
+                i++;
+            }
+        }
+
+        // 3. The equal run continues 8 bytes deeper unless the names ended
+        size_t lessLen = lt, equalLen = (pivot & 0xFF) ? gt - lt : 0, greaterLen = n - gt;
+        for (size_t k = lt; k < lt + equalLen; k++) a[k].key = sortKeyAt(a[k].name, depth + 8);
+
+        // 4. Recurse on the two smaller parts and loop on the largest, so
+        //    every recursive call gets at most half the refs
+        if (lessLen >= equalLen && lessLen >= greaterLen) {
+            multikeyQuicksort(a + lt, equalLen, depth + 8);
+            multikeyQuicksort(a + gt, greaterLen, depth);
+            n = lessLen;
+        } else if (greaterLen >= equalLen) {
+            multikeyQuicksort(a, lessLen, depth);
+            multikeyQuicksort(a + lt, equalLen, depth + 8);
+            a += gt;
+            n = greaterLen;
+        } else {
+            multikeyQuicksort(a, lessLen, depth);
+            multikeyQuicksort(a + gt, greaterLen, depth);
+            a += lt;
+            n = equalLen;
+            depth += 8;
+        }
+    }
+
+    // 5. Small runs: insertion sort on (key, remaining bytes)
+    for (size_t i = 1; i < n; i++) {
+        SortRef t = a[i];
+        size_t j = i;
+        while (j > 0 && (a[j - 1].key > t.key ||
+                         (a[j - 1].key == t.key && (t.key & 0xFF) &&
+                          strcmp(a[j - 1].name + depth + 8, t.name + depth + 8) > 0))) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = t;
+    }
+}
+
+static void* sortBucketRun(void *arg) {
+    SortJob *job = (SortJob*)arg;
+    int b;
+    while ((b = __atomic_fetch_add(&job->nextBucket, 1, __ATOMIC_RELAXED)) < 256) {
+        multikeyQuicksort(job->refs + job->bucketStart[b],
+                          job->bucketStart[b + 1] - job->bucketStart[b], 0);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Writes every contact as "name<TAB>phone" lines in name order.
+ * Order is by bytes (so upper case sorts before lower case).
+ * @param ht A pointer to the hash table.
+ * @param out The stream to write to.
+ * @param threads The number of sorting threads.
+ * @return The number of contacts written, or -1 on failure.
+ */
+long exportContactsSorted(HashTable *ht, FILE *out, int threads) {
+    // 1. Copy out contacts that do not live in ContactNodes
+    SpillCopy spilled;
+    if (copySpilledContacts(ht, &spilled) != 0) return -1;
+
+    // 2. Collect references, counting by leading byte
+    size_t total = (ht->disk ? 0 : residentContacts(ht)) + spilled.count;
+    SortRef *refs = (SortRef*)malloc((total + 1) * sizeof(SortRef));
+    SortJob *job = (SortJob*)calloc(1, sizeof(SortJob));
+    SortRef *tmp = (SortRef*)malloc((total + 1) * sizeof(SortRef));
+    if (!refs || !job || !tmp) {
+        free(refs); free(job); free(tmp); free(spilled.records);
+        return -1;
+    }
+    size_t n = 0;
+    for (int i = 0; i < ht->size; i++) {
+        for (ContactNode *node = ht->table[i]; node && n < total; node = node->next) {
+            refs[n].name = node->name;
+            refs[n].phone = node->phone;
+            n++;
+        }
+    }
+    for (size_t i = 0; i < spilled.count && n < total; i++) {
+        refs[n].name = spilled.records[i].name;
+        refs[n].phone = spilled.records[i].phone;
+        n++;
+    }
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < n; i++) {
+        refs[i].key = sortKeyAt(refs[i].name, 0);
+        counts[refs[i].key >> 56]++;
+    }
+
+    // 3. MSD radix pass on the first byte
+    for (int b = 0; b < 256; b++) job->bucketStart[b + 1] = job->bucketStart[b] + counts[b];
+    size_t cursor[256];
+    memcpy(cursor, job->bucketStart, sizeof(cursor));
+    for (size_t i = 0; i < n; i++) tmp[cursor[refs[i].key >> 56]++] = refs[i];
+    free(refs);
+    job->refs = tmp;
+
+    // 4. Sort the buckets in parallel (small inputs are not worth threads)
+    runParallel(sortBucketRun, job, n > 100000 ? threads : 1);
+
+    // 5. Format into a large buffer and write it in big chunks
+    char *buffer = (char*)malloc(SORT_OUTPUT_BUFFER);
+    size_t used = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!buffer) {
+            fprintf(out, "%s\t%s\n", job->refs[i].name, job->refs[i].phone);
+            continue;
+        }
+        if (used + MAX_NAME_LEN + MAX_PHONE_LEN + 2 > SORT_OUTPUT_BUFFER) {
+            fwrite(buffer, 1, used, out);
+            used = 0;
+        }
+        size_t nl = strlen(job->refs[i].name), pl = strlen(job->refs[i].phone);
+        memcpy(buffer + used, job->refs[i].name, nl);
+        buffer[used + nl] = '\t';
+        memcpy(buffer + used + nl + 1, job->refs[i].phone, pl);
+        buffer[used + nl + 1 + pl] = '\n';
+        used += nl + pl + 2;
+    }
+    if (buffer) fwrite(buffer, 1, used, out);
+    fflush(out);
+    free(buffer);
+
+    free(job->refs);
+    free(job);
+    free(spilled.records);
+    return (long)n;
+}
+
+/**
+ * @brief Displays all contacts in alphabetical order.
+ * @param ht A pointer to the hash table.
+ */
+void displayContactsSorted(HashTable *ht) {
+    printf("\n--- 📖 Phonebook Contacts (A-Z) 📖 ---\n");
+    fflush(stdout);
+    long n = exportContactsSorted(ht, stdout, defaultThreadCount());
+    if (n == 0) {
+        printf("Phonebook is empty.\n");
+    }
+    printf("--------------------------------------\n");
+}
+
+/* ------------------------------------------------------------------ */
+/*  Compiled filter expressions                                         */
+/*                                                                     */
+/*  A filter such as                                                   */
+/*      phone starts "212" and (name contains "smith" or namelen < 5)  */
+/*  is parsed once into accumulator bytecode with short-circuit jumps.  */
+/*  A peephole pass threads jumps that land on other jumps, then fuses  */
+/*  each test with a following "not" and conditional jump into a single */
+/*  superinstruction, so a typical predicate runs one dispatch per      */
+/*  test. Each test is specialized by field and operator, and string    */
+/*  operands carry precomputed lengths.                                 */
+/*                                                                     */
+/*  Grammar:                                                            */
+/*      expr    := and ("or" and)*                                     */
+/*      and     := unary ("and" unary)*                                */
+/*      unary   := "not" unary | "(" expr ")" | test                   */
+/*      test    := ("name" | "phone") ("=" | "!=" | "starts" | "ends"  */
+/*                 | "contains") "string"                              */
+/*               | ("namelen" | "phonelen" | "area")                   */
+/*                 ("=" | "!=" | "<" | "<=" | ">" | ">=") number       */
+/* ------------------------------------------------------------------ */
+
+// Filter bytecode operations
+typedef enum FilterOp {
+    FOP_NAME_EQ,
+    FOP_NAME_PREFIX,
+    FOP_NAME_SUFFIX,
+    FOP_NAME_CONTAINS,
+    FOP_PHONE_EQ,
+    FOP_PHONE_PREFIX,
+    FOP_PHONE_SUFFIX,
+    FOP_PHONE_CONTAINS,
+    FOP_NAME_LEN,
+    FOP_PHONE_LEN,
+    FOP_AREA_CODE,
+    FOP_NOT,
+    FOP_JUMP_IF_FALSE,
+    FOP_JUMP_IF_TRUE,
+    FOP_END
+} FilterOp;
+
+// Integer comparisons
+typedef enum FilterCompare {
+    FCMP_EQ, FCMP_NE, FCMP_LT, FCMP_LE, FCMP_GT, FCMP_GE
+} FilterCompare;
+
+// Branch fused into a test instruction
+typedef enum FilterBranch {
+    FBRANCH_NONE, FBRANCH_IF_FALSE, FBRANCH_IF_TRUE
+} FilterBranch;
+
+// One filter instruction
+typedef struct FilterInstr {
+    uint8_t op;           // FilterOp
+    uint8_t negate;       // Invert the test's result
+    uint8_t branch;       // FilterBranch taken after the test
+    uint8_t cmp;          // FilterCompare for integer tests
+    int32_t target;       // Jump target (instruction index)
+    int32_t value;        // Integer operand
+    uint32_t argLen;      // String operand length
+    char arg[FILTER_MAX_STRING];
+} FilterInstr;
+
+// A compiled filter program
+typedef struct CompiledFilter {
+    FilterInstr *code;
+    int count;
+    int capacity;
+} CompiledFilter;
+
+// Parser state
+typedef struct FilterParser {
+    const char *src;
+    const char *pos;
+    CompiledFilter *prog;
+    int failed;
+} FilterParser;
+
+// One matching contact
+typedef struct FilterMatch {
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+} FilterMatch;
+
+// The result of a filtered scan
+typedef struct FilterResult {
+    FilterMatch *matches;
+    size_t count;
+    size_t capacity;
+    size_t scanned;
+} FilterResult;
+
+/**
+ * @brief Reports a syntax error (only the first one).
+ * @param p The parser.
+ * @param message What went wrong.
+ */
+static void filterError(FilterParser *p, const char *message) {
+    if (!p->failed) {
+        fprintf(stderr, "ERROR: Filter %s at column %d.\n", message, (int)(p->pos - p->src) + 1);
+    }
+    p->failed = 1;
+}
+
+/**
+ * @brief Appends an instruction.
+ * @param p The parser.
+ * @param op The operation.
+ * @return The instruction's index, or -1 on failure.
+ */
+static int filterEmit(FilterParser *p, FilterOp op) {
+    CompiledFilter *prog = p->prog;
+    if (prog->count == prog->capacity) {
+        int capacity = prog->capacity ? prog->capacity * 2 : 16;
+        FilterInstr *grown = (FilterInstr*)realloc(prog->code, capacity * sizeof(FilterInstr));
+        if (!grown) {
+            perror("Failed to grow filter program");
+            p->failed = 1;
+            return -1;
+        }
+        prog->code = grown;
+        prog->capacity = capacity;
+    }
+    FilterInstr *in = &prog->code[prog->count];
+    memset(in, 0, sizeof(*in));
+    in->op = (uint8_t)op;
+    return prog->count++;
+}
+
+/**
+ * @brief Skips spaces and consumes a keyword or symbol if it comes next.
+ * @param p The parser.
+ * @param word The keyword or symbol.
+ * @return 1 if consumed, 0 otherwise.
+ */
+static int filterAccept(FilterParser *p, const char *word) {
+    while (isspace((unsigned char)*p->pos)) p->pos++;
+    size_t len = strlen(word);
+    if (strncasecmp(p->pos, word, len) != 0) return 0;
+    // Keywords must end at a word boundary; symbols must not run into '='
+    if (isalpha((unsigned char)word[0]) ? isalnum((unsigned char)p->pos[len]) || p->pos[len] == '_'
+                                        : p->pos[len] == '=' && word[len - 1] != '=') {
+        return 0;
+    }
+    p->pos += len;
+    return 1;
+}
+
+/**
+ * @brief Parses a comparison operator.
+ * @param p The parser.
+ * @return The comparison, or -1 if none follows.
+ */
+static int filterCompareOp(FilterParser *p) {
+    if (filterAccept(p, "<=")) return FCMP_LE;
+    if (filterAccept(p, ">=")) return FCMP_GE;
+    if (filterAccept(p, "!=")) return FCMP_NE;
+    if (filterAccept(p, "<")) return FCMP_LT;
+    if (filterAccept(p, ">")) return FCMP_GT;
+    if (filterAccept(p, "=")) return FCMP_EQ;
+    return -1;
+}
+
+/**
+ * @brief Parses a single test.
+ * @param p The parser.
+ */
+static void filterParseTest(FilterParser *p) {
+    int isName = 0, isPhone = 0;
+    FilterOp numericOp = FOP_END;
+    if (filterAccept(p, "namelen")) numericOp = FOP_NAME_LEN;
+    else if (filterAccept(p, "phonelen")) numericOp = FOP_PHONE_LEN;
+    else if (filterAccept(p, "area")) numericOp = FOP_AREA_CODE;
+    else if (filterAccept(p, "name")) isName = 1;
+    else if (filterAccept(p, "phone")) isPhone = 1;
+    else {
+        filterError(p, "expects name, phone, namelen, phonelen or area");
+        return;
+    }
+
+    // 1. Integer tests
+    if (numericOp != FOP_END) {
+        int cmp = filterCompareOp(p);
+        while (isspace((unsigned char)*p->pos)) p->pos++;
+        char *end;
+        long value = strtol(p->pos, &end, 10);
+        if (cmp < 0 || end == p->pos) {
+            filterError(p, "expects a comparison and a number");
+            return;
+        }
+        p->pos = end;
+        int at = filterEmit(p, numericOp);
+        if (at < 0) return;
+        p->prog->code[at].cmp = (uint8_t)cmp;
+        p->prog->code[at].value = (int32_t)value;
+        return;
+    }
+
+    // 2. String tests: the operator picks the specialized instruction
+    int negate = 0;
+    FilterOp op;
+    if (filterAccept(p, "starts")) op = isName ? FOP_NAME_PREFIX : FOP_PHONE_PREFIX;
+    else if (filterAccept(p, "ends")) op = isName ? FOP_NAME_SUFFIX : FOP_PHONE_SUFFIX;
+    else if (filterAccept(p, "contains")) op = isName ? FOP_NAME_CONTAINS : FOP_PHONE_CONTAINS;
+    else if (filterAccept(p, "!=")) {
+        op = isName ? FOP_NAME_EQ : FOP_PHONE_EQ;
+        negate = 1;
+    } else if (filterAccept(p, "=")) op = isName ? FOP_NAME_EQ : FOP_PHONE_EQ;
+    else {
+        filterError(p, "expects =, !=, starts, ends or contains");
+        return;
+    }
+    (void)isPhone;
+
+    while (isspace((unsigned char)*p->pos)) p->pos++;
+    const char *close = *p->pos == '"' ? strchr(p->pos + 1, '"') : NULL;
+    if (!close) {
+        filterError(p, "expects a quoted string");
+        return;
+    }
+    size_t len = (size_t)(close - p->pos - 1);
+    if (len >= FILTER_MAX_STRING) {
+        filterError(p, "string is too long");
+        return;
+    }
+    int at = filterEmit(p, op);
+    if (at < 0) return;
+    FilterInstr *in = &p->prog->code[at];
+    memcpy(in->arg, p->pos + 1, len);
+    in->arg[len] = '\0';
+    in->argLen = (uint32_t)len;
+    in->negate = (uint8_t)negate;
+    p->pos = close + 1;
+}
+
+static void filterParseOr(FilterParser *p);
+
+/**
+ * @brief Parses "not" prefixes, parentheses and tests.
+ * @param p The parser.
+ */
+static void filterParseUnary(FilterParser *p) {
+    if (p->failed) return;
+    if (filterAccept(p, "not")) {
+        filterParseUnary(p);
+        filterEmit(p, FOP_NOT);
+    } else if (filterAccept(p, "(")) {
+        filterParseOr(p);
+        if (!filterAccept(p, ")")) filterError(p, "expects )");
+    } else {
+        filterParseTest(p);
+    }
+}
+
+/**
+ * @brief Parses a chain joined by one connective, emitting a
+ * short-circuit jump after each operand.
+ * @param p The parser.
+ * @param word "and" or "or".
+ * @param jump The jump leaving the chain early.
+ * @param operand Parses one operand.
+ */
+static void filterParseChain(FilterParser *p, const char *word, FilterOp jump,
+                             void (*operand)(FilterParser*)) {
+    int pending[64];
+    int numPending = 0;
+    operand(p);
+    while (!p->failed && filterAccept(p, word)) {
+        if (numPending == (int)(sizeof(pending) / sizeof(pending[0]))) {
+            filterError(p, "chain is too long");
+            return;
+        }
+        int at = filterEmit(p, jump);
+        if (at >= 0) pending[numPending++] = at;
+        operand(p);
+    }
+    for (int i = 0; i < numPending && !p->failed; i++) {
+        p->prog->code[pending[i]].target = p->prog->count;
+    }
+}
+
+static void filterParseAnd(FilterParser *p) {
+    filterParseChain(p, "and", FOP_JUMP_IF_FALSE, filterParseUnary);
+}
+
+static void filterParseOr(FilterParser *p) {
+    filterParseChain(p, "or", FOP_JUMP_IF_TRUE, filterParseAnd);
+}
+
+/**
+ * @brief Threads jumps and fuses tests with their "not" and jump.
+ * @param prog The program (rewritten in place).
+ * @return 0 on success, -1 on failure.
+ */
+static int optimizeFilter(CompiledFilter *prog) {
+    FilterInstr *code = prog->code;
+    int n = prog->count;
+    char *isTarget = (char*)calloc(n + 1, 1);
+    int *newIndex = (int*)malloc((n + 1) * sizeof(int));
+    if (!isTarget || !newIndex) {
+        free(isTarget);
+        free(newIndex);
+        return -1;
+    }
+
+    // 1. A jump landing on a jump of the same kind takes it too; one
+    //    landing on the opposite kind falls through it
+    for (int i = 0; i < n; i++) {
+        if (code[i].op != FOP_JUMP_IF_FALSE && code[i].op != FOP_JUMP_IF_TRUE) continue;
+        int t = code[i].target;
+        while (t < n && (code[t].op == FOP_JUMP_IF_FALSE || code[t].op == FOP_JUMP_IF_TRUE)) {
+            t = code[t].op == code[i].op ? code[t].target : t + 1;
+        }
+        code[i].target = t;
+        isTarget[t] = 1;
+    }
+
+    // 2. Fuse test + not + jump; nothing may jump into the middle
+    int out = 0;
+    for (int i = 0; i < n; ) {
+        FilterInstr in = code[i];
+        newIndex[i++] = out;
+        if (in.op <= FOP_AREA_CODE) {
+            while (i < n && code[i].op == FOP_NOT && !isTarget[i]) {
+                in.negate ^= 1;
+                newIndex[i++] = out;
+            }
+            if (i < n && !isTarget[i] &&
+                (code[i].op == FOP_JUMP_IF_FALSE || code[i].op == FOP_JUMP_IF_TRUE)) {
+                in.branch = code[i].op == FOP_JUMP_IF_FALSE ? FBRANCH_IF_FALSE : FBRANCH_IF_TRUE;
+                in.target = code[i].target;
+                newIndex[i++] = out;
+            }
+        }
+        code[out++] = in;
+    }
+    newIndex[n] = out;
+
+    // 3. Retarget every jump
+    for (int i = 0; i < out; i++) {
+        if (code[i].branch != FBRANCH_NONE || code[i].op == FOP_JUMP_IF_FALSE ||
+            code[i].op == FOP_JUMP_IF_TRUE) {
+            code[i].target = newIndex[code[i].target];
+        }
+    }
+    prog->count = out;
+    free(isTarget);
+    free(newIndex);
+    return 0;
+}
+
+/**
+ * @brief Frees a compiled filter.
+ * @param prog The program.
+ */
+void freeFilter(CompiledFilter *prog) {
+    if (!prog) return;
+    free(prog->code);
+    free(prog);
+}
+
+/**
+ * @brief Compiles a filter expression.
+ * An empty expression matches every contact.
+ * @param expr The expression.
+ * @return The program, or NULL on a syntax error (reported on stderr).
+ */
+CompiledFilter* compileFilter(const char *expr) {
+    CompiledFilter *prog = (CompiledFilter*)calloc(1, sizeof(CompiledFilter));
+    if (!prog) {
+        perror("Failed to allocate CompiledFilter");
+        return NULL;
+    }
+    FilterParser p = { expr, expr, prog, 0 };
+
+    // 1. Parse into plain bytecode
+    while (isspace((unsigned char)*p.pos)) p.pos++;
+    if (*p.pos) filterParseOr(&p);
+    while (isspace((unsigned char)*p.pos)) p.pos++;
+    if (*p.pos) filterError(&p, "has unexpected text");
+    filterEmit(&p, FOP_END);
+
+    // 2. Form superinstructions
+    if (p.failed || optimizeFilter(prog) != 0) {
+        freeFilter(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+/**
+ * @brief Compares two integers.
+ * @param a The left side.
+ * @param cmp The comparison.
+ * @param b The right side.
+ * @return The result.
+ */
+static inline int filterCompare(int a, int cmp, int b) {
+    switch (cmp) {
+        case FCMP_EQ: return a == b;
+        case FCMP_NE: return a != b;
+        case FCMP_LT: return a < b;
+        case FCMP_LE: return a <= b;
+        case FCMP_GT: return a > b;
+        default:      return a >= b;
+    }
+}
+
+/**
+ * @brief Runs a compiled filter against one contact.
+ * @param prog The program.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return Non-zero if the contact matches.
+ */
+static int filterMatches(const CompiledFilter *prog, const char *name, const char *phone) {
+    const FilterInstr *code = prog->code;
+    const FilterInstr *ip = code;
+    int nameLen = -1, phoneLen = -1;
+    int acc = 1;
+
+    for (;;) {
+        switch ((FilterOp)ip->op) {
+            case FOP_NAME_EQ:
+                acc = strcmp(name, ip->arg) == 0;
+                break;
+            case FOP_NAME_PREFIX:
+                acc = strncmp(name, ip->arg, ip->argLen) == 0;
+                break;
+            case FOP_NAME_SUFFIX:
+                if (nameLen < 0) nameLen = (int)strlen(name);
+                acc = (uint32_t)nameLen >= ip->argLen &&
+                      memcmp(name + nameLen - ip->argLen, ip->arg, ip->argLen) == 0;
+                break;
+            case FOP_NAME_CONTAINS:
+                acc = strstr(name, ip->arg) != NULL;
+                break;
+            case FOP_PHONE_EQ:
+                acc = strcmp(phone, ip->arg) == 0;
+                break;
+            case FOP_PHONE_PREFIX:
+                acc = strncmp(phone, ip->arg, ip->argLen) == 0;
+                break;
+            case FOP_PHONE_SUFFIX:
+                if (phoneLen < 0) phoneLen = (int)strlen(phone);
+                acc = (uint32_t)phoneLen >= ip->argLen &&
+                      memcmp(phone + phoneLen - ip->argLen, ip->arg, ip->argLen) == 0;
+                break;
+            case FOP_PHONE_CONTAINS:
+                acc = strstr(phone, ip->arg) != NULL;
+                break;
+            case FOP_NAME_LEN:
+                if (nameLen < 0) nameLen = (int)strlen(name);
+                acc = filterCompare(nameLen, ip->cmp, ip->value);
+                break;
+            case FOP_PHONE_LEN:
+                if (phoneLen < 0) phoneLen = (int)strlen(phone);
+                acc = filterCompare(phoneLen, ip->cmp, ip->value);
+                break;
+            case FOP_AREA_CODE:
+                acc = filterCompare(phoneAreaCode(phone, NULL), ip->cmp, ip->value);
+                break;
+            case FOP_NOT:
+                acc = !acc;
+                ip++;
+                continue;
+            case FOP_JUMP_IF_FALSE:
+                ip = acc ? ip + 1 : code + ip->target;
+                continue;
+            case FOP_JUMP_IF_TRUE:
+                ip = acc ? code + ip->target : ip + 1;
+                continue;
+            case FOP_END:
+                return acc;
+        }
+
+        // Fused "not" and branch of a superinstruction
+        acc ^= ip->negate;
+        if ((ip->branch == FBRANCH_IF_FALSE && !acc) || (ip->branch == FBRANCH_IF_TRUE && acc)) {
+            ip = code + ip->target;
+        } else {
+            ip++;
+        }
+    }
+}
+
+/**
+ * @brief Appends a match to a result.
+ * @param result The result.
+ * @param name The contact's name.
+ * @param phone The contact's phone number.
+ * @return 0 on success, -1 on failure.
+ */
+static int filterResultAdd(FilterResult *result, const char *name, const char *phone) {
+    if (result->count == result->capacity) {
+        size_t capacity = result->capacity ? result->capacity * 2 : 64;
+        FilterMatch *grown = (FilterMatch*)realloc(result->matches, capacity * sizeof(FilterMatch));
+        if (!grown) return -1;
+        result->matches = grown;
+        result->capacity = capacity;
+    }
+    FilterMatch *m = &result->matches[result->count++];
+    copyField(m->name, name, MAX_NAME_LEN);
+    copyField(m->phone, phone, MAX_PHONE_LEN);
+    return 0;
+}
+
+// Shared state of a parallel filtered scan
+typedef struct FilterJob {
+    HashTable *ht;
+    const CompiledFilter *prog;
+    int nextChunk;
+    int numChunks;
+    FilterResult *perChunk;   // Kept per chunk so output follows bucket order
+    int failed;               // Set atomically by any scan thread
+} FilterJob;
+
+static void *filterScanRun(void *arg) {
+    FilterJob *job = (FilterJob*)arg;
+    HashTable *ht = job->ht;
+    int c;
+    while ((c = __atomic_fetch_add(&job->nextChunk, 1, __ATOMIC_RELAXED)) < job->numChunks) {
+        FilterResult *out = &job->perChunk[c];
+        int last = (c + 1) * FILTER_SCAN_CHUNK < ht->size ? (c + 1) * FILTER_SCAN_CHUNK : ht->size;
+        for (int i = c * FILTER_SCAN_CHUNK; i < last; i++) {
+            for (ContactNode *node = ht->table[i]; node; node = node->next) {
+                out->scanned++;
+                if (filterMatches(job->prog, node->name, node->phone) &&
+                    filterResultAdd(out, node->name, node->phone) != 0) {
+                    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// Helper state for filtering disk records
+typedef struct FilterDiskState {
+    const CompiledFilter *prog;
+    FilterResult *result;
+    int failed;
+} FilterDiskState;
+
+static void filterDiskRecord(uint32_t page, const DiskRecord *rec, void *ctx) {
+    (void)page;
+    FilterDiskState *state = (FilterDiskState*)ctx;
+    state->result->scanned++;
+    if (filterMatches(state->prog, rec->name, rec->phone) &&
+        filterResultAdd(state->result, rec->name, rec->phone) != 0) {
+        state->failed = 1;
+    }
+}
+
+/**
+ * @brief Frees a filter result.
+ * @param result The result.
+ */
+void freeFilterResult(FilterResult *result) {
+    if (!result) return;
+    free(result->matches);
+    free(result);
+}
+
+/**
+ * @brief Scans every contact with a compiled filter.
+ * Resident buckets are scanned in parallel; spilled and disk-backed
+ * contacts follow in a single pass.
+ * @param ht A pointer to the hash table.
+ * @param prog The compiled filter.
+ * @param threads The number of threads.
+ * @return The matches in table order, or NULL on failure.
+ */
+FilterResult* scanContacts(HashTable *ht, const CompiledFilter *prog, int threads) {
+    FilterResult *result = (FilterResult*)calloc(1, sizeof(FilterResult));
+    if (!result) {
+        perror("Failed to allocate FilterResult");
+        return NULL;
+    }
+    int failed = 0;
+
+    // 1. Resident buckets, in parallel chunks
+    if (!ht->disk) {
+        FilterJob job;
+        job.ht = ht;
+        job.prog = prog;
+        job.nextChunk = 0;
+        job.numChunks = (ht->size + FILTER_SCAN_CHUNK - 1) / FILTER_SCAN_CHUNK;
+        job.perChunk = (FilterResult*)calloc(job.numChunks, sizeof(FilterResult));
+        job.failed = 0;
+        if (!job.perChunk) {
+            freeFilterResult(result);
+            return NULL;
+        }
+        runParallel(filterScanRun, &job, threads);
+
+        // 2. Concatenate the chunks in bucket order
+        size_t total = 0;
+        for (int c = 0; c < job.numChunks; c++) total += job.perChunk[c].count;
+        result->matches = (FilterMatch*)malloc((total ? total : 1) * sizeof(FilterMatch));
+        result->capacity = total ? total : 1;
+        failed = job.failed || !result->matches;
+        for (int c = 0; c < job.numChunks; c++) {
+            FilterResult *part = &job.perChunk[c];
+            if (!failed && part->count) memcpy(result->matches + result->count, part->matches, part->count * sizeof(FilterMatch));
+            result->count += part->count;
+            result->scanned += part->scanned;
+            free(part->matches);
+        }
+        free(job.perChunk);
+    }
+
+    // 3. Contacts living on disk
+    FilterDiskState state = { prog, result, 0 };
+    if (!failed && ht->disk) diskHashForEach(ht->disk, filterDiskRecord, &state);
+    if (!failed && ht->overflow) diskHashForEach(ht->overflow, filterDiskRecord, &state);
+    if (failed || state.failed) {
+        perror("Failed to collect filter matches");
+        freeFilterResult(result);
+        return NULL;
+    }
+    return result;
+}
+
+/**
+ * @brief Compiles a filter, scans the table and prints the matches.
+ * @param ht A pointer to the hash table.
+ * @param expr The filter expression.
+ */
+void displayFilterExpression(HashTable *ht, const char *expr) {
+    CompiledFilter *prog = compileFilter(expr);
+    if (!prog) return;
+    FilterResult *result = scanContacts(ht, prog, defaultThreadCount());
+    freeFilter(prog);
+    if (!result) return;
+
+    printf("\n--- Filtered Contacts ---\n");
+    for (size_t i = 0; i < result->count; i++) {
+        printf("  -> Name: %-20s | Phone: %s\n", result->matches[i].name, result->matches[i].phone);
+    }
+    printf("%zu of %zu contact(s) matched.\n", result->count, result->scanned);
+    printf("-------------------------\n");
+    freeFilterResult(result);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Ingest validation and normalization                                 */
+/*                                                                     */
+/*  Every imported row goes through normalizeContact(): the name must   */
+/*  be valid UTF-8 without control characters and is trimmed, then cut */
+/*  to the field size on a character boundary; the phone keeps a        */
+/*  leading '+' and its digits once spaces, dashes, dots and            */
+/*  parentheses are stripped. ASCII runs of the UTF-8 check and the     */
+/*  phone character classes are tested 32 bytes at a time with AVX2.   */
+/*  Accepted rows are upserted in batches by the bulk insert path.      */
+/* ------------------------------------------------------------------ */
+
+// Why a row was rejected
+typedef enum IngestReject {
+    INGEST_OK,
+    INGEST_BAD_UTF8,
+    INGEST_CONTROL_CHAR,
+    INGEST_EMPTY_NAME,
+    INGEST_BAD_PHONE_CHAR,
+    INGEST_PHONE_LENGTH,
+    INGEST_MALFORMED,
+    INGEST_REJECT_KINDS
+} IngestReject;
+
+static const char *ingestRejectReasons[INGEST_REJECT_KINDS] = {
+    "ok",
+    "name is not valid UTF-8",
+    "name contains control characters",
+    "name is empty",
+    "phone contains characters other than digits, spaces, - . ( ) and a leading +",
+    "phone has too few or too many digits",
+    "record is malformed"
+};
+
+// Counters of an import
+typedef struct IngestStats {
+    uint64_t rows;
+    uint64_t inserted;
+    uint64_t updated;
+    uint64_t unchanged;
+    uint64_t truncated;   // Names cut to fit
+    uint64_t bytes;       // Input bytes consumed
+    uint64_t rejected[INGEST_REJECT_KINDS];
+} IngestStats;
+
+// One normalized row
+typedef struct IngestRow {
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+} IngestRow;
+
+// Bulk insert state: normalized rows waiting to be upserted
+typedef struct IngestBatch {
+    HashTable *ht;
+    IngestRow *rows;
+    int count;
+    IngestStats stats;
+    FILE *report;         // Where rejects are echoed (NULL for none)
+} IngestBatch;
+
+/**
+ * @brief Returns the length of the pure-ASCII prefix (portable version).
+ * @param s The bytes.
+ * @param n Their length.
+ * @return The prefix length.
+ */
+static size_t asciiPrefixScalar(const unsigned char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, s + i, 8);
+        if (word & 0x8080808080808080ULL) break;
+    }
+    while (i < n && s[i] < 0x80) i++;
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Returns the length of the pure-ASCII prefix, 32 bytes at a time.
+ * @param s The bytes.
+ * @param n Their length.
+ * @return The prefix length.
+ */
+__attribute__((target("avx2")))
+static size_t asciiPrefixAvx2(const unsigned char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        uint32_t high = (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(s + i)));
+        if (high) return i + __builtin_ctz(high);
+    }
+    return i + asciiPrefixScalar(s + i, n - i);
+}
+#endif
+
+/**
+ * @brief Checks that bytes are well-formed UTF-8 (no overlong forms,
+ * surrogates or code points past U+10FFFF).
+ * @param str The bytes.
+ * @param n Their length.
+ * @param useAvx2 Non-zero to skip ASCII runs with AVX2.
+ * @return Non-zero if valid.
+ */
+static int utf8Valid(const char *str, size_t n, int useAvx2) {
+    const unsigned char *s = (const unsigned char*)str;
+    size_t i = 0;
+    while (i < n) {
+        // 1. Skip the ASCII run
+#if defined(__x86_64__) || defined(__i386__)
+        if (useAvx2) i += asciiPrefixAvx2(s + i, n - i);
+        else
+#endif
+        i += asciiPrefixScalar(s + i, n - i);
+        (void)useAvx2;
+        if (i >= n) break;
+
+        // 2. Decode one multi-byte sequence
+        unsigned char c = s[i];
+        size_t len;
+        uint32_t cp;
+        if ((c & 0xE0) == 0xC0) { len = 2; cp = c & 0x1F; }
+        else if ((c & 0xF0) == 0xE0) { len = 3; cp = c & 0x0F; }
+        else if ((c & 0xF8) == 0xF0) { len = 4; cp = c & 0x07; }
+        else return 0;
+        if (i + len > n) return 0;
+        for (size_t j = 1; j < len; j++) {
+            if ((s[i + j] & 0xC0) != 0x80) return 0;
+            cp = (cp << 6) | (s[i + j] & 0x3F);
+        }
+        if ((len == 2 && cp < 0x80) || (len == 3 && cp < 0x800) ||
+            (len == 4 && (cp < 0x10000 || cp > 0x10FFFF)) || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            return 0;
+        }
+        i += len;
+    }
+    return 1;
+}
+
+/**
+ * @brief Classifies up to 32 phone bytes (portable version).
+ * @param p The bytes, zero-padded to 32.
+ * @param len The number of meaningful bytes.
+ * @param digits Receives a bit per digit position.
+ * @return Non-zero if every byte is a digit or a separator.
+ */
+static int phoneClassifyScalar(const char *p, size_t len, uint32_t *digits) {
+    uint32_t d = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = p[i];
+        if (c >= '0' && c <= '9') d |= (uint32_t)1 << i;
+        else if (c != ' ' && c != '-' && c != '(' && c != ')' && c != '.') return 0;
+    }
+    *digits = d;
+    return 1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Classifies 32 phone bytes at once.
+ * @param p The bytes, zero-padded to 32.
+ * @param len The number of meaningful bytes.
+ * @param digits Receives a bit per digit position.
+ * @return Non-zero if every byte is a digit or a separator.
+ */
+__attribute__((target("avx2")))
+static int phoneClassifyAvx2(const char *p, size_t len, uint32_t *digits) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i sep = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'))),
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')'))),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.'))));
+    uint32_t lenMask = len >= 32 ? UINT32_MAX : ((uint32_t)1 << len) - 1;
+    uint32_t d = (uint32_t)_mm256_movemask_epi8(digit) & lenMask;
+    uint32_t ok = ((uint32_t)_mm256_movemask_epi8(sep) | d) & lenMask;
+    *digits = d;
+    return ok == lenMask;
+}
+#endif
+
+/**
+ * @brief Validates and normalizes one contact for import.
+ * @param name The raw name (need not be NUL-terminated).
+ * @param nameLen Its length.
+ * @param phone The raw phone.
+ * @param phoneLen Its length.
+ * @param row Receives the normalized name and phone.
+ * @param truncated Set to 1 if the name had to be cut (may be NULL).
+ * A NULL phone marks a record the caller could not parse; name then
+ * holds the raw record for the report.
+ * @return INGEST_OK, or why the row was rejected.
+ */
+IngestReject normalizeContact(const char *name, size_t nameLen, const char *phone, size_t phoneLen,
+                              IngestRow *row, int *truncated) {
+    if (!phone) return INGEST_MALFORMED;
+    int useAvx2 = 0; // A read of the CPU model the runtime filled in at startup
+#if defined(__x86_64__) || defined(__i386__)
+    useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    // 1. Name: trim, validate, cut on a character boundary
+    while (nameLen > 0 && isspace((unsigned char)*name)) {
+        name++;
+        nameLen--;
+    }
+    while (nameLen > 0 && isspace((unsigned char)name[nameLen - 1])) nameLen--;
+    if (nameLen == 0) return INGEST_EMPTY_NAME;
+    if (!utf8Valid(name, nameLen, useAvx2)) return INGEST_BAD_UTF8;
+    for (size_t i = 0; i < nameLen; i++) {
+        if ((unsigned char)name[i] < 0x20 || name[i] == 0x7F) return INGEST_CONTROL_CHAR;
+    }
+    size_t keep = nameLen;
+    if (keep > MAX_NAME_LEN - 1) {
+        keep = MAX_NAME_LEN - 1;
+        while (keep > 0 && ((unsigned char)name[keep] & 0xC0) == 0x80) keep--;
+        while (keep > 0 && isspace((unsigned char)name[keep - 1])) keep--;
+    }
+    if (truncated) *truncated = keep < nameLen;
+
+    // 2. Phone: keep a leading '+' and the digits
+    while (phoneLen > 0 && isspace((unsigned char)*phone)) {
+        phone++;
+        phoneLen--;
+    }
+    while (phoneLen > 0 && isspace((unsigned char)phone[phoneLen - 1])) phoneLen--;
+    int plus = phoneLen > 0 && phone[0] == '+';
+    if (plus) {
+        phone++;
+        phoneLen--;
+    }
+    if (phoneLen > INGEST_MAX_RAW_PHONE) return INGEST_PHONE_LENGTH;
+    char padded[INGEST_MAX_RAW_PHONE] = {0};
+    memcpy(padded, phone, phoneLen);
+    uint32_t digitMask;
+    int ok;
+#if defined(__x86_64__) || defined(__i386__)
+    if (useAvx2) ok = phoneClassifyAvx2(padded, phoneLen, &digitMask);
+    else
+#endif
+    ok = phoneClassifyScalar(padded, phoneLen, &digitMask);
+    if (!ok) return INGEST_BAD_PHONE_CHAR;
+    int numDigits = __builtin_popcount(digitMask);
+    if (numDigits < INGEST_MIN_DIGITS || numDigits + plus > MAX_PHONE_LEN - 1) return INGEST_PHONE_LENGTH;
+
+    // 3. Write the normalized row
+    memcpy(row->name, name, keep);
+    row->name[keep] = '\0';
+    int out = 0;
+    if (plus) row->phone[out++] = '+';
+    for (uint32_t m = digitMask; m; m &= m - 1) row->phone[out++] = padded[__builtin_ctz(m)];
+    row->phone[out] = '\0';
+    return INGEST_OK;
+}
+
+/**
+ * @brief Starts a bulk insert.
+ * @param batch The batch state.
+ * @param ht The table receiving the contacts.
+ * @param report Where rejected rows are echoed (NULL for none).
+ * @return 0 on success, -1 on failure.
+ */
+int ingestBegin(IngestBatch *batch, HashTable *ht, FILE *report) {
+    memset(batch, 0, sizeof(*batch));
+    batch->ht = ht;
+    batch->report = report;
+    batch->rows = (IngestRow*)malloc(INGEST_BATCH_ROWS * sizeof(IngestRow));
+    if (!batch->rows) {
+        perror("Failed to allocate ingest batch");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Upserts the buffered rows: new names are added, known names
+ * take the imported phone.
+ * @param batch The batch state.
+ */
+void ingestFlush(IngestBatch *batch) {
+    HashTable *ht = batch->ht;
+    for (int i = 0; i < batch->count; i++) {
+        const IngestRow *row = &batch->rows[i];
+        ContactNode *existing = lookupContact(ht, row->name);
+        if (!existing) {
+            if (addContact(ht, row->name, row->phone) == 0) batch->stats.inserted++;
+        } else if (strcmp(existing->phone, row->phone) != 0) {
+            if (changeContactPhone(ht, row->name, row->phone) == 1) batch->stats.updated++;
+        } else {
+            batch->stats.unchanged++;
+        }
+    }
+    batch->count = 0;
+}
+
+/**
+ * @brief Validates one raw row and queues it for insertion.
+ * @param batch The batch state.
+ * @param name The raw name.
+ * @param nameLen Its length.
+ * @param phone The raw phone.
+ * @param phoneLen Its length.
+ * @param line The row's line (or record) number, for reports.
+ * @return INGEST_OK, or why the row was rejected.
+ */
+IngestReject ingestRow(IngestBatch *batch, const char *name, size_t nameLen,
+                       const char *phone, size_t phoneLen, uint64_t line) {
+    int truncated = 0;
+    batch->stats.rows++;
+    IngestReject why = normalizeContact(name, nameLen, phone, phoneLen, &batch->rows[batch->count], &truncated);
+    if (why != INGEST_OK) {
+        uint64_t rejected = 0;
+        for (int k = 1; k < INGEST_REJECT_KINDS; k++) rejected += batch->stats.rejected[k];
+        if (batch->report && rejected < INGEST_MAX_REPORTED) {
+            if (why == INGEST_MALFORMED) {
+                fprintf(batch->report, "Rejected row %llu: %s: %.*s\n", (unsigned long long)line,
+                        ingestRejectReasons[why], (int)(nameLen < 120 ? nameLen : 120), name);
+            } else {
+                fprintf(batch->report, "Rejected row %llu: %s: \"%.*s\" \"%.*s\"\n",
+                        (unsigned long long)line, ingestRejectReasons[why],
+                        (int)(nameLen < 80 ? nameLen : 80), name, (int)(phoneLen < 40 ? phoneLen : 40), phone);
+            }
+        }
+        batch->stats.rejected[why]++;
+        return why;
+    }
+    batch->stats.truncated += truncated;
+    if (++batch->count == INGEST_BATCH_ROWS) ingestFlush(batch);
+    return INGEST_OK;
+}
+
+/**
+ * @brief Finishes a bulk insert and frees the batch buffer.
+ * @param batch The batch state (its stats remain readable).
+ */
+void ingestEnd(IngestBatch *batch) {
+    ingestFlush(batch);
+    free(batch->rows);
+    batch->rows = NULL;
+}
+
+/**
+ * @brief Prints an import summary.
+ * @param stats The import counters.
+ * @param seconds The elapsed time.
+ * @param out Where to print.
+ */
+void printIngestStats(const IngestStats *stats, double seconds, FILE *out) {
+    uint64_t rejected = 0;
+    for (int k = 1; k < INGEST_REJECT_KINDS; k++) rejected += stats->rejected[k];
+    fprintf(out, "Imported %llu rows: %llu added, %llu updated, %llu unchanged, %llu rejected, "
+            "%llu names truncated.\n",
+            (unsigned long long)stats->rows, (unsigned long long)stats->inserted,
+            (unsigned long long)stats->updated, (unsigned long long)stats->unchanged,
+            (unsigned long long)rejected, (unsigned long long)stats->truncated);
+    for (int k = 1; k < INGEST_REJECT_KINDS; k++) {
+        if (stats->rejected[k]) {
+            fprintf(out, "  %llu: %s\n", (unsigned long long)stats->rejected[k], ingestRejectReasons[k]);
+        }
+    }
+    if (seconds > 0) {
+        fprintf(out, "%.1f MB in %.3f s (%.1f MB/s).\n", stats->bytes / 1e6, seconds,
+                stats->bytes / 1e6 / seconds);
+    }
+}
+
+/**
+ * @brief Streams a file line by line through a fixed read buffer.
+ * Lines are passed without their "\n" or "\r\n"; a final line without a
+ * newline is passed too.
+ * @param fp The input.
+ * @param bytes Incremented by the bytes read.
+ * @param fn Called for every line.
+ * @param ctx Passed through to the callback.
+ * @return 0 on success, -1 on a read error.
+ */
+static int forEachInputLine(FILE *fp, uint64_t *bytes,
+                            void (*fn)(const char*, size_t, uint64_t, void*), void *ctx) {
+    char *buf = (char*)malloc(INGEST_READ_BUFFER);
+    if (!buf) {
+        perror("Failed to allocate read buffer");
+        return -1;
+    }
+    size_t have = 0;
+    uint64_t line = 0;
+    int eof = 0;
+    int skipping = 0; // Inside the rest of an overlong line
+
+    while (!eof || have > 0) {
+        // 1. Refill behind whatever partial line is left
+        if (!eof) {
+            size_t got = fread(buf + have, 1, INGEST_READ_BUFFER - have, fp);
+            if (got < INGEST_READ_BUFFER - have) eof = 1;
+            have += got;
+            *bytes += got;
+        }
+        if (skipping) {
+            char *nl = (char*)memchr(buf, '\n', have);
+            if (!nl) {
+                have = 0;
+                continue;
+            }
+            size_t rest = have - (size_t)(nl + 1 - buf);
+            memmove(buf, nl + 1, rest);
+            have = rest;
+            skipping = 0;
+        }
+
+        // 2. Hand over every complete line (and a final unterminated one)
+        size_t start = 0;
+        for (;;) {
+            char *nl = (char*)memchr(buf + start, '\n', have - start);
+            if (!nl && !(eof && start < have)) break;
+            size_t end = nl ? (size_t)(nl - buf) : have;
+            size_t len = end - start;
+            if (len > 0 && buf[start + len - 1] == '\r') len--;
+            fn(buf + start, len, ++line, ctx);
+            start = nl ? end + 1 : have;
+        }
+
+        // 3. Keep the partial line; a line longer than the buffer is dropped
+        //    through its newline and still counts as one line
+        if (start == 0 && have == INGEST_READ_BUFFER) {
+            fprintf(stderr, "ERROR: Line %llu is longer than %d bytes; skipped.\n",
+                    (unsigned long long)++line, INGEST_READ_BUFFER);
+            have = 0;
+            skipping = 1;
+            continue;
+        }
+        memmove(buf, buf + start, have - start);
+        have -= start;
+    }
+    int failed = ferror(fp);
+    free(buf);
+    return failed ? -1 : 0;
+}
+
+static void tsvLine(const char *row, size_t len, uint64_t line, void *ctx) {
+    if (len == 0) return;
+    const char *tab = (const char*)memchr(row, '\t', len);
+    size_t nameLen = tab ? (size_t)(tab - row) : len;
+    ingestRow((IngestBatch*)ctx, row, nameLen, tab ? tab + 1 : row + len,
+              tab ? len - nameLen - 1 : 0, line);
+}
+
+/**
+ * @brief Imports tab-separated "name<TAB>phone" lines, the format written
+ * by the sorted and filter tools.
+ * @param batch The bulk insert state.
+ * @param fp The input.
+ * @return 0 on success, -1 on a read error.
+ */
+int importTsv(IngestBatch *batch, FILE *fp) {
+    return forEachInputLine(fp, &batch->stats.bytes, tsvLine, batch);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Buffered output and whole-table iteration for exporters             */
+/* ------------------------------------------------------------------ */
+
+// A large output buffer written in big chunks
+typedef struct OutputBuffer {
+    FILE *fp;
+    char *data;
+    size_t used;
+    size_t capacity;
+    uint64_t written;     // Bytes handed to the file so far
+    int failed;
+} OutputBuffer;
+
+/**
+ * @brief Sets up an output buffer.
+ * @param ob The buffer.
+ * @param fp The destination file.
+ * @param capacity The buffer size.
+ * @return 0 on success, -1 on failure.
+ */
+static int outputOpen(OutputBuffer *ob, FILE *fp, size_t capacity) {
+    memset(ob, 0, sizeof(*ob));
+    ob->fp = fp;
+    ob->capacity = capacity;
+    ob->data = (char*)malloc(capacity);
+    if (!ob->data) {
+        perror("Failed to allocate output buffer");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes out everything buffered so far.
+ * @param ob The buffer.
+ */
+static void outputFlush(OutputBuffer *ob) {
+    if (ob->used && fwrite(ob->data, 1, ob->used, ob->fp) != ob->used) ob->failed = 1;
+    ob->written += ob->used;
+    ob->used = 0;
+}
+
+/**
+ * @brief Returns room for n more bytes, flushing first if needed.
+ * @param ob The buffer.
+ * @param n The number of bytes (at most the capacity).
+ * @return Where to write them; call outputCommit() afterwards.
+ */
+static inline char* outputReserve(OutputBuffer *ob, size_t n) {
+    if (ob->used + n > ob->capacity) outputFlush(ob);
+    return ob->data + ob->used;
+}
+
+static inline void outputCommit(OutputBuffer *ob, size_t n) {
+    ob->used += n;
+}
+
+/**
+ * @brief Appends bytes to the buffer.
+ * @param ob The buffer.
+ * @param bytes The bytes.
+ * @param n Their length.
+ */
+static void outputWrite(OutputBuffer *ob, const void *bytes, size_t n) {
+    while (n > 0) {
+        size_t chunk = n < ob->capacity ? n : ob->capacity;
+        memcpy(outputReserve(ob, chunk), bytes, chunk);
+        outputCommit(ob, chunk);
+        bytes = (const char*)bytes + chunk;
+        n -= chunk;
+    }
+}
+
+/**
+ * @brief Flushes and frees an output buffer.
+ * @param ob The buffer.
+ * @return 0 if every write succeeded, -1 otherwise.
+ */
+static int outputClose(OutputBuffer *ob) {
+    outputFlush(ob);
+    if (fflush(ob->fp) != 0) ob->failed = 1;
+    free(ob->data);
+    ob->data = NULL;
+    return ob->failed ? -1 : 0;
+}
+
+// Adapter from disk records to forEachContact() callbacks
+typedef struct ContactVisitor {
+    void (*fn)(const char*, const char*, void*);
+    void *ctx;
+    long count;
+} ContactVisitor;
+
+static void visitDiskRecord(uint32_t page, const DiskRecord *rec, void *ctx) {
+    (void)page;
+    ContactVisitor *visitor = (ContactVisitor*)ctx;
+    visitor->fn(rec->name, rec->phone, visitor->ctx);
+    visitor->count++;
+}
+
+/**
+ * @brief Calls a function for every contact in table order: resident
+ * buckets first, then spilled or disk-backed records.
+ * @param ht A pointer to the hash table.
+ * @param fn The callback, given the name and phone.
+ * @param ctx Passed through to the callback.
+ * @return The number of contacts visited.
+ */
+static long forEachContact(HashTable *ht, void (*fn)(const char*, const char*, void*), void *ctx) {
+    long count = 0;
+    for (int i = 0; i < ht->size && ht->table; i++) {
+        for (ContactNode *node = ht->table[i]; node; node = node->next) {
+            fn(node->name, node->phone, ctx);
+            count++;
+        }
+    }
+    ContactVisitor visitor = { fn, ctx, 0 };
+    if (ht->disk) diskHashForEach(ht->disk, visitDiskRecord, &visitor);
+    if (ht->overflow) diskHashForEach(ht->overflow, visitDiskRecord, &visitor);
+    return count + visitor.count;
+}
+
+/* ------------------------------------------------------------------ */
+/*  vCard import and export                                             */
+/*                                                                     */
+/*  The importer streams .vcf files line by line and keeps only the     */
+/*  card being read: FN (or N when FN is missing) and the first TEL, or */
+/*  a later one marked preferred. Values are copied into fixed buffers  */
+/*  with folded lines joined and quoted-printable (vCard 2.1) decoded,  */
+/*  so memory stays constant however large the file is. Each finished  */
+/*  card goes through the bulk insert path.                             */
+/* ------------------------------------------------------------------ */
+
+// Where the next folded line continues
+typedef enum VcardField {
+    VCARD_NONE, VCARD_FN, VCARD_N, VCARD_TEL
+} VcardField;
+
+// Parser state for the card being read
+typedef struct VcardParser {
+    IngestBatch *batch;
+    int inCard;
+    uint64_t cardLine;
+    char fn[4 * MAX_NAME_LEN];
+    size_t fnLen;
+    char n[4 * MAX_NAME_LEN];
+    size_t nLen;
+    char tel[INGEST_MAX_RAW_PHONE * 2];
+    size_t telLen;
+    int telPreferred;
+    VcardField field;     // Field of the previous line
+    int quotedPrintable;  // Previous field uses quoted-printable
+    int softBreak;        // Previous line ended in a quoted-printable '='
+} VcardParser;
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = (char)toupper((unsigned char)c);
+    return c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+/**
+ * @brief Appends part of a value to a field buffer (extra bytes are
+ * dropped; the ingest step truncates anyway).
+ * @param p The parser.
+ * @param dst The field buffer.
+ * @param len The field length (updated).
+ * @param cap The buffer size.
+ * @param src The value bytes.
+ * @param n Their length.
+ */
+static void vcardAppend(VcardParser *p, char *dst, size_t *len, size_t cap, const char *src, size_t n) {
+    p->softBreak = 0;
+    for (size_t i = 0; i < n; i++) {
+        char c = src[i];
+        if (p->quotedPrintable && c == '=') {
+            if (i + 1 == n) {
+                p->softBreak = 1; // Value continues on the next line
+                break;
+            }
+            int hi = i + 1 < n ? hexValue(src[i + 1]) : -1;
+            int lo = i + 2 < n ? hexValue(src[i + 2]) : -1;
+            if (hi >= 0 && lo >= 0) {
+                c = (char)(hi << 4 | lo);
+                i += 2;
+            }
+        }
+        if (*len < cap - 1) dst[(*len)++] = c;
+    }
+    dst[*len] = '\0';
+}
+
+/**
+ * @brief Removes vCard text escapes (\, \; \\ \n) in place.
+ * @param s The value.
+ * @param len Its length (updated).
+ */
+static void vcardUnescape(char *s, size_t *len) {
+    size_t out = 0;
+    for (size_t i = 0; i < *len; i++) {
+        if (s[i] == '\\' && i + 1 < *len) {
+            i++;
+            s[out++] = (s[i] == 'n' || s[i] == 'N') ? ' ' : s[i];
+        } else {
+            s[out++] = s[i];
+        }
+    }
+    *len = out;
+    s[out] = '\0';
+}
+
+/**
+ * @brief Finishes a card and hands it to the bulk insert path.
+ * @param p The parser.
+ */
+static void vcardEmit(VcardParser *p) {
+    char name[4 * MAX_NAME_LEN];
+    size_t nameLen = 0;
+    if (p->fnLen > 0) {
+        vcardUnescape(p->fn, &p->fnLen);
+        memcpy(name, p->fn, p->fnLen);
+        nameLen = p->fnLen;
+    } else if (p->nLen > 0) {
+        // N is "Family;Given;Additional;Prefix;Suffix": use "Given Family"
+        size_t semi = 0;
+        while (semi < p->nLen && !(p->n[semi] == ';' && (semi == 0 || p->n[semi - 1] != '\\'))) semi++;
+        size_t givenEnd = semi < p->nLen ? semi + 1 : p->nLen;
+        while (givenEnd < p->nLen && !(p->n[givenEnd] == ';' && p->n[givenEnd - 1] != '\\')) givenEnd++;
+        if (semi + 1 < givenEnd) {
+            memcpy(name, p->n + semi + 1, givenEnd - semi - 1);
+            nameLen = givenEnd - semi - 1;
+            name[nameLen++] = ' ';
+        }
+        memcpy(name + nameLen, p->n, semi);
+        nameLen += semi;
+        name[nameLen] = '\0';
+        vcardUnescape(name, &nameLen);
+    }
+    ingestRow(p->batch, name, nameLen, p->tel, p->telLen, p->cardLine);
+}
+
+/**
+ * @brief Tests whether a property's parameters contain a word.
+ * @param params The parameter text (between the name and the colon).
+ * @param len Its length.
+ * @param word The word, e.g. "QUOTED-PRINTABLE".
+ * @return Non-zero if present.
+ */
+static int vcardHasParam(const char *params, size_t len, const char *word) {
+    size_t wl = strlen(word);
+    for (size_t i = 0; i + wl <= len; i++) {
+        if (strncasecmp(params + i, word, wl) == 0) return 1;
+    }
+    return 0;
+}
+
+static void vcardLine(const char *line, size_t len, uint64_t lineNo, void *ctx) {
+    VcardParser *p = (VcardParser*)ctx;
+
+    // 1. Continuations: folded lines, and quoted-printable soft breaks
+    int folded = len > 0 && (line[0] == ' ' || line[0] == '\t');
+    if ((folded || p->softBreak) && p->field != VCARD_NONE) {
+        const char *part = folded ? line + 1 : line;
+        size_t partLen = folded ? len - 1 : len;
+        if (p->field == VCARD_FN) vcardAppend(p, p->fn, &p->fnLen, sizeof(p->fn), part, partLen);
+        else if (p->field == VCARD_N) vcardAppend(p, p->n, &p->nLen, sizeof(p->n), part, partLen);
+        else vcardAppend(p, p->tel, &p->telLen, sizeof(p->tel), part, partLen);
+        return;
+    }
+    p->field = VCARD_NONE;
+    p->softBreak = 0;
+
+    // 2. Split "group.NAME;params:value" at the first colon outside quotes
+    size_t colon = 0;
+    int quoted = 0;
+    while (colon < len && (line[colon] != ':' || quoted)) {
+        if (line[colon] == '"') quoted = !quoted;
+        colon++;
+    }
+    if (colon == len) return;
+    const char *prop = line;
+    size_t propLen = colon;
+    const char *dot = (const char*)memchr(prop, '.', propLen);
+    const char *semi = (const char*)memchr(prop, ';', propLen);
+    if (dot && (!semi || dot < semi)) {
+        propLen -= (size_t)(dot + 1 - prop);
+        prop = dot + 1;
+    }
+    size_t nameLen = 0;
+    while (nameLen < propLen && prop[nameLen] != ';') nameLen++;
+    const char *params = prop + nameLen;
+    size_t paramsLen = propLen - nameLen;
+    const char *value = line + colon + 1;
+    size_t valueLen = len - colon - 1;
+
+#define VCARD_IS(word) (nameLen == sizeof(word) - 1 && strncasecmp(prop, word, nameLen) == 0)
+    // 3. Card boundaries and the fields we keep
+    if (VCARD_IS("BEGIN") && valueLen == 5 && strncasecmp(value, "VCARD", 5) == 0) {
+        IngestBatch *batch = p->batch;
+        memset(p, 0, sizeof(*p));
+        p->batch = batch;
+        p->inCard = 1;
+        p->cardLine = lineNo;
+    } else if (!p->inCard) {
+        return;
+    } else if (VCARD_IS("END")) {
+        vcardEmit(p);
+        p->inCard = 0;
+    } else if (VCARD_IS("FN")) {
+        p->quotedPrintable = vcardHasParam(params, paramsLen, "QUOTED-PRINTABLE");
+        p->fnLen = 0;
+        vcardAppend(p, p->fn, &p->fnLen, sizeof(p->fn), value, valueLen);
+        p->field = VCARD_FN;
+    } else if (VCARD_IS("N")) {
+        p->quotedPrintable = vcardHasParam(params, paramsLen, "QUOTED-PRINTABLE");
+        p->nLen = 0;
+        vcardAppend(p, p->n, &p->nLen, sizeof(p->n), value, valueLen);
+        p->field = VCARD_N;
+    } else if (VCARD_IS("TEL")) {
+        int preferred = vcardHasParam(params, paramsLen, "PREF");
+        if (p->telLen > 0 && (p->telPreferred || !preferred)) return;
+        if (valueLen >= 4 && strncasecmp(value, "tel:", 4) == 0) {
+            value += 4;
+            valueLen -= 4;
+        }
+        p->quotedPrintable = 0;
+        p->telLen = 0;
+        p->telPreferred = preferred;
+        vcardAppend(p, p->tel, &p->telLen, sizeof(p->tel), value, valueLen);
+        p->field = VCARD_TEL;
+    }
+#undef VCARD_IS
+}
+
+/**
+ * @brief Imports a vCard (.vcf) file, versions 2.1 to 4.0.
+ * @param batch The bulk insert state.
+ * @param fp The input.
+ * @return 0 on success, -1 on a read error.
+ */
+int importVcard(IngestBatch *batch, FILE *fp) {
+    VcardParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.batch = batch;
+    return forEachInputLine(fp, &batch->stats.bytes, vcardLine, &parser);
+}
+
+/**
+ * @brief Writes one vCard property, escaping the value and folding the
+ * line at 75 bytes without splitting a UTF-8 character.
+ * @param ob The output buffer.
+ * @param prefix The property name and colon, e.g. "FN:".
+ * @param parts The value pieces; ';' between them is written unescaped.
+ * @param numParts The number of pieces.
+ */
+static void vcardWriteProperty(OutputBuffer *ob, const char *prefix, const char **parts, int numParts) {
+    char line[16 + 8 * MAX_NAME_LEN];
+    size_t len = strlen(prefix);
+    memcpy(line, prefix, len);
+    for (int k = 0; k < numParts; k++) {
+        if (k > 0) line[len++] = ';';
+        for (const char *c = parts[k]; *c; c++) {
+            if (*c == ',' || *c == ';' || *c == '\\') line[len++] = '\\';
+            line[len++] = *c;
+        }
+    }
+
+    char *out = outputReserve(ob, len + len / 37 + 8);
+    size_t o = 0, col = 0;
+    for (size_t i = 0; i < len; i++) {
+        int lead = ((unsigned char)line[i] & 0xC0) != 0x80;
+        if (col >= 74 && lead) {
+            memcpy(out + o, "\r\n ", 3);
+            o += 3;
+            col = 1;
+        }
+        out[o++] = line[i];
+        col++;
+    }
+    memcpy(out + o, "\r\n", 2);
+    outputCommit(ob, o + 2);
+}
+
+// Exporter state
+typedef struct ExportWriter {
+    OutputBuffer out;
+    long count;
+} ExportWriter;
+
+static void vcardWriteContact(const char *name, const char *phone, void *ctx) {
+    ExportWriter *w = (ExportWriter*)ctx;
+    OutputBuffer *ob = &w->out;
+
+    // 1. Split the name into family and given names for N
+    char family[MAX_NAME_LEN], given[MAX_NAME_LEN];
+    const char *comma = strstr(name, ", ");
+    const char *space = strrchr(name, ' ');
+    if (comma) {
+        copyField(family, name, (size_t)(comma - name) + 1 < MAX_NAME_LEN ? (size_t)(comma - name) + 1 : MAX_NAME_LEN);
+        copyField(given, comma + 2, MAX_NAME_LEN);
+    } else if (space) {
+        copyField(family, space + 1, MAX_NAME_LEN);
+        copyField(given, name, (size_t)(space - name) + 1);
+    } else {
+        copyField(family, name, MAX_NAME_LEN);
+        given[0] = '\0';
+    }
+
+    // 2. Write the card
+    static const char begin[] = "BEGIN:VCARD\r\nVERSION:3.0\r\n";
+    outputWrite(ob, begin, sizeof(begin) - 1);
+    const char *fn[] = { name };
+    vcardWriteProperty(ob, "FN:", fn, 1);
+    const char *n[] = { family, given, "", "", "" };
+    vcardWriteProperty(ob, "N:", n, 5);
+    const char *tel[] = { phone };
+    vcardWriteProperty(ob, "TEL;TYPE=CELL:", tel, 1);
+    static const char end[] = "END:VCARD\r\n";
+    outputWrite(ob, end, sizeof(end) - 1);
+    w->count++;
+}
+
+/**
+ * @brief Writes every contact as a vCard 3.0 entry.
+ * @param ht A pointer to the hash table.
+ * @param fp The output.
+ * @return The number of contacts written, or -1 on failure.
+ */
+long exportVcard(HashTable *ht, FILE *fp) {
+    ExportWriter w;
+    if (outputOpen(&w.out, fp, INGEST_READ_BUFFER) != 0) return -1;
+    w.count = 0;
+    forEachContact(ht, vcardWriteContact, &w);
+    return outputClose(&w.out) == 0 ? w.count : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  JSON lines import and export                                        */
+/*                                                                     */
+/*  Each line holds one object such as {"name":"...","phone":"..."}.   */
+/*  Import follows the two-stage design of SIMD JSON parsers without    */
+/*  building a document: stage 1 classifies 64-byte blocks into         */
+/*  bitmasks (backslashes, quotes, structural characters) with AVX2,    */
+/*  drops escaped quotes with carry arithmetic, computes which bytes    */
+/*  are inside strings with a prefix XOR, and emits the offsets of the  */
+/*  structural characters outside strings. Stage 2 walks only those     */
+/*  offsets, copies the "name" and "phone" values (unescaping only when */
+/*  a backslash is present) and skips every other member, nested or    */
+/*  not. Export escapes values straight into the output buffer.         */
+/* ------------------------------------------------------------------ */
+
+// Stage 1 output and scratch, reused across lines
+typedef struct JsonScanner {
+    IngestBatch *batch;
+    uint32_t *offsets;    // Structural offsets of the current line
+    size_t capacity;
+    int useAvx2;
+} JsonScanner;
+
+/**
+ * @brief Classifies a 64-byte block (portable version).
+ * @param block The bytes.
+ * @param backslash Receives a bit per '\\'.
+ * @param quote Receives a bit per '"'.
+ * @param structural Receives a bit per { } [ ] : or ','.
+ */
+static void jsonClassifyScalar(const unsigned char *block, uint64_t *backslash, uint64_t *quote, uint64_t *structural) {
+    uint64_t b = 0, q = 0, op = 0;
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = block[i];
+        uint64_t bit = (uint64_t)1 << i;
+        if (c == '\\') b |= bit;
+        else if (c == '"') q |= bit;
+        else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') op |= bit;
+    }
+    *backslash = b;
+    *quote = q;
+    *structural = op;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Classifies a 64-byte block with two 32-byte compares per class.
+ * @param block The bytes.
+ * @param backslash Receives a bit per '\\'.
+ * @param quote Receives a bit per '"'.
+ * @param structural Receives a bit per { } [ ] : or ','.
+ */
+__attribute__((target("avx2")))
+static void jsonClassifyAvx2(const unsigned char *block, uint64_t *backslash, uint64_t *quote, uint64_t *structural) {
+    uint64_t b = 0, q = 0, op = 0;
+    for (int half = 0; half < 2; half++) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(block + 32 * half));
+        // '[' ']' are '{' '}' without 0x20, so OR-ing 0x20 leaves two compares for four
+        __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i ops = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                            _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+        int shift = 32 * half;
+        b |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << shift;
+        q |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << shift;
+        op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ops) << shift;
+    }
+    *backslash = b;
+    *quote = q;
+    *structural = op;
+}
+#endif
+
+/**
+ * @brief Marks the bytes escaped by a backslash, carrying odd runs of
+ * backslashes across blocks.
+ * @param backslash The block's backslash bits.
+ * @param carry In: whether the first byte is escaped; out: the same for
+ * the next block.
+ * @return A bit per escaped byte.
+ */
+static inline uint64_t jsonEscapedBits(uint64_t backslash, uint64_t *carry) {
+    const uint64_t oddBits = 0xAAAAAAAAAAAAAAAAULL;
+    if (!backslash) {
+        uint64_t escaped = *carry;
+        *carry = 0;
+        return escaped;
+    }
+    // 1. A backslash escaped by the previous block starts no sequence
+    uint64_t potential = backslash & ~*carry;
+    // 2. Adding each run's start to the run makes the carry land one past
+    //    the run; the run's parity is read off the odd/even bit pattern
+    uint64_t maybeEscaped = potential << 1;
+    uint64_t seriesCodes = (maybeEscaped | oddBits) - potential;
+    uint64_t escapeAndTerminal = seriesCodes ^ oddBits;
+    uint64_t escaped = escapeAndTerminal ^ (backslash | *carry);
+    uint64_t escape = escapeAndTerminal & backslash;
+    *carry = escape >> 63;
+    return escaped;
+}
+
+/**
+ * @brief Turns each set bit into a run that lasts up to the next set bit
+ * (a running XOR), so quote pairs become in-string masks.
+ * @param x The quote bits.
+ * @return The prefix XOR.
+ */
+static inline uint64_t prefixXor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/**
+ * @brief Stage 1: records the offsets of quotes and of structural
+ * characters outside strings.
+ * @param sc The scanner.
+ * @param line The line.
+ * @param len Its length.
+ * @return The number of offsets, or -1 if a string is unterminated or
+ * memory ran out.
+ */
+static long jsonStructuralScan(JsonScanner *sc, const char *line, size_t len) {
+    // 1. At most one offset per byte
+    if (len + 1 > sc->capacity) {
+        size_t capacity = sc->capacity ? sc->capacity : 256;
+        while (capacity < len + 1) capacity *= 2;
+        uint32_t *grown = (uint32_t*)realloc(sc->offsets, capacity * sizeof(uint32_t));
+        if (!grown) return -1;
+        sc->offsets = grown;
+        sc->capacity = capacity;
+    }
+
+    uint64_t escapeCarry = 0, inStringCarry = 0;
+    long count = 0;
+    for (size_t base = 0; base < len; base += 64) {
+        // 2. Classify the block (the tail is padded with spaces)
+        const unsigned char *block = (const unsigned char*)line + base;
+        unsigned char tail[64];
+        if (len - base < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, len - base);
+            block = tail;
+        }
+        uint64_t backslash, quote, structural;
+#if defined(__x86_64__) || defined(__i386__)
+        if (sc->useAvx2) jsonClassifyAvx2(block, &backslash, &quote, &structural);
+        else
+#endif
+        jsonClassifyScalar(block, &backslash, &quote, &structural);
+
+        // 3. Real quotes, string interiors, and what is left outside them
+        quote &= ~jsonEscapedBits(backslash, &escapeCarry);
+        uint64_t inString = prefixXor(quote) ^ inStringCarry;
+        inStringCarry = (uint64_t)((int64_t)inString >> 63);
+        uint64_t bits = (structural & ~inString) | quote;
+
+        // 4. Emit offsets
+        for (; bits; bits &= bits - 1) sc->offsets[count++] = (uint32_t)(base + __builtin_ctzll(bits));
+    }
+    return inStringCarry ? -1 : count;
+}
+
+/**
+ * @brief Copies a JSON string body, decoding escapes (\\uXXXX surrogate
+ * pairs become one UTF-8 character).
+ * @param src The bytes between the quotes.
+ * @param n Their length.
+ * @param dst The output (at least n bytes).
+ * @return The decoded length, or -1 on a bad escape.
+ */
+static long jsonUnescape(const char *src, size_t n, char *dst) {
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (src[i] != '\\') {
+            dst[out++] = src[i];
+            continue;
+        }
+        if (++i == n) return -1;
+        switch (src[i]) {
+            case '"': case '\\': case '/': dst[out++] = src[i]; break;
+            case 'b': dst[out++] = '\b'; break;
+            case 'f': dst[out++] = '\f'; break;
+            case 'n': dst[out++] = '\n'; break;
+            case 'r': dst[out++] = '\r'; break;
+            case 't': dst[out++] = '\t'; break;
+            case 'u': {
+                uint32_t cp = 0;
+                for (int pair = 0; pair < 2; pair++) {
+                    if (i + 4 >= n) return -1;
+                    uint32_t unit = 0;
+                    for (int k = 1; k <= 4; k++) {
+                        int h = hexValue(src[i + k]);
+                        if (h < 0) return -1;
+                        unit = unit << 4 | (uint32_t)h;
+                    }
+                    i += 4;
+                    if (pair == 0 && unit >= 0xD800 && unit < 0xDC00) {
+                        // High surrogate: the low half must follow
+                        if (i + 2 >= n || src[i + 1] != '\\' || src[i + 2] != 'u') return -1;
+                        cp = unit;
+                        i += 2;
+                        continue;
+                    }
+                    if (pair == 1) {
+                        if (unit < 0xDC00 || unit > 0xDFFF) return -1;
+                        unit = 0x10000 + ((cp - 0xD800) << 10) + (unit - 0xDC00);
+                    }
+                    cp = unit;
+                    break;
+                }
+                // \uXXXX is 6 bytes and its UTF-8 at most 3 (4 for a 12-byte pair)
+                if (cp < 0x80) {
+                    dst[out++] = (char)cp;
+                } else if (cp < 0x800) {
+                    dst[out++] = (char)(0xC0 | cp >> 6);
+                    dst[out++] = (char)(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    dst[out++] = (char)(0xE0 | cp >> 12);
+                    dst[out++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    dst[out++] = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    dst[out++] = (char)(0xF0 | cp >> 18);
+                    dst[out++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    dst[out++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    dst[out++] = (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    return (long)out;
+}
+
+/**
+ * @brief Stage 2: walks the structural offsets of one object and hands
+ * its "name" and "phone" to the bulk insert path.
+ */
+static void jsonLine(const char *line, size_t len, uint64_t lineNo, void *ctx) {
+    JsonScanner *sc = (JsonScanner*)ctx;
+    while (len > 0 && isspace((unsigned char)line[len - 1])) len--;
+    size_t lead = 0;
+    while (lead < len && isspace((unsigned char)line[lead])) lead++;
+    if (lead == len) return;
+
+    long count = jsonStructuralScan(sc, line, len);
+    const uint32_t *at = sc->offsets;
+    const char *name = NULL, *phone = NULL;
+    size_t nameLen = 0, phoneLen = 0;
+    int nameEscaped = 0, phoneEscaped = 0;
+    long i = 0;
+
+    // 1. The object must open the line and close it
+    if (count < 2 || at[0] != lead || line[at[0]] != '{' || at[count - 1] != len - 1 || line[len - 1] != '}') {
+        goto malformed;
+    }
+    i = 1;
+    if (count == 2) goto done;
+    for (;;) {
+        // 2. "key" :
+        if (i + 3 > count || line[at[i]] != '"' || line[at[i + 2]] != ':') goto malformed;
+        const char *key = line + at[i] + 1;
+        size_t keyLen = at[i + 1] - at[i] - 1;
+        i += 3;
+
+        // 3. The value: a string, a nested value, or a bare literal
+        const char **slot = NULL;
+        size_t *slotLen = NULL;
+        int *slotEscaped = NULL;
+        if (keyLen == 4 && memcmp(key, "name", 4) == 0) {
+            slot = &name; slotLen = &nameLen; slotEscaped = &nameEscaped;
+        } else if (keyLen == 5 && memcmp(key, "phone", 5) == 0) {
+            slot = &phone; slotLen = &phoneLen; slotEscaped = &phoneEscaped;
+        }
+        if (i >= count) goto malformed;
+        char c = line[at[i]];
+        if (c == '"') {
+            if (i + 1 >= count) goto malformed;
+            size_t start = at[i] + 1, end = at[i + 1];
+            if (slot) {
+                *slot = line + start;
+                *slotLen = end - start;
+                *slotEscaped = memchr(line + start, '\\', end - start) != NULL;
+            }
+            i += 2;
+        } else if (c == '{' || c == '[') {
+            int depth = 0;
+            for (; i < count; i++) {
+                char d = line[at[i]];
+                if (d == '"') i++;
+                else if (d == '{' || d == '[') depth++;
+                else if ((d == '}' || d == ']') && --depth == 0) break;
+            }
+            if (i++ >= count) goto malformed;
+        } else {
+            // Numbers, true, false and null lie between ':' and the next ',' or '}'
+            size_t start = at[i - 1] + 1, end = at[i];
+            while (start < end && isspace((unsigned char)line[start])) start++;
+            while (end > start && isspace((unsigned char)line[end - 1])) end--;
+            if (start == end) goto malformed;
+            if (slot && !(end - start == 4 && memcmp(line + start, "null", 4) == 0)) {
+                *slot = line + start;
+                *slotLen = end - start;
+                *slotEscaped = 0;
+            }
+        }
+
+        // 4. ',' for another member, or the closing brace
+        if (i >= count) goto malformed;
+        if (line[at[i]] == '}' && i == count - 1) break;
+        if (line[at[i]] != ',') goto malformed;
+        i++;
+    }
+
+done:
+    {
+        // 5. Decode escaped values into scratch space; the line itself is read-only
+        char nameBuf[4 * MAX_NAME_LEN], phoneBuf[2 * INGEST_MAX_RAW_PHONE];
+        if (nameEscaped) {
+            long n = nameLen <= sizeof(nameBuf) ? jsonUnescape(name, nameLen, nameBuf) : -1;
+            if (n < 0) goto malformed;
+            name = nameBuf;
+            nameLen = (size_t)n;
+        }
+        if (phoneEscaped) {
+            long n = phoneLen <= sizeof(phoneBuf) ? jsonUnescape(phone, phoneLen, phoneBuf) : -1;
+            if (n < 0) goto malformed;
+            phone = phoneBuf;
+            phoneLen = (size_t)n;
+        }
+        ingestRow(sc->batch, name ? name : "", nameLen, phone ? phone : "", phoneLen, lineNo);
+        return;
+    }
+
+malformed:
+    ingestRow(sc->batch, line, len, NULL, 0, lineNo);
+}
+
+/**
+ * @brief Imports JSON lines: one object per line with "name" and
+ * "phone" members; other members are ignored.
+ * @param batch The bulk insert state.
+ * @param fp The input.
+ * @return 0 on success, -1 on a read error.
+ */
+int importJsonLines(IngestBatch *batch, FILE *fp) {
+    JsonScanner sc;
+    memset(&sc, 0, sizeof(sc));
+    sc.batch = batch;
+#if defined(__x86_64__) || defined(__i386__)
+    sc.useAvx2 = __builtin_cpu_supports("avx2");
+#endif
+    int rc = forEachInputLine(fp, &batch->stats.bytes, jsonLine, &sc);
+    free(sc.offsets);
+    return rc;
+}
+
+/**
+ * @brief Writes a JSON string literal, escaping quotes, backslashes and
+ * control characters.
+ * @param out Where to write (room for 6 bytes per input byte plus 2).
+ * @param s The NUL-terminated value.
+ * @return The number of bytes written.
+ */
+static size_t jsonQuote(char *out, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    size_t o = 0;
+    out[o++] = '"';
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            out[o++] = (char)c;
+        } else if (c == '"' || c == '\\') {
+            out[o++] = '\\';
+            out[o++] = (char)c;
+        } else {
+            memcpy(out + o, "\\u00", 4);
+            out[o + 4] = hex[c >> 4];
+            out[o + 5] = hex[c & 15];
+            o += 6;
+        }
+    }
+    out[o++] = '"';
+    return o;
+}
+
+static void jsonWriteContact(const char *name, const char *phone, void *ctx) {
+    ExportWriter *w = (ExportWriter*)ctx;
+    char *out = outputReserve(&w->out, 6 * (MAX_NAME_LEN + MAX_PHONE_LEN) + 32);
+    size_t o = 0;
+    memcpy(out, "{\"name\":", 8);
+    o += 8;
+    o += jsonQuote(out + o, name);
+    memcpy(out + o, ",\"phone\":", 9);
+    o += 9;
+    o += jsonQuote(out + o, phone);
+    memcpy(out + o, "}\n", 2);
+    outputCommit(&w->out, o + 2);
+    w->count++;
+}
+
+/**
+ * @brief Writes every contact as a JSON line.
+ * @param ht A pointer to the hash table.
+ * @param fp The output.
+ * @return The number of contacts written, or -1 on failure.
+ */
+long exportJsonLines(HashTable *ht, FILE *fp) {
+    ExportWriter w;
+    if (outputOpen(&w.out, fp, INGEST_READ_BUFFER) != 0) return -1;
+    w.count = 0;
+    forEachContact(ht, jsonWriteContact, &w);
+    return outputClose(&w.out) == 0 ? w.count : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Columnar export                                                     */
+/*                                                                     */
+/*  A .pbc file stores contacts column by column, so analytics readers */
+/*  fetch only the columns they need:                                   */
+/*                                                                     */
+/*    "PBCOLS01"                                                       */
+/*    row group 0: name chunk, phone chunk, area_code chunk             */
+/*    row group 1: ...                                                  */
+/*    footer                                                            */
+/*    uint32 footer length (little-endian), "PBCOLS01"                 */
+/*                                                                     */
+/*  All integers are unsigned LEB128 varints unless noted. The footer   */
+/*  holds the column count, each column's length-prefixed name, the     */
+/*  row group count and, per group, its row count followed by the file  */
+/*  offset and length of each column chunk. A chunk starts with one     */
+/*  encoding byte:                                                      */
+/*    1 FRONT  per row: prefix length shared with the previous value,   */
+/*             suffix length, suffix bytes. Rows of a group are sorted  */
+/*             by name, so neighbouring names share prefixes.           */
+/*    2 DELTA  per row: (digit count << 1 | leading '+'), then the      */
+/*             zigzag difference from the previous row's digits read as */
+/*             a number. Used for phones when all of a group's phones   */
+/*             are an optional '+' and 1-18 digits.                     */
+/*    3 PLAIN  per row: length, bytes. Phones otherwise.                */
+/*    4 DICT   entry count, zigzag entries, a bit-width byte, then one  */
+/*             entry index per row packed LSB first. Area codes, with   */
+/*             -1 for phones that have none.                            */
+/*  Rows are staged a few groups at a time, groups are encoded in       */
+/*  parallel and written in order, so memory stays bounded.             */
+/* ------------------------------------------------------------------ */
+
+// Chunk encodings
+typedef enum ColumnEncoding {
+    COLUMN_FRONT = 1,
+    COLUMN_DELTA,
+    COLUMN_PLAIN,
+    COLUMN_DICT
+} ColumnEncoding;
+
+static const char *columnNames[COLUMNAR_COLUMNS] = { "name", "phone", "area_code" };
+
+// A growable byte string
+typedef struct ByteBuffer {
+    unsigned char *data;
+    size_t used;
+    size_t capacity;
+    int failed;           // An allocation failed; contents are incomplete
+} ByteBuffer;
+
+/**
+ * @brief Makes room for n more bytes.
+ * @param b The buffer.
+ * @param n The number of bytes.
+ * @return 0 on success, -1 if memory ran out.
+ */
+static int bytesReserve(ByteBuffer *b, size_t n) {
+    if (b->used + n <= b->capacity) return 0;
+    size_t capacity = b->capacity ? b->capacity : 4096;
+    while (capacity < b->used + n) capacity *= 2;
+    unsigned char *grown = (unsigned char*)realloc(b->data, capacity);
+    if (!grown) {
+        b->failed = 1;
+        return -1;
+    }
+    b->data = grown;
+    b->capacity = capacity;
+    return 0;
+}
+
+static void bytesPut(ByteBuffer *b, const void *src, size_t n) {
+    if (bytesReserve(b, n) != 0) return;
+    memcpy(b->data + b->used, src, n);
+    b->used += n;
+}
+
+static void bytesPutVarint(ByteBuffer *b, uint64_t v) {
+    if (bytesReserve(b, 10) != 0) return;
+    while (v >= 0x80) {
+        b->data[b->used++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    b->data[b->used++] = (unsigned char)v;
+}
+
+/**
+ * @brief Reads a varint.
+ * @param p The read position (advanced).
+ * @param end The end of the input.
+ * @param v Receives the value.
+ * @return 0 on success, -1 if the input is truncated or malformed.
+ */
+static int bytesGetVarint(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        unsigned char c = *(*p)++;
+        value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *v = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// One row group being encoded
+typedef struct ColumnarGroup {
+    IngestRow *rows;
+    size_t count;
+    ByteBuffer chunks[COLUMNAR_COLUMNS];
+} ColumnarGroup;
+
+// Shared state of the encoding workers
+typedef struct ColumnarJob {
+    ColumnarGroup *groups;
+    int numGroups;
+    int nextGroup;        // Claimed atomically by workers
+} ColumnarJob;
+
+/**
+ * @brief Parses a phone for DELTA encoding.
+ * @param phone The phone.
+ * @param value Receives its digits as a number.
+ * @return (digit count << 1 | leading '+'), or -1 if it does not fit.
+ */
+static int phoneDeltaHeader(const char *phone, uint64_t *value) {
+    int plus = phone[0] == '+';
+    int digits = 0;
+    uint64_t v = 0;
+    for (const char *c = phone + plus; *c; c++) {
+        if (*c < '0' || *c > '9' || ++digits > 18) return -1;
+        v = v * 10 + (uint64_t)(*c - '0');
+    }
+    if (digits == 0) return -1;
+    *value = v;
+    return digits << 1 | plus;
+}
+
+/**
+ * @brief Encodes one row group into its three column chunks.
+ * @param g The group.
+ * @return 0 on success, -1 if memory ran out.
+ */
+static int encodeColumnarGroup(ColumnarGroup *g) {
+    // 1. Sort the rows by name
+    SortRef *refs = (SortRef*)malloc((g->count + 1) * sizeof(SortRef));
+    if (!refs) return -1;
+    for (size_t i = 0; i < g->count; i++) {
+        refs[i].name = g->rows[i].name;
+        refs[i].phone = g->rows[i].phone;
+        refs[i].key = sortKeyAt(refs[i].name, 0);
+    }
+    multikeyQuicksort(refs, g->count, 0);
+
+    // 2. Names, front-coded
+    ByteBuffer *names = &g->chunks[0];
+    unsigned char encoding = COLUMN_FRONT;
+    bytesPut(names, &encoding, 1);
+    const char *prev = "";
+    for (size_t i = 0; i < g->count; i++) {
+        size_t shared = 0;
+        while (prev[shared] && prev[shared] == refs[i].name[shared]) shared++;
+        size_t suffix = strlen(refs[i].name + shared);
+        bytesPutVarint(names, shared);
+        bytesPutVarint(names, suffix);
+        bytesPut(names, refs[i].name + shared, suffix);
+        prev = refs[i].name;
+    }
+
+    // 3. Phones, delta-coded when they are all plain numbers
+    ByteBuffer *phones = &g->chunks[1];
+    encoding = COLUMN_DELTA;
+    uint64_t value;
+    for (size_t i = 0; i < g->count; i++) {
+        if (phoneDeltaHeader(refs[i].phone, &value) < 0) {
+            encoding = COLUMN_PLAIN;
+            break;
+        }
+    }
+    bytesPut(phones, &encoding, 1);
+    int64_t last = 0;
+    for (size_t i = 0; i < g->count; i++) {
+        if (encoding == COLUMN_DELTA) {
+            bytesPutVarint(phones, (uint64_t)phoneDeltaHeader(refs[i].phone, &value));
+            bytesPutVarint(phones, zigzag((int64_t)value - last));
+            last = (int64_t)value;
+        } else {
+            size_t len = strlen(refs[i].phone);
+            bytesPutVarint(phones, len);
+            bytesPut(phones, refs[i].phone, len);
+        }
+    }
+
+    // 4. Area codes, dictionary-coded (slot 1000 stands for "none")
+    ByteBuffer *areas = &g->chunks[2];
+    int16_t slot[1001];
+    int16_t entries[1001];
+    int numEntries = 0;
+    memset(slot, -1, sizeof(slot));
+    uint16_t *index = (uint16_t*)malloc((g->count + 1) * sizeof(uint16_t));
+    if (!index) {
+        free(refs);
+        return -1;
+    }
+    for (size_t i = 0; i < g->count; i++) {
+        int code = phoneAreaCode(refs[i].phone, NULL);
+        int key = code < 0 ? 1000 : code;
+        if (slot[key] < 0) {
+            slot[key] = (int16_t)numEntries;
+            entries[numEntries++] = (int16_t)code;
+        }
+        index[i] = (uint16_t)slot[key];
+    }
+    int width = 0;
+    while ((1 << width) < numEntries) width++;
+    encoding = COLUMN_DICT;
+    bytesPut(areas, &encoding, 1);
+    bytesPutVarint(areas, (uint64_t)numEntries);
+    for (int e = 0; e < numEntries; e++) bytesPutVarint(areas, zigzag(entries[e]));
+    unsigned char w = (unsigned char)width;
+    bytesPut(areas, &w, 1);
+    size_t packedBytes = (g->count * (size_t)width + 7) / 8;
+    if (bytesReserve(areas, packedBytes) == 0) {
+        unsigned char *packed = areas->data + areas->used;
+        memset(packed, 0, packedBytes);
+        for (size_t i = 0; i < g->count; i++) {
+            for (int bit = 0; bit < width; bit++) {
+                size_t at = i * (size_t)width + (size_t)bit;
+                if (index[i] >> bit & 1) packed[at >> 3] |= (unsigned char)(1 << (at & 7));
+            }
+        }
+        areas->used += packedBytes;
+    }
+    free(index);
+    free(refs);
+
+    for (int c = 0; c < COLUMNAR_COLUMNS; c++) {
+        if (g->chunks[c].failed) return -1;
+    }
+    return 0;
+}
+
+static void* columnarEncodeRun(void *arg) {
+    ColumnarJob *job = (ColumnarJob*)arg;
+    int g;
+    while ((g = __atomic_fetch_add(&job->nextGroup, 1, __ATOMIC_RELAXED)) < job->numGroups) {
+        encodeColumnarGroup(&job->groups[g]);
+    }
+    return NULL;
+}
+
+// Exporter state: staged rows and the footer built so far
+typedef struct ColumnarWriter {
+    FILE *fp;
+    IngestRow *rows;      // threads * COLUMNAR_GROUP_ROWS staged rows
+    size_t count;
+    int threads;
+    uint64_t offset;      // File offset of the next chunk
+    ByteBuffer groupIndex; // Footer entries of the groups written so far
+    uint64_t numGroups;
+    long written;
+    int failed;
+} ColumnarWriter;
+
+/**
+ * @brief Encodes the staged rows as row groups and appends them.
+ * @param w The writer.
+ */
+static void columnarFlush(ColumnarWriter *w) {
+    if (w->count == 0 || w->failed) return;
+
+    // 1. Encode groups in parallel
+    ColumnarJob job;
+    job.numGroups = (int)((w->count + COLUMNAR_GROUP_ROWS - 1) / COLUMNAR_GROUP_ROWS);
+    job.nextGroup = 0;
+    job.groups = (ColumnarGroup*)calloc((size_t)job.numGroups, sizeof(ColumnarGroup));
+    if (!job.groups) {
+        w->failed = 1;
+        return;
+    }
+    for (int g = 0; g < job.numGroups; g++) {
+        job.groups[g].rows = w->rows + (size_t)g * COLUMNAR_GROUP_ROWS;
+        size_t left = w->count - (size_t)g * COLUMNAR_GROUP_ROWS;
+        job.groups[g].count = left < COLUMNAR_GROUP_ROWS ? left : COLUMNAR_GROUP_ROWS;
+    }
+    runParallel(columnarEncodeRun, &job, w->threads < job.numGroups ? w->threads : job.numGroups);
+
+    // 2. Write them in order, recording chunk positions for the footer
+    for (int g = 0; g < job.numGroups; g++) {
+        ColumnarGroup *group = &job.groups[g];
+        bytesPutVarint(&w->groupIndex, group->count);
+        for (int c = 0; c < COLUMNAR_COLUMNS; c++) {
+            ByteBuffer *chunk = &group->chunks[c];
+            if (chunk->failed || fwrite(chunk->data, 1, chunk->used, w->fp) != chunk->used) w->failed = 1;
+            bytesPutVarint(&w->groupIndex, w->offset);
+            bytesPutVarint(&w->groupIndex, chunk->used);
+            w->offset += chunk->used;
+            free(chunk->data);
+        }
+        w->written += (long)group->count;
+        w->numGroups++;
+    }
+    free(job.groups);
+    w->count = 0;
+}
+
+static void columnarStageContact(const char *name, const char *phone, void *ctx) {
+    ColumnarWriter *w = (ColumnarWriter*)ctx;
+    IngestRow *row = &w->rows[w->count];
+    copyField(row->name, name, MAX_NAME_LEN);
+    copyField(row->phone, phone, MAX_PHONE_LEN);
+    if (++w->count == (size_t)w->threads * COLUMNAR_GROUP_ROWS) columnarFlush(w);
+}
+
+/**
+ * @brief Writes every contact to a columnar (.pbc) file.
+ * @param ht A pointer to the hash table.
+ * @param fp The output.
+ * @param threads The number of encoding threads.
+ * @return The number of contacts written, or -1 on failure.
+ */
+long exportColumnarThreads(HashTable *ht, FILE *fp, int threads) {
+    ColumnarWriter w;
+    memset(&w, 0, sizeof(w));
+    w.fp = fp;
+    w.threads = threads < 1 ? 1 : threads;
+    w.rows = (IngestRow*)malloc((size_t)w.threads * COLUMNAR_GROUP_ROWS * sizeof(IngestRow));
+    if (!w.rows) {
+        perror("Failed to allocate row groups");
+        return -1;
+    }
+
+    // 1. Magic, then the row groups
+    if (fwrite(COLUMNAR_MAGIC, 1, 8, fp) != 8) w.failed = 1;
+    w.offset = 8;
+    forEachContact(ht, columnarStageContact, &w);
+    columnarFlush(&w);
+    free(w.rows);
+
+    // 2. Footer: the schema, then the group index
+    ByteBuffer footer = { NULL, 0, 0, 0 };
+    bytesPutVarint(&footer, COLUMNAR_COLUMNS);
+    for (int c = 0; c < COLUMNAR_COLUMNS; c++) {
+        size_t len = strlen(columnNames[c]);
+        bytesPutVarint(&footer, len);
+        bytesPut(&footer, columnNames[c], len);
+    }
+    bytesPutVarint(&footer, w.numGroups);
+    bytesPut(&footer, w.groupIndex.data, w.groupIndex.used);
+    unsigned char tail[12];
+    uint32_t footerLen = (uint32_t)footer.used;
+    for (int b = 0; b < 4; b++) tail[b] = (unsigned char)(footerLen >> (8 * b));
+    memcpy(tail + 4, COLUMNAR_MAGIC, 8);
+    if (footer.failed || w.groupIndex.failed ||
+        fwrite(footer.data, 1, footer.used, fp) != footer.used || fwrite(tail, 1, 12, fp) != 12) {
+        w.failed = 1;
+    }
+    free(footer.data);
+    free(w.groupIndex.data);
+    return w.failed ? -1 : w.written;
+}
+
+long exportColumnar(HashTable *ht, FILE *fp) {
+    return exportColumnarThreads(ht, fp, defaultThreadCount());
+}
+
+/**
+ * @brief Decodes one column chunk into fixed-width cells.
+ * @param p The chunk.
+ * @param len Its length.
+ * @param rows The group's row count.
+ * @param cells Receives rows * COLUMNAR_CELL bytes of NUL-terminated text.
+ * @return 0 on success, -1 if the chunk is malformed.
+ */
+static int decodeColumnChunk(const unsigned char *p, size_t len, size_t rows, char *cells) {
+    const unsigned char *end = p + len;
+    if (len == 0) return -1;
+    unsigned char encoding = *p++;
+    uint64_t a, b;
+
+    if (encoding == COLUMN_FRONT || encoding == COLUMN_PLAIN) {
+        const char *prev = "";
+        for (size_t i = 0; i < rows; i++) {
+            char *cell = cells + i * COLUMNAR_CELL;
+            a = 0;
+            if (encoding == COLUMN_FRONT && bytesGetVarint(&p, end, &a) != 0) return -1;
+            if (bytesGetVarint(&p, end, &b) != 0 || a > strlen(prev) ||
+                a + b >= COLUMNAR_CELL || b > (size_t)(end - p)) {
+                return -1;
+            }
+            memcpy(cell, prev, a);
+            memcpy(cell + a, p, b);
+            cell[a + b] = '\0';
+            p += b;
+            prev = cell;
+        }
+        return 0;
+    }
+    if (encoding == COLUMN_DELTA) {
+        int64_t value = 0;
+        for (size_t i = 0; i < rows; i++) {
+            if (bytesGetVarint(&p, end, &a) != 0 || bytesGetVarint(&p, end, &b) != 0) return -1;
+            int digits = (int)(a >> 1);
+            if (digits < 1 || digits > 18) return -1;
+            value += unzigzag(b);
+            char *cell = cells + i * COLUMNAR_CELL;
+            int o = 0;
+            if (a & 1) cell[o++] = '+';
+            uint64_t v = (uint64_t)value;
+            for (int d = digits - 1; d >= 0; d--) {
+                cell[o + d] = (char)('0' + v % 10);
+                v /= 10;
+            }
+            cell[o + digits] = '\0';
+        }
+        return 0;
+    }
+    if (encoding == COLUMN_DICT) {
+        int64_t entries[1001];
+        if (bytesGetVarint(&p, end, &a) != 0 || a == 0 || a > 1001) return -1;
+        size_t numEntries = (size_t)a;
+        for (size_t e = 0; e < numEntries; e++) {
+            if (bytesGetVarint(&p, end, &b) != 0) return -1;
+            entries[e] = unzigzag(b);
+        }
+        if (p >= end) return -1;
+        int width = *p++;
+        if (width > 16 || (size_t)(end - p) < (rows * (size_t)width + 7) / 8) return -1;
+        for (size_t i = 0; i < rows; i++) {
+            size_t idx = 0;
+            for (int bit = 0; bit < width; bit++) {
+                size_t at = i * (size_t)width + (size_t)bit;
+                idx |= (size_t)(p[at >> 3] >> (at & 7) & 1) << bit;
+            }
+            if (idx >= numEntries) return -1;
+            snprintf(cells + i * COLUMNAR_CELL, COLUMNAR_CELL, "%lld", (long long)entries[idx]);
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief The "columns" tool: prints chosen columns of a .pbc file as
+ * tab-separated rows, reading only those columns' chunks.
+ * Usage: phonebook columns <in.pbc> [name,phone,area_code]
+ * @return The process exit status.
+ */
+int runColumnsTool(int argc, char *argv[]) {
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s columns <in.pbc> [name,phone,area_code]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *in = fopen(argv[2], "rb");
+    if (!in) {
+        perror("Failed to open input");
+        return EXIT_FAILURE;
+    }
+
+    // 1. Read the footer from the end of the file
+    unsigned char tail[12];
+    unsigned char *footer = NULL;
+    uint32_t footerLen = 0;
+    off_t fileSize = 0;
+    if (fseeko(in, 0, SEEK_END) == 0) fileSize = ftello(in);
+    if (fileSize >= 20 && fseeko(in, fileSize - 12, SEEK_SET) == 0 && fread(tail, 1, 12, in) == 12 &&
+        memcmp(tail + 4, COLUMNAR_MAGIC, 8) == 0) {
+        for (int b = 0; b < 4; b++) footerLen |= (uint32_t)tail[b] << (8 * b);
+        if (footerLen <= (uint64_t)fileSize - 20) footer = (unsigned char*)malloc(footerLen + 1);
+    }
+    if (!footer || fseeko(in, fileSize - 12 - footerLen, SEEK_SET) != 0 ||
+        fread(footer, 1, footerLen, in) != footerLen) {
+        fprintf(stderr, "ERROR: %s is not a columnar phonebook file.\n", argv[2]);
+        free(footer);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    // 2. Map the requested columns to their positions in the file
+    const unsigned char *p = footer, *end = footer + footerLen;
+    uint64_t numColumns = 0, numGroups = 0, v;
+    int want[COLUMNAR_COLUMNS], numWanted = 0, ok = bytesGetVarint(&p, end, &numColumns) == 0 && numColumns <= 64;
+    char fileColumns[64][32];
+    for (uint64_t c = 0; ok && c < numColumns; c++) {
+        ok = bytesGetVarint(&p, end, &v) == 0 && v < 32 && v <= (uint64_t)(end - p);
+        if (ok) {
+            memcpy(fileColumns[c], p, v);
+            fileColumns[c][v] = '\0';
+            p += v;
+        }
+    }
+    const char *request = argc == 4 ? argv[3] : "name,phone,area_code";
+    while (ok && *request) {
+        size_t len = strcspn(request, ",");
+        int found = -1;
+        for (uint64_t c = 0; c < numColumns; c++) {
+            if (strlen(fileColumns[c]) == len && strncmp(fileColumns[c], request, len) == 0) found = (int)c;
+        }
+        if (found < 0 || numWanted == COLUMNAR_COLUMNS) {
+            fprintf(stderr, "ERROR: Unknown or repeated column '%.*s'.\n", (int)len, request);
+            ok = 0;
+            break;
+        }
+        want[numWanted++] = found;
+        request += len + (request[len] == ',');
+    }
+    ok = ok && numWanted > 0 && bytesGetVarint(&p, end, &numGroups) == 0;
+
+    // 3. Per group, read and decode only the wanted chunks
+    char *cells = (char*)malloc((size_t)COLUMNAR_COLUMNS * COLUMNAR_GROUP_ROWS * COLUMNAR_CELL);
+    unsigned char *chunk = NULL;
+    size_t chunkCapacity = 0;
+    uint64_t bytesRead = 12 + footerLen, rowsOut = 0;
+    OutputBuffer out;
+    memset(&out, 0, sizeof(out));
+    ok = ok && cells && outputOpen(&out, stdout, INGEST_READ_BUFFER) == 0;
+    for (uint64_t g = 0; ok && g < numGroups; g++) {
+        uint64_t rows = 0, offset[64], length[64];
+        ok = bytesGetVarint(&p, end, &rows) == 0 && rows <= COLUMNAR_GROUP_ROWS;
+        for (uint64_t c = 0; ok && c < numColumns; c++) {
+            ok = bytesGetVarint(&p, end, &offset[c]) == 0 && bytesGetVarint(&p, end, &length[c]) == 0;
+        }
+        for (int k = 0; ok && k < numWanted; k++) {
+            uint64_t len = length[want[k]];
+            if (len > (uint64_t)fileSize) { ok = 0; break; }
+            if (len > chunkCapacity) {
+                unsigned char *grown = (unsigned char*)realloc(chunk, len);
+                if (!grown) { ok = 0; break; }
+                chunk = grown;
+                chunkCapacity = len;
+            }
+            ok = fseeko(in, (off_t)offset[want[k]], SEEK_SET) == 0 && fread(chunk, 1, len, in) == len &&
+                 decodeColumnChunk(chunk, len, rows, cells + (size_t)k * COLUMNAR_GROUP_ROWS * COLUMNAR_CELL) == 0;
+            bytesRead += len;
+        }
+        for (uint64_t r = 0; ok && r < rows; r++) {
+            for (int k = 0; k < numWanted; k++) {
+                const char *cell = cells + ((size_t)k * COLUMNAR_GROUP_ROWS + r) * COLUMNAR_CELL;
+                outputWrite(&out, cell, strlen(cell));
+                outputWrite(&out, k + 1 < numWanted ? "\t" : "\n", 1);
+            }
+        }
+        rowsOut += rows;
+    }
+    if (out.data && outputClose(&out) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "ERROR: %s is truncated or malformed.\n", argv[2]);
+    else fprintf(stderr, "Read %llu rows, %d of %llu columns: %llu of %lld bytes.\n",
+                 (unsigned long long)rowsOut, numWanted, (unsigned long long)numColumns,
+                 (unsigned long long)bytesRead, (long long)fileSize);
+    free(chunk);
+    free(cells);
+    free(footer);
+    fclose(in);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief The "sorted" tool: writes a snapshot as an alphabetical listing.
+ * Usage: phonebook sorted <snapshot> [out.tsv]
+ * @return The process exit status.
+ */
+int runSortedTool(int argc, char *argv[]) {
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s sorted <snapshot> [out.tsv]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    HashTable *ht = loadSnapshot(argv[2]);
+    if (!ht) return EXIT_FAILURE;
+
+    FILE *out = argc == 4 ? fopen(argv[3], "w") : stdout;
+    if (!out) {
+        perror("Failed to open output");
+        releaseHashTable(ht);
+        return EXIT_FAILURE;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long n = exportContactsSorted(ht, out, defaultThreadCount());
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "Sorted %ld contacts in %.3f s.\n", n,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    releaseHashTable(ht);
+    return n >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief The "setop" tool: union, intersection or difference of snapshots.
+ * Usage: phonebook setop <union|intersect|subtract> <a.snap> <b.snap> <out.snap>
+ * @return The process exit status.
+ */
+int runSetOperationTool(int argc, char *argv[]) {
+    SetOperation op;
+    if (argc == 6 && strcmp(argv[2], "union") == 0) op = SET_UNION;
+    else if (argc == 6 && strcmp(argv[2], "intersect") == 0) op = SET_INTERSECTION;
+    else if (argc == 6 && strcmp(argv[2], "subtract") == 0) op = SET_DIFFERENCE;
+    else {
+        fprintf(stderr, "Usage: %s setop <union|intersect|subtract> <a.snap> <b.snap> "
+                "<out.snap>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    HashTable *a = loadSnapshot(argv[3]);
+    HashTable *b = a ? loadSnapshot(argv[4]) : NULL;
+    HashTable *result = b ? phonebookSetOperation(a, b, op, defaultThreadCount()) : NULL;
+    int rc = result && saveSnapshot(result, argv[5]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (result) {
+        printf("%s: %zu contacts written to '%s'.\n", argv[2], residentContacts(result), argv[5]);
+    }
+    releaseHashTable(result);
+    releaseHashTable(b);
+    releaseHashTable(a);
+    return rc;
+}
+
+/**
+ * @brief The "diff" tool: two-way or three-way diff report of snapshots.
+ * Usage: phonebook diff <old.snap> <new.snap>
+ *        phonebook diff <base.snap> <left.snap> <right.snap>
+ * @return The process exit status.
+ */
+int runDiffTool(int argc, char *argv[]) {
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "Usage: %s diff <old.snap> <new.snap>\n"
+                "       %s diff <base.snap> <left.snap> <right.snap>\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    HashTable *tables[3] = { NULL, NULL, NULL };
+    int n = argc - 2, ok = 1;
+    for (int i = 0; i < n && ok; i++) {
+        tables[i] = loadSnapshot(argv[2 + i]);
+        ok = tables[i] != NULL;
+    }
+    int rc = EXIT_FAILURE;
+    if (ok) {
+        HashTable *base = n == 3 ? tables[0] : NULL;
+        HashTable *left = n == 3 ? tables[1] : tables[0];
+        HashTable *right = n == 3 ? tables[2] : tables[1];
+        rc = phonebookDiff(base, left, right, stdout, defaultThreadCount()) == 0
+                 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    for (int i = 0; i < 3; i++) releaseHashTable(tables[i]);
+    return rc;
+}
+
+/**
+ * @brief The "filter" tool: prints the contacts of a snapshot that match
+ * a filter expression, as tab-separated lines.
+ * Usage: phonebook filter <snapshot> <expression>
+ * @return The process exit status.
+ */
+int runFilterTool(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s filter <snapshot> <expression>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    CompiledFilter *prog = compileFilter(argv[3]);
+    if (!prog) return EXIT_FAILURE;
+    HashTable *ht = loadSnapshot(argv[2]);
+    if (!ht) {
+        freeFilter(prog);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    FilterResult *result = scanContacts(ht, prog, defaultThreadCount());
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (result) {
+        for (size_t i = 0; i < result->count; i++) {
+            printf("%s\t%s\n", result->matches[i].name, result->matches[i].phone);
+        }
+        fprintf(stderr, "Matched %zu of %zu contacts in %.3f s.\n", result->count, result->scanned,
+                (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+
+    int ok = result != NULL;
+    freeFilterResult(result);
+    freeFilter(prog);
+    releaseHashTable(ht);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Tests a path's extension, ignoring case.
+ * @param path The path.
+ * @param ext The extension including the dot.
+ * @return Non-zero if the path ends with it.
+ */
+static int hasExtension(const char *path, const char *ext) {
+    size_t pl = strlen(path), el = strlen(ext);
+    return pl >= el && strcasecmp(path + pl - el, ext) == 0;
+}
+
+/**
+ * @brief The "import" tool: validates, normalizes and bulk-inserts a
+ * contact file into a snapshot (created if missing). The format follows
+ * the extension: .vcf for vCard, .jsonl or .ndjson for JSON lines, and
+ * anything else for name<TAB>phone lines.
+ * Usage: phonebook import <in.tsv|in.vcf|in.jsonl> <snapshot>
+ * @return The process exit status.
+ */
+int runImportTool(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s import <in.tsv|in.vcf|in.jsonl> <snapshot>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *in = fopen(argv[2], "rb");
+    if (!in) {
+        perror("Failed to open input");
+        return EXIT_FAILURE;
+    }
+    // A new table gets about one bucket per two rows of ~24 bytes
+    fseeko(in, 0, SEEK_END);
+    off_t inputBytes = ftello(in);
+    rewind(in);
+    long buckets = inputBytes > 0 ? (long)(inputBytes / 48) : 0;
+    if (buckets < TABLE_SIZE) buckets = TABLE_SIZE;
+    if (buckets > (1L << 24)) buckets = 1L << 24;
+
+    HashTable *ht = access(argv[3], F_OK) == 0 ? loadSnapshot(argv[3]) : createHashTable((int)buckets);
+    IngestBatch batch;
+    if (!ht || ingestBegin(&batch, ht, stderr) != 0) {
+        fclose(in);
+        releaseHashTable(ht);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rc;
+    if (hasExtension(argv[2], ".vcf")) rc = importVcard(&batch, in);
+    else if (hasExtension(argv[2], ".jsonl") || hasExtension(argv[2], ".ndjson")) rc = importJsonLines(&batch, in);
+    else rc = importTsv(&batch, in);
+    ingestEnd(&batch);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fclose(in);
+    printIngestStats(&batch.stats, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, stderr);
+
+    if (rc == 0) rc = saveSnapshot(ht, argv[3]);
+    releaseHashTable(ht);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief The "export" tool: writes a snapshot in an interchange format
+ * chosen by the output's extension (.vcf for vCard, .jsonl or .ndjson
+ * for JSON lines, .pbc for the columnar layout).
+ * Usage: phonebook export <snapshot> <out.vcf|out.jsonl|out.pbc>
+ * @return The process exit status.
+ */
+int runExportTool(int argc, char *argv[]) {
+    long (*exporter)(HashTable*, FILE*) = NULL;
+    if (argc == 4 && hasExtension(argv[3], ".vcf")) exporter = exportVcard;
+    else if (argc == 4 && (hasExtension(argv[3], ".jsonl") || hasExtension(argv[3], ".ndjson"))) exporter = exportJsonLines;
+    else if (argc == 4 && hasExtension(argv[3], ".pbc")) exporter = exportColumnar;
+    if (!exporter) {
+        fprintf(stderr, "Usage: %s export <snapshot> <out.vcf|out.jsonl|out.pbc>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    HashTable *ht = loadSnapshot(argv[2]);
+    if (!ht) return EXIT_FAILURE;
+    FILE *out = fopen(argv[3], "wb");
+    if (!out) {
+        perror("Failed to open output");
+        releaseHashTable(ht);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long n = exporter(ht, out);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    off_t bytes = ftello(out);
+    if (fclose(out) != 0) n = -1;
+    if (n >= 0) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "Exported %ld contacts (%.1f MB) in %.3f s (%.1f MB/s).\n",
+                n, bytes / 1e6, seconds, seconds > 0 ? bytes / 1e6 / seconds : 0.0);
+    }
+    releaseHashTable(ht);
+    return n >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Benchmark driver with hardware performance counters                 */
+/*                                                                     */
+/*  Each scenario runs on a fresh table of the chosen layout (chained   */
+/*  in memory, disk-resident, or memory budget with overflow), filled   */
+/*  with the same generated contacts. The timed loop is wrapped in      */
+/*  perf_event_open counters for cycles, instructions, L1D, LLC and     */
+/*  dTLB read misses and branch mispredicts, reported per operation.    */
+/*  Counters are opened one by one, so an event the CPU or the kernel   */
+/*  lacks only blanks its own column; multiplexed counts are scaled by  */
+/*  time enabled over time running.                                     */
+/* ------------------------------------------------------------------ */
+
+static const char *perfCounterNames[BENCH_COUNTERS] = {
+    "cycles", "instr", "L1D-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+// Open counters and their readings at the start of a measurement
+typedef struct PerfCounters {
+    int fd[BENCH_COUNTERS];            // -1 where the event is unavailable
+    uint64_t start[BENCH_COUNTERS][3]; // Value, time enabled, time running
+    int openErrno;                     // Why the first event failed, if it did
+} PerfCounters;
+
+// Measured cost of one scenario
+typedef struct BenchResult {
+    uint64_t ops;
+    double seconds;
+    double counts[BENCH_COUNTERS];
+    int valid[BENCH_COUNTERS];
+} BenchResult;
+
+/**
+ * @brief Opens the hardware counters for the calling thread (user space
+ * only, so the default perf_event_paranoid setting allows it).
+ * @param pc The counters.
+ * @return The number of counters opened.
+ */
+int perfCountersOpen(PerfCounters *pc) {
+    memset(pc, 0, sizeof(*pc));
+    int opened = 0;
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        pc->fd[i] = -1;
+#ifdef __linux__
+        static const uint32_t types[BENCH_COUNTERS] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+        };
+        static const uint64_t configs[BENCH_COUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+            PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+            PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pc->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (pc->fd[i] < 0 && !pc->openErrno) pc->openErrno = errno;
+#else
+        if (!pc->openErrno) pc->openErrno = ENOSYS;
+#endif
+        if (pc->fd[i] >= 0) opened++;
+    }
+    return opened;
+}
+
+/**
+ * @brief Closes the counters.
+ * @param pc The counters.
+ */
+void perfCountersClose(PerfCounters *pc) {
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        if (pc->fd[i] >= 0) close(pc->fd[i]);
+        pc->fd[i] = -1;
+    }
+}
+
+/**
+ * @brief Records the counters' readings at the start of a measurement.
+ * @param pc The counters.
+ */
+void perfCountersStart(PerfCounters *pc) {
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        if (pc->fd[i] >= 0 && read(pc->fd[i], pc->start[i], sizeof(pc->start[i])) != sizeof(pc->start[i])) {
+            close(pc->fd[i]);
+            pc->fd[i] = -1;
+        }
+    }
+}
+
+/**
+ * @brief Reads how much each counter advanced since perfCountersStart().
+ * @param pc The counters.
+ * @param result Receives the scaled counts and which ones are valid.
+ */
+void perfCountersStop(PerfCounters *pc, BenchResult *result) {
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        uint64_t now[3];
+        result->valid[i] = 0;
+        if (pc->fd[i] < 0 || read(pc->fd[i], now, sizeof(now)) != sizeof(now)) continue;
+        uint64_t enabled = now[1] - pc->start[i][1], running = now[2] - pc->start[i][2];
+        if (running == 0) continue; // Never scheduled on the PMU
+        result->counts[i] = (double)(now[0] - pc->start[i][0]) * ((double)enabled / (double)running);
+        result->valid[i] = 1;
+    }
+}
+
+// Storage layouts the benchmark can build
+typedef enum BenchLayout {
+    BENCH_CHAINED,
+    BENCH_DISK,
+    BENCH_BUDGET
+} BenchLayout;
+
+// Generated workload and the table under test
+typedef struct BenchContext {
+    BenchLayout layout;
+    int buckets;          // Chained and budget layouts
+    size_t budget;        // Budget layout: bytes of resident contacts
+    char path[64];        // Disk file or overflow store
+    IngestRow *keys;      // Contacts inserted into the table
+    IngestRow *missKeys;  // Names that are never inserted
+    uint32_t *order;      // Random key index per operation
+    size_t contacts;
+    size_t ops;
+    HashTable *ht;
+} BenchContext;
+
+static inline uint64_t benchRandom(uint64_t *state) {
+    *state += 0x9e3779b97f4a7c15ULL;
+    return mixHash(*state);
+}
+
+/**
+ * @brief Generates n contacts: names of varying length built from
+ * common given names and surnames plus a number, phones in +1 form.
+ * @param rows The output.
+ * @param n The number of contacts.
+ * @param first The index of the first one (distinct ranges never collide).
+ */
+void benchGenerateContacts(IngestRow *rows, size_t n, uint64_t first) {
+    static const char *given[16] = {
+        "James", "Mary", "Robert", "Patricia", "John", "Jennifer", "Michael", "Linda",
+        "David", "Elizabeth", "William", "Barbara", "Richard", "Susan", "Joseph", "Jessica"
+    };
+    static const char *family[16] = {
+        "Smith", "Johnson", "Williams", "Brown", "Jones", "Garcia", "Miller", "Davis",
+        "Rodriguez", "Martinez", "Hernandez", "Lopez", "Gonzalez", "Wilson", "Anderson", "Thomas"
+    };
+    for (size_t i = 0; i < n; i++) {
+        uint64_t id = first + i;
+        uint64_t h = mixHash(id);
+        snprintf(rows[i].name, MAX_NAME_LEN, "%s %s %llu", given[h & 15], family[(h >> 4) & 15],
+                 (unsigned long long)id);
+        snprintf(rows[i].phone, MAX_PHONE_LEN, "+1%03u555%04u", (unsigned)(h >> 8) % 800 + 200,
+                 (unsigned)(h >> 20) % 10000);
+    }
+}
+
+/**
+ * @brief Creates an empty table of the context's layout.
+ * @param ctx The benchmark context.
+ * @return 0 on success, -1 on failure.
+ */
+static int benchOpenTable(BenchContext *ctx) {
+    // The scratch files are the benchmark's own; clear any left behind
+    char dirPath[80];
+    snprintf(dirPath, sizeof(dirPath), "%s.dir", ctx->path);
+    unlink(ctx->path);
+    unlink(dirPath);
+    if (ctx->layout == BENCH_DISK) {
+        ctx->ht = openDiskHashTable(ctx->path, DISK_POOL_PAGES);
+        return ctx->ht ? 0 : -1;
+    }
+    ctx->ht = createHashTable(ctx->buckets);
+    if (ctx->layout == BENCH_BUDGET && setMemoryBudget(ctx->ht, ctx->budget, ctx->path) != 0) {
+        releaseHashTable(ctx->ht);
+        ctx->ht = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees the table under test and removes its files.
+ * @param ctx The benchmark context.
+ */
+static void benchCloseTable(BenchContext *ctx) {
+    releaseHashTable(ctx->ht);
+    ctx->ht = NULL;
+    if (ctx->layout == BENCH_DISK) {
+        char dirPath[80];
+        snprintf(dirPath, sizeof(dirPath), "%s.dir", ctx->path);
+        unlink(ctx->path);
+        unlink(dirPath);
+    }
+}
+
+static volatile uint64_t benchSink;
+
+/**
+ * @brief Runs one scenario's timed loop.
+ * @param ctx The benchmark context (its table is already populated
+ * unless the scenario is "insert").
+ * @param scenario The scenario name.
+ * @param pc The counters.
+ * @param result Receives the measurements.
+ * @return 0 on success, -1 for an unknown scenario.
+ */
+static int benchRunScenario(BenchContext *ctx, const char *scenario, PerfCounters *pc, BenchResult *result) {
+    HashTable *ht = ctx->ht;
+    const IngestRow *keys = ctx->keys;
+    const uint32_t *order = ctx->order;
+    size_t ops = ctx->ops;
+    uint64_t sink = 0;
+    int kind;
+    if (strcmp(scenario, "insert") == 0) kind = 0;
+    else if (strcmp(scenario, "search-hit") == 0) kind = 1;
+    else if (strcmp(scenario, "search-miss") == 0) kind = 2;
+    else if (strcmp(scenario, "update") == 0) kind = 3;
+    else if (strcmp(scenario, "delete") == 0) kind = 4;
+    else if (strcmp(scenario, "hash-djb2") == 0) kind = 5;
+    else if (strcmp(scenario, "hash-mix") == 0) kind = 6;
+    else return -1;
+    // Inserts and deletes touch each key once
+    if (kind == 0 || kind == 4) ops = ctx->contacts;
+    uint64_t mask = 1;
+    while (mask < (uint64_t)ctx->buckets) mask <<= 1;
+    mask--;
+
+    struct timespec start, end;
+    perfCountersStart(pc);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < ops; i++) {
+        switch (kind) {
+            case 0: sink += (uint64_t)addContact(ht, keys[i].name, keys[i].phone); break;
+            case 1: sink += (uintptr_t)searchContact(ht, keys[order[i]].name); break;
+            case 2: sink += (uintptr_t)searchContact(ht, ctx->missKeys[order[i]].name); break;
+            case 3: sink += (uint64_t)changeContactPhone(ht, keys[order[i]].name, keys[order[i] ^ 1].phone); break;
+            case 4: sink += (uint64_t)removeContact(ht, keys[order[i]].name); break;
+            case 5: sink += hashFunction(keys[order[i]].name, ctx->buckets); break;
+            default: sink += mixHash(hashString(keys[order[i]].name)) & mask; break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    perfCountersStop(pc, result);
+    benchSink = sink;
+    result->ops = ops;
+    result->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return 0;
+}
+
+/**
+ * @brief Prints one result row; counters are per operation.
+ * @param scenario The scenario name.
+ * @param r The result.
+ */
+static void benchPrintResult(const char *scenario, const BenchResult *r) {
+    double ops = r->ops ? (double)r->ops : 1.0;
+    printf("%-12s %10llu %9.1f %8.2f", scenario, (unsigned long long)r->ops,
+           r->seconds * 1e9 / ops, r->seconds > 0 ? r->ops / r->seconds / 1e6 : 0.0);
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        if (r->valid[i]) printf(" %10.2f", r->counts[i] / ops);
+        else printf(" %10s", "-");
+    }
+    if (r->valid[0] && r->valid[1] && r->counts[0] > 0) printf(" %6.2f", r->counts[1] / r->counts[0]);
+    else printf(" %6s", "-");
+    printf("\n");
+}
+
+/**
+ * @brief Describes the chains of an in-memory table: load factor and the
+ * average number of nodes a successful lookup walks.
+ * @param ht A pointer to the hash table.
+ * @param out Receives the description.
+ * @param size The size of out.
+ */
+static void benchDescribeChains(HashTable *ht, char *out, size_t size) {
+    uint64_t nodes = 0, walk = 0;
+    size_t longest = 0;
+    for (int i = 0; i < ht->size; i++) {
+        size_t len = 0;
+        for (ContactNode *node = ht->table[i]; node; node = node->next) len++;
+        nodes += len;
+        walk += len * (len + 1) / 2;
+        if (len > longest) longest = len;
+    }
+    snprintf(out, size, "Chains: load factor %.2f, %.2f nodes walked per hit, longest %zu",
+             (double)nodes / ht->size, nodes ? (double)walk / nodes : 0.0, longest);
+}
+
+/**
+ * @brief The "bench" tool: measures table operations with hardware
+ * counters.
+ * Usage: phonebook bench [--layout chained|disk|budget] [--contacts N]
+ *        [--ops N] [--buckets N] [--budget BYTES] [scenario...]
+ * Scenarios: insert, search-hit, search-miss, update, delete, hash-djb2,
+ * hash-mix (all but the hash ones by default).
+ * @return The process exit status.
+ */
+int runBenchTool(int argc, char *argv[]) {
+    BenchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.layout = BENCH_CHAINED;
+    ctx.contacts = BENCH_DEFAULT_CONTACTS;
+    ctx.ops = BENCH_DEFAULT_OPS;
+    long buckets = 0;
+    const char *scenarios[16];
+    int numScenarios = 0;
+
+    // 1. Options
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "chained") == 0) ctx.layout = BENCH_CHAINED;
+            else if (strcmp(argv[i], "disk") == 0) ctx.layout = BENCH_DISK;
+            else if (strcmp(argv[i], "budget") == 0) ctx.layout = BENCH_BUDGET;
+            else numScenarios = -1;
+        } else if (strcmp(argv[i], "--contacts") == 0 && i + 1 < argc) {
+            ctx.contacts = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            ctx.ops = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--buckets") == 0 && i + 1 < argc) {
+            buckets = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            ctx.budget = strtoull(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && numScenarios >= 0 && numScenarios < 16) {
+            scenarios[numScenarios++] = argv[i];
+        } else {
+            numScenarios = -1;
+        }
+    }
+    if (numScenarios < 0 || ctx.contacts < 2 || ctx.contacts > UINT32_MAX || ctx.ops < 1) {
+        fprintf(stderr, "Usage: %s bench [--layout chained|disk|budget] [--contacts N] [--ops N]\n"
+                        "       [--buckets N] [--budget BYTES] [insert|search-hit|search-miss|update|\n"
+                        "       delete|hash-djb2|hash-mix ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (numScenarios == 0) {
+        static const char *defaults[] = { "insert", "search-hit", "search-miss", "update", "delete" };
+        for (int k = 0; k < 5; k++) scenarios[numScenarios++] = defaults[k];
+    }
+    // One bucket per contact unless told otherwise
+    ctx.buckets = (int)(buckets > 0 ? buckets : (ctx.contacts < INT32_MAX ? (long)ctx.contacts : INT32_MAX));
+    if (!ctx.budget) ctx.budget = ctx.contacts / 4 * sizeof(ContactNode);
+    snprintf(ctx.path, sizeof(ctx.path), "phonebook-bench-%ld.tmp", (long)getpid());
+
+    // 2. The workload: contacts, absent names, and a random op order
+    ctx.keys = (IngestRow*)malloc(ctx.contacts * sizeof(IngestRow));
+    ctx.missKeys = (IngestRow*)malloc(ctx.contacts * sizeof(IngestRow));
+    ctx.order = (uint32_t*)malloc((ctx.ops > ctx.contacts ? ctx.ops : ctx.contacts) * sizeof(uint32_t));
+    if (!ctx.keys || !ctx.missKeys || !ctx.order) {
+        perror("Failed to allocate the workload");
+        free(ctx.keys); free(ctx.missKeys); free(ctx.order);
+        return EXIT_FAILURE;
+    }
+    benchGenerateContacts(ctx.keys, ctx.contacts, 0);
+    benchGenerateContacts(ctx.missKeys, ctx.contacts, ctx.contacts);
+    uint64_t seed = 42;
+    size_t orderLen = ctx.ops > ctx.contacts ? ctx.ops : ctx.contacts;
+    for (size_t i = 0; i < orderLen; i++) ctx.order[i] = (uint32_t)(benchRandom(&seed) % ctx.contacts);
+    // Deletes need each key exactly once: a shuffled permutation in the prefix
+    for (size_t i = 0; i < ctx.contacts; i++) ctx.order[i] = (uint32_t)i;
+    for (size_t i = ctx.contacts - 1; i > 0; i--) {
+        size_t j = benchRandom(&seed) % (i + 1);
+        uint32_t t = ctx.order[i]; ctx.order[i] = ctx.order[j]; ctx.order[j] = t;
+    }
+    // ^1 in the update scenario must stay in range
+    if (ctx.contacts % 2) {
+        for (size_t i = 0; i < orderLen; i++) if (ctx.order[i] == ctx.contacts - 1) ctx.order[i]--;
+    }
+
+    // 3. Counters
+    PerfCounters pc;
+    int opened = perfCountersOpen(&pc);
+    if (opened < BENCH_COUNTERS) {
+        int denied = pc.openErrno == EACCES || pc.openErrno == EPERM;
+        fprintf(stderr, "Note: %d of %d hardware counters available (perf_event_open: %s); %s.\n",
+                opened, BENCH_COUNTERS, strerror(pc.openErrno),
+                denied ? "see /proc/sys/kernel/perf_event_paranoid"
+                       : "the CPU or hypervisor may not expose these events");
+    }
+
+    // 4. Each scenario on a fresh, populated table
+    static const char *layoutNames[] = { "chained", "disk", "budget" };
+    if (ctx.layout == BENCH_DISK) {
+        printf("Layout disk, %zu contacts, %d pool pages\n", ctx.contacts, DISK_POOL_PAGES);
+    } else {
+        printf("Layout %s, %zu contacts, %d buckets\n", layoutNames[ctx.layout], ctx.contacts, ctx.buckets);
+    }
+    printf("%-12s %10s %9s %8s", "scenario", "ops", "ns/op", "Mops/s");
+    for (int i = 0; i < BENCH_COUNTERS; i++) printf(" %10s", perfCounterNames[i]);
+    printf(" %6s\n", "IPC");
+    int status = EXIT_SUCCESS;
+    char chains[128] = "";
+    for (int k = 0; k < numScenarios && status == EXIT_SUCCESS; k++) {
+        if (benchOpenTable(&ctx) != 0) {
+            status = EXIT_FAILURE;
+            break;
+        }
+        int populate = strcmp(scenarios[k], "insert") != 0;
+        for (size_t i = 0; populate && i < ctx.contacts; i++) {
+            addContact(ctx.ht, ctx.keys[i].name, ctx.keys[i].phone);
+        }
+        BenchResult result;
+        memset(&result, 0, sizeof(result));
+        if (benchRunScenario(&ctx, scenarios[k], &pc, &result) != 0) {
+            fprintf(stderr, "ERROR: Unknown scenario '%s'.\n", scenarios[k]);
+            status = EXIT_FAILURE;
+        } else {
+            benchPrintResult(scenarios[k], &result);
+        }
+        if (populate && !chains[0] && ctx.layout != BENCH_DISK) {
+            benchDescribeChains(ctx.ht, chains, sizeof(chains));
+        }
+        benchCloseTable(&ctx);
+    }
+    if (chains[0]) printf("%s\n", chains);
+
+    perfCountersClose(&pc);
+    free(ctx.keys);
+    free(ctx.missKeys);
+    free(ctx.order);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Multi-threaded scaling benchmark                                    */
+/*                                                                     */
+/*  Threads share one table in concurrent mode and run a workload mix   */
+/*  for a fixed time after being released together. Each thread         */
+/*  counts its operations and times every BENCH_LATENCY_SAMPLE-th one;  */
+/*  the report gives throughput and speedup over one thread, per-thread */
+/*  fairness (slowest/fastest and Jain's index) and latency quantiles.  */
+/*  Inserts and deletes use names private to the thread, so the table   */
+/*  size stays steady and every delete finds its contact.               */
+/* ------------------------------------------------------------------ */
+
+// A workload mix in percent; the rest of the operations are lookups
+typedef struct ScaleWorkload {
+    const char *name;
+    int updatePct;
+    int insertPct;
+    int deletePct;
+    int hotPct;           // Share of keys drawn from the BENCH_HOT_KEYS hot set
+} ScaleWorkload;
+
+static const ScaleWorkload scaleWorkloads[] = {
+    { "read-only",   0,  0,  0,  0 },
+    { "read-mostly", 5,  0,  0,  0 },
+    { "write-heavy", 30, 15, 15, 0 },
+    { "hot-key",     20, 0,  0,  90 }
+};
+
+// Shared state of one measurement point
+typedef struct ScaleJob {
+    HashTable *ht;
+    const IngestRow *keys;
+    size_t contacts;
+    const ScaleWorkload *workload;
+    unsigned run;         // Distinguishes private names across points
+    int ready;            // Threads waiting for the start signal
+    int go;               // Set by the coordinator to start
+    int stop;             // Set by the coordinator when time is up
+} ScaleJob;
+
+// One thread's counters and latency samples
+typedef struct ScaleWorker {
+    ScaleJob *job;
+    int id;
+    uint64_t ops;
+    uint32_t *latencies;  // Nanoseconds, one per sampled operation
+    size_t numLatencies;
+    size_t capacity;
+} ScaleWorker;
+
+/**
+ * @brief Formats a thread-private contact name without stdio.
+ * @param out The output (MAX_NAME_LEN bytes).
+ * @param run The measurement point.
+ * @param thread The thread.
+ * @param seq The thread's insert sequence number.
+ */
+static void scalePrivateName(char *out, unsigned run, int thread, uint64_t seq) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + seq % 10);
+        seq /= 10;
+    } while (seq);
+    int o = 0;
+    memcpy(out, "Scale ", 6);
+    o += 6;
+    out[o++] = (char)('A' + run % 26);
+    out[o++] = (char)('A' + (unsigned)thread / 26 % 26);
+    out[o++] = (char)('A' + (unsigned)thread % 26);
+    out[o++] = ' ';
+    while (n > 0) out[o++] = digits[--n];
+    out[o] = '\0';
+}
+
+static inline uint64_t scaleNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void* scaleWorkerRun(void *arg) {
+    ScaleWorker *w = (ScaleWorker*)arg;
+    ScaleJob *job = w->job;
+    const ScaleWorkload *mix = job->workload;
+    uint64_t seed = mixHash((uint64_t)job->run << 32 | (uint64_t)w->id);
+    uint64_t inserted = 0, deleted = 0;
+    char name[MAX_NAME_LEN], phone[MAX_PHONE_LEN];
+
+    __atomic_add_fetch(&job->ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&job->go, __ATOMIC_ACQUIRE)) sched_yield();
+    while (!__atomic_load_n(&job->stop, __ATOMIC_RELAXED)) {
+        // 1. Pick the operation and its key
+        uint64_t r = benchRandom(&seed);
+        int pct = (int)(r % 100);
+        uint64_t pick = (r >> 8) % 100 < (uint64_t)mix->hotPct ? (r >> 16) % BENCH_HOT_KEYS
+                                                                : (r >> 16) % job->contacts;
+        const IngestRow *key = &job->keys[pick];
+        int op = pct < mix->updatePct ? 1
+               : pct < mix->updatePct + mix->insertPct ? 2
+               : pct < mix->updatePct + mix->insertPct + mix->deletePct ? 3 : 0;
+        if (op == 3 && deleted == inserted) op = 2; // Nothing of ours to delete yet
+        if (op == 2) scalePrivateName(name, job->run, w->id, inserted);
+        if (op == 3) scalePrivateName(name, job->run, w->id, deleted);
+
+        // 2. Run it, timing every BENCH_LATENCY_SAMPLE-th one
+        int sampled = w->ops % BENCH_LATENCY_SAMPLE == 0;
+        uint64_t began = sampled ? scaleNow() : 0;
+        switch (op) {
+            case 0: concurrentSearch(job->ht, key->name, phone); break;
+            case 1: concurrentUpdate(job->ht, key->name, job->keys[(pick + 1) % job->contacts].phone); break;
+            case 2: if (concurrentInsert(job->ht, name, key->phone) == 0) inserted++; break;
+            default: deleted += (uint64_t)concurrentDelete(job->ht, name); break;
+        }
+        if (sampled) {
+            uint64_t took = scaleNow() - began;
+            if (w->numLatencies == w->capacity) {
+                size_t capacity = w->capacity ? w->capacity * 2 : 4096;
+                uint32_t *grown = (uint32_t*)realloc(w->latencies, capacity * sizeof(uint32_t));
+                if (grown) {
+                    w->latencies = grown;
+                    w->capacity = capacity;
+                }
+            }
+            if (w->numLatencies < w->capacity) w->latencies[w->numLatencies++] = took > UINT32_MAX ? UINT32_MAX : (uint32_t)took;
+        }
+        w->ops++;
+    }
+
+    // 3. Leave the table as we found it
+    while (deleted < inserted) {
+        scalePrivateName(name, job->run, w->id, deleted++);
+        concurrentDelete(job->ht, name);
+    }
+    return NULL;
+}
+
+static int compareUint32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Runs one workload at one thread count and prints its row.
+ * @param job The shared state (table, keys, workload, run number).
+ * @param threads The number of threads.
+ * @param millis How long to run.
+ * @param baseline Throughput at one thread (0 if not yet known).
+ * @return The throughput in operations per second.
+ */
+static double scaleMeasure(ScaleJob *job, int threads, int millis, double baseline) {
+    ScaleWorker *workers = (ScaleWorker*)calloc((size_t)threads, sizeof(ScaleWorker));
+    pthread_t *tids = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+    if (!workers || !tids) {
+        perror("Failed to allocate workers");
+        free(workers); free(tids);
+        return 0;
+    }
+
+    // 1. Start the threads, release them together, then stop them
+    job->ready = job->go = job->stop = 0;
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].job = job;
+        workers[t].id = t;
+        if (pthread_create(&tids[t], NULL, scaleWorkerRun, &workers[t]) != 0) break;
+        started++;
+    }
+    if (started < threads) fprintf(stderr, "ERROR: Could only start %d of %d threads.\n", started, threads);
+    while (__atomic_load_n(&job->ready, __ATOMIC_ACQUIRE) < started) sched_yield();
+    uint64_t began = scaleNow();
+    __atomic_store_n(&job->go, 1, __ATOMIC_RELEASE);
+    struct timespec nap = { millis / 1000, (long)(millis % 1000) * 1000000L };
+    nanosleep(&nap, NULL);
+    __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+    for (int t = 0; t < started; t++) pthread_join(tids[t], NULL);
+    double seconds = (scaleNow() - began) / 1e9;
+
+    // 2. Throughput and fairness
+    uint64_t total = 0, fewest = UINT64_MAX, most = 0;
+    double sum = 0, sumSquares = 0;
+    size_t samples = 0;
+    for (int t = 0; t < started; t++) {
+        uint64_t ops = workers[t].ops;
+        total += ops;
+        if (ops < fewest) fewest = ops;
+        if (ops > most) most = ops;
+        sum += (double)ops;
+        sumSquares += (double)ops * (double)ops;
+        samples += workers[t].numLatencies;
+    }
+    double throughput = seconds > 0 ? total / seconds : 0;
+    double jain = sumSquares > 0 ? sum * sum / (started * sumSquares) : 0;
+    if (started == 0) seconds = 1;
+
+    // 3. Latency quantiles over every thread's samples
+    uint32_t *all = (uint32_t*)malloc((samples + 1) * sizeof(uint32_t));
+    double p50 = 0, p99 = 0, p999 = 0, worst = 0;
+    if (all && samples > 0) {
+        size_t n = 0;
+        for (int t = 0; t < started; t++) {
+            memcpy(all + n, workers[t].latencies, workers[t].numLatencies * sizeof(uint32_t));
+            n += workers[t].numLatencies;
+        }
+        qsort(all, n, sizeof(uint32_t), compareUint32);
+        p50 = all[(size_t)(0.50 * (n - 1))];
+        p99 = all[(size_t)(0.99 * (n - 1))];
+        p999 = all[(size_t)(0.999 * (n - 1))];
+        worst = all[n - 1];
+    }
+    printf("%7d %9.2f %7.2f %10.0f %10.0f %6.3f %8.0f %8.0f %9.0f %9.0f\n",
+           started, throughput / 1e6, baseline > 0 ? throughput / baseline : 1.0,
+           fewest == UINT64_MAX ? 0.0 : fewest / seconds, most / seconds, jain, p50, p99, p999, worst);
+    fflush(stdout);
+
+    free(all);
+    for (int t = 0; t < threads; t++) free(workers[t].latencies);
+    free(workers);
+    free(tids);
+    return throughput;
+}
+
+/**
+ * @brief The "scale" tool: measures how a shared table behaves as
+ * threads are added, for several workload mixes.
+ * Usage: phonebook scale [--contacts N] [--threads 1,2,4,...] [--millis N]
+ *        [--stripes N] [read-only|read-mostly|write-heavy|hot-key ...]
+ * @return The process exit status.
+ */
+int runScaleTool(int argc, char *argv[]) {
+    size_t contacts = BENCH_SCALE_CONTACTS;
+    int threadCounts[32], numThreadCounts = 0;
+    int millis = BENCH_SCALE_MILLIS, stripes = 0, numWorkloads = 0, bad = 0;
+    const ScaleWorkload *workloads[8];
+    int numKnown = (int)(sizeof(scaleWorkloads) / sizeof(scaleWorkloads[0]));
+
+    // 1. Options
+    for (int i = 2; i < argc && !bad; i++) {
+        if (strcmp(argv[i], "--contacts") == 0 && i + 1 < argc) {
+            contacts = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--millis") == 0 && i + 1 < argc) {
+            millis = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stripes") == 0 && i + 1 < argc) {
+            stripes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            for (char *p = argv[++i]; *p && numThreadCounts < 32; ) {
+                int t = (int)strtol(p, &p, 10);
+                if (t < 1 || t > BENCH_MAX_THREADS) bad = 1;
+                threadCounts[numThreadCounts++] = t;
+                if (*p == ',') p++;
+                else if (*p) bad = 1;
+            }
+        } else {
+            int found = 0;
+            for (int k = 0; k < numKnown; k++) {
+                if (strcmp(argv[i], scaleWorkloads[k].name) == 0 && numWorkloads < 8) {
+                    workloads[numWorkloads++] = &scaleWorkloads[k];
+                    found = 1;
+                }
+            }
+            bad = !found;
+        }
+    }
+    if (bad || contacts < BENCH_HOT_KEYS || contacts > UINT32_MAX || millis < 1) {
+        fprintf(stderr, "Usage: %s scale [--contacts N] [--threads 1,2,4,...] [--millis N] [--stripes N]\n"
+                        "       [read-only|read-mostly|write-heavy|hot-key ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (numThreadCounts == 0) {
+        for (int t = 1; t <= 64; t *= 2) threadCounts[numThreadCounts++] = t;
+    }
+    if (numWorkloads == 0) {
+        for (int k = 0; k < numKnown; k++) workloads[numWorkloads++] = &scaleWorkloads[k];
+    }
+    int maxThreads = 1;
+    for (int k = 0; k < numThreadCounts; k++) if (threadCounts[k] > maxThreads) maxThreads = threadCounts[k];
+    // Enough stripes that threads rarely share one by chance
+    if (stripes < 1) stripes = maxThreads * 16;
+
+    // 2. One shared table, loaded once
+    IngestRow *keys = (IngestRow*)malloc(contacts * sizeof(IngestRow));
+    HashTable *ht = keys ? createHashTable(contacts < INT32_MAX ? (int)contacts : INT32_MAX) : NULL;
+    if (!ht || enableConcurrentAccess(ht, stripes) != 0) {
+        if (!keys) perror("Failed to allocate the workload");
+        free(keys);
+        releaseHashTable(ht);
+        return EXIT_FAILURE;
+    }
+    benchGenerateContacts(keys, contacts, 0);
+    for (size_t i = 0; i < contacts; i++) addContact(ht, keys[i].name, keys[i].phone);
+
+    // 3. Every workload across every thread count
+    ScaleJob job;
+    memset(&job, 0, sizeof(job));
+    job.ht = ht;
+    job.keys = keys;
+    job.contacts = contacts;
+    printf("%zu contacts, %u stripes, %d ms per point, %d CPUs, latency sampled 1 in %d\n",
+           contacts, ht->stripeMask + 1, millis, defaultThreadCount(), BENCH_LATENCY_SAMPLE);
+    for (int w = 0; w < numWorkloads; w++) {
+        job.workload = workloads[w];
+        printf("\n%s (update %d%%, insert %d%%, delete %d%%, hot keys %d%%)\n", workloads[w]->name,
+               workloads[w]->updatePct, workloads[w]->insertPct, workloads[w]->deletePct, workloads[w]->hotPct);
+        printf("%7s %9s %7s %10s %10s %6s %8s %8s %9s %9s\n", "threads", "Mops/s", "speedup",
+               "min op/s", "max op/s", "jain", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+        double baseline = 0;
+        for (int k = 0; k < numThreadCounts; k++) {
+            job.run++;
+            double throughput = scaleMeasure(&job, threadCounts[k], millis, baseline);
+            if (k == 0) baseline = throughput / threadCounts[0]; // Per thread, if the list skips 1
+        }
+    }
+
+    releaseHashTable(ht);
+    free(keys);
+    return EXIT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Memory footprint and restart time                                   */
+/*                                                                     */
+/*  For every (layout, size) pair a child process builds the table from */
+/*  generated contacts and persists it; a second, fresh child reopens   */
+/*  it, timing the first answered lookup and the point where every      */
+/*  contact is in memory (or, for the disk layout, has been read once). */
+/*  Separate processes keep the measurements independent: resident      */
+/*  memory comes from /proc/self/statm and allocator figures from       */
+/*  mallinfo2(), both taken as the growth over the child's own baseline.*/
+/*  Results are written as JSON for tracking across releases.           */
+/* ------------------------------------------------------------------ */
+
+// What one child reports back through its pipe
+typedef struct FootprintResult {
+    int ok;
+    double buildSeconds;
+    long long rssBytes;       // Resident growth while building
+    long long heapInUse;      // Allocated bytes including chunk headers (-1 if unknown)
+    long long heapObtained;   // Bytes the allocator holds from the system (-1 if unknown)
+    long long payloadBytes;   // Bytes the table asked for: nodes, bucket array and page pools
+    long long fileBytes;      // Persisted size
+    double firstQuerySeconds; // Restart: until the first lookup is answered
+    double fullLoadSeconds;   // Restart: until every contact is loaded
+    long long restartRssBytes;
+} FootprintResult;
+
+static long long residentBytes(void) {
+    long long size = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%lld %lld", &size, &resident) != 2) resident = 0;
+        fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Reads the allocator's totals.
+ * @param inUse Receives the allocated bytes (-1 if unknown).
+ * @param obtained Receives the bytes held from the system (-1 if unknown).
+ */
+static void heapBytes(long long *inUse, long long *obtained) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    *inUse = (long long)(mi.uordblks + mi.hblkhd);
+    *obtained = (long long)(mi.arena + mi.hblkhd);
+#else
+    *inUse = -1;
+    *obtained = -1;
+#endif
+}
+
+static long long fileSize(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : 0;
+}
+
+static double secondsSince(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void footprintCount(uint32_t page, const DiskRecord *rec, void *ctx) {
+    (void)page;
+    (void)rec;
+    (*(uint64_t*)ctx)++;
+}
+
+/**
+ * @brief Child side of a build: loads generated contacts, measures, and
+ * persists the table.
+ * @param ctx Layout, size and file names.
+ * @param r Receives the measurements.
+ */
+static void footprintBuild(BenchContext *ctx, FootprintResult *r) {
+    IngestRow *chunk = (IngestRow*)malloc(BENCH_GENERATE_CHUNK * sizeof(IngestRow));
+    if (!chunk) return;
+    long long rss0 = residentBytes(), inUse0, obtained0;
+    heapBytes(&inUse0, &obtained0);
+
+    // 1. Build
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (benchOpenTable(ctx) != 0) {
+        free(chunk);
+        return;
+    }
+    for (size_t done = 0; done < ctx->contacts; done += BENCH_GENERATE_CHUNK) {
+        size_t n = ctx->contacts - done < BENCH_GENERATE_CHUNK ? ctx->contacts - done : BENCH_GENERATE_CHUNK;
+        benchGenerateContacts(chunk, n, done);
+        for (size_t i = 0; i < n; i++) addContact(ctx->ht, chunk[i].name, chunk[i].phone);
+    }
+    r->buildSeconds = secondsSince(&start);
+
+    // 2. Measure
+    r->rssBytes = residentBytes() - rss0;
+    long long inUse, obtained;
+    heapBytes(&inUse, &obtained);
+    r->heapInUse = inUse < 0 ? -1 : inUse - inUse0;
+    r->heapObtained = obtained < 0 ? -1 : obtained - obtained0;
+    if (ctx->layout == BENCH_DISK) {
+        r->payloadBytes = (long long)DISK_POOL_PAGES * DISK_PAGE_SIZE;
+    } else {
+        r->payloadBytes = (long long)ctx->ht->memoryUsed + (long long)ctx->ht->size * (long long)sizeof(ContactNode*);
+        if (ctx->ht->overflow) r->payloadBytes += (long long)ctx->ht->overflow->numFrames * DISK_PAGE_SIZE;
+    }
+
+    // 3. Persist: disk tables flush on close, the others write a snapshot
+    char snapshot[80];
+    snprintf(snapshot, sizeof(snapshot), "%s.snap", ctx->path);
+    int saved = ctx->layout == BENCH_DISK ? 0 : saveSnapshot(ctx->ht, snapshot);
+    if (ctx->layout == BENCH_DISK) {
+        releaseHashTable(ctx->ht);
+    } else {
+        benchCloseTable(ctx);
+    }
+    ctx->ht = NULL;
+    if (ctx->layout == BENCH_DISK) {
+        char dirPath[80];
+        snprintf(dirPath, sizeof(dirPath), "%s.dir", ctx->path);
+        r->fileBytes = fileSize(ctx->path) + fileSize(dirPath);
+    } else {
+        r->fileBytes = fileSize(snapshot);
+    }
+    r->ok = saved == 0;
+    free(chunk);
+}
+
+/**
+ * @brief Child side of a restart: reopens the persisted table in a fresh
+ * process and times the first lookup and the full load.
+ * @param ctx Layout, size and file names.
+ * @param r Receives the measurements.
+ */
+static void footprintRestart(BenchContext *ctx, FootprintResult *r) {
+    IngestRow probe;
+    benchGenerateContacts(&probe, 1, ctx->contacts / 2);
+    char snapshot[80];
+    snprintf(snapshot, sizeof(snapshot), "%s.snap", ctx->path);
+    long long rss0 = residentBytes();
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    HashTable *ht = NULL;
+    int loaded = 0;
+    if (ctx->layout == BENCH_DISK) {
+        ht = openDiskHashTable(ctx->path, DISK_POOL_PAGES);
+    } else if (ctx->layout == BENCH_BUDGET) {
+        // Reload under the same budget so the restart never exceeds it
+        char overflow[80];
+        char overflowDir[96];
+        snprintf(overflow, sizeof(overflow), "%s.restart", ctx->path);
+        snprintf(overflowDir, sizeof(overflowDir), "%s.dir", overflow);
+        unlink(overflow);
+        unlink(overflowDir);
+        ht = createHashTable(ctx->buckets);
+        loaded = setMemoryBudget(ht, ctx->budget, overflow) == 0 && loadSnapshotInto(ht, snapshot) == 0;
+    } else {
+        ht = loadSnapshot(snapshot);
+        loaded = ht != NULL;
+    }
+    if (!ht || (ctx->layout != BENCH_DISK && !loaded)) {
+        releaseHashTable(ht);
+        return;
+    }
+    int found = lookupContact(ht, probe.name) != NULL;
+    r->firstQuerySeconds = secondsSince(&start);
+
+    // A disk table is fully loaded once every page has been read
+    uint64_t seen = 0;
+    if (ctx->layout == BENCH_DISK) diskHashForEach(ht->disk, footprintCount, &seen);
+    r->fullLoadSeconds = secondsSince(&start);
+    r->restartRssBytes = residentBytes() - rss0;
+    r->ok = found && (ctx->layout != BENCH_DISK || seen == ctx->contacts);
+    releaseHashTable(ht);
+}
+
+/**
+ * @brief Runs one measurement in a child process.
+ * @param ctx Layout, size and file names.
+ * @param restart Non-zero for the restart measurement.
+ * @param r Receives the child's measurements.
+ * @return 0 on success, -1 if the child failed.
+ */
+static int footprintFork(BenchContext *ctx, int restart, FootprintResult *r) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Failed to create pipe");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Failed to fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // The table code reports on stdout; keep it out of the JSON
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        FootprintResult mine;
+        memset(&mine, 0, sizeof(mine));
+        if (restart) footprintRestart(ctx, &mine);
+        else footprintBuild(ctx, &mine);
+        ssize_t wrote = write(fds[1], &mine, sizeof(mine));
+        _exit(wrote == (ssize_t)sizeof(mine) ? 0 : 1);
+    }
+    close(fds[1]);
+    FootprintResult theirs;
+    ssize_t got = read(fds[0], &theirs, sizeof(theirs));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (got != (ssize_t)sizeof(theirs) || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !theirs.ok) return -1;
+    if (restart) {
+        r->firstQuerySeconds = theirs.firstQuerySeconds;
+        r->fullLoadSeconds = theirs.fullLoadSeconds;
+        r->restartRssBytes = theirs.restartRssBytes;
+    } else {
+        *r = theirs;
+    }
+    return 0;
+}
+
+/**
+ * @brief The "footprint" tool: reports bytes per contact and restart
+ * times for each layout and size as JSON on stdout.
+ * Usage: phonebook footprint [--sizes 1000,10000,...] [--layouts chained,disk,budget]
+ * @return The process exit status.
+ */
+int runFootprintTool(int argc, char *argv[]) {
+    size_t sizes[16];
+    int numSizes = 0, bad = 0;
+    int layouts[3], numLayouts = 0;
+    static const char *layoutNames[] = { "chained", "disk", "budget" };
+
+    // 1. Options
+    for (int i = 2; i < argc && !bad; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            for (char *p = argv[++i]; *p && numSizes < 16; ) {
+                unsigned long long n = strtoull(p, &p, 10);
+                if (n < 1 || n > UINT32_MAX) bad = 1;
+                sizes[numSizes++] = (size_t)n;
+                if (*p == ',') p++;
+                else if (*p) bad = 1;
+            }
+        } else if (strcmp(argv[i], "--layouts") == 0 && i + 1 < argc) {
+            for (char *p = argv[++i]; *p && !bad; ) {
+                size_t len = strcspn(p, ",");
+                int found = -1;
+                for (int k = 0; k < 3; k++) {
+                    if (strlen(layoutNames[k]) == len && strncmp(p, layoutNames[k], len) == 0) found = k;
+                }
+                if (found < 0 || numLayouts == 3) bad = 1;
+                else layouts[numLayouts++] = found;
+                p += len + (p[len] == ',');
+            }
+        } else {
+            bad = 1;
+        }
+    }
+    if (bad) {
+        fprintf(stderr, "Usage: %s footprint [--sizes 1000,10000,...] [--layouts chained,disk,budget]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (numSizes == 0) {
+        for (size_t n = 1000; n <= 1000000; n *= 10) sizes[numSizes++] = n;
+    }
+    if (numLayouts == 0) {
+        for (int k = 0; k < 3; k++) layouts[numLayouts++] = k;
+    }
+    long long physical = (long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+
+    // 2. Every layout at every size, as JSON
+    printf("{\n  \"tool\": \"phonebook footprint\",\n  \"format\": 1,\n  \"timestamp\": %lld,\n"
+           "  \"page_size\": %ld,\n  \"contact_node_bytes\": %zu,\n  \"physical_memory\": %lld,\n"
+           "  \"results\": [",
+           (long long)time(NULL), sysconf(_SC_PAGESIZE), sizeof(ContactNode), physical);
+    int first = 1, failures = 0;
+    for (int l = 0; l < numLayouts; l++) {
+        for (int k = 0; k < numSizes; k++) {
+            BenchContext ctx;
+            memset(&ctx, 0, sizeof(ctx));
+            ctx.layout = (BenchLayout)layouts[l];
+            ctx.contacts = sizes[k];
+            ctx.buckets = (int)(sizes[k] < INT32_MAX ? sizes[k] : INT32_MAX);
+            ctx.budget = ctx.contacts * sizeof(ContactNode) / 100 * BENCH_BUDGET_PERCENT + 64 * sizeof(ContactNode);
+            snprintf(ctx.path, sizeof(ctx.path), "phonebook-footprint-%ld.tmp", (long)getpid());
+
+            printf("%s\n    { \"layout\": \"%s\", \"contacts\": %zu", first ? "" : ",", layoutNames[ctx.layout], ctx.contacts);
+            first = 0;
+            // Roughly node, chunk header and bucket pointer per contact, kept twice while restarting
+            long long estimate = (long long)ctx.contacts * (long long)(sizeof(ContactNode) + 24);
+            if (ctx.layout == BENCH_CHAINED && estimate > physical / 2) {
+                printf(", \"skipped\": \"needs about %lld MB of memory\" }", estimate >> 20);
+                fprintf(stderr, "%-8s %10zu skipped (memory)\n", layoutNames[ctx.layout], ctx.contacts);
+                continue;
+            }
+
+            FootprintResult r;
+            memset(&r, 0, sizeof(r));
+            int ok = footprintFork(&ctx, 0, &r) == 0 && footprintFork(&ctx, 1, &r) == 0;
+            char snapshot[80], dirPath[80];
+            snprintf(snapshot, sizeof(snapshot), "%s.snap", ctx.path);
+            snprintf(dirPath, sizeof(dirPath), "%s.dir", ctx.path);
+            unlink(snapshot);
+            unlink(ctx.path);
+            unlink(dirPath);
+            if (!ok) {
+                printf(", \"error\": \"measurement failed\" }");
+                fprintf(stderr, "%-8s %10zu failed\n", layoutNames[ctx.layout], ctx.contacts);
+                failures++;
+                continue;
+            }
+
+            double n = (double)ctx.contacts;
+            printf(",\n      \"build_seconds\": %.6f, \"rss_bytes\": %lld, \"rss_bytes_per_contact\": %.2f,\n"
+                   "      \"payload_bytes\": %lld, \"heap_in_use_bytes\": %lld, \"heap_obtained_bytes\": %lld,\n"
+                   "      \"allocator_overhead_bytes_per_contact\": %.2f, \"file_bytes\": %lld,\n"
+                   "      \"first_query_seconds\": %.6f, \"full_load_seconds\": %.6f, "
+                   "\"restart_rss_bytes_per_contact\": %.2f }",
+                   r.buildSeconds, r.rssBytes, r.rssBytes / n, r.payloadBytes, r.heapInUse, r.heapObtained,
+                   r.heapInUse < 0 ? 0.0 : (r.heapInUse - r.payloadBytes) / n, r.fileBytes,
+                   r.firstQuerySeconds, r.fullLoadSeconds, r.restartRssBytes / n);
+            fprintf(stderr, "%-8s %10zu  %7.1f B/contact resident  %6.1f B/contact allocator overhead  "
+                            "first query %.4f s  full load %.4f s\n",
+                    layoutNames[ctx.layout], ctx.contacts, r.rssBytes / n,
+                    r.heapInUse < 0 ? 0.0 : (r.heapInUse - r.payloadBytes) / n,
+                    r.firstQuerySeconds, r.fullLoadSeconds);
+        }
+    }
+    printf("\n  ]\n}\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Baseline comparison against other hash maps                         */
+/*                                                                     */
+/*  The same generated contacts and operation order drive three maps    */
+/*  from name to phone, each owning copies of its keys and values:      */
+/*    phonebook  the chained HashTable (one bucket per contact)         */
+/*    hsearch_r  the C library's hash table (POSIX <search.h>): open    */
+/*               addressing with a fixed prime capacity and no delete;  */
+/*               its 28-bit ELF-style string hash collides heavily on   */
+/*               names sharing a prefix, so large runs skip it          */
+/*    open-addr  a compact open-addressing map: linear probing over a   */
+/*               power-of-two slot array holding records inline with    */
+/*               their hash, backward-shift deletion, grown at 3/4 full */
+/*  All three are called through the same function table, so each pays  */
+/*  the same indirect call, and are measured with the same counters.    */
+/* ------------------------------------------------------------------ */
+
+// A slot of the open-addressing map; hash 0 marks an empty slot
+typedef struct OpenSlot {
+    uint64_t hash;
+    IngestRow row;
+} OpenSlot;
+
+// Linear-probing map from name to phone
+typedef struct OpenMap {
+    OpenSlot *slots;
+    size_t capacity;      // A power of two
+    size_t count;
+} OpenMap;
+
+static inline uint64_t openMapHash(const char *name) {
+    uint64_t h = mixHash(hashString(name));
+    return h ? h : 1;
+}
+
+/**
+ * @brief Creates an empty open-addressing map.
+ * @param map The map.
+ * @param expected The number of entries to size for.
+ * @return 0 on success, -1 on failure.
+ */
+int openMapInit(OpenMap *map, size_t expected) {
+    size_t capacity = OPEN_MAP_MIN_CAPACITY;
+    while (capacity / 4 * 3 < expected) capacity *= 2;
+    map->slots = (OpenSlot*)calloc(capacity, sizeof(OpenSlot));
+    map->capacity = capacity;
+    map->count = 0;
+    return map->slots ? 0 : -1;
+}
+
+void openMapFree(OpenMap *map) {
+    free(map->slots);
+    map->slots = NULL;
+    map->capacity = map->count = 0;
+}
+
+/**
+ * @brief Finds the slot holding a name, or the empty slot ending its probe.
+ * @param map The map.
+ * @param name The name.
+ * @param h Its hash.
+ * @return The slot index.
+ */
+static size_t openMapProbe(const OpenMap *map, const char *name, uint64_t h) {
+    size_t mask = map->capacity - 1;
+    size_t i = (size_t)h & mask;
+    while (map->slots[i].hash && (map->slots[i].hash != h || strcmp(map->slots[i].row.name, name) != 0)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Doubles the slot array and re-inserts every entry.
+ * @param map The map.
+ * @return 0 on success, -1 on failure.
+ */
+static int openMapGrow(OpenMap *map) {
+    OpenMap bigger;
+    bigger.capacity = map->capacity * 2;
+    bigger.count = map->count;
+    bigger.slots = (OpenSlot*)calloc(bigger.capacity, sizeof(OpenSlot));
+    if (!bigger.slots) return -1;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (!map->slots[i].hash) continue;
+        size_t j = (size_t)map->slots[i].hash & (bigger.capacity - 1);
+        while (bigger.slots[j].hash) j = (j + 1) & (bigger.capacity - 1);
+        bigger.slots[j] = map->slots[i];
+    }
+    free(map->slots);
+    *map = bigger;
+    return 0;
+}
+
+/**
+ * @brief Inserts a contact or replaces its phone.
+ * @param map The map.
+ * @param name The name.
+ * @param phone The phone.
+ * @return 0 on success, -1 on failure.
+ */
+int openMapPut(OpenMap *map, const char *name, const char *phone) {
+    if ((map->count + 1) > map->capacity / 4 * 3 && openMapGrow(map) != 0) return -1;
+    uint64_t h = openMapHash(name);
+    OpenSlot *slot = &map->slots[openMapProbe(map, name, h)];
+    if (!slot->hash) {
+        slot->hash = h;
+        copyField(slot->row.name, name, MAX_NAME_LEN);
+        map->count++;
+    }
+    copyField(slot->row.phone, phone, MAX_PHONE_LEN);
+    return 0;
+}
+
+/**
+ * @brief Looks up a name.
+ * @param map The map.
+ * @param name The name.
+ * @return The stored row, or NULL if absent.
+ */
+const IngestRow* openMapGet(const OpenMap *map, const char *name) {
+    OpenSlot *slot = &map->slots[openMapProbe(map, name, openMapHash(name))];
+    return slot->hash ? &slot->row : NULL;
+}
+
+/**
+ * @brief Removes a name, shifting later members of its run back so no
+ * tombstones are needed.
+ * @param map The map.
+ * @param name The name.
+ * @return 1 if removed, 0 if absent.
+ */
+int openMapDelete(OpenMap *map, const char *name) {
+    size_t mask = map->capacity - 1;
+    size_t hole = openMapProbe(map, name, openMapHash(name));
+    if (!map->slots[hole].hash) return 0;
+    for (size_t i = (hole + 1) & mask; map->slots[i].hash; i = (i + 1) & mask) {
+        // An entry may fill the hole unless its home lies in (hole, i]
+        size_t home = (size_t)map->slots[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            map->slots[hole] = map->slots[i];
+            hole = i;
+        }
+    }
+    map->slots[hole].hash = 0;
+    map->count--;
+    return 1;
+}
+
+// The map under comparison and its bookkeeping
+typedef struct CompareMap {
+    HashTable *ht;
+    struct hsearch_data htab;
+    IngestRow **records;  // hsearch_r: the records it points to, freed at the end
+    size_t numRecords;
+    OpenMap open;
+} CompareMap;
+
+// Operations every compared map provides
+typedef struct CompareOps {
+    const char *name;
+    int (*open)(CompareMap*, size_t);
+    void (*close)(CompareMap*);
+    int (*insert)(CompareMap*, const char*, const char*);
+    int (*search)(CompareMap*, const char*, char*);
+    int (*update)(CompareMap*, const char*, const char*);
+    int (*remove)(CompareMap*, const char*); // NULL if unsupported
+    size_t maxContacts;                      // 0 for no limit
+} CompareOps;
+
+static int phonebookOpen(CompareMap *m, size_t n) {
+    m->ht = createHashTable(n < INT32_MAX ? (int)n : INT32_MAX);
+    if (!m->ht) {
+        perror("Failed to create phonebook table");
+        return -1;
+    }
+    return 0;
+}
+static void phonebookClose(CompareMap *m) { releaseHashTable(m->ht); }
+static int phonebookInsert(CompareMap *m, const char *name, const char *phone) { return addContact(m->ht, name, phone); }
+static int phonebookSearch(CompareMap *m, const char *name, char *phone) {
+    ContactNode *node = lookupContact(m->ht, name);
+    if (node) memcpy(phone, node->phone, MAX_PHONE_LEN);
+    return node != NULL;
+}
+static int phonebookUpdate(CompareMap *m, const char *name, const char *phone) { return changeContactPhone(m->ht, name, phone); }
+static int phonebookRemove(CompareMap *m, const char *name) { return removeContact(m->ht, name); }
+
+static int hsearchOpen(CompareMap *m, size_t n) {
+    memset(&m->htab, 0, sizeof(m->htab));
+    m->records = (IngestRow**)malloc((n + 1) * sizeof(IngestRow*));
+    m->numRecords = 0;
+    // hsearch_r cannot grow; a quarter of headroom keeps probes short
+    if (!m->records || !hcreate_r(n + n / 4 + 1, &m->htab)) {
+        free(m->records);
+        return -1;
+    }
+    return 0;
+}
+static void hsearchClose(CompareMap *m) {
+    hdestroy_r(&m->htab);
+    for (size_t i = 0; i < m->numRecords; i++) free(m->records[i]);
+    free(m->records);
+}
+static int hsearchInsert(CompareMap *m, const char *name, const char *phone) {
+    IngestRow *row = (IngestRow*)malloc(sizeof(IngestRow));
+    if (!row) return -1;
+    copyField(row->name, name, MAX_NAME_LEN);
+    copyField(row->phone, phone, MAX_PHONE_LEN);
+    ENTRY entry = { row->name, row }, *found;
+    if (!hsearch_r(entry, ENTER, &found, &m->htab)) {
+        free(row);
+        return -1;
+    }
+    if (found->data != row) {
+        // Already present: keep the existing record, take the new phone
+        memcpy(((IngestRow*)found->data)->phone, row->phone, MAX_PHONE_LEN);
+        free(row);
+        return 0;
+    }
+    m->records[m->numRecords++] = row;
+    return 0;
+}
+static int hsearchSearch(CompareMap *m, const char *name, char *phone) {
+    ENTRY entry = { (char*)name, NULL }, *found;
+    if (!hsearch_r(entry, FIND, &found, &m->htab)) return 0;
+    memcpy(phone, ((IngestRow*)found->data)->phone, MAX_PHONE_LEN);
+    return 1;
+}
+static int hsearchUpdate(CompareMap *m, const char *name, const char *phone) {
+    ENTRY entry = { (char*)name, NULL }, *found;
+    if (!hsearch_r(entry, FIND, &found, &m->htab)) return 0;
+    copyField(((IngestRow*)found->data)->phone, phone, MAX_PHONE_LEN);
+    return 1;
+}
+
+static int openAddrOpen(CompareMap *m, size_t n) { (void)n; return openMapInit(&m->open, 0); }
+static void openAddrClose(CompareMap *m) { openMapFree(&m->open); }
+static int openAddrInsert(CompareMap *m, const char *name, const char *phone) { return openMapPut(&m->open, name, phone); }
+static int openAddrSearch(CompareMap *m, const char *name, char *phone) {
+    const IngestRow *row = openMapGet(&m->open, name);
+    if (row) memcpy(phone, row->phone, MAX_PHONE_LEN);
+    return row != NULL;
+}
+static int openAddrUpdate(CompareMap *m, const char *name, const char *phone) {
+    const IngestRow *row = openMapGet(&m->open, name);
+    if (!row) return 0;
+    copyField(((IngestRow*)row)->phone, phone, MAX_PHONE_LEN);
+    return 1;
+}
+static int openAddrRemove(CompareMap *m, const char *name) { return openMapDelete(&m->open, name); }
+
+static const CompareOps compareMaps[] = {
+    { "phonebook", phonebookOpen, phonebookClose, phonebookInsert, phonebookSearch, phonebookUpdate, phonebookRemove, 0 },
+    { "hsearch_r", hsearchOpen, hsearchClose, hsearchInsert, hsearchSearch, hsearchUpdate, NULL, COMPARE_HSEARCH_MAX },
+    { "open-addr", openAddrOpen, openAddrClose, openAddrInsert, openAddrSearch, openAddrUpdate, openAddrRemove, 0 }
+};
+
+/**
+ * @brief Runs one scenario against one map and prints its row.
+ * @param ops The map.
+ * @param ctx The workload (keys, absent names, op order).
+ * @param scenario The scenario name.
+ * @param pc The counters.
+ * @param heapPerContact Receives heap bytes per contact after the load.
+ * @return 0 on success, 1 if unsupported, 2 if too large for the map, -1 on failure.
+ */
+static int compareRun(const CompareOps *ops, BenchContext *ctx, const char *scenario, PerfCounters *pc,
+                      double *heapPerContact) {
+    int kind;
+    if (strcmp(scenario, "insert") == 0) kind = 0;
+    else if (strcmp(scenario, "search-hit") == 0) kind = 1;
+    else if (strcmp(scenario, "search-miss") == 0) kind = 2;
+    else if (strcmp(scenario, "update") == 0) kind = 3;
+    else if (strcmp(scenario, "delete") == 0) kind = 4;
+    else return -1;
+    if (kind == 4 && !ops->remove) return 1;
+    if (ops->maxContacts && ctx->contacts > ops->maxContacts) return 2;
+
+    // 1. A fresh map, loaded unless the scenario is the load itself
+    CompareMap map;
+    memset(&map, 0, sizeof(map));
+    long long inUse0, obtained0, inUse, obtained;
+    heapBytes(&inUse0, &obtained0);
+    if (ops->open(&map, ctx->contacts) != 0) return -1;
+    for (size_t i = 0; kind != 0 && i < ctx->contacts; i++) {
+        ops->insert(&map, ctx->keys[i].name, ctx->keys[i].phone);
+    }
+
+    // 2. The timed loop
+    const IngestRow *keys = ctx->keys;
+    const uint32_t *order = ctx->order;
+    size_t count = kind == 0 || kind == 4 ? ctx->contacts : ctx->ops;
+    char phone[MAX_PHONE_LEN];
+    uint64_t sink = 0;
+    BenchResult result;
+    memset(&result, 0, sizeof(result));
+    struct timespec start, end;
+    perfCountersStart(pc);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i++) {
+        switch (kind) {
+            case 0: sink += (uint64_t)ops->insert(&map, keys[i].name, keys[i].phone); break;
+            case 1: sink += (uint64_t)ops->search(&map, keys[order[i]].name, phone); break;
+            case 2: sink += (uint64_t)ops->search(&map, ctx->missKeys[order[i]].name, phone); break;
+            case 3: sink += (uint64_t)ops->update(&map, keys[order[i]].name, keys[order[i] ^ 1].phone); break;
+            default: sink += (uint64_t)ops->remove(&map, keys[order[i]].name); break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    perfCountersStop(pc, &result);
+    benchSink = sink;
+    result.ops = count;
+    result.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    benchPrintResult(ops->name, &result);
+
+    if (kind == 0) {
+        heapBytes(&inUse, &obtained);
+        *heapPerContact = inUse0 < 0 ? -1 : (double)(inUse - inUse0) / ctx->contacts;
+    }
+    ops->close(&map);
+    return 0;
+}
+
+/**
+ * @brief The "compare" tool: runs identical workloads against the
+ * phonebook table and two other hash maps.
+ * Usage: phonebook compare [--contacts N] [--ops N]
+ *        [insert|search-hit|search-miss|update|delete ...]
+ * @return The process exit status.
+ */
+int runCompareTool(int argc, char *argv[]) {
+    BenchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.contacts = BENCH_DEFAULT_CONTACTS;
+    ctx.ops = BENCH_DEFAULT_OPS;
+    const char *scenarios[8];
+    int numScenarios = 0, bad = 0;
+    for (int i = 2; i < argc && !bad; i++) {
+        if (strcmp(argv[i], "--contacts") == 0 && i + 1 < argc) ctx.contacts = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) ctx.ops = strtoull(argv[++i], NULL, 10);
+        else if (argv[i][0] != '-' && numScenarios < 8) scenarios[numScenarios++] = argv[i];
+        else bad = 1;
+    }
+    if (bad || ctx.contacts < 2 || ctx.contacts > UINT32_MAX || ctx.ops < 1) {
+        fprintf(stderr, "Usage: %s compare [--contacts N] [--ops N] "
+                        "[insert|search-hit|search-miss|update|delete ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (numScenarios == 0) {
+        static const char *defaults[] = { "insert", "search-hit", "search-miss", "update", "delete" };
+        for (int k = 0; k < 5; k++) scenarios[numScenarios++] = defaults[k];
+    }
+
+    // 1. One workload shared by every map (same generator and order as bench)
+    size_t orderLen = ctx.ops > ctx.contacts ? ctx.ops : ctx.contacts;
+    ctx.keys = (IngestRow*)malloc(ctx.contacts * sizeof(IngestRow));
+    ctx.missKeys = (IngestRow*)malloc(ctx.contacts * sizeof(IngestRow));
+    ctx.order = (uint32_t*)malloc(orderLen * sizeof(uint32_t));
+    if (!ctx.keys || !ctx.missKeys || !ctx.order) {
+        perror("Failed to allocate the workload");
+        free(ctx.keys); free(ctx.missKeys); free(ctx.order);
+        return EXIT_FAILURE;
+    }
+    benchGenerateContacts(ctx.keys, ctx.contacts, 0);
+    benchGenerateContacts(ctx.missKeys, ctx.contacts, ctx.contacts);
+    uint64_t seed = 42;
+    for (size_t i = 0; i < orderLen; i++) ctx.order[i] = (uint32_t)(benchRandom(&seed) % ctx.contacts);
+    for (size_t i = 0; i < ctx.contacts; i++) ctx.order[i] = (uint32_t)i;
+    for (size_t i = ctx.contacts - 1; i > 0; i--) {
+        size_t j = benchRandom(&seed) % (i + 1);
+        uint32_t t = ctx.order[i]; ctx.order[i] = ctx.order[j]; ctx.order[j] = t;
+    }
+    if (ctx.contacts % 2) {
+        for (size_t i = 0; i < orderLen; i++) if (ctx.order[i] == ctx.contacts - 1) ctx.order[i]--;
+    }
+
+    PerfCounters pc;
+    int opened = perfCountersOpen(&pc);
+    if (opened < BENCH_COUNTERS) {
+        fprintf(stderr, "Note: %d of %d hardware counters available (perf_event_open: %s).\n",
+                opened, BENCH_COUNTERS, strerror(pc.openErrno));
+    }
+
+    // 2. Each scenario against each map
+    int numMaps = (int)(sizeof(compareMaps) / sizeof(compareMaps[0]));
+    double heap[8];
+    int haveHeap = 0, status = EXIT_SUCCESS;
+    for (int m = 0; m < numMaps; m++) heap[m] = -1;
+    printf("%zu contacts, %zu lookups per scenario\n", ctx.contacts, ctx.ops);
+    for (int k = 0; k < numScenarios && status == EXIT_SUCCESS; k++) {
+        printf("\n%s\n%-12s %10s %9s %8s", scenarios[k], "map", "ops", "ns/op", "Mops/s");
+        for (int i = 0; i < BENCH_COUNTERS; i++) printf(" %10s", perfCounterNames[i]);
+        printf(" %6s\n", "IPC");
+        for (int m = 0; m < numMaps; m++) {
+            int rc = compareRun(&compareMaps[m], &ctx, scenarios[k], &pc, &heap[m]);
+            if (rc == 1) printf("%-12s (not supported)\n", compareMaps[m].name);
+            if (rc == 2) printf("%-12s (skipped above %zu contacts)\n", compareMaps[m].name, compareMaps[m].maxContacts);
+            if (rc < 0) {
+                fprintf(stderr, "ERROR: Unknown scenario '%s' or %s failed.\n", scenarios[k], compareMaps[m].name);
+                status = EXIT_FAILURE;
+                break;
+            }
+            if (strcmp(scenarios[k], "insert") == 0) haveHeap = 1;
+        }
+    }
+    if (haveHeap) {
+        printf("\nHeap bytes per contact after the load:");
+        for (int m = 0; m < numMaps; m++) {
+            if (heap[m] >= 0) printf(" %s %.1f", compareMaps[m].name, heap[m]);
+        }
+        printf("\n");
+    }
+
+    perfCountersClose(&pc);
+    free(ctx.keys);
+    free(ctx.missKeys);
+    free(ctx.order);
+    return status;
+}
+
+// Main driver function
+// Usage: phonebook [--disk <file>] [--memory-budget <bytes> <overflow-file>]
+//                  [--log <dir>] [--history] [--track-hot]
+//                  [--stats] [--suggest] [--attributes] [--trigram]
+//        phonebook restore <log-dir> <time> [snapshot-out]
+//        phonebook sync <replica.snap> <source.snap>
+//        phonebook setop <union|intersect|subtract> <a.snap> <b.snap> <out.snap>
+//        phonebook diff [<base.snap>] <left.snap> <right.snap>
+//        phonebook sorted <snapshot> [out.tsv]
+//        phonebook filter <snapshot> <expression>
+//        phonebook import <in.tsv|in.vcf|in.jsonl> <snapshot>
+//        phonebook export <snapshot> <out.vcf|out.jsonl|out.pbc>
+//        phonebook columns <in.pbc> [name,phone,area_code]
+//        phonebook bench [--layout chained|disk|budget] [--contacts N] [--ops N] [scenario...]
+//        phonebook scale [--contacts N] [--threads 1,2,4,...] [--millis N] [workload...]
+//        phonebook footprint [--sizes 1000,10000,...] [--layouts chained,disk,budget]
+//        phonebook compare [--contacts N] [--ops N] [scenario...]
+int main(int argc, char *argv[]) {
+    HashTable *phonebook = NULL;
+    const char *diskPath = NULL;
+    const char *overflowPath = NULL;
+    const char *logDir = NULL;
+    size_t budget = 0;
+    int history = 0;
+    int trackHot = 0;
+    int stats = 0;
+    int suggest = 0;
+    int attributes = 0;
+    int trigram = 0;
+
+    if (argc > 1 && strcmp(argv[1], "restore") == 0) {
+        return runRestoreTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "sync") == 0) {
+        return runSyncTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "setop") == 0) {
+        return runSetOperationTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "diff") == 0) {
+        return runDiffTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "sorted") == 0) {
+        return runSortedTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "filter") == 0) {
+        return runFilterTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "import") == 0) {
+        return runImportTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "export") == 0) {
+        return runExportTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "columns") == 0) {
+        return runColumnsTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return runBenchTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "scale") == 0) {
+        return runScaleTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "footprint") == 0) {
+        return runFootprintTool(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "compare") == 0) {
+        return runCompareTool(argc, argv);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--disk") == 0 && i + 1 < argc) {
+            diskPath = argv[++i];
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 2 < argc) {
+            budget = strtoull(argv[++i], NULL, 10);
+            overflowPath = argv[++i];
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            logDir = argv[++i];
+        } else if (strcmp(argv[i], "--history") == 0) {
+            history = 1;
+        } else if (strcmp(argv[i], "--track-hot") == 0) {
+            trackHot = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "--suggest") == 0) {
+            suggest = 1;
+        } else if (strcmp(argv[i], "--attributes") == 0) {
+            attributes = 1;
+        } else if (strcmp(argv[i], "--trigram") == 0) {
+            trigram = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--disk <file>] "
+                    "[--memory-budget <bytes> <overflow-file>] [--log <dir>] [--history]\n"
+                    "                 [--track-hot] [--stats] [--suggest] [--attributes] [--trigram]\n"
+                    "       %s restore <log-dir> <time> [snapshot-out]\n"
+                    "       %s sync <replica.snap> <source.snap>\n"
+                    "       %s setop <union|intersect|subtract> <a.snap> <b.snap> <out.snap>\n"
+                    "       %s diff [<base.snap>] <left.snap> <right.snap>\n"
+                    "       %s sorted <snapshot> [out.tsv]\n"
+                    "       %s filter <snapshot> <expression>\n"
+                    "       %s import <in.tsv|in.vcf|in.jsonl> <snapshot>\n"
+                    "       %s export <snapshot> <out.vcf|out.jsonl|out.pbc>\n"
+                    "       %s columns <in.pbc> [name,phone,area_code]\n"
+                    "       %s bench [--layout chained|disk|budget] [--contacts N] [--ops N] [scenario...]\n"
+                    "       %s scale [--contacts N] [--threads 1,2,4,...] [--millis N] [workload...]\n"
+                    "       %s footprint [--sizes 1000,10000,...] [--layouts chained,disk,budget]\n"
+                    "       %s compare [--contacts N] [--ops N] [scenario...]\n",
+                    argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+                    argv[0], argv[0], argv[0], argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (diskPath) {
+        phonebook = openDiskHashTable(diskPath, DISK_POOL_PAGES);
+        if (!phonebook) return EXIT_FAILURE;
+    } else {
+        phonebook = createHashTable(TABLE_SIZE);
+        if (overflowPath && setMemoryBudget(phonebook, budget, overflowPath) != 0) {
+            freeHashTable(phonebook);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((history && enableVersionHistory(phonebook) != 0) ||
+        (trackHot && enableHeavyHitters(phonebook, HH_DEFAULT_K) != 0) ||
+        (stats && enableDirectoryStats(phonebook, defaultThreadCount()) != 0) ||
+        (suggest && enableSuggestions(phonebook) != 0) ||
+        (attributes && enableAttributeIndex(phonebook) != 0) ||
+        (trigram && enableTrigramIndex(phonebook) != 0) ||
+        (logDir && openChangeLog(phonebook, logDir) != 0)) {
+        freeHashTable(phonebook);
+        return EXIT_FAILURE;
+    }
+    int choice;
+    char name[MAX_NAME_LEN];
+    char phone[MAX_PHONE_LEN];
+    ContactNode *found;
+
+    while (1) {
+        printf("\n--- Contact/Phonebook Menu ---\n");
+        printf("1. Add Contact\n");
+        printf("2. Search Contact\n");
+        printf("3. Delete Contact\n");
+        printf("4. Display All Contacts\n");
+        printf("5. Exit\n");
+        printf("6. Update Contact\n");
+        printf("7. Show Contact History\n");
+        printf("8. Find Shared Phone Numbers\n");
+        printf("9. Find Similar Names\n");
+        printf("10. Display Contacts Sorted by Name\n");
+        printf("11. Show Hottest Names\n");
+        printf("12. Show Directory Statistics\n");
+        printf("13. Suggest Contacts by Prefix\n");
+        printf("14. Tag Contact\n");
+        printf("15. Filter Contacts by Attributes\n");
+        printf("16. Filter Contacts by Expression\n");
+        printf("17. Search Names Containing Text\n");
+        printf("18. Search Contact As Of a Time\n");
+        printf("19. Watch a Name or Prefix\n");
+        printf("20. Show Watched Changes\n");
+        printf("21. Stop Watching\n");
+        printf("Enter your choice: ");
+
+        if (scanf("%d", &choice) != 1) {
+            printf("Invalid input. Please enter a number.\n");
+            clearInputBuffer();
+            continue;
+        }
+        clearInputBuffer(); // Consume the newline character
+
+        switch (choice) {
+            case 1: { // Add
+                char rawName[256], rawPhone[64];
+                IngestRow row;
+                printf("Enter Name: ");
+                fgets(rawName, sizeof(rawName), stdin);
+                rawName[strcspn(rawName, "\n")] = 0; // Remove newline
+
+                printf("Enter Phone: ");
+                fgets(rawPhone, sizeof(rawPhone), stdin);
+                rawPhone[strcspn(rawPhone, "\n")] = 0; // Remove newline
+
+                IngestReject why = normalizeContact(rawName, strlen(rawName), rawPhone,
+                                                    strlen(rawPhone), &row, NULL);
+                if (why != INGEST_OK) {
+                    printf("ERROR: The %s.\n", ingestRejectReasons[why]);
+                    break;
+                }
+                insertContact(phonebook, row.name, row.phone);
+                break;
+            }
+
+            case 2: // Search
+                printf("Enter Name to Search: ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+
+                found = searchContact(phonebook, name);
+                if (found) {
+                    printf("FOUND: Name: %s, Phone: %s\n", found->name, found->phone);
+                } else {
+                    printf("ERROR: Contact '%s' not found.\n", name);
+                }
+                break;
+
+            case 3: // Delete
+                printf("Enter Name to Delete: ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+                deleteContact(phonebook, name);
+                break;
+
+            case 4: // Display
+                displayContacts(phonebook);
+                break;
+
+            case 5: // Exit
+                printf("Exiting...\n");
+                freeHashTable(phonebook); // Clean up memory
+                return 0;
+
+            case 6: { // Update
+                char rawName[256], rawPhone[64];
+                IngestRow row;
+                printf("Enter Name to Update: ");
+                fgets(rawName, sizeof(rawName), stdin);
+                rawName[strcspn(rawName, "\n")] = 0; // Remove newline
+
+                printf("Enter New Phone: ");
+                fgets(rawPhone, sizeof(rawPhone), stdin);
+                rawPhone[strcspn(rawPhone, "\n")] = 0; // Remove newline
+
+                IngestReject why = normalizeContact(rawName, strlen(rawName), rawPhone,
+                                                    strlen(rawPhone), &row, NULL);
+                if (why != INGEST_OK) {
+                    printf("ERROR: The %s.\n", ingestRejectReasons[why]);
+                    break;
+                }
+                updateContact(phonebook, row.name, row.phone);
+                break;
+            }
+
+            case 7: // History
+                printf("Enter Name: ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+                printContactHistory(phonebook, name);
+                break;
+
+            case 8: // Duplicates
+                displayDuplicatePhones(phonebook);
+                break;
+
+            case 9: // Near-duplicates
+                displaySimilarNames(phonebook);
+                break;
+
+            case 10: // Sorted display
+                displayContactsSorted(phonebook);
+                break;
+
+            case 11: // Heavy hitters
+                displayHeavyHitters(phonebook);
+                break;
+
+            case 12: // Directory statistics
+                displayDirectoryStats(phonebook);
+                break;
+
+            case 13: // Suggestions
+                printf("Enter Prefix: ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+                displaySuggestions(phonebook, name);
+                break;
+
+            case 14: { // Tag
+                char tag[ATTRIBUTE_MAX_TAG];
+                printf("Enter Name: ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+                printf("Enter Tag: ");
+                fgets(tag, sizeof(tag), stdin);
+                tag[strcspn(tag, "\n")] = 0;
+                if (!phonebook->attributes) {
+                    printf("Attribute indexes are off (start with --attributes).\n");
+                } else if (tagContact(phonebook, name, tag, 1) == 0) {
+                    printf("SUCCESS: Tagged '%s' as '%s'.\n", name, tag);
+                } else {
+                    printf("ERROR: Contact '%s' not found.\n", name);
+                }
+                break;
+            }
+
+            case 15: { // Combined attribute filter
+                char tag[ATTRIBUTE_MAX_TAG];
+                char line[32];
+                AttributeFilter filter = { -1, NULL, 0 };
+                printf("Area code (blank for any): ");
+                fgets(line, sizeof(line), stdin);
+                if (line[0] != '\n') filter.areaCode = atoi(line);
+                printf("Tag (blank for any): ");
+                fgets(tag, sizeof(tag), stdin);
+                tag[strcspn(tag, "\n")] = 0;
+                if (tag[0]) filter.tag = tag;
+                printf("Added month YYYYMM (blank for any): ");
+                fgets(line, sizeof(line), stdin);
+                if (line[0] != '\n') filter.addedMonth = atoi(line);
+                displayFilteredContacts(phonebook, &filter);
+                break;
+            }
+
+            case 16: { // Filter expression
+                char expr[256];
+                printf("Filter (e.g. phone starts \"212\" and namelen < 10): ");
+                fgets(expr, sizeof(expr), stdin);
+                expr[strcspn(expr, "\n")] = 0;
+                displayFilterExpression(phonebook, expr);
+                break;
+            }
+
+            case 17: // Substring search
+                printf("Enter Text: ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+                displayNamesContaining(phonebook, name);
+                break;
+
+            case 18: { // Point-in-time lookup
+                char when[64];
+                int64_t asOf;
+                printf("Enter Name: ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+                printf("Enter Time (Unix seconds or YYYY-MM-DDTHH:MM:SS): ");
+                fgets(when, sizeof(when), stdin);
+                when[strcspn(when, "\n")] = 0; // Remove newline
+
+                if (parseTimestamp(when, &asOf) != 0) {
+                    printf("ERROR: '%s' is not a time.\n", when);
+                } else if (searchContactAsOf(phonebook, name, asOf, phone)) {
+                    printf("FOUND: Name: %s, Phone: %s\n", name, phone);
+                } else {
+                    printf("ERROR: Contact '%s' did not exist at that time.\n", name);
+                }
+                break;
+            }
+
+            case 19: { // Subscribe
+                printf("Enter Name (end with '*' to watch a prefix): ");
+                fgets(name, MAX_NAME_LEN, stdin);
+                name[strcspn(name, "\n")] = 0; // Remove newline
+                size_t len = strlen(name);
+                int isPrefix = len > 0 && name[len - 1] == '*';
+                if (isPrefix) name[len - 1] = '\0';
+
+                int id = watchSubscribe(phonebook, name, isPrefix, WATCH_MENU_CAPACITY);
+                if (id >= 0) {
+                    printf("SUCCESS: Watching %s '%s' as watcher %d.\n",
+                           isPrefix ? "prefix" : "name", name, id);
+                }
+                break;
+            }
+
+            case 20: // Poll
+            case 21: { // Unsubscribe
+                char idText[32];
+                printf("Enter Watcher: ");
+                fgets(idText, sizeof(idText), stdin);
+                int id = atoi(idText);
+                if (choice == 20) {
+                    displayWatchEvents(phonebook, id);
+                } else if (watchUnsubscribe(phonebook, id) == 0) {
+                    printf("SUCCESS: Stopped watcher %d.\n", id);
+                } else {
+                    printf("ERROR: No watcher %d.\n", id);
+                }
+                break;
+            }
+
+            default:
+                printf("Invalid choice. Please try again.\n");
+        }
+    }
+
+    return 0;
 }
\ No newline at end of file
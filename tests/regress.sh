@@ -0,0 +1,377 @@
+#!/bin/sh
+# Regression checks for the phonebook's file formats and fixed bugs.
+# Builds Phonebook.c into a scratch directory and drives the binary through
+# its menu and command-line tools. Exits non-zero if any check fails.
+#
+# Usage: tests/regress.sh [path/to/Phonebook.c]
+
+SRC=${1:-$(dirname "$0")/../Phonebook.c}
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+PB="$WORK/phonebook"
+gcc -std=gnu11 -O2 -pthread "$SRC" -o "$PB" -lm || exit 1
+
+failures=0
+
+# check <description> <command...>: runs the command, reports ok/FAIL
+check() {
+    what=$1
+    shift
+    if "$@"; then
+        echo "ok   $what"
+    else
+        echo "FAIL $what"
+        failures=$((failures + 1))
+    fi
+}
+
+# contains <file> <text>: the file has a line containing the text
+contains() {
+    grep -qF -- "$2" "$1"
+}
+
+# lacks <file> <text>: no line of the file contains the text
+lacks() {
+    ! grep -qF -- "$2" "$1"
+}
+
+# adds <count> <prefix> <first-phone>: menu input adding numbered contacts
+adds() {
+    awk -v n="$1" -v p="$2" -v ph="$3" \
+        'BEGIN { for (i = 0; i < n; i++) printf "1\n%s%05d\n%d\n", p, i, ph + i }'
+}
+
+# ---- Disk-resident extendible hashing -------------------------------
+
+{ adds 3000 Disk 2125500000; echo 5; } | "$PB" --disk "$WORK/d.db" > /dev/null
+printf '2\nDisk02999\n2\nDisk00000\n5\n' | "$PB" --disk "$WORK/d.db" > "$WORK/d.out"
+check "disk table keeps contacts across reopen (after splits)" \
+    contains "$WORK/d.out" "FOUND: Name: Disk02999, Phone: 2125502999"
+check "disk table keeps the first contact" \
+    contains "$WORK/d.out" "FOUND: Name: Disk00000, Phone: 2125500000"
+
+printf '1\nDisk00001\n3105550000\n2\nDisk00001\n5\n' | "$PB" --disk "$WORK/d.db" > "$WORK/d2.out"
+check "adding an existing name updates it" \
+    contains "$WORK/d2.out" "already existed"
+check "the update is visible" \
+    contains "$WORK/d2.out" "FOUND: Name: Disk00001, Phone: 3105550000"
+
+cp "$WORK/d.db" "$WORK/c.db"
+printf 'not a directory' > "$WORK/c.db.dir"
+cp "$WORK/c.db.dir" "$WORK/c.dir.orig"
+echo 5 | "$PB" --disk "$WORK/c.db" > /dev/null 2>&1
+check "a corrupt directory is rejected" test $? -ne 0
+check "a corrupt directory is left untouched" cmp -s "$WORK/c.db.dir" "$WORK/c.dir.orig"
+
+rm "$WORK/c.db.dir"
+cp "$WORK/c.db" "$WORK/c.db.orig"
+echo 5 | "$PB" --disk "$WORK/c.db" > /dev/null 2>&1
+check "a data file without its directory is rejected" test $? -ne 0
+check "a data file without its directory is left untouched" cmp -s "$WORK/c.db" "$WORK/c.db.orig"
+
+# ---- Memory budget with eviction to disk -----------------------------
+
+{ adds 200 Spill 2125600000; printf '2\nSpill00000\n2\nSpill00199\n5\n'; } |
+    "$PB" --memory-budget 30000 "$WORK/ov" > "$WORK/ov.out"
+check "evicted contacts are found again" \
+    contains "$WORK/ov.out" "FOUND: Name: Spill00000, Phone: 2125600000"
+check "recent contacts stay resident" \
+    contains "$WORK/ov.out" "FOUND: Name: Spill00199, Phone: 2125600199"
+check "the overflow store is removed on exit" test ! -e "$WORK/ov"
+check "the overflow directory is removed on exit" test ! -e "$WORK/ov.dir"
+
+# An existing file given as the overflow store is refused, not deleted
+printf 'keep me' > "$WORK/precious"
+echo 5 | "$PB" --memory-budget 2000 "$WORK/precious" > /dev/null 2>&1
+check "an existing overflow path is refused" test $? -ne 0
+check "an existing overflow path is kept" contains "$WORK/precious" "keep me"
+printf 'keep me' > "$WORK/ov2.dir"
+echo 5 | "$PB" --memory-budget 2000 "$WORK/ov2" > /dev/null 2>&1
+check "an existing overflow directory is refused" test $? -ne 0
+check "an existing overflow directory is kept" contains "$WORK/ov2.dir" "keep me"
+check "a refused overflow store leaves no file behind" test ! -e "$WORK/ov2"
+
+{
+    printf '1\nAlice\n2125550100\n1\nBob\n2125550100\n'
+    printf '1\nCarol\n2125550100\n1\nDave\n2125550100\n8\n5\n'
+} | "$PB" --memory-budget 200 "$WORK/ov" > "$WORK/dup.out" 2> /dev/null
+check "shared phones include evicted contacts" \
+    contains "$WORK/dup.out" "Phone: 2125550100 (4 names)"
+
+{
+    printf '1\nJohn Smith\n2125550101\n1\nSmith, John\n2125550102\n'
+    printf '1\njohn smith\n2125550103\n1\nZzyx Q\n2125550104\n9\n5\n'
+} | "$PB" --memory-budget 200 "$WORK/ov" > "$WORK/similar.out" 2> /dev/null
+check "similar names include evicted contacts" \
+    contains "$WORK/similar.out" "-> Name: Smith, John"
+
+# ---- Point-in-time recovery from the change log ----------------------
+
+mkdir "$WORK/log"
+{
+    printf '1\nAnn\n2125550100\n1\nBen\n2125550101\n'
+    sleep 1
+    date +%s > "$WORK/log.time"
+    sleep 1
+    printf '3\nAnn\n6\nBen\n3105550000\n1\nCy\n2125550102\n5\n'
+} | "$PB" --log "$WORK/log" > /dev/null
+"$PB" restore "$WORK/log" "$(cat "$WORK/log.time")" "$WORK/then.snap" > /dev/null
+"$PB" sorted "$WORK/then.snap" "$WORK/then.tsv" > /dev/null 2>&1
+printf 'Ann\t2125550100\nBen\t2125550101\n' > "$WORK/then.expect"
+check "restore replays the log up to the given time" cmp -s "$WORK/then.tsv" "$WORK/then.expect"
+"$PB" restore "$WORK/log" 4102444800 "$WORK/now.snap" > /dev/null
+"$PB" sorted "$WORK/now.snap" "$WORK/now.tsv" > /dev/null 2>&1
+printf 'Ben\t3105550000\nCy\t2125550102\n' > "$WORK/now.expect"
+check "restore to a later time gives the final state" cmp -s "$WORK/now.tsv" "$WORK/now.expect"
+
+# A change that cannot be logged is refused, and the table matches the log
+mkdir "$WORK/fulllog"
+{ adds 40 Log 2125550000; printf '4\n5\n'; } |
+    (trap '' XFSZ; ulimit -f 1; exec "$PB" --log "$WORK/fulllog" 2>&1) |
+    cat > "$WORK/fulllog.out"
+"$PB" restore "$WORK/fulllog" 4102444800 "$WORK/fulllog.snap" > /dev/null
+"$PB" sorted "$WORK/fulllog.snap" "$WORK/fulllog.tsv" > /dev/null 2>&1
+added=$(grep -c "SUCCESS: Added" "$WORK/fulllog.out")
+check "an add that cannot be logged fails" contains "$WORK/fulllog.out" "ERROR: Could not add 'Log00039'"
+check "a failed log append leaves the contact out of the table" \
+    test "$(grep -c 'Name: Log' "$WORK/fulllog.out")" -eq "$added"
+check "the log replays exactly the contacts that were added" \
+    test "$(wc -l < "$WORK/fulllog.tsv")" -eq "$added"
+
+# ---- Version history --------------------------------------------------
+
+{
+    printf '1\nAnn\n2125550100\n6\nAnn\n2125550111\n'
+    sleep 1
+    t=$(date +%s)
+    sleep 1
+    printf '3\nAnn\n18\nAnn\n%s\n18\nAnn\n4102444800\n18\nAnn\n1000000000\n7\nAnn\n' "$t"
+    printf '1\nAnn\n2125550122\n18\nAnn\n%s\n5\n' "$t"
+} | "$PB" --history > "$WORK/history.out"
+check "a deleted contact is found as of a time before the delete" \
+    test "$(grep -c 'FOUND: Name: Ann, Phone: 2125550111' "$WORK/history.out")" -eq 2
+check "a deleted contact is absent after the delete and before the add" \
+    test "$(grep -c "Contact 'Ann' did not exist at that time" "$WORK/history.out")" -eq 2
+check "history of a deleted contact lists its old phones" \
+    contains "$WORK/history.out" "-> 2125550100"
+
+# ---- Change watchers --------------------------------------------------
+
+{
+    printf '19\nAn*\n19\nBen\n1\nAnn\n2125550100\n1\nBen\n2125550101\n'
+    printf '1\nAndy\n2125550102\n6\nAnn\n2125550199\n3\nAndy\n20\n0\n'
+    printf '20\n1\n21\n1\n3\nBen\n20\n1\n20\n0\n5\n'
+} | "$PB" > "$WORK/watch.out"
+grep '^  #' "$WORK/watch.out" > "$WORK/watch.events"
+grep -A 1 'Changes for watcher 0:' "$WORK/watch.out" > "$WORK/watch.drained"
+cat > "$WORK/watch.expect" <<'EOF'
+  #1 added Name: Ann, Phone: 2125550100
+  #3 added Name: Andy, Phone: 2125550102
+  #4 updated Name: Ann, Phone: 2125550199
+  #5 deleted Name: Andy, Phone: 2125550102
+  #2 added Name: Ben, Phone: 2125550101
+EOF
+check "watchers receive only the changes matching their name or prefix" \
+    cmp -s "$WORK/watch.events" "$WORK/watch.expect"
+check "a stopped watcher is gone" contains "$WORK/watch.out" "ERROR: No watcher 1."
+check "a drained watcher reports no new changes" \
+    test "$(tail -n 1 "$WORK/watch.drained")" = "  (no new changes)"
+
+# ---- Hottest names -----------------------------------------------------
+
+{
+    printf '1\nAnn\n2125550100\n1\nBen\n2125550101\n1\nCy\n2125550102\n'
+    for i in 1 2 3 4 5; do printf '2\nBen\n'; done
+    for i in 1 2 3; do printf '2\nAnn\n'; done
+    printf '2\nCy\n11\n5\n'
+} | "$PB" --track-hot > "$WORK/hot.out"
+check "hottest names are ranked by lookups" \
+    test "$(grep '^ [0-9]\. .*lookups' "$WORK/hot.out" | awk '{ printf "%s %s ", $2, $3 }')" = \
+        "Ben ~5 Ann ~3 Cy ~1 "
+
+# ---- Directory statistics -----------------------------------------------
+
+{
+    printf '1\nAnn Lee\n2125550100\n1\nBen Lee\n3105550101\n1\nCy Park\n2125550102\n'
+    printf '6\nAnn Lee\n2125550199\n3\nCy Park\n12\n5\n'
+} | "$PB" --stats > "$WORK/stats.out"
+check "stats count the contacts left" contains "$WORK/stats.out" "Contacts:            2"
+check "stats estimate distinct surnames and area codes" \
+    sh -c "grep -q 'Distinct surnames:   ~2' '$WORK/stats.out' &&
+           grep -q 'Distinct area codes: ~2' '$WORK/stats.out'"
+check "stats report name-length and digit quantiles" \
+    sh -c "grep -q 'Name length p50/p90/p99: 7/7/7' '$WORK/stats.out' &&
+           grep -q 'Phone digits p50/p90/p99: 10/10/10' '$WORK/stats.out'"
+check "an update is not counted as a delete" \
+    contains "$WORK/stats.out" "include 1 deleted contacts"
+
+# ---- Prefix suggestions -------------------------------------------------
+
+{
+    printf '1\nAnna\n2125550100\n1\nAnnie\n2125550101\n1\nAndy\n2125550102\n1\nBob\n2125550103\n'
+    printf '2\nAndy\n2\nAndy\n2\nAnnie\n13\nAn\n3\nAndy\n13\nAn\n5\n'
+} | "$PB" --suggest > "$WORK/suggest.out"
+grep 'used ~' "$WORK/suggest.out" | awk '{ printf "%s %s\n", $2, $4 }' > "$WORK/suggest.got"
+cat > "$WORK/suggest.expect" <<'EOF'
+Andy ~2.0
+Annie ~1.0
+Anna ~0.0
+Annie ~1.0
+Anna ~0.0
+EOF
+check "suggestions rank by use and drop deleted names" \
+    cmp -s "$WORK/suggest.got" "$WORK/suggest.expect"
+
+# ---- Substring search ---------------------------------------------------
+
+{
+    printf '1\nJohn Smith\n2125550100\n1\nJane Smithers\n2125550101\n1\nBob Jones\n2125550102\n'
+    printf '17\nmith\n3\nJohn Smith\n17\nmith\n1\nJohn Smith\n3105550000\n17\nmith\n'
+    printf '17\nSm\n17\nzzz\n5\n'
+} | "$PB" --trigram > "$WORK/trigram.out"
+grep -e '-> Name' -e 'matched' "$WORK/trigram.out" | tr -s ' ' > "$WORK/trigram.got"
+cat > "$WORK/trigram.expect" <<'EOF'
+ -> Name: John Smith | Phone: 2125550100
+ -> Name: Jane Smithers | Phone: 2125550101
+2 contact(s) matched.
+ -> Name: Jane Smithers | Phone: 2125550101
+1 contact(s) matched.
+ -> Name: John Smith | Phone: 3105550000
+ -> Name: Jane Smithers | Phone: 2125550101
+2 contact(s) matched.
+ -> Name: John Smith | Phone: 3105550000
+ -> Name: Jane Smithers | Phone: 2125550101
+2 contact(s) matched.
+0 contact(s) matched.
+EOF
+check "substring search follows deletes and re-adds" \
+    cmp -s "$WORK/trigram.got" "$WORK/trigram.expect"
+
+# ---- Set operations and diffs -----------------------------------------
+
+printf 'Ann\t2125550100\nBen\t2125550101\n' > "$WORK/left.tsv"
+printf 'Ben\t3105550000\nCy\t2125550102\n' > "$WORK/right.tsv"
+"$PB" import "$WORK/left.tsv" "$WORK/left.snap" > /dev/null 2>&1
+"$PB" import "$WORK/right.tsv" "$WORK/right.snap" > /dev/null 2>&1
+"$PB" setop union "$WORK/left.snap" "$WORK/right.snap" "$WORK/union.snap" > "$WORK/setop.out" 2>&1
+"$PB" sorted "$WORK/union.snap" "$WORK/union.tsv" > /dev/null 2>&1
+printf 'Ann\t2125550100\nBen\t2125550101\nCy\t2125550102\n' > "$WORK/union.expect"
+check "union keeps the left phone of shared names" cmp -s "$WORK/union.tsv" "$WORK/union.expect"
+check "setop output has no teardown message" lacks "$WORK/setop.out" "memory freed"
+"$PB" diff "$WORK/left.snap" "$WORK/right.snap" > "$WORK/diff.out" 2>&1
+check "diff reports the changed phone" \
+    contains "$WORK/diff.out" "$(printf 'changed-right\tBen\t-\t2125550101\t3105550000')"
+check "diff output has no teardown message" lacks "$WORK/diff.out" "memory freed"
+
+# ---- Secondary indexes --------------------------------------------------
+
+# Re-adding a name must not leave a second entry behind after the delete
+printf '1\nAnn\n2125550100\n1\nAnn\n2125550101\n1\nBen\n2125550102\n3\nAnn\n15\n212\n\n\n5\n' |
+    "$PB" --attributes > "$WORK/attr.out"
+check "attribute index drops a re-added, then deleted name" \
+    contains "$WORK/attr.out" "1 contact(s) matched."
+check "attribute index keeps the other contact" contains "$WORK/attr.out" "-> Ben"
+
+# ---- Name sort ----------------------------------------------------------
+
+# Many names share long prefixes, so the sort recurses well past 8 bytes
+awk 'BEGIN {
+    split("Alexander Montgomery,A,Zz,alexander montgomery-smith ", prefixes, ",")
+    for (i = 0; i < 20000; i++) {
+        name = prefixes[i % 4 + 1]
+        for (n = i; n > 0; n = int(n / 2)) name = name (n % 2 ? "b" : "a")
+        printf "%s\t%d\n", name, 2120000000 + i
+    }
+}' > "$WORK/names.tsv"
+"$PB" import "$WORK/names.tsv" "$WORK/names.snap" > /dev/null 2>&1
+"$PB" sorted "$WORK/names.snap" "$WORK/names.out" > /dev/null 2>&1
+LC_ALL=C sort "$WORK/names.tsv" > "$WORK/names.expect"
+check "sorted export is in byte order" cmp -s "$WORK/names.out" "$WORK/names.expect"
+
+# ---- Filter expressions -------------------------------------------------
+
+"$PB" filter "$WORK/names.snap" 'name starts "Zz" and phone ends "7"' > "$WORK/filter.out" 2>&1
+awk -F '\t' '$1 ~ /^Zz/ && $2 ~ /7$/' "$WORK/names.expect" > "$WORK/filter.expect"
+grep -v '^Matched ' "$WORK/filter.out" | LC_ALL=C sort > "$WORK/filter.tsv"
+check "filter matches exactly the expected contacts" cmp -s "$WORK/filter.tsv" "$WORK/filter.expect"
+check "filter output has no teardown message" lacks "$WORK/filter.out" "memory freed"
+
+# ---- Import of malformed input -----------------------------------------
+
+# A line longer than the read buffer is skipped whole, not split in two
+{
+    printf 'Ann\t2125550100\n'
+    head -c 3000000 /dev/zero | tr '\0' 'x'
+    printf '\tbad\nBen\t2125550101\n'
+} > "$WORK/long.tsv"
+"$PB" import "$WORK/long.tsv" "$WORK/long.snap" > "$WORK/long.out" 2>&1
+"$PB" sorted "$WORK/long.snap" "$WORK/long.sorted" > /dev/null 2>&1
+printf 'Ann\t2125550100\nBen\t2125550101\n' > "$WORK/long.expect"
+check "an overlong line is skipped whole" cmp -s "$WORK/long.sorted" "$WORK/long.expect"
+check "the overlong line is reported with its number" contains "$WORK/long.out" "Line 2 is longer"
+check "import output has no teardown message" lacks "$WORK/long.out" "memory freed"
+
+# ---- Menu input normalization -------------------------------------------
+
+printf '1\nAnn\n212-555-0100\n6\n Ann \n(310) 555 0199\n6\nAnn\n12\n2\nAnn\n5\n' |
+    "$PB" > "$WORK/normalize.out"
+check "update normalizes the name and phone like add" \
+    contains "$WORK/normalize.out" "SUCCESS: Updated 'Ann' to phone '3105550199'."
+check "update rejects a malformed phone" \
+    sh -c "grep -q 'ERROR: The phone has too few or too many digits.' '$WORK/normalize.out' &&
+           grep -q 'FOUND: Name: Ann, Phone: 3105550199' '$WORK/normalize.out'"
+
+# ---- Export formats -----------------------------------------------------
+
+# Names with the characters each format has to escape
+printf 'Smith, John\t2125550100\nO"Brien \\ Pat\t2125550101\nLee; Ann\t2125550102\n' |
+    cat - "$WORK/names.tsv" > "$WORK/formats.tsv"
+"$PB" import "$WORK/formats.tsv" "$WORK/formats.snap" > /dev/null 2>&1
+LC_ALL=C sort "$WORK/formats.tsv" > "$WORK/formats.expect"
+
+# roundtrip <extension>: export, import back and compare the sorted tables
+roundtrip() {
+    rm -f "$WORK/back.snap" "$WORK/back.tsv"
+    "$PB" export "$WORK/formats.snap" "$WORK/formats.$1" > "$WORK/export.out" 2>&1 &&
+        "$PB" import "$WORK/formats.$1" "$WORK/back.snap" > /dev/null 2>&1 &&
+        "$PB" sorted "$WORK/back.snap" "$WORK/back.tsv" > /dev/null 2>&1 &&
+        cmp -s "$WORK/back.tsv" "$WORK/formats.expect" &&
+        lacks "$WORK/export.out" "memory freed"
+}
+
+check "vCard export imports back unchanged" roundtrip vcf
+check "JSON lines export imports back unchanged" roundtrip jsonl
+
+"$PB" export "$WORK/formats.snap" "$WORK/formats.pbc" > /dev/null 2>&1
+"$PB" columns "$WORK/formats.pbc" name,phone 2> /dev/null | LC_ALL=C sort > "$WORK/columns.tsv"
+check "columnar export reads back unchanged" cmp -s "$WORK/columns.tsv" "$WORK/formats.expect"
+"$PB" columns "$WORK/formats.pbc" area_code 2> /dev/null | sort -u > "$WORK/areas.out"
+printf '212\n' > "$WORK/areas.expect"
+check "the area code column is derived from the phone" cmp -s "$WORK/areas.out" "$WORK/areas.expect"
+
+# ---- Replica sync -----------------------------------------------------------
+
+# Replicas of the same size; every 100th phone is stale in the replica
+awk -F '\t' 'NR % 100 == 0 { $2 = 3100000000 + NR } { print $1 "\t" $2 }' \
+    "$WORK/names.tsv" > "$WORK/replica.tsv"
+"$PB" import "$WORK/replica.tsv" "$WORK/replica.snap" > /dev/null 2>&1
+"$PB" sync "$WORK/replica.snap" "$WORK/names.snap" > "$WORK/sync.out" 2>&1
+"$PB" sorted "$WORK/replica.snap" "$WORK/replica.sorted" > /dev/null 2>&1
+check "sync brings the replica up to the source" cmp -s "$WORK/replica.sorted" "$WORK/names.expect"
+check "sync reports the changed contacts" contains "$WORK/sync.out" "200 contacts changed"
+check "sync output has no teardown message" lacks "$WORK/sync.out" "memory freed"
+
+# ---- Static tracepoints -----------------------------------------------------
+
+# The main build uses <sys/sdt.h> when it is installed; check the other side
+gcc -std=gnu11 -O2 -pthread -DPHONEBOOK_NO_PROBES "$SRC" -o "$WORK/noprobes" -lm
+printf '1\nAnn\n2125550100\n2\nAnn\n3\nAnn\n5\n' | "$WORK/noprobes" > "$WORK/noprobes.out" 2>&1
+check "a build without probes adds, finds and deletes" \
+    contains "$WORK/noprobes.out" "SUCCESS: Deleted 'Ann'."
+
+echo
+if [ "$failures" -ne 0 ]; then
+    echo "$failures check(s) failed"
+    exit 1
+fi
+echo "All checks passed"